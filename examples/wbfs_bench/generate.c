@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "generate.h"
+
+// Layout of the wbfs file, the same one wbfs_build_from_disc writes
+#define HD_SECTOR_SHIFT (9)
+#define HD_SECTOR_SIZE (1u << HD_SECTOR_SHIFT)
+#define WII_SECTOR_SHIFT (15)
+#define WII_DISC_SECTOR_COUNT (143432ull * 2)
+#define DISC_HEADER_COPY_SIZE (0x100)
+
+// Where things go on the disc
+#define DISC_MAGIC (0x5D1C9EA3)
+#define PARTITION_INFO (0x40000)
+#define PARTITION_TABLE (0x40020)
+#define SYSTEM_AREA (0x50000)
+
+// Partition header, the ticket and the offsets after it
+#define TICKET_TITLE_KEY (0x1BF)
+#define TICKET_TITLE_ID (0x1DC)
+#define PARTITION_HEADER (0x2A4)
+#define PARTITION_TMD (0x2C0)
+#define PARTITION_TMD_SIZE (0x208)
+#define PARTITION_CERT (0x4C8)
+#define PARTITION_H3 (0x8000)
+#define PARTITION_DATA (0x20000)
+
+// The first few clusters of every partition hold the boot header, main
+// executable header and file system table, all built up front
+#define META_CLUSTERS (4)
+#define META_SIZE (META_CLUSTERS * WII_CLUSTER_DATA_SIZE)
+#define BOOT_DOL (0x3000)
+#define BOOT_FST (0x4000)
+#define MAX_FILES (4096)
+
+#define GAME_ID "RWBE01"
+#define GAME_TITLE "wbfs bench disc"
+
+typedef struct GeneratePartition
+{
+  uint64_t offset;       // Where the partition starts on the disc
+  uint64_t data_size;    // Size of the encrypted clusters
+  uint8_t header[0x2C0]; // Ticket and partition header
+  uint8_t meta[META_SIZE];
+  WbfsAesKey key;
+} GeneratePartition;
+
+typedef struct Generator
+{
+  const GenerateOptions *options;
+  uint64_t sector_size;
+  uint8_t disc_header[0x100];
+  uint8_t partition_table[0x40];
+  GeneratePartition partitions[GENERATE_MAX_PARTITIONS];
+} Generator;
+
+// splitmix64, small and good enough that every option gives the same file
+static uint64_t next_random(uint64_t *state)
+{
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+static double next_double(uint64_t *state)
+{
+  return (double)(next_random(state) >> 11) / (double)(1ull << 53);
+}
+
+static void put_be32(uint8_t *p, uint32_t value)
+{
+  p[0] = (uint8_t)(value >> 24);
+  p[1] = (uint8_t)(value >> 16);
+  p[2] = (uint8_t)(value >> 8);
+  p[3] = (uint8_t)value;
+}
+
+void generate_default_options(GenerateOptions *options)
+{
+  memset(options, 0, sizeof(GenerateOptions));
+  options->wbfs_sector_shift = WBFS_DEFAULT_SECTOR_SHIFT;
+  options->disc_size = 512ull * 1024 * 1024;
+  options->fill = 1.0;
+  options->fragmentation = 0.0;
+  options->partition_count = 1;
+  options->files_per_partition = 256;
+  options->seed = 1;
+}
+
+// Builds the boot header, a main executable header and a flat file system
+// table spreading the files evenly across the partition data
+static void build_meta(GeneratePartition *partition, uint32_t file_count)
+{
+  uint8_t *meta = partition->meta;
+  memset(meta, 0, META_SIZE);
+  memcpy(meta, GAME_ID, 6);
+  put_be32(meta + 0x18, DISC_MAGIC);
+  memcpy(meta + 0x20, GAME_TITLE, sizeof(GAME_TITLE));
+
+  uint8_t *dol = meta + BOOT_DOL;
+  put_be32(dol, 0x100);
+  put_be32(dol + 0x90, 0x1000);
+
+  uint64_t plain_size
+    = partition->data_size / WII_CLUSTER_SIZE * WII_CLUSTER_DATA_SIZE;
+  uint64_t span = (plain_size - META_SIZE) / file_count & ~0x3Full;
+  uint8_t *entries = meta + BOOT_FST;
+  char *names = (char *)entries + (file_count + 1) * 12;
+  uint32_t names_size = 1;
+  entries[0] = 1;
+  put_be32(entries + 8, file_count + 1);
+  for(uint32_t i = 0; i < file_count; i++)
+    {
+      uint8_t *entry = entries + (i + 1) * 12;
+      put_be32(entry, names_size);
+      put_be32(entry + 4, (uint32_t)((META_SIZE + i * span) >> 2));
+      put_be32(entry + 8, (uint32_t)span);
+      names_size += (uint32_t)sprintf(names + names_size, "file%04u.bin", i)
+                    + 1;
+    }
+
+  uint32_t fst_size = (file_count + 1) * 12 + names_size;
+  put_be32(meta + 0x420, BOOT_DOL >> 2);
+  put_be32(meta + 0x424, BOOT_FST >> 2);
+  put_be32(meta + 0x428, (fst_size + 3) >> 2);
+}
+
+// Sets up a partition, with its own title key derived from the seed
+static void build_partition(Generator *generator, uint32_t index,
+                            uint64_t offset, uint64_t size)
+{
+  GeneratePartition *partition = generator->partitions + index;
+  uint64_t state = generator->options->seed ^ ((uint64_t)index << 56);
+  memset(partition->header, 0, sizeof(partition->header));
+  partition->offset = offset;
+  partition->data_size
+    = (size - PARTITION_DATA) / WII_CLUSTER_SIZE * WII_CLUSTER_SIZE;
+
+  uint8_t title_key[16];
+  for(uint32_t i = 0; i < 16; i++)
+    {
+      title_key[i] = (uint8_t)next_random(&state);
+    }
+  uint8_t *header = partition->header;
+  memcpy(header + TICKET_TITLE_ID, "\x00\x01\x00\x00", 4);
+  memcpy(header + TICKET_TITLE_ID + 4, GAME_ID, 4);
+  uint8_t iv[16];
+  memset(iv, 0, sizeof(iv));
+  memcpy(iv, header + TICKET_TITLE_ID, 8);
+  WbfsAesKey common_key;
+  wbfs_aes_set_key(&common_key, k_wii_aes_common_key);
+  wbfs_aes_cbc_encrypt(&common_key, iv, title_key, header + TICKET_TITLE_KEY,
+                       16);
+  wbfs_aes_set_key(&partition->key, title_key);
+
+  put_be32(header + PARTITION_HEADER, PARTITION_TMD_SIZE);
+  put_be32(header + PARTITION_HEADER + 4, PARTITION_TMD >> 2);
+  put_be32(header + PARTITION_HEADER + 12, PARTITION_CERT >> 2);
+  put_be32(header + PARTITION_HEADER + 16, PARTITION_H3 >> 2);
+  put_be32(header + PARTITION_HEADER + 20, PARTITION_DATA >> 2);
+  put_be32(header + PARTITION_HEADER + 24,
+           (uint32_t)(partition->data_size >> 2));
+
+  uint32_t file_count = generator->options->files_per_partition;
+  if(file_count == 0)
+    {
+      file_count = 1;
+    }
+  if(file_count > MAX_FILES)
+    {
+      file_count = MAX_FILES;
+    }
+  build_meta(partition, file_count);
+}
+
+// Encrypts one cluster of partition data, the hash block is left as zeros
+static void fill_cluster(Generator *generator, GeneratePartition *partition,
+                         uint64_t cluster, uint8_t *out)
+{
+  uint8_t plain[WII_CLUSTER_DATA_SIZE];
+  uint64_t address = cluster * WII_CLUSTER_DATA_SIZE;
+  if(address < META_SIZE)
+    {
+      memcpy(plain, partition->meta + address, WII_CLUSTER_DATA_SIZE);
+    }
+  else
+    {
+      uint64_t state = generator->options->seed ^ (partition->offset << 20)
+                       ^ (cluster * 0xD1B54A32D192ED03ull);
+      for(uint32_t i = 0; i < WII_CLUSTER_DATA_SIZE; i += 8)
+        {
+          uint64_t value = next_random(&state);
+          memcpy(plain + i, &value, 8);
+        }
+    }
+
+  uint8_t iv[16];
+  memset(iv, 0, sizeof(iv));
+  memset(out, 0, WII_CLUSTER_HASH_SIZE);
+  wbfs_aes_cbc_encrypt(&partition->key, iv, out, out, WII_CLUSTER_HASH_SIZE);
+  wbfs_aes_cbc_encrypt(&partition->key, out + 0x3D0, plain,
+                       out + WII_CLUSTER_HASH_SIZE, WII_CLUSTER_DATA_SIZE);
+}
+
+// Fills one wbfs sector of the disc, a cluster at a time
+static void fill_sector(Generator *generator, uint32_t sector, uint8_t *out)
+{
+  uint64_t start = (uint64_t)sector * generator->sector_size;
+  memset(out, 0, generator->sector_size);
+  for(uint64_t done = 0; done < generator->sector_size;
+      done += WII_CLUSTER_SIZE)
+    {
+      uint64_t address = start + done;
+      uint8_t *cluster = out + done;
+      if(address == 0)
+        {
+          memcpy(cluster, generator->disc_header,
+                 sizeof(generator->disc_header));
+        }
+      if(address <= PARTITION_INFO
+         && PARTITION_INFO < address + WII_CLUSTER_SIZE)
+        {
+          memcpy(cluster + (PARTITION_INFO - address),
+                 generator->partition_table,
+                 sizeof(generator->partition_table));
+        }
+
+      for(uint32_t i = 0; i < generator->options->partition_count; i++)
+        {
+          GeneratePartition *partition = generator->partitions + i;
+          uint64_t data_start = partition->offset + PARTITION_DATA;
+          if(address == partition->offset)
+            {
+              memcpy(cluster, partition->header, sizeof(partition->header));
+            }
+          else if(address >= data_start
+                  && address < data_start + partition->data_size)
+            {
+              fill_cluster(generator, partition,
+                           (address - data_start) / WII_CLUSTER_SIZE,
+                           cluster);
+            }
+        }
+    }
+}
+
+// Marks the sectors holding a range as stored whatever the fill ratio is
+static void keep_range(uint8_t *stored, uint64_t address, uint64_t size,
+                       uint8_t shift)
+{
+  for(uint64_t i = address >> shift; i <= (address + size - 1) >> shift; i++)
+    {
+      stored[i] = 1;
+    }
+}
+
+int generate_wbfs(const GenerateOptions *options, const char *path,
+                  GenerateResult *result)
+{
+  memset(result, 0, sizeof(GenerateResult));
+  uint8_t shift = options->wbfs_sector_shift;
+  size_t memory_size = wbfs_helper_build_size(shift);
+  if(memory_size == 0 || options->partition_count == 0
+     || options->partition_count > GENERATE_MAX_PARTITIONS)
+    {
+      fprintf(stderr, "Can't generate with those options\n");
+      return -1;
+    }
+
+  Generator *generator = malloc(sizeof(Generator));
+  uint64_t sector_size = 1ull << shift;
+  uint32_t sectors_per_disc
+    = (uint32_t)(WII_DISC_SECTOR_COUNT >> (shift - WII_SECTOR_SHIFT));
+  uint32_t disc_sectors
+    = (uint32_t)((options->disc_size + sector_size - 1) >> shift);
+  uint64_t partition_span
+    = (options->disc_size - SYSTEM_AREA) / options->partition_count
+      & ~(uint64_t)(WII_CLUSTER_SIZE - 1);
+  if(!generator || disc_sectors > sectors_per_disc
+     || options->disc_size < SYSTEM_AREA
+     || partition_span < PARTITION_DATA + 2ull * META_CLUSTERS
+                                            * WII_CLUSTER_SIZE)
+    {
+      fprintf(stderr, "The disc size doesn't fit the partitions\n");
+      free(generator);
+      return -1;
+    }
+
+  // The disc header and the partition table, everything goes in the first
+  // of the four tables
+  memset(generator, 0, sizeof(Generator));
+  generator->options = options;
+  generator->sector_size = sector_size;
+  memcpy(generator->disc_header, GAME_ID, 6);
+  put_be32(generator->disc_header + 0x18, DISC_MAGIC);
+  memcpy(generator->disc_header + 0x20, GAME_TITLE, sizeof(GAME_TITLE));
+  put_be32(generator->partition_table, options->partition_count);
+  put_be32(generator->partition_table + 4, PARTITION_TABLE >> 2);
+
+  // Pick which sectors are stored. The system area and the start of every
+  // partition always are, so the metadata can be parsed whatever the fill
+  uint64_t state = options->seed;
+  result->stored = calloc(disc_sectors, 1);
+  uint16_t *file_sectors = calloc(disc_sectors, sizeof(uint16_t));
+  uint8_t *buffer = malloc(memory_size);
+  FILE *fp = fopen(path, "wb");
+  WbfsIo io;
+  if(!result->stored || !file_sectors || !buffer || !fp
+     || wbfs_io_init_file(&io, fp) != e_wbfs_success)
+    {
+      fprintf(stderr, "Could not set up the generator for %s\n", path);
+      free(result->stored);
+      free(file_sectors);
+      free(buffer);
+      free(generator);
+      if(fp)
+        {
+          fclose(fp);
+        }
+      return -1;
+    }
+  for(uint32_t i = 0; i < disc_sectors; i++)
+    {
+      result->stored[i] = next_double(&state) < options->fill;
+    }
+  keep_range(result->stored, 0, SYSTEM_AREA, shift);
+  for(uint32_t i = 0; i < options->partition_count; i++)
+    {
+      uint64_t offset = SYSTEM_AREA + i * partition_span;
+      build_partition(generator, i, offset, partition_span);
+      uint8_t *entry = generator->partition_table + 0x20 + i * 8;
+      put_be32(entry, (uint32_t)(offset >> 2));
+      put_be32(entry + 4, i == 0 ? 0 : 1);
+      keep_range(result->stored, offset,
+                 PARTITION_DATA + META_CLUSTERS * WII_CLUSTER_SIZE, shift);
+    }
+
+  // Number the stored sectors in disc order, then fragmentation swaps some
+  // of them with another stored sector anywhere in the file
+  uint32_t *order = malloc((disc_sectors + 1) * sizeof(uint32_t));
+  for(uint32_t i = 0; order && i < disc_sectors; i++)
+    {
+      if(result->stored[i])
+        {
+          order[result->stored_count++] = i;
+        }
+    }
+  for(uint32_t i = 0; order && i < result->stored_count; i++)
+    {
+      file_sectors[order[i]] = (uint16_t)(i + 1);
+    }
+  for(uint32_t i = 0; order && i < result->stored_count; i++)
+    {
+      if(next_double(&state) >= options->fragmentation)
+        {
+          continue;
+        }
+      uint32_t j = (uint32_t)(next_random(&state) % result->stored_count);
+      uint16_t swap = file_sectors[order[i]];
+      file_sectors[order[i]] = file_sectors[order[j]];
+      file_sectors[order[j]] = swap;
+    }
+  for(uint32_t i = 0; order && i < result->stored_count; i++)
+    {
+      if(i == 0 || order[i] != order[i - 1] + 1
+         || file_sectors[order[i]] != file_sectors[order[i - 1]] + 1)
+        {
+          result->extent_count++;
+        }
+    }
+  free(order);
+
+  // Header, disc info and free block map all live in the first wbfs sector,
+  // the map goes where the library's builder puts it
+  uint32_t sector_count = (sectors_per_disc + 1 + 31) & ~31u;
+  size_t free_map_size
+    = wbfs_helper_free_map_size(HD_SECTOR_SHIFT, sector_count);
+  memset(buffer, 0, memory_size);
+  put_be32(buffer, WBFS_MAGIC);
+  put_be32(buffer + 4, sector_count << (shift - HD_SECTOR_SHIFT));
+  buffer[8] = HD_SECTOR_SHIFT;
+  buffer[9] = shift;
+  buffer[12] = 1;
+  uint8_t *disc_info = buffer + HD_SECTOR_SIZE;
+  memcpy(disc_info, generator->disc_header, DISC_HEADER_COPY_SIZE);
+  for(uint32_t i = 0; i < disc_sectors; i++)
+    {
+      disc_info[DISC_HEADER_COPY_SIZE + i * 2]
+        = (uint8_t)(file_sectors[i] >> 8);
+      disc_info[DISC_HEADER_COPY_SIZE + i * 2 + 1] = (uint8_t)file_sectors[i];
+    }
+  uint8_t *free_map = buffer + memory_size - sector_size - free_map_size;
+  for(uint32_t block = result->stored_count + 1; block < sector_count;
+      block++)
+    {
+      wbfs_helper_free_map_set(free_map, free_map_size, block);
+    }
+
+  uint64_t free_map_offset
+    = wbfs_helper_free_map_offset(HD_SECTOR_SHIFT, shift, sector_count);
+  int failed
+    = io.write_at(&io, buffer, 0, free_map - buffer) != 0
+      || io.write_at(&io, free_map, free_map_offset, free_map_size) != 0;
+
+  // Then every stored sector, the last part of the buffer is a whole sector
+  uint8_t *sector = buffer + memory_size - sector_size;
+  for(uint32_t i = 0; !failed && i < disc_sectors; i++)
+    {
+      if(!file_sectors[i])
+        {
+          continue;
+        }
+      fill_sector(generator, i, sector);
+      failed = io.write_at(&io, sector, (uint64_t)file_sectors[i] << shift,
+                           sector_size)
+               != 0;
+    }
+
+  result->disc_sector_count = disc_sectors;
+  result->file_size = (uint64_t)(result->stored_count + 1) << shift;
+  fclose(fp);
+  free(buffer);
+  free(file_sectors);
+  free(generator);
+  if(failed)
+    {
+      fprintf(stderr, "Could not write %s\n", path);
+      free(result->stored);
+      result->stored = NULL;
+      return -1;
+    }
+  return 0;
+}
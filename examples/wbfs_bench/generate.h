@@ -0,0 +1,56 @@
+#ifndef __WBFS_GENERATE_H__
+#define __WBFS_GENERATE_H__ (1)
+#include "wbfs.h"
+
+// The most partitions the generator puts on a disc, all go in the first
+// partition table
+#define GENERATE_MAX_PARTITIONS (4)
+
+/**
+ * What the synthetic image looks like. Everything is derived from the seed,
+ * so the same options always give a byte for byte identical file
+ */
+typedef struct GenerateOptions
+{
+  uint8_t wbfs_sector_shift; // 2 ^ shift is the size of the wbfs sectors
+  uint64_t disc_size;        // How much of the disc the partitions span
+  double fill;               // Share of the partition sectors that are stored
+  double fragmentation;      // Chance a stored sector is moved out of order
+  uint32_t partition_count;  // 1 to GENERATE_MAX_PARTITIONS
+  uint32_t files_per_partition;
+  uint64_t seed;
+} GenerateOptions;
+
+/**
+ * A summary of what was generated, so reads can be aimed at sectors that
+ * are actually stored
+ */
+typedef struct GenerateResult
+{
+  uint64_t file_size;
+  uint32_t disc_sector_count; // Wbfs sectors the disc spans
+  uint32_t stored_count;      // How many of them are stored
+  uint32_t extent_count;      // Runs the stored sectors form in the file
+  uint8_t *stored;            // One byte per disc sector, 1 if stored
+} GenerateResult;
+
+/**
+ * Fills in the defaults, a 512MB single partition disc with 2MB sectors
+ * @param options Options to fill in
+ */
+void generate_default_options(GenerateOptions *options);
+
+/**
+ * Writes a synthetic single disc wbfs file. The disc has a real disc header,
+ * partition table and encrypted partitions with a boot header, main
+ * executable header and file system table, so everything up to parsing the
+ * file system works on it. File contents are random, and the hash blocks are
+ * left empty
+ * @returns 0 on success
+ * @param options What to generate
+ * @param path Where to write the wbfs file
+ * @param result Filled in on success, the stored map has to be freed
+ */
+int generate_wbfs(const GenerateOptions *options, const char *path,
+                  GenerateResult *result);
+#endif // !__WBFS_GENERATE_H__
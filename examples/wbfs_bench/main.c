@@ -0,0 +1,565 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "generate.h"
+#include "wbfs.h"
+
+// Each benchmark keeps repeating until it has run for at least this long
+#define BENCH_MIN_SECONDS (1.0)
+
+// Sizes of the reads each benchmark makes
+#define SEQUENTIAL_READ_SIZE (1024 * 1024)
+#define RANDOM_READ_SIZE (4096)
+#define BOUNDARY_READ_SIZE (64 * 1024)
+
+// Random reads queued up on a batch this many at a time, they all land in
+// the one read buffer
+#define BATCH_READ_COUNT (256)
+
+// How the disc's sector table is held, the compact form only keeps the
+// extent map
+#define LOOKUP_TABLE (0)
+#define LOOKUP_EXTENTS (1)
+#define LOOKUP_COMPACT (2)
+#define LOOKUP_COUNT (3)
+
+static const char *lookup_names[LOOKUP_COUNT]
+  = { "table", "extents", "compact" };
+
+typedef struct Bench
+{
+  GenerateOptions options;
+  GenerateResult image;
+  const char *path;
+  double min_seconds;
+
+  FILE *fp;
+  Wbfs wbfs;
+  WbfsFileHeader header;
+  WiiDisc disc;
+  uint8_t *buffer;
+  uint64_t random_state;
+#ifdef WBFS_STATS
+  WbfsStats stats;
+#endif
+} Bench;
+
+static double now_seconds(void)
+{
+#ifdef _WIN32
+  LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+#endif
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+// Every result is one JSON object on its own line, so runs can be collected
+// and compared by a script
+static void report(const Bench *bench, const char *name, const char *lookup,
+                   uint64_t iterations, uint64_t bytes, double seconds)
+{
+  printf("{\"bench\":\"%s\",\"lookup\":\"%s\",\"shift\":%u,"
+         "\"disc_size\":%llu,\"fill\":%.3f,\"fragmentation\":%.3f,"
+         "\"partitions\":%u,\"extents\":%u,\"iterations\":%llu,"
+         "\"bytes\":%llu,\"seconds\":%.6f,\"mb_per_s\":%.2f,"
+         "\"ops_per_s\":%.1f,\"us_per_op\":%.3f}\n",
+         name, lookup, bench->options.wbfs_sector_shift,
+         (unsigned long long)bench->options.disc_size, bench->options.fill,
+         bench->options.fragmentation, bench->options.partition_count,
+         bench->image.extent_count, (unsigned long long)iterations,
+         (unsigned long long)bytes, seconds,
+         seconds > 0 ? (double)bytes / seconds / (1024 * 1024) : 0,
+         seconds > 0 ? (double)iterations / seconds : 0,
+         iterations ? seconds * 1e6 / (double)iterations : 0);
+  fflush(stdout);
+}
+
+// Opens the disc the way a tool would. The sector table is measured so only
+// as much memory as the disc needs is given, and it's left to the first read
+// to load it
+static int open_disc(Bench *bench, int lookup)
+{
+  bench->fp = fopen(bench->path, "rb");
+  if(!bench->fp
+     || wbfs_file_header_parse(&bench->wbfs, &bench->header, bench->fp)
+          != e_wbfs_success)
+    {
+      return -1;
+    }
+#ifdef WBFS_STATS
+  wbfs_stats_reset(&bench->stats);
+  wbfs_stats_attach(&bench->wbfs, &bench->stats);
+#endif
+  bench->header.disc_table
+    = malloc(wbfs_helper_disc_table_size(&bench->wbfs));
+  memset(&bench->disc, 0, sizeof(WiiDisc));
+  if(!bench->header.disc_table
+     || wbfs_file_disc_table_parse(&bench->wbfs) != e_wbfs_success
+     || wbfs_disc_get_offset(&bench->disc, &bench->wbfs, 0) != e_wbfs_success
+     || wbfs_disc_measure_sector_table(&bench->disc) != e_wbfs_success)
+    {
+      return -1;
+    }
+  if(lookup != LOOKUP_COMPACT)
+    {
+      bench->disc.wbfs_sector_lookup
+        = malloc(wbfs_helper_disc_sector_table_size(&bench->disc));
+      if(!bench->disc.wbfs_sector_lookup)
+        {
+          return -1;
+        }
+    }
+  if(lookup != LOOKUP_TABLE)
+    {
+      bench->disc.extents
+        = malloc(wbfs_helper_disc_extent_table_size(&bench->disc));
+      if(!bench->disc.extents)
+        {
+          return -1;
+        }
+    }
+  return 0;
+}
+
+static void close_disc(Bench *bench)
+{
+  free(bench->disc.extents);
+  free(bench->disc.wbfs_sector_lookup);
+  free(bench->header.disc_table);
+  if(bench->fp)
+    {
+      fclose(bench->fp);
+    }
+  bench->fp = NULL;
+  memset(&bench->disc, 0, sizeof(WiiDisc));
+  bench->header.disc_table = NULL;
+}
+
+// Everything a tool does before it can look at a file, from the header
+// through to the file system table of every partition
+static int parse_metadata(Bench *bench, int lookup)
+{
+  if(open_disc(bench, lookup) != 0)
+    {
+      close_disc(bench);
+      return -1;
+    }
+  WiiDiscPartitionInfoEntry info[4];
+  int result = wbfs_disc_parse_partition_info(&bench->disc, info)
+                   == e_wbfs_success
+                 ? 0
+                 : -1;
+  for(uint32_t i = 0; result == 0 && i < info[0].partition_count; i++)
+    {
+      WiiDiscPartitionTableEntry entry;
+      WiiPartition partition;
+      WiiFst fst;
+      void *fst_memory = NULL;
+      if(wbfs_disc_parse_partition_table(
+           &bench->disc, &entry,
+           info[0].offset + i * sizeof(WiiDiscPartitionTableEntry))
+           != e_wbfs_success
+         || wbfs_partition_open(&partition, &bench->disc, entry.offset)
+              != e_wbfs_success
+         || wbfs_fst_parse_header(&fst, &partition) != e_wbfs_success
+         || !(fst_memory = malloc(wbfs_helper_fst_size(&fst)))
+         || wbfs_fst_parse(&fst, &partition, fst_memory) != e_wbfs_success)
+        {
+          result = -1;
+        }
+      free(fst_memory);
+    }
+  close_disc(bench);
+  return result;
+}
+
+static void bench_metadata(Bench *bench, int lookup)
+{
+  uint64_t iterations = 0;
+  double start = now_seconds();
+  double elapsed = 0;
+  while(elapsed < bench->min_seconds)
+    {
+      if(parse_metadata(bench, lookup) != 0)
+        {
+          fprintf(stderr, "Parsing the metadata failed\n");
+          return;
+        }
+      iterations++;
+      elapsed = now_seconds() - start;
+    }
+  report(bench, "metadata", lookup_names[lookup], iterations, 0, elapsed);
+}
+
+// Reads every stored run of sectors front to back in large reads
+static void bench_sequential(Bench *bench, const char *lookup)
+{
+  uint64_t sector_size = bench->wbfs.wbfs_sector_size;
+  uint64_t iterations = 0;
+  uint64_t bytes = 0;
+  double start = now_seconds();
+  double elapsed = 0;
+  while(elapsed < bench->min_seconds)
+    {
+      for(uint32_t i = 0; i < bench->image.disc_sector_count; i++)
+        {
+          if(!bench->image.stored[i])
+            {
+              continue;
+            }
+          uint32_t end = i;
+          while(end < bench->image.disc_sector_count
+                && bench->image.stored[end])
+            {
+              end++;
+            }
+          uint64_t address = (uint64_t)i * sector_size;
+          uint64_t run_end = (uint64_t)end * sector_size;
+          for(; address < run_end; address += SEQUENTIAL_READ_SIZE)
+            {
+              uint64_t size = run_end - address < SEQUENTIAL_READ_SIZE
+                                ? run_end - address
+                                : SEQUENTIAL_READ_SIZE;
+              if(wbfs_disc_read_buffer(&bench->disc, bench->buffer, address,
+                                       size)
+                 != e_wbfs_success)
+                {
+                  fprintf(stderr, "Sequential read failed\n");
+                  return;
+                }
+              iterations++;
+              bytes += size;
+            }
+          i = end;
+        }
+      elapsed = now_seconds() - start;
+    }
+  report(bench, "sequential_1m", lookup, iterations, bytes, elapsed);
+}
+
+// Lists the disc sectors the image stores, for picking random reads from
+static uint32_t *stored_sectors(const Bench *bench, uint32_t *count)
+{
+  uint32_t *stored = malloc(bench->image.stored_count * sizeof(uint32_t));
+  *count = 0;
+  for(uint32_t i = 0; stored && i < bench->image.disc_sector_count; i++)
+    {
+      if(bench->image.stored[i])
+        {
+          stored[(*count)++] = i;
+        }
+    }
+  return stored;
+}
+
+// Small reads scattered over the stored sectors
+static void bench_random(Bench *bench, const char *lookup)
+{
+  uint64_t sector_size = bench->wbfs.wbfs_sector_size;
+  uint32_t stored_count;
+  uint32_t *stored = stored_sectors(bench, &stored_count);
+  if(!stored)
+    {
+      return;
+    }
+
+  uint64_t iterations = 0;
+  double start = now_seconds();
+  double elapsed = 0;
+  while(elapsed < bench->min_seconds)
+    {
+      for(uint32_t j = 0; j < 1024; j++)
+        {
+          uint64_t sector = stored[next_random(&bench->random_state)
+                                   % stored_count];
+          uint64_t offset = next_random(&bench->random_state)
+                            % (sector_size - RANDOM_READ_SIZE + 1) & ~511ull;
+          if(wbfs_disc_read_buffer(&bench->disc, bench->buffer,
+                                   sector * sector_size + offset,
+                                   RANDOM_READ_SIZE)
+             != e_wbfs_success)
+            {
+              fprintf(stderr, "Random read failed\n");
+              free(stored);
+              return;
+            }
+          iterations++;
+        }
+      elapsed = now_seconds() - start;
+    }
+  report(bench, "random_4k", lookup, iterations,
+         iterations * RANDOM_READ_SIZE, elapsed);
+  free(stored);
+}
+
+// Reads that straddle the boundary between two stored sectors, with
+// fragmentation the two halves usually come from different places
+static void bench_boundary(Bench *bench, const char *lookup)
+{
+  uint64_t sector_size = bench->wbfs.wbfs_sector_size;
+  uint64_t iterations = 0;
+  double start = now_seconds();
+  double elapsed = 0;
+  int found = 1;
+  while(found && elapsed < bench->min_seconds)
+    {
+      found = 0;
+      for(uint32_t i = 0; i + 1 < bench->image.disc_sector_count; i++)
+        {
+          if(!bench->image.stored[i] || !bench->image.stored[i + 1])
+            {
+              continue;
+            }
+          uint64_t address
+            = (uint64_t)(i + 1) * sector_size - BOUNDARY_READ_SIZE / 2;
+          if(wbfs_disc_read_buffer(&bench->disc, bench->buffer, address,
+                                   BOUNDARY_READ_SIZE)
+             != e_wbfs_success)
+            {
+              fprintf(stderr, "Boundary read failed\n");
+              return;
+            }
+          iterations++;
+          found = 1;
+        }
+      elapsed = now_seconds() - start;
+    }
+  report(bench, "boundary_64k", lookup, iterations,
+         iterations * BOUNDARY_READ_SIZE, elapsed);
+}
+
+// The same scattered reads as random_4k, but queued up on a batch so they
+// can be sorted and handed over together rather than made one at a time
+static void bench_batch(Bench *bench, const char *lookup, uint32_t flags)
+{
+  // A 4k read can straddle two sectors, so every request gets two pieces
+  void *memory = malloc(wbfs_helper_batch_size(BATCH_READ_COUNT * 2));
+  WbfsReadRequest *requests
+    = malloc(BATCH_READ_COUNT * sizeof(WbfsReadRequest));
+  uint32_t stored_count;
+  uint32_t *stored = stored_sectors(bench, &stored_count);
+  WbfsBatch batch;
+  if(!memory || !requests || !stored
+     || wbfs_batch_init(&batch, &bench->disc, memory, BATCH_READ_COUNT * 2,
+                        0, flags)
+          != e_wbfs_success)
+    {
+      free(stored);
+      free(requests);
+      free(memory);
+      return;
+    }
+
+  // Only report the ring when there really is one, it falls back to the
+  // worker threads when io_uring isn't there
+  const char *name
+    = batch.ring.fd >= 0 ? "batch_4k_ring" : "batch_4k_threads";
+  if(!(flags & WBFS_BATCH_NO_URING) && batch.ring.fd < 0)
+    {
+      wbfs_batch_destroy(&batch);
+      free(stored);
+      free(requests);
+      free(memory);
+      return;
+    }
+
+  uint64_t sector_size = bench->wbfs.wbfs_sector_size;
+  uint64_t iterations = 0;
+  double start = now_seconds();
+  double elapsed = 0;
+  int failed = 0;
+  while(!failed && elapsed < bench->min_seconds)
+    {
+      for(uint32_t j = 0; !failed && j < BATCH_READ_COUNT; j++)
+        {
+          uint64_t sector
+            = stored[next_random(&bench->random_state) % stored_count];
+          uint64_t offset = next_random(&bench->random_state)
+                            % (sector_size - RANDOM_READ_SIZE + 1) & ~511ull;
+          memset(requests + j, 0, sizeof(WbfsReadRequest));
+          requests[j].address = sector * sector_size + offset;
+          requests[j].size = RANDOM_READ_SIZE;
+          requests[j].data = bench->buffer + j * RANDOM_READ_SIZE;
+          failed = wbfs_batch_add(&batch, requests + j) != e_wbfs_success;
+        }
+      failed = failed || wbfs_batch_submit(&batch) != e_wbfs_success;
+
+      WbfsReadRequest *completed[BATCH_READ_COUNT];
+      uint32_t reaped;
+      while(batch.running
+            && (reaped = wbfs_batch_reap(&batch, completed,
+                                         BATCH_READ_COUNT, 1)))
+        {
+          for(uint32_t j = 0; j < reaped; j++)
+            {
+              failed = failed || completed[j]->result != e_wbfs_success;
+            }
+          iterations += reaped;
+        }
+      elapsed = now_seconds() - start;
+    }
+  if(failed)
+    {
+      fprintf(stderr, "Batched read failed\n");
+    }
+  else
+    {
+      report(bench, name, lookup, iterations, iterations * RANDOM_READ_SIZE,
+             elapsed);
+    }
+  wbfs_batch_destroy(&batch);
+  free(stored);
+  free(requests);
+  free(memory);
+}
+
+static void usage(void)
+{
+  fprintf(stderr,
+          "wbfs_bench [options]\n"
+          "  --shift N        wbfs sector shift, default 21\n"
+          "  --size MB        disc size the partitions span, default 512\n"
+          "  --fill F         share of sectors stored, 0 to 1, default 1\n"
+          "  --frag F         chance a sector is out of order, default 0\n"
+          "  --partitions N   1 to 4, default 1\n"
+          "  --files N        files per partition, default 256\n"
+          "  --seed N         generator seed, default 1\n"
+          "  --seconds S      minimum time per benchmark, default 1\n"
+          "  --out PATH       where to generate the image\n"
+          "  --keep           leave the image behind afterwards\n");
+}
+
+int main(int argc, char *argv[])
+{
+  Bench bench;
+  memset(&bench, 0, sizeof(Bench));
+  generate_default_options(&bench.options);
+  bench.path = "wbfs_bench.wbfs";
+  bench.min_seconds = BENCH_MIN_SECONDS;
+  bench.random_state = 0x2545F4914F6CDD1Dull;
+  int keep = 0;
+
+  for(int i = 1; i < argc; i++)
+    {
+      const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+      if(strcmp(argv[i], "--keep") == 0)
+        {
+          keep = 1;
+          continue;
+        }
+      if(!value)
+        {
+          usage();
+          return -1;
+        }
+      if(strcmp(argv[i], "--shift") == 0)
+        {
+          bench.options.wbfs_sector_shift = (uint8_t)atoi(value);
+        }
+      else if(strcmp(argv[i], "--size") == 0)
+        {
+          bench.options.disc_size = strtoull(value, NULL, 10) << 20;
+        }
+      else if(strcmp(argv[i], "--fill") == 0)
+        {
+          bench.options.fill = atof(value);
+        }
+      else if(strcmp(argv[i], "--frag") == 0)
+        {
+          bench.options.fragmentation = atof(value);
+        }
+      else if(strcmp(argv[i], "--partitions") == 0)
+        {
+          bench.options.partition_count = (uint32_t)atoi(value);
+        }
+      else if(strcmp(argv[i], "--files") == 0)
+        {
+          bench.options.files_per_partition = (uint32_t)atoi(value);
+        }
+      else if(strcmp(argv[i], "--seed") == 0)
+        {
+          bench.options.seed = strtoull(value, NULL, 10);
+        }
+      else if(strcmp(argv[i], "--seconds") == 0)
+        {
+          bench.min_seconds = atof(value);
+        }
+      else if(strcmp(argv[i], "--out") == 0)
+        {
+          bench.path = value;
+        }
+      else
+        {
+          usage();
+          return -1;
+        }
+      i++;
+    }
+
+  double start = now_seconds();
+  if(generate_wbfs(&bench.options, bench.path, &bench.image) != 0)
+    {
+      return -1;
+    }
+  fprintf(stderr, " * generated %s, %u of %u sectors in %u runs, %.2fs\n",
+          bench.path, bench.image.stored_count, bench.image.disc_sector_count,
+          bench.image.extent_count, now_seconds() - start);
+
+  bench.buffer = malloc(BOUNDARY_READ_SIZE > SEQUENTIAL_READ_SIZE
+                          ? BOUNDARY_READ_SIZE
+                          : SEQUENTIAL_READ_SIZE);
+  int result = bench.buffer ? 0 : -1;
+
+  // Every benchmark runs once walking the sector table, once with the extent
+  // map next to it and once with only the extent map
+  for(int lookup = 0; result == 0 && lookup < LOOKUP_COUNT; lookup++)
+    {
+      const char *name = lookup_names[lookup];
+      bench_metadata(&bench, lookup);
+      if(open_disc(&bench, lookup) != 0)
+        {
+          fprintf(stderr, "Could not open %s\n", bench.path);
+          result = -1;
+        }
+      else
+        {
+          bench_sequential(&bench, name);
+          bench_random(&bench, name);
+          bench_boundary(&bench, name);
+          bench_batch(&bench, name, 0);
+          bench_batch(&bench, name, WBFS_BATCH_NO_URING);
+#ifdef WBFS_STATS
+          fprintf(stderr, " * reads with the %s lookup\n", name);
+          wbfs_stats_dump(&bench.stats, stderr);
+#endif
+        }
+      close_disc(&bench);
+    }
+
+  free(bench.buffer);
+  free(bench.image.stored);
+  if(!keep)
+    {
+      remove(bench.path);
+    }
+  return result;
+}
@@ -0,0 +1,907 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#define STAT_STRUCT struct __stat64
+#define STAT(PATH, BUF) _stat64(PATH, BUF)
+#else
+#define STAT_STRUCT struct stat
+#define STAT(PATH, BUF) stat(PATH, BUF)
+#endif
+#include "batch.h"
+#include "library.h"
+#include "wbfs_thread.h"
+
+#define BATCH_PATH_SIZE (1024)
+
+// Every partition table together rarely holds more than a game, an update
+// and a channel
+#define BATCH_MAX_PARTITIONS (16)
+
+// Arenas grow to at least this, room for the extent maps of a few discs, so
+// most only have to grow once
+#define BATCH_ARENA_SIZE (64 * 1024)
+
+// Marks the task that opens an image rather than checking its clusters
+#define BATCH_OPEN_TASK (0xFFFFFFFFu)
+
+typedef struct BatchPartition
+{
+  WiiPartition partition;
+  uint8_t *h3;
+  uint32_t h3_valid;
+  uint64_t cluster_count;
+} BatchPartition;
+
+// Arenas are passed from image to image, once one has grown to fit the
+// largest image it's seen opening another doesn't touch the heap. The H3
+// tables sit in a block of their own next to it, since how many there are
+// isn't known until the file in the arena has been opened
+typedef struct BatchArena
+{
+  WbfsArena arena;
+  void *memory;
+  uint8_t *h3_tables;
+  uint32_t h3_capacity;
+  struct BatchArena *next;
+} BatchArena;
+
+// One wbfs file, everything it needs stays put once the workers start since
+// the handles point into each other
+typedef struct BatchImage
+{
+  char path[BATCH_PATH_SIZE];
+  uint32_t device;
+  WbfsSplitFile split;
+  WbfsIo io;
+  BatchArena *arena;  // Holds the opened file and the H3 tables
+  WbfsFile *file;
+  BatchPartition partitions[BATCH_MAX_PARTITIONS];
+  uint32_t partition_count;
+  uint32_t partitions_unopened;  // Couldn't be decrypted, so weren't checked
+
+  // Tasks still to run, the one that takes this to 0 closes the image
+  uint32_t tasks_left;
+
+  // Bumped from every thread checking the image
+  uint64_t good;
+  uint64_t bad;
+  uint64_t unreadable;
+  uint64_t bytes_read;
+  uint64_t start_ns;
+  uint64_t end_ns;
+  wbfs_enum error;
+} BatchImage;
+
+typedef struct BatchTask
+{
+  uint32_t image;
+  uint32_t partition;
+  uint64_t first_cluster;
+} BatchTask;
+
+// A thread's own queue. The owner pushes and pops at the bottom so it works
+// depth first through what it just queued, other threads steal from the top
+// where the oldest tasks are
+typedef struct BatchDeque
+{
+  WbfsMutex lock;
+  BatchTask *tasks;
+  uint32_t capacity;  // Always a power of two
+  uint64_t top;
+  uint64_t bottom;
+} BatchDeque;
+
+typedef struct BatchDevice
+{
+  uint64_t id;
+  uint32_t in_flight;
+} BatchDevice;
+
+typedef struct Batch
+{
+  BatchImage *images;
+  uint32_t image_count;
+  uint32_t image_capacity;
+
+  BatchDevice *devices;
+  uint32_t device_count;
+  uint32_t reads_per_device;
+  WbfsMutex io_lock;
+  WbfsCond io_changed;
+
+  WbfsMutex image_lock;
+  BatchArena *free_arenas;
+  uint32_t arena_count;
+  uint64_t arena_growths;
+
+  BatchDeque deques[WBFS_MAX_THREADS];
+  uint32_t thread_count;
+  uint64_t pending;  // Tasks queued or running, 0 once everything is done
+  uint64_t steals;
+
+  // Threads with nothing to do sleep until a task is queued or the last one
+  // is done. Every wake up bumps the count so a thread can tell if one came
+  // between it looking through the queues and going to sleep
+  WbfsMutex idle_lock;
+  WbfsCond work_changed;
+  uint64_t work_posted;
+} Batch;
+
+typedef struct BatchWorker
+{
+  Batch *batch;
+  uint32_t index;
+  uint8_t *clusters;
+  WbfsThread thread;
+} BatchWorker;
+
+/*
+ * The task queues
+ */
+static int deque_push(BatchDeque *deque, const BatchTask *task)
+{
+  wbfs_mutex_lock(&deque->lock);
+  if(deque->bottom - deque->top == deque->capacity)
+    {
+      uint32_t capacity = deque->capacity ? deque->capacity * 2 : 256;
+      BatchTask *tasks = malloc(capacity * sizeof(BatchTask));
+      if(!tasks)
+        {
+          wbfs_mutex_unlock(&deque->lock);
+          return -1;
+        }
+      for(uint64_t i = deque->top; i < deque->bottom; i++)
+        {
+          tasks[i & (capacity - 1)] = deque->tasks[i & (deque->capacity - 1)];
+        }
+      free(deque->tasks);
+      deque->tasks = tasks;
+      deque->capacity = capacity;
+    }
+  deque->tasks[deque->bottom & (deque->capacity - 1)] = *task;
+  deque->bottom++;
+  wbfs_mutex_unlock(&deque->lock);
+  return 0;
+}
+
+static int deque_pop(BatchDeque *deque, BatchTask *task)
+{
+  wbfs_mutex_lock(&deque->lock);
+  int found = deque->bottom != deque->top;
+  if(found)
+    {
+      deque->bottom--;
+      *task = deque->tasks[deque->bottom & (deque->capacity - 1)];
+    }
+  wbfs_mutex_unlock(&deque->lock);
+  return found;
+}
+
+static int deque_steal(BatchDeque *deque, BatchTask *task)
+{
+  wbfs_mutex_lock(&deque->lock);
+  int found = deque->bottom != deque->top;
+  if(found)
+    {
+      *task = deque->tasks[deque->top & (deque->capacity - 1)];
+      deque->top++;
+    }
+  wbfs_mutex_unlock(&deque->lock);
+  return found;
+}
+
+/*
+ * Per device read limits, a thread waits for a free slot before it reads
+ */
+static void device_begin(Batch *batch, uint32_t device)
+{
+  if(!batch->reads_per_device)
+    {
+      return;
+    }
+  wbfs_mutex_lock(&batch->io_lock);
+  while(batch->devices[device].in_flight >= batch->reads_per_device)
+    {
+      wbfs_cond_wait(&batch->io_changed, &batch->io_lock);
+    }
+  batch->devices[device].in_flight++;
+  wbfs_mutex_unlock(&batch->io_lock);
+}
+
+static void device_end(Batch *batch, uint32_t device)
+{
+  if(!batch->reads_per_device)
+    {
+      return;
+    }
+  wbfs_mutex_lock(&batch->io_lock);
+  batch->devices[device].in_flight--;
+  wbfs_cond_broadcast(&batch->io_changed);
+  wbfs_mutex_unlock(&batch->io_lock);
+}
+
+/*
+ * Building the list of images
+ */
+static int batch_add_path(Batch *batch, const char *path)
+{
+  STAT_STRUCT info;
+  if(STAT(path, &info) != 0)
+    {
+      fprintf(stderr, "Could not find %s\n", path);
+      return 0;
+    }
+
+  if(batch->image_count == batch->image_capacity)
+    {
+      uint32_t capacity
+        = batch->image_capacity ? batch->image_capacity * 2 : 64;
+      BatchImage *images
+        = realloc(batch->images, capacity * sizeof(BatchImage));
+      if(!images)
+        {
+          return -1;
+        }
+      batch->images = images;
+      batch->image_capacity = capacity;
+    }
+
+  // Files on the same device share its read limit
+  uint32_t device = 0;
+  while(device < batch->device_count
+        && batch->devices[device].id != (uint64_t)info.st_dev)
+    {
+      device++;
+    }
+  if(device == batch->device_count)
+    {
+      BatchDevice *devices = realloc(
+        batch->devices, (batch->device_count + 1) * sizeof(BatchDevice));
+      if(!devices)
+        {
+          return -1;
+        }
+      batch->devices = devices;
+      batch->devices[device].id = (uint64_t)info.st_dev;
+      batch->devices[device].in_flight = 0;
+      batch->device_count++;
+    }
+
+  BatchImage *image = batch->images + batch->image_count++;
+  memset(image, 0, sizeof(BatchImage));
+  snprintf(image->path, sizeof(image->path), "%s", path);
+  image->device = device;
+  image->tasks_left = 1;
+  return 0;
+}
+
+static int batch_add_file(void *user, const char *dir, const char *name)
+{
+  char path[BATCH_PATH_SIZE];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  return batch_add_path((Batch *)user, path);
+}
+
+// Reads a list of paths, one per line
+static int batch_add_list(Batch *batch, const char *list_path)
+{
+  FILE *fp = fopen(list_path, "r");
+  if(!fp)
+    {
+      return -1;
+    }
+  char line[BATCH_PATH_SIZE];
+  int result = 0;
+  while(result == 0 && fgets(line, sizeof(line), fp))
+    {
+      size_t length = strcspn(line, "\r\n");
+      line[length] = 0;
+      if(length > 0)
+        {
+          result = batch_add_path(batch, line);
+        }
+    }
+  fclose(fp);
+  return result;
+}
+
+/*
+ * Opening and closing images
+ */
+static BatchArena *arena_take(Batch *batch)
+{
+  wbfs_mutex_lock(&batch->image_lock);
+  BatchArena *arena = batch->free_arenas;
+  if(arena)
+    {
+      batch->free_arenas = arena->next;
+    }
+  else
+    {
+      // New arenas start empty and grow to fit the first image they open
+      arena = calloc(1, sizeof(BatchArena));
+      batch->arena_count += arena ? 1 : 0;
+    }
+  wbfs_mutex_unlock(&batch->image_lock);
+  return arena;
+}
+
+static void arena_give_back(Batch *batch, BatchArena *arena)
+{
+  wbfs_arena_reset(&arena->arena);
+  wbfs_mutex_lock(&batch->image_lock);
+  arena->next = batch->free_arenas;
+  batch->free_arenas = arena;
+  wbfs_mutex_unlock(&batch->image_lock);
+}
+
+// Makes sure the arena can hold a file measured at needed bytes, and the H3
+// tables of h3_count partitions
+static int arena_fit(Batch *batch, BatchArena *arena, size_t needed,
+                     uint32_t h3_count)
+{
+  if(needed > arena->arena.size)
+    {
+      // Larger images tend to follow, so grow well past what's needed
+      size_t size = arena->arena.size * 2;
+      if(size < needed)
+        {
+          size = needed;
+        }
+      if(size < BATCH_ARENA_SIZE)
+        {
+          size = BATCH_ARENA_SIZE;
+        }
+      free(arena->memory);
+      arena->memory = malloc(size);
+      wbfs_arena_init(&arena->arena, arena->memory, arena->memory ? size : 0);
+      WBFS_ATOMIC_ADD(&batch->arena_growths, 1);
+      if(!arena->memory)
+        {
+          return -1;
+        }
+    }
+  if(h3_count > arena->h3_capacity)
+    {
+      free(arena->h3_tables);
+      arena->h3_tables = malloc((size_t)h3_count * WII_H3_TABLE_SIZE);
+      arena->h3_capacity = arena->h3_tables ? h3_count : 0;
+      WBFS_ATOMIC_ADD(&batch->arena_growths, 1);
+      if(!arena->h3_tables)
+        {
+          return -1;
+        }
+    }
+  return 0;
+}
+
+static wbfs_enum image_open_partitions(BatchImage *image, WiiDisc *disc)
+{
+  WiiDiscPartitionInfoEntry info[4];
+  wbfs_enum result = wbfs_disc_parse_partition_info(disc, info);
+  for(uint32_t table = 0; result == e_wbfs_success && table < 4; table++)
+    {
+      for(uint32_t i = 0; i < info[table].partition_count
+                          && image->partition_count < BATCH_MAX_PARTITIONS;
+          i++)
+        {
+          WiiDiscPartitionTableEntry entry;
+          result = wbfs_disc_parse_partition_table(
+            disc, &entry,
+            info[table].offset + i * sizeof(WiiDiscPartitionTableEntry));
+          if(result != e_wbfs_success)
+            {
+              return result;
+            }
+
+          // Partitions that can't be decrypted are skipped like the verify
+          // mode does, but none of their clusters get checked so the image
+          // still fails
+          BatchPartition *partition
+            = image->partitions + image->partition_count;
+          if(wbfs_partition_open(&partition->partition, disc, entry.offset)
+             != e_wbfs_success)
+            {
+              image->partitions_unopened++;
+              continue;
+            }
+          image->partition_count++;
+          partition->cluster_count
+            = wbfs_partition_cluster_count(&partition->partition);
+        }
+    }
+  return result;
+}
+
+// Reads everything about an image that isn't cluster data, the header, the
+// disc table, each disc's extent map and each partition's H3 table. The file
+// is measured first so the arena only has to grow before it's opened, never
+// part way through
+static wbfs_enum image_open(Batch *batch, BatchImage *image)
+{
+  if(wbfs_io_init_split(&image->io, &image->split, image->path)
+     != e_wbfs_success)
+    {
+      return e_wbfs_invalid_io;
+    }
+  image->arena = arena_take(batch);
+  if(!image->arena)
+    {
+      return e_wbfs_segfault;
+    }
+
+  size_t needed;
+  wbfs_enum result
+    = wbfs_file_measure_arena(&image->io, WBFS_OPEN_EXTENTS_ONLY, &needed);
+  if(result != e_wbfs_success)
+    {
+      return result;
+    }
+  if(arena_fit(batch, image->arena, needed, 0) != 0)
+    {
+      return e_wbfs_segfault;
+    }
+  result = wbfs_file_open_arena(&image->file, &image->arena->arena,
+                                &image->io, WBFS_OPEN_EXTENTS_ONLY);
+  for(uint32_t i = 0;
+      result == e_wbfs_success && i < image->file->wbfs.wii_disc_count; i++)
+    {
+      result = image_open_partitions(image, image->file->discs + i);
+    }
+  if(result != e_wbfs_success)
+    {
+      return result;
+    }
+
+  if(arena_fit(batch, image->arena, 0, image->partition_count) != 0)
+    {
+      return e_wbfs_segfault;
+    }
+  for(uint32_t i = 0; result == e_wbfs_success && i < image->partition_count;
+      i++)
+    {
+      BatchPartition *partition = image->partitions + i;
+      partition->h3
+        = image->arena->h3_tables + (size_t)i * WII_H3_TABLE_SIZE;
+      result = wbfs_partition_read_h3(&partition->partition, partition->h3,
+                                      &partition->h3_valid);
+    }
+  return result;
+}
+
+static void image_close(Batch *batch, BatchImage *image)
+{
+  if(image->arena)
+    {
+      arena_give_back(batch, image->arena);
+    }
+  wbfs_io_close_split(&image->io);
+  image->end_ns = wbfs_thread_time_ns();
+}
+
+/*
+ * Running tasks
+ */
+static void batch_run(Batch *batch, BatchWorker *worker,
+                      const BatchTask *task);
+
+static void batch_wake(Batch *batch, int everyone)
+{
+  wbfs_mutex_lock(&batch->idle_lock);
+  WBFS_ATOMIC_ADD(&batch->work_posted, 1);
+  if(everyone)
+    {
+      wbfs_cond_broadcast(&batch->work_changed);
+    }
+  else
+    {
+      wbfs_cond_signal(&batch->work_changed);
+    }
+  wbfs_mutex_unlock(&batch->idle_lock);
+}
+
+// Takes a task off the pending count, once the last is done every sleeping
+// thread is woken to finish
+static void batch_finish(Batch *batch)
+{
+  if(WBFS_ATOMIC_ADD(&batch->pending, (uint64_t)-1) == 1)
+    {
+      batch_wake(batch, 1);
+    }
+}
+
+static void batch_push(Batch *batch, BatchWorker *worker,
+                       const BatchTask *task)
+{
+  WBFS_ATOMIC_ADD(&batch->pending, 1);
+  if(deque_push(batch->deques + worker->index, task) != 0)
+    {
+      // Without room to queue it, it's run on the spot and so is finished
+      // as soon as it's pushed
+      batch_run(batch, worker, task);
+      batch_finish(batch);
+      return;
+    }
+  batch_wake(batch, 0);
+}
+
+// Marks one of an image's tasks as done, the last one closes it
+static void batch_task_done(Batch *batch, BatchImage *image)
+{
+  wbfs_mutex_lock(&batch->image_lock);
+  int last = --image->tasks_left == 0;
+  wbfs_mutex_unlock(&batch->image_lock);
+  if(last)
+    {
+      image_close(batch, image);
+    }
+}
+
+// Opens an image and queues a task for every group of clusters. They're
+// queued back to front so this thread pops them front to back and reads
+// forwards through the image, while anything stolen comes off the end
+static void batch_open_image(Batch *batch, BatchWorker *worker,
+                             uint32_t index)
+{
+  BatchImage *image = batch->images + index;
+  image->start_ns = wbfs_thread_time_ns();
+  device_begin(batch, image->device);
+  image->error = image_open(batch, image);
+  device_end(batch, image->device);
+  if(image->error != e_wbfs_success)
+    {
+      return;
+    }
+
+  uint32_t task_count = 0;
+  for(uint32_t i = 0; i < image->partition_count; i++)
+    {
+      uint64_t clusters = image->partitions[i].cluster_count;
+      task_count
+        += (uint32_t)((clusters + WII_GROUP_CLUSTERS - 1) / WII_GROUP_CLUSTERS);
+    }
+  wbfs_mutex_lock(&batch->image_lock);
+  image->tasks_left += task_count;
+  wbfs_mutex_unlock(&batch->image_lock);
+
+  for(uint32_t i = image->partition_count; i-- > 0;)
+    {
+      uint64_t groups = (image->partitions[i].cluster_count
+                         + WII_GROUP_CLUSTERS - 1)
+                        / WII_GROUP_CLUSTERS;
+      for(uint64_t group = groups; group-- > 0;)
+        {
+          BatchTask task;
+          task.image = index;
+          task.partition = i;
+          task.first_cluster = group * WII_GROUP_CLUSTERS;
+          batch_push(batch, worker, &task);
+        }
+    }
+}
+
+// Reads a group of clusters and checks them, clusters the file doesn't
+// store are counted as unreadable
+static void batch_check_group(Batch *batch, BatchWorker *worker,
+                              const BatchTask *task)
+{
+  BatchImage *image = batch->images + task->image;
+  BatchPartition *partition = image->partitions + task->partition;
+  uint64_t left = partition->cluster_count - task->first_cluster;
+  uint32_t count = left < WII_GROUP_CLUSTERS ? (uint32_t)left
+                                             : WII_GROUP_CLUSTERS;
+  uint8_t status[WII_GROUP_CLUSTERS];
+  memset(status, 0, sizeof(status));
+
+  WiiDisc *disc = partition->partition.disc;
+  uint64_t address = partition->partition.data_offset
+                     + task->first_cluster * WII_CLUSTER_SIZE;
+  uint64_t bytes_read = (uint64_t)count * WII_CLUSTER_SIZE;
+  device_begin(batch, image->device);
+  if(wbfs_disc_read_buffer(disc, worker->clusters, address, bytes_read)
+     != e_wbfs_success)
+    {
+      for(uint32_t i = 0; i < count; i++)
+        {
+          uint64_t offset = (uint64_t)i * WII_CLUSTER_SIZE;
+          if(wbfs_disc_read_buffer(disc, worker->clusters + offset,
+                                   address + offset, WII_CLUSTER_SIZE)
+             != e_wbfs_success)
+            {
+              status[i] = WBFS_VERIFY_UNREADABLE;
+              bytes_read -= WII_CLUSTER_SIZE;
+            }
+        }
+    }
+  device_end(batch, image->device);
+
+  wbfs_partition_check_clusters(&partition->partition, partition->h3,
+                                task->first_cluster, count, worker->clusters,
+                                status);
+  uint64_t good = 0;
+  uint64_t bad = 0;
+  uint64_t unreadable = 0;
+  for(uint32_t i = 0; i < count; i++)
+    {
+      if(status[i] == 0)
+        {
+          good++;
+        }
+      else if(status[i] & WBFS_VERIFY_UNREADABLE)
+        {
+          unreadable++;
+        }
+      else
+        {
+          bad++;
+        }
+    }
+  WBFS_ATOMIC_ADD(&image->good, good);
+  WBFS_ATOMIC_ADD(&image->bad, bad);
+  WBFS_ATOMIC_ADD(&image->unreadable, unreadable);
+  WBFS_ATOMIC_ADD(&image->bytes_read, bytes_read);
+}
+
+static void batch_run(Batch *batch, BatchWorker *worker,
+                      const BatchTask *task)
+{
+  if(task->partition == BATCH_OPEN_TASK)
+    {
+      batch_open_image(batch, worker, task->image);
+    }
+  else
+    {
+      batch_check_group(batch, worker, task);
+    }
+  batch_task_done(batch, batch->images + task->image);
+}
+
+// Takes the oldest task from the first other thread that has one, starting
+// from the next thread along so thieves spread out
+static int batch_steal(Batch *batch, uint32_t thief, BatchTask *task)
+{
+  for(uint32_t i = 1; i < batch->thread_count; i++)
+    {
+      uint32_t victim = (thief + i) % batch->thread_count;
+      if(deque_steal(batch->deques + victim, task))
+        {
+          WBFS_ATOMIC_ADD(&batch->steals, 1);
+          return 1;
+        }
+    }
+  return 0;
+}
+
+static void batch_worker(void *argument)
+{
+  BatchWorker *worker = (BatchWorker *)argument;
+  Batch *batch = worker->batch;
+  BatchTask task;
+  for(;;)
+    {
+      uint64_t posted = WBFS_ATOMIC_ADD(&batch->work_posted, 0);
+      if(deque_pop(batch->deques + worker->index, &task)
+         || batch_steal(batch, worker->index, &task))
+        {
+          batch_run(batch, worker, &task);
+          batch_finish(batch);
+          continue;
+        }
+
+      // Nothing queued anywhere, but a running task can still queue more so
+      // sleep until something changes
+      if(WBFS_ATOMIC_ADD(&batch->pending, 0) == 0)
+        {
+          break;
+        }
+      wbfs_mutex_lock(&batch->idle_lock);
+      while(WBFS_ATOMIC_ADD(&batch->work_posted, 0) == posted)
+        {
+          wbfs_cond_wait(&batch->work_changed, &batch->idle_lock);
+        }
+      wbfs_mutex_unlock(&batch->idle_lock);
+    }
+}
+
+static uint32_t image_h3_valid(const BatchImage *image)
+{
+  uint32_t h3_valid = 1;
+  for(uint32_t i = 0; i < image->partition_count; i++)
+    {
+      h3_valid &= image->partitions[i].h3_valid;
+    }
+  return h3_valid;
+}
+
+// The one rule for an image failing, used by both the report and the exit
+// status
+static int image_failed(const BatchImage *image)
+{
+  return image->error != e_wbfs_success || image->bad
+         || image->partitions_unopened || !image_h3_valid(image);
+}
+
+static void print_report(const Batch *batch, uint64_t elapsed_ns)
+{
+  uint64_t total_bytes = 0;
+  uint32_t failed = 0;
+  printf("     MB/s   seconds      MB     good    bad  unread  path\n");
+  for(uint32_t i = 0; i < batch->image_count; i++)
+    {
+      const BatchImage *image = batch->images + i;
+      failed += image_failed(image) ? 1 : 0;
+      if(image->error != e_wbfs_success)
+        {
+          printf("   failed: %s  %s\n", wbfs_helper_enum_lookup(image->error),
+                 image->path);
+          continue;
+        }
+
+      uint32_t h3_valid = image_h3_valid(image);
+      double seconds = (double)(image->end_ns - image->start_ns) / 1e9;
+      double mb = (double)image->bytes_read / (1024.0 * 1024.0);
+      printf("%9.1f %9.2f %7.0f %8llu %6llu %7llu  %s%s",
+             seconds > 0 ? mb / seconds : 0.0, seconds, mb,
+             (unsigned long long)image->good, (unsigned long long)image->bad,
+             (unsigned long long)image->unreadable, image->path,
+             h3_valid ? "" : " (H3 table invalid)");
+      if(image->partitions_unopened)
+        {
+          printf(" (could not open %u partitions)",
+                 image->partitions_unopened);
+        }
+      printf("\n");
+      total_bytes += image->bytes_read;
+    }
+
+  double seconds = (double)elapsed_ns / 1e9;
+  double mb = (double)total_bytes / (1024.0 * 1024.0);
+  printf(" * %u images, %u failed, %.0f MB in %.2fs, %.1f MB/s\n",
+         batch->image_count, failed, mb, seconds,
+         seconds > 0 ? mb / seconds : 0.0);
+  printf(" * %u threads, %llu tasks stolen, %u devices with ",
+         batch->thread_count, (unsigned long long)batch->steals,
+         batch->device_count);
+  if(batch->reads_per_device)
+    {
+      printf("%u reads each\n", batch->reads_per_device);
+    }
+  else
+    {
+      printf("no read limit\n");
+    }
+  printf(" * %u arenas opened every image, growing %llu times\n",
+         batch->arena_count, (unsigned long long)batch->arena_growths);
+}
+
+int batch_verify(const char *source, uint32_t thread_count,
+                 uint32_t reads_per_device)
+{
+  Batch *batch = calloc(1, sizeof(Batch));
+  if(!batch)
+    {
+      return -1;
+    }
+  batch->reads_per_device = reads_per_device;
+
+  STAT_STRUCT info;
+  int result = -1;
+  if(STAT(source, &info) == 0)
+    {
+      result = (info.st_mode & S_IFMT) == S_IFDIR
+                 ? scan_wbfs_directory(source, batch_add_file, batch)
+                 : batch_add_list(batch, source);
+    }
+  if(result != 0)
+    {
+      fprintf(stderr, "Could not read %s\n", source);
+      free(batch->images);
+      free(batch->devices);
+      free(batch);
+      return -1;
+    }
+
+  if(thread_count == 0)
+    {
+      thread_count = wbfs_thread_hardware_count();
+    }
+  batch->thread_count
+    = thread_count > WBFS_MAX_THREADS ? WBFS_MAX_THREADS : thread_count;
+  wbfs_mutex_init(&batch->io_lock);
+  wbfs_cond_init(&batch->io_changed);
+  wbfs_mutex_init(&batch->image_lock);
+  wbfs_mutex_init(&batch->idle_lock);
+  wbfs_cond_init(&batch->work_changed);
+  BatchWorker workers[WBFS_MAX_THREADS];
+  for(uint32_t i = 0; i < batch->thread_count; i++)
+    {
+      wbfs_mutex_init(&batch->deques[i].lock);
+      workers[i].batch = batch;
+      workers[i].index = i;
+      workers[i].clusters = malloc(WII_GROUP_CLUSTERS * WII_CLUSTER_SIZE);
+      if(!workers[i].clusters)
+        {
+          wbfs_mutex_destroy(&batch->deques[i].lock);
+          batch->thread_count = i;
+          break;
+        }
+    }
+
+  // With no workers at all nothing would be opened, and every image would
+  // look like it passed
+  if(batch->thread_count == 0)
+    {
+      fprintf(stderr, "Could not allocate a buffer to verify with\n");
+    }
+
+  // The images are dealt out over the threads to start with, after that it
+  // comes down to stealing
+  uint64_t start = wbfs_thread_time_ns();
+  for(uint32_t i = 0; batch->thread_count && i < batch->image_count; i++)
+    {
+      BatchTask task;
+      task.image = batch->image_count - 1 - i;
+      task.partition = BATCH_OPEN_TASK;
+      task.first_cluster = 0;
+      batch_push(batch, workers + i % batch->thread_count, &task);
+    }
+
+  // The calling thread is worker 0, if a thread can't be started its queue
+  // still gets emptied by the others stealing from it
+  uint32_t started = 1;
+  while(started < batch->thread_count
+        && wbfs_thread_create(&workers[started].thread, batch_worker,
+                              workers + started)
+             == 0)
+    {
+      started++;
+    }
+  if(batch->thread_count)
+    {
+      batch_worker(workers);
+    }
+  for(uint32_t i = 1; i < started; i++)
+    {
+      wbfs_thread_join(&workers[i].thread);
+    }
+  uint64_t elapsed = wbfs_thread_time_ns() - start;
+
+  result = batch->thread_count ? 0 : -1;
+  if(batch->thread_count)
+    {
+      print_report(batch, elapsed);
+    }
+  for(uint32_t i = 0; i < batch->image_count; i++)
+    {
+      if(image_failed(batch->images + i))
+        {
+          result = -1;
+        }
+    }
+
+  for(uint32_t i = 0; i < batch->thread_count; i++)
+    {
+      free(workers[i].clusters);
+      free(batch->deques[i].tasks);
+      wbfs_mutex_destroy(&batch->deques[i].lock);
+    }
+  while(batch->free_arenas)
+    {
+      BatchArena *arena = batch->free_arenas;
+      batch->free_arenas = arena->next;
+      free(arena->memory);
+      free(arena->h3_tables);
+      free(arena);
+    }
+  wbfs_cond_destroy(&batch->work_changed);
+  wbfs_mutex_destroy(&batch->idle_lock);
+  wbfs_mutex_destroy(&batch->image_lock);
+  wbfs_cond_destroy(&batch->io_changed);
+  wbfs_mutex_destroy(&batch->io_lock);
+  free(batch->images);
+  free(batch->devices);
+  free(batch);
+  return result;
+}
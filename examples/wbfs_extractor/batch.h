@@ -0,0 +1,23 @@
+#ifndef __WBFS_BATCH_H__
+#define __WBFS_BATCH_H__ (1)
+#include "wbfs.h"
+
+/**
+ * Checks the hash tree of every partition of every disc in a set of wbfs
+ * files with one pool of threads. Each image is split into tasks of one
+ * group of clusters, every thread works through its own queue of tasks and
+ * steals from the others once it runs dry, so one large image still ends up
+ * spread over every thread. Reads are capped per device so a disc isn't
+ * thrashed by every thread at once. Throughput is reported for every image
+ * and for the whole batch at the end
+ * @returns 0 if every image could be read and every cluster that's stored
+ * is good
+ * @param source Directory of wbfs files, or a text file with one path per
+ * line
+ * @param thread_count How many threads to use, 0 uses all
+ * @param reads_per_device How many reads can be in flight on one device at
+ * once, 0 means no limit
+ */
+int batch_verify(const char *source, uint32_t thread_count,
+                 uint32_t reads_per_device);
+#endif // !__WBFS_BATCH_H__
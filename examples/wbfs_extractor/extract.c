@@ -0,0 +1,557 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <direct.h>
+#define MAKE_DIR(PATH) _mkdir(PATH)
+#else
+#include <sys/stat.h>
+#define MAKE_DIR(PATH) mkdir(PATH, 0755)
+#endif
+#include "extract.h"
+#include "wbfs_thread.h"
+
+#define EXTRACT_PATH_SIZE (1024)
+
+// A run of clusters making its way through the pipeline. The sequence number
+// is the order the reader issued it in, so the writer can put them back in
+// order
+typedef struct ExtractChunk
+{
+  uint64_t sequence;
+  uint64_t first_cluster;
+  uint32_t cluster_count;
+  uint8_t *data;
+} ExtractChunk;
+
+// A bounded queue of chunks between two stages of the pipeline, pushing
+// blocks when it's full and popping blocks when it's empty. Once closed pops
+// return null once the queue drains
+typedef struct ChunkQueue
+{
+  ExtractChunk **items;
+  uint32_t capacity;
+  uint32_t head;
+  uint32_t count;
+  int closed;
+  WbfsMutex lock;
+  WbfsCond not_empty;
+  WbfsCond not_full;
+} ChunkQueue;
+
+// A file to write, sorted by where it starts in the partition so the files
+// come out in the same order as the reads
+typedef struct ExtractFile
+{
+  uint32_t index;
+  uint64_t offset;
+  uint64_t size;
+  FILE *fp;
+} ExtractFile;
+
+typedef struct Extraction
+{
+  const WiiPartition *partition;
+  const WiiFst *fst;
+  const char *out_dir;
+
+  // Every run of clusters to read, worked out before the pipeline starts
+  ExtractChunk *plan;
+  uint64_t plan_count;
+
+  ExtractFile *files;
+  uint32_t file_count;
+
+  ChunkQueue free_buffers;
+  ChunkQueue to_decrypt;
+  ChunkQueue to_write;
+
+  // Set by any stage that fails, the rest of the pipeline drains and stops.
+  // Both are touched from every stage so only go through the atomics
+  uint32_t failed;
+  uint64_t bytes_written;
+} Extraction;
+
+static void extract_fail(Extraction *ex)
+{
+  WBFS_ATOMIC_CAS32(&ex->failed, 0, 1);
+}
+
+static int extract_failed(Extraction *ex)
+{
+  return WBFS_ATOMIC_LOAD32(&ex->failed) != 0;
+}
+
+static int queue_init(ChunkQueue *queue, uint32_t capacity)
+{
+  memset(queue, 0, sizeof(ChunkQueue));
+  queue->items = malloc(capacity * sizeof(ExtractChunk *));
+  if(!queue->items)
+    {
+      return -1;
+    }
+  queue->capacity = capacity;
+  wbfs_mutex_init(&queue->lock);
+  wbfs_cond_init(&queue->not_empty);
+  wbfs_cond_init(&queue->not_full);
+  return 0;
+}
+
+static void queue_destroy(ChunkQueue *queue)
+{
+  wbfs_cond_destroy(&queue->not_full);
+  wbfs_cond_destroy(&queue->not_empty);
+  wbfs_mutex_destroy(&queue->lock);
+  free(queue->items);
+}
+
+static void queue_push(ChunkQueue *queue, ExtractChunk *chunk)
+{
+  wbfs_mutex_lock(&queue->lock);
+  while(queue->count == queue->capacity)
+    {
+      wbfs_cond_wait(&queue->not_full, &queue->lock);
+    }
+  queue->items[(queue->head + queue->count) % queue->capacity] = chunk;
+  queue->count++;
+  wbfs_cond_signal(&queue->not_empty);
+  wbfs_mutex_unlock(&queue->lock);
+}
+
+static ExtractChunk *queue_pop(ChunkQueue *queue)
+{
+  ExtractChunk *chunk = NULL;
+  wbfs_mutex_lock(&queue->lock);
+  while(queue->count == 0 && !queue->closed)
+    {
+      wbfs_cond_wait(&queue->not_empty, &queue->lock);
+    }
+  if(queue->count > 0)
+    {
+      chunk = queue->items[queue->head];
+      queue->head = (queue->head + 1) % queue->capacity;
+      queue->count--;
+      wbfs_cond_signal(&queue->not_full);
+    }
+  wbfs_mutex_unlock(&queue->lock);
+  return chunk;
+}
+
+static void queue_close(ChunkQueue *queue)
+{
+  wbfs_mutex_lock(&queue->lock);
+  queue->closed = 1;
+  wbfs_cond_broadcast(&queue->not_empty);
+  wbfs_mutex_unlock(&queue->lock);
+}
+
+static int compare_files(const void *a, const void *b)
+{
+  const ExtractFile *fa = (const ExtractFile *)a;
+  const ExtractFile *fb = (const ExtractFile *)b;
+  if(fa->offset != fb->offset)
+    {
+      return fa->offset < fb->offset ? -1 : 1;
+    }
+  return fa->index < fb->index ? -1 : 1;
+}
+
+// Builds the output path for an entry, and makes sure any directories are
+// there. Zero sized files are created here since no chunk will ever cover them
+static int prepare_entries(Extraction *ex)
+{
+  char path[EXTRACT_PATH_SIZE];
+  size_t dir_length = strlen(ex->out_dir);
+  if(dir_length + 2 >= sizeof(path))
+    {
+      return -1;
+    }
+  memcpy(path, ex->out_dir, dir_length);
+  path[dir_length] = '/';
+
+  for(uint32_t i = 1; i < ex->fst->entry_count; i++)
+    {
+      if(wbfs_fst_path(ex->fst, i, path + dir_length + 1,
+                       sizeof(path) - dir_length - 1)
+         != e_wbfs_success)
+        {
+          return -1;
+        }
+
+      // Directories always come before anything inside them
+      const WiiFstEntry *entry = ex->fst->entries + i;
+      if(entry->is_directory)
+        {
+          MAKE_DIR(path);
+        }
+      else if(entry->size == 0)
+        {
+          FILE *fp = fopen(path, "wb");
+          if(!fp)
+            {
+              return -1;
+            }
+          fclose(fp);
+        }
+    }
+  return 0;
+}
+
+// Collects every file with data and sorts them into partition order, then
+// merges their clusters into runs and splits the runs into chunk sized reads.
+// Clusters no file uses are never read
+static int build_plan(Extraction *ex)
+{
+  ex->files = malloc(ex->fst->entry_count * sizeof(ExtractFile));
+  ex->plan = malloc(wbfs_partition_cluster_count(ex->partition)
+                    * sizeof(ExtractChunk));
+  if(!ex->files || !ex->plan)
+    {
+      return -1;
+    }
+
+  for(uint32_t i = 1; i < ex->fst->entry_count; i++)
+    {
+      const WiiFstEntry *entry = ex->fst->entries + i;
+      if(entry->is_directory || entry->size == 0)
+        {
+          continue;
+        }
+      ExtractFile *file = ex->files + ex->file_count++;
+      file->index = i;
+      file->offset = entry->offset;
+      file->size = entry->size;
+      file->fp = NULL;
+    }
+  qsort(ex->files, ex->file_count, sizeof(ExtractFile), compare_files);
+
+  uint64_t next_cluster = 0;
+  for(uint32_t i = 0; i < ex->file_count; i++)
+    {
+      WiiFileRange range;
+      wbfs_fst_file_range(ex->fst, ex->files[i].index, &range);
+      if(range.first_cluster + range.cluster_count
+         > wbfs_partition_cluster_count(ex->partition))
+        {
+          return -1;
+        }
+
+      // Skip any clusters this file shares with the previous run
+      uint64_t cluster = range.first_cluster;
+      uint64_t end = range.first_cluster + range.cluster_count;
+      if(cluster < next_cluster)
+        {
+          cluster = next_cluster;
+        }
+
+      while(cluster < end)
+        {
+          // Grow the previous chunk if this carries straight on from it
+          ExtractChunk *last
+            = ex->plan_count ? ex->plan + ex->plan_count - 1 : NULL;
+          if(last && last->first_cluster + last->cluster_count == cluster
+             && last->cluster_count < EXTRACT_CHUNK_CLUSTERS)
+            {
+              last->cluster_count++;
+              cluster++;
+              continue;
+            }
+
+          ExtractChunk *chunk = ex->plan + ex->plan_count;
+          chunk->sequence = ex->plan_count++;
+          chunk->first_cluster = cluster++;
+          chunk->cluster_count = 1;
+          chunk->data = NULL;
+        }
+      if(end > next_cluster)
+        {
+          next_cluster = end;
+        }
+    }
+  return 0;
+}
+
+// Reader stage, issues each run of clusters as a single read in disc order
+static void reader_thread(void *argument)
+{
+  Extraction *ex = (Extraction *)argument;
+  for(uint64_t i = 0; i < ex->plan_count && !extract_failed(ex); i++)
+    {
+      ExtractChunk *buffer = queue_pop(&ex->free_buffers);
+      if(!buffer)
+        {
+          break;
+        }
+
+      ExtractChunk *planned = ex->plan + i;
+      buffer->sequence = planned->sequence;
+      buffer->first_cluster = planned->first_cluster;
+      buffer->cluster_count = planned->cluster_count;
+
+      uint64_t address = ex->partition->data_offset
+                         + buffer->first_cluster * WII_CLUSTER_SIZE;
+      if(wbfs_disc_read_buffer(ex->partition->disc, buffer->data, address,
+                               (uint64_t)buffer->cluster_count
+                                 * WII_CLUSTER_SIZE)
+         != e_wbfs_success)
+        {
+          extract_fail(ex);
+        }
+      queue_push(&ex->to_decrypt, buffer);
+    }
+  queue_close(&ex->to_decrypt);
+}
+
+// Decrypt stage, any number of these run at once
+static void decrypt_thread(void *argument)
+{
+  Extraction *ex = (Extraction *)argument;
+  ExtractChunk *chunk;
+  while((chunk = queue_pop(&ex->to_decrypt)) != NULL)
+    {
+      if(!extract_failed(ex))
+        {
+          wbfs_partition_decrypt_clusters(ex->partition, chunk->data,
+                                          chunk->data, chunk->cluster_count,
+                                          1);
+        }
+      queue_push(&ex->to_write, chunk);
+    }
+}
+
+// Writes the part of every file that falls inside a decrypted chunk. Chunks
+// arrive in order, so each file is written front to back and only needs to be
+// open while the chunks covering it go past
+static int write_chunk(Extraction *ex, ExtractChunk *chunk,
+                       uint32_t *first_file)
+{
+  char path[EXTRACT_PATH_SIZE];
+  size_t dir_length = strlen(ex->out_dir);
+  memcpy(path, ex->out_dir, dir_length);
+  path[dir_length] = '/';
+
+  uint64_t chunk_start = chunk->first_cluster * WII_CLUSTER_DATA_SIZE;
+  uint64_t chunk_end
+    = chunk_start + (uint64_t)chunk->cluster_count * WII_CLUSTER_DATA_SIZE;
+
+  for(uint32_t i = *first_file;
+      i < ex->file_count && ex->files[i].offset < chunk_end; i++)
+    {
+      ExtractFile *file = ex->files + i;
+      uint64_t file_end = file->offset + file->size;
+      uint64_t start = file->offset > chunk_start ? file->offset : chunk_start;
+      uint64_t end = file_end < chunk_end ? file_end : chunk_end;
+      if(start >= end)
+        {
+          continue;
+        }
+
+      if(!file->fp)
+        {
+          wbfs_fst_path(ex->fst, file->index, path + dir_length + 1,
+                        sizeof(path) - dir_length - 1);
+          file->fp = fopen(path, "wb");
+          if(!file->fp)
+            {
+              fprintf(stderr, "Could not create %s\n", path);
+              return -1;
+            }
+        }
+
+      // The chunk still has each cluster's hashes in front of its data, so
+      // write it a cluster at a time
+      while(start < end)
+        {
+          uint64_t cluster = start / WII_CLUSTER_DATA_SIZE;
+          uint64_t offset = start % WII_CLUSTER_DATA_SIZE;
+          uint64_t size = WII_CLUSTER_DATA_SIZE - offset;
+          if(size > end - start)
+            {
+              size = end - start;
+            }
+          const uint8_t *src
+            = chunk->data + (cluster - chunk->first_cluster) * WII_CLUSTER_SIZE
+              + WII_CLUSTER_HASH_SIZE + offset;
+          if(fwrite(src, 1, size, file->fp) != size)
+            {
+              return -1;
+            }
+          start += size;
+          WBFS_ATOMIC_ADD(&ex->bytes_written, size);
+        }
+
+      if(file_end <= chunk_end)
+        {
+          fclose(file->fp);
+          file->fp = NULL;
+        }
+    }
+
+  // Move past the files that are finished so later chunks don't look at them
+  while(*first_file < ex->file_count
+        && ex->files[*first_file].offset + ex->files[*first_file].size
+             <= chunk_end)
+    {
+      (*first_file)++;
+    }
+  return 0;
+}
+
+// Writer stage, puts the chunks back in order and writes them out, then hands
+// the buffer back to the reader
+static void writer_thread(void *argument)
+{
+  Extraction *ex = (Extraction *)argument;
+  ExtractChunk **pending
+    = calloc(ex->free_buffers.capacity, sizeof(ExtractChunk *));
+  uint32_t pending_count = 0;
+  uint64_t next_sequence = 0;
+  uint32_t first_file = 0;
+
+  ExtractChunk *chunk;
+  while((chunk = queue_pop(&ex->to_write)) != NULL)
+    {
+      pending[pending_count++] = chunk;
+
+      // Write out everything that's now in order
+      for(uint32_t i = 0; i < pending_count;)
+        {
+          if(pending[i]->sequence != next_sequence)
+            {
+              i++;
+              continue;
+            }
+          if(!extract_failed(ex)
+             && write_chunk(ex, pending[i], &first_file) != 0)
+            {
+              extract_fail(ex);
+            }
+          next_sequence++;
+          queue_push(&ex->free_buffers, pending[i]);
+          pending[i] = pending[--pending_count];
+          i = 0;
+        }
+
+      if(next_sequence == ex->plan_count)
+        {
+          break;
+        }
+    }
+  free(pending);
+
+  // If something failed part way there may still be files open
+  for(uint32_t i = 0; i < ex->file_count; i++)
+    {
+      if(ex->files[i].fp)
+        {
+          fclose(ex->files[i].fp);
+        }
+    }
+}
+
+int extract_partition(const WiiPartition *partition, const WiiFst *fst,
+                      const char *out_dir, uint32_t thread_count)
+{
+  Extraction ex;
+  memset(&ex, 0, sizeof(Extraction));
+  ex.partition = partition;
+  ex.fst = fst;
+  ex.out_dir = out_dir;
+
+  if(thread_count == 0)
+    {
+      thread_count = wbfs_thread_hardware_count();
+    }
+  if(thread_count > WBFS_MAX_THREADS)
+    {
+      thread_count = WBFS_MAX_THREADS;
+    }
+
+  int result = prepare_entries(&ex);
+  if(result == 0)
+    {
+      result = build_plan(&ex);
+    }
+
+  // Every buffer the pipeline will ever use is allocated up front, the
+  // queues are big enough to hold all of them so only the free buffers
+  // queue ever makes a stage wait
+  uint32_t buffer_count = thread_count * EXTRACT_BUFFERS_PER_THREAD + 2;
+  ExtractChunk *buffers = calloc(buffer_count, sizeof(ExtractChunk));
+  uint8_t *memory
+    = malloc((size_t)buffer_count * EXTRACT_CHUNK_CLUSTERS * WII_CLUSTER_SIZE);
+  if(result != 0 || !buffers || !memory
+     || queue_init(&ex.free_buffers, buffer_count) != 0
+     || queue_init(&ex.to_decrypt, buffer_count) != 0
+     || queue_init(&ex.to_write, buffer_count) != 0)
+    {
+      free(buffers);
+      free(memory);
+      free(ex.plan);
+      free(ex.files);
+      return -1;
+    }
+  for(uint32_t i = 0; i < buffer_count; i++)
+    {
+      buffers[i].data
+        = memory + (size_t)i * EXTRACT_CHUNK_CLUSTERS * WII_CLUSTER_SIZE;
+      queue_push(&ex.free_buffers, buffers + i);
+    }
+
+  WbfsThread reader;
+  WbfsThread writer;
+  WbfsThread decrypters[WBFS_MAX_THREADS];
+  int reader_started = wbfs_thread_create(&reader, reader_thread, &ex) == 0;
+  int writer_started = wbfs_thread_create(&writer, writer_thread, &ex) == 0;
+  uint32_t decrypters_started = 0;
+  while(decrypters_started < thread_count
+        && wbfs_thread_create(decrypters + decrypters_started, decrypt_thread,
+                              &ex)
+             == 0)
+    {
+      decrypters_started++;
+    }
+
+  // If any stage is missing the pipeline can't finish, so it's failed and
+  // the stages that did start are unwound. Closing the free buffers stops
+  // the reader waiting on buffers that will never come back, and without a
+  // reader the decrypt queue is closed here instead
+  if(!reader_started || !writer_started || decrypters_started < thread_count)
+    {
+      fprintf(stderr, "Could not start the extraction threads\n");
+      extract_fail(&ex);
+      queue_close(&ex.free_buffers);
+      if(!reader_started)
+        {
+          queue_close(&ex.to_decrypt);
+        }
+    }
+
+  // Once the reader is done the decrypt queue closes, once the decrypters
+  // have drained it the write queue closes
+  if(reader_started)
+    {
+      wbfs_thread_join(&reader);
+    }
+  for(uint32_t i = 0; i < decrypters_started; i++)
+    {
+      wbfs_thread_join(decrypters + i);
+    }
+  queue_close(&ex.to_write);
+  if(writer_started)
+    {
+      wbfs_thread_join(&writer);
+    }
+
+  printf(" * extracted %u files, %.1f MiB\n", ex.file_count,
+         WBFS_ATOMIC_ADD(&ex.bytes_written, 0) / (1024.0 * 1024.0));
+
+  queue_destroy(&ex.to_write);
+  queue_destroy(&ex.to_decrypt);
+  queue_destroy(&ex.free_buffers);
+  free(memory);
+  free(buffers);
+  free(ex.plan);
+  free(ex.files);
+  return extract_failed(&ex) ? -1 : 0;
+}
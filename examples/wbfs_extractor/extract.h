@@ -0,0 +1,24 @@
+#ifndef __WBFS_EXTRACT_H__
+#define __WBFS_EXTRACT_H__ (1)
+#include "wbfs.h"
+
+// Extraction reads this many clusters at a time, and keeps a couple of
+// buffers per thread in flight so memory use stays flat however big the
+// partition is
+#define EXTRACT_CHUNK_CLUSTERS (64)
+#define EXTRACT_BUFFERS_PER_THREAD (2)
+
+/**
+ * Writes every file in a partition out under a directory, recreating the
+ * directories from the file system table. The work runs as a pipeline, one
+ * thread reads runs of clusters in disc order, a pool of threads decrypts
+ * them and one thread writes the files out
+ * @returns 0 on success
+ * @param partition Opened partition to extract
+ * @param fst Parsed file system table of the partition
+ * @param out_dir Directory to extract into, has to already exist
+ * @param thread_count How many decryption threads to use, 0 uses all
+ */
+int extract_partition(const WiiPartition *partition, const WiiFst *fst,
+                      const char *out_dir, uint32_t thread_count);
+#endif // !__WBFS_EXTRACT_H__
@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#define STAT_STRUCT struct __stat64
+#define STAT(PATH, BUF) _stat64(PATH, BUF)
+#define STAT_MTIME_NS(BUF) ((uint64_t)(BUF).st_mtime * 1000000000u)
+#else
+#include <dirent.h>
+#define STAT_STRUCT struct stat
+#define STAT(PATH, BUF) stat(PATH, BUF)
+#ifdef __APPLE__
+#define STAT_MTIME_NS(BUF)                                                    \
+  ((uint64_t)(BUF).st_mtimespec.tv_sec * 1000000000u                          \
+   + (uint64_t)(BUF).st_mtimespec.tv_nsec)
+#else
+#define STAT_MTIME_NS(BUF)                                                    \
+  ((uint64_t)(BUF).st_mtim.tv_sec * 1000000000u                               \
+   + (uint64_t)(BUF).st_mtim.tv_nsec)
+#endif
+#endif
+#include "library.h"
+#include "wbfs_thread.h"
+
+#define LIBRARY_PATH_SIZE (1024)
+
+// A wbfs file found in the directory, the record either points into the
+// loaded index or at a freshly built one that has to be freed
+typedef struct LibraryFile
+{
+  char path[LIBRARY_PATH_SIZE];
+  WbfsIndexKey key;
+  const void *record;
+  void *built;
+} LibraryFile;
+
+typedef struct Library
+{
+  LibraryFile *files;
+  uint32_t file_count;
+  uint32_t file_capacity;
+
+  // Positions in files of the ones that need indexing again
+  uint32_t *stale;
+  uint32_t stale_count;
+
+  // WBFS_INDEX_ flags every record is built with
+  uint32_t flags;
+} Library;
+
+static int has_wbfs_extension(const char *name)
+{
+  size_t length = strlen(name);
+  return length > 5 && strcmp(name + length - 5, ".wbfs") == 0;
+}
+
+// Adds a file to the library along with the size and time it was last
+// changed, which is what decides if its index record is still good. The time
+// is in nanoseconds where the platform has them, so a file rewritten within
+// the same second to the same size is still caught
+static int library_add(void *user, const char *dir, const char *name)
+{
+  Library *library = (Library *)user;
+  if(library->file_count == library->file_capacity)
+    {
+      uint32_t capacity
+        = library->file_capacity ? library->file_capacity * 2 : 64;
+      LibraryFile *files
+        = realloc(library->files, capacity * sizeof(LibraryFile));
+      if(!files)
+        {
+          return -1;
+        }
+      library->files = files;
+      library->file_capacity = capacity;
+    }
+
+  LibraryFile *file = library->files + library->file_count;
+  memset(file, 0, sizeof(LibraryFile));
+  snprintf(file->path, sizeof(file->path), "%s/%s", dir, name);
+  STAT_STRUCT info;
+  if(STAT(file->path, &info) != 0)
+    {
+      return 0;
+    }
+  file->key.path = file->path;
+  file->key.file_size = (uint64_t)info.st_size;
+  file->key.mtime = STAT_MTIME_NS(info);
+  library->file_count++;
+  return 0;
+}
+
+int scan_wbfs_directory(const char *dir,
+                        int (*add)(void *user, const char *dir,
+                                   const char *name),
+                        void *user)
+{
+#ifdef _WIN32
+  char pattern[LIBRARY_PATH_SIZE];
+  snprintf(pattern, sizeof(pattern), "%s\\*.wbfs", dir);
+  WIN32_FIND_DATAA found;
+  HANDLE handle = FindFirstFileA(pattern, &found);
+  if(handle == INVALID_HANDLE_VALUE)
+    {
+      return 0;
+    }
+  int result = 0;
+  do
+    {
+      if(has_wbfs_extension(found.cFileName))
+        {
+          result = add(user, dir, found.cFileName);
+        }
+    }
+  while(result == 0 && FindNextFileA(handle, &found));
+  FindClose(handle);
+  return result;
+#else
+  DIR *handle = opendir(dir);
+  if(!handle)
+    {
+      return -1;
+    }
+  int result = 0;
+  struct dirent *entry;
+  while(result == 0 && (entry = readdir(handle)))
+    {
+      if(has_wbfs_extension(entry->d_name))
+        {
+          result = add(user, dir, entry->d_name);
+        }
+    }
+  closedir(handle);
+  return result;
+#endif
+}
+
+// Opens one wbfs file and builds its record, a file that can't be read is
+// just left out of the index
+static void index_file_job(void *user, uint64_t index)
+{
+  Library *library = (Library *)user;
+  LibraryFile *file = library->files + library->stale[index];
+
+  FILE *fp = fopen(file->path, "rb");
+  if(!fp)
+    {
+      return;
+    }
+  Wbfs wbfs;
+  WbfsFileHeader header;
+  void *memory = NULL;
+  if(wbfs_file_header_parse(&wbfs, &header, fp) == e_wbfs_success)
+    {
+      header.disc_table = malloc(wbfs_helper_disc_table_size(&wbfs));
+      if(header.disc_table
+         && wbfs_file_disc_table_parse(&wbfs) == e_wbfs_success)
+        {
+          memory = malloc(wbfs_helper_index_build_size(&wbfs));
+          file->built = malloc(
+            wbfs_helper_index_record_size(&wbfs, file->path, library->flags));
+        }
+      if(memory && file->built
+         && wbfs_index_record_build(&wbfs, &file->key, library->flags, memory,
+                                    file->built)
+              == e_wbfs_success)
+        {
+          file->record = file->built;
+        }
+      free(header.disc_table);
+    }
+  free(memory);
+  fclose(fp);
+}
+
+// Reads the whole index file into memory, a missing or unreadable index is
+// treated as an empty one
+static void *load_index(const char *index_path, WbfsIndex *index)
+{
+  memset(index, 0, sizeof(WbfsIndex));
+  FILE *fp = fopen(index_path, "rb");
+  if(!fp)
+    {
+      return NULL;
+    }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  void *data = size > 0 ? malloc((size_t)size) : NULL;
+  if(data && fread(data, 1, (size_t)size, fp) == (size_t)size)
+    {
+      wbfs_index_open(index, data, (uint64_t)size);
+    }
+  fclose(fp);
+  return data;
+}
+
+static void print_record(const void *record)
+{
+  WbfsIndexFile file;
+  wbfs_index_record_file(record, &file);
+  for(uint32_t i = 0; i < file.disc_count; i++)
+    {
+      WbfsIndexDisc disc;
+      if(wbfs_index_record_disc(record, i, &disc, NULL) != e_wbfs_success)
+        {
+          continue;
+        }
+      printf("%-6s  %-6s  %6llu MB  %-40s  %s\n", disc.catalog.game_id,
+             wbfs_helper_region_name(disc.catalog.game_id),
+             (unsigned long long)(disc.catalog.stored_size >> 20),
+             disc.catalog.title, file.path);
+    }
+}
+
+// Writes the index next to the old one and then moves it over the top, so a
+// crash or a full disk part way through leaves the old index as it was
+static int write_index(const char *index_path, const void **records,
+                       uint32_t record_count)
+{
+  char temp_path[LIBRARY_PATH_SIZE];
+  snprintf(temp_path, sizeof(temp_path), "%s.tmp", index_path);
+  FILE *index_fp = fopen(temp_path, "wb");
+  if(!index_fp)
+    {
+      return -1;
+    }
+  WbfsIo index_io;
+  int failed
+    = wbfs_io_init_file(&index_io, index_fp) != e_wbfs_success
+      || wbfs_index_write(&index_io, records, record_count) != e_wbfs_success;
+  failed |= fclose(index_fp) != 0;
+#ifdef _WIN32
+  failed = failed
+           || !MoveFileExA(temp_path, index_path, MOVEFILE_REPLACE_EXISTING);
+#else
+  failed = failed || rename(temp_path, index_path) != 0;
+#endif
+  if(failed)
+    {
+      remove(temp_path);
+    }
+  return failed ? -1 : 0;
+}
+
+int index_library(const char *dir, const char *index_path,
+                  uint32_t thread_count, uint32_t flags)
+{
+  Library library;
+  memset(&library, 0, sizeof(Library));
+  library.flags = flags;
+  if(scan_wbfs_directory(dir, library_add, &library) != 0)
+    {
+      fprintf(stderr, "Could not read the directory %s\n", dir);
+      free(library.files);
+      return -1;
+    }
+
+  // Anything the index has a current record for doesn't need opening, as
+  // long as the record holds everything the flags ask for
+  WbfsIndex index;
+  void *index_data = load_index(index_path, &index);
+  library.stale = malloc((library.file_count + 1) * sizeof(uint32_t));
+  if(!library.stale)
+    {
+      free(index_data);
+      free(library.files);
+      return -1;
+    }
+  for(uint32_t i = 0; i < library.file_count; i++)
+    {
+      LibraryFile *file = library.files + i;
+      WbfsIndexFile found;
+      if(wbfs_index_find(&index, &file->key, &file->record)
+           != e_wbfs_success
+         || wbfs_index_record_file(file->record, &found) != e_wbfs_success
+         || (found.flags & flags) != flags)
+        {
+          file->record = NULL;
+          library.stale[library.stale_count++] = i;
+        }
+    }
+  wbfs_thread_parallel_for(thread_count, library.stale_count, index_file_job,
+                           &library);
+
+  // The new index only holds the files that are still there
+  const void **records
+    = malloc((library.file_count + 1) * sizeof(const void *));
+  uint32_t record_count = 0;
+  int result = records ? 0 : -1;
+  for(uint32_t i = 0; records && i < library.file_count; i++)
+    {
+      if(library.files[i].record)
+        {
+          records[record_count++] = library.files[i].record;
+        }
+    }
+
+  if(!records || write_index(index_path, records, record_count) != 0)
+    {
+      fprintf(stderr, "Could not write the index %s\n", index_path);
+      result = -1;
+    }
+
+  for(uint32_t i = 0; i < record_count; i++)
+    {
+      print_record(records[i]);
+    }
+  printf(" * %u files, %u from the index, %u indexed again\n",
+         library.file_count, library.file_count - library.stale_count,
+         library.stale_count);
+
+  for(uint32_t i = 0; i < library.file_count; i++)
+    {
+      free(library.files[i].built);
+    }
+  free(records);
+  free(index_data);
+  free(library.stale);
+  free(library.files);
+  return result;
+}
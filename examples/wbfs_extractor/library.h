@@ -0,0 +1,34 @@
+#ifndef __WBFS_LIBRARY_H__
+#define __WBFS_LIBRARY_H__ (1)
+#include "wbfs.h"
+
+/**
+ * Lists every wbfs file in a directory through a library index. Files that
+ * haven't changed since the index was last written are listed straight out
+ * of it, the rest are opened and indexed again in parallel, and the index is
+ * then written back out
+ * @returns 0 on success
+ * @param dir Directory holding the wbfs files
+ * @param index_path Index file to read and update, created if it's missing
+ * @param thread_count How many files to index at once, 0 uses all
+ * @param flags WBFS_INDEX_ flags to build records with, a record in the index
+ * that's missing any of them is built again
+ */
+int index_library(const char *dir, const char *index_path,
+                  uint32_t thread_count, uint32_t flags);
+
+/**
+ * Finds every wbfs file in a directory, the pieces of split files after the
+ * first aren't included
+ * @returns 0 on success, -1 if the directory can't be read, otherwise
+ * whatever add returned to stop the scan early
+ * @param dir Directory to look in
+ * @param add Called with the directory and the name of every file found,
+ * returning anything but 0 stops the scan
+ * @param user Passed to add
+ */
+int scan_wbfs_directory(const char *dir,
+                        int (*add)(void *user, const char *dir,
+                                   const char *name),
+                        void *user);
+#endif // !__WBFS_LIBRARY_H__
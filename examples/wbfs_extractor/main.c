@@ -1,8 +1,22 @@
 #include <stdlib.h>
 #include <string.h>
-#include "aes_light.h"
+#include <sys/stat.h>
+#ifdef _WIN32
+#define STAT_STRUCT struct __stat64
+#define STAT(PATH, BUF) _stat64(PATH, BUF)
+#else
+#define STAT_STRUCT struct stat
+#define STAT(PATH, BUF) stat(PATH, BUF)
+#endif
+#include "batch.h"
+#include "extract.h"
+#include "library.h"
+#include "patch.h"
 #include "wbfs.h"
 
+// Disc images are written in large chunks, half of this buffer each
+#define ISO_BUFFER_SIZE (16 * 1024 * 1024)
+
 // Error loggers based on how many arguments get parsed to the format string
 #define ERROR_EXIT_0(MSG)                                                     \
   fprintf(stderr, MSG "\n");                                                  \
@@ -11,11 +25,219 @@
   fprintf(stderr, MSG "\n%s\n", FORMAT);                                      \
   return -1;
 
-// We use two different aes encryption decryption contexts at once. One to
-// decrypt the partition key, and another to use that decrypted key to decrypt
-// the contents of that partition
-static aes_working_buffer aes_common;
-static aes_working_buffer aes_part;
+// Builds a wbfs file out of a plain disc image, only keeping what's used
+static int build_wbfs(const char *iso_path, const char *wbfs_path)
+{
+  // The size comes from stat, ftell is only 32 bits on windows and a dual
+  // layer disc is well past that
+  STAT_STRUCT iso_info;
+  FILE *iso_fp = fopen(iso_path, "rb");
+  if(!iso_fp || STAT(iso_path, &iso_info) != 0)
+    {
+      ERROR_EXIT_1("Could not open file", iso_path);
+    }
+  uint64_t iso_size = (uint64_t)iso_info.st_size;
+
+  Wbfs iso_handle;
+  WiiDisc disc;
+  WbfsIo iso_io;
+  wbfs_io_init_file(&iso_io, iso_fp);
+  wbfs_enum result
+    = wbfs_disc_open_plain(&disc, &iso_handle, &iso_io, iso_size);
+  if(result != e_wbfs_success)
+    {
+      ERROR_EXIT_1("Could not read the disc image",
+                   wbfs_helper_enum_lookup(result));
+    }
+
+  // Opened for reading as well so the build can check what it wrote
+  FILE *wbfs_fp = fopen(wbfs_path, "w+b");
+  WbfsIo wbfs_io;
+  void *memory = malloc(wbfs_helper_build_size(WBFS_DEFAULT_SECTOR_SHIFT));
+  if(!wbfs_fp || !memory
+     || wbfs_io_init_file(&wbfs_io, wbfs_fp) != e_wbfs_success)
+    {
+      ERROR_EXIT_1("Could not create the wbfs file", wbfs_path);
+    }
+  result = wbfs_build_from_disc(&disc, &wbfs_io, WBFS_DEFAULT_SECTOR_SHIFT,
+                                memory);
+  printf(" * built %s from %s: %s\n", wbfs_path, iso_path,
+         wbfs_helper_enum_lookup(result));
+
+  free(memory);
+  fclose(wbfs_fp);
+  fclose(iso_fp);
+  return result == e_wbfs_success ? 0 : -1;
+}
+
+// Rewrites a wbfs file with only the sectors its discs use, packed together
+static int compact_wbfs(const char *in_path, const char *out_path)
+{
+  FILE *in_fp = fopen(in_path, "rb");
+  if(!in_fp)
+    {
+      ERROR_EXIT_1("Could not open file", in_path);
+    }
+  Wbfs wbfs_handle;
+  WbfsFileHeader wbfs_file_header;
+  wbfs_enum result
+    = wbfs_file_header_parse(&wbfs_handle, &wbfs_file_header, in_fp);
+  if(result != e_wbfs_success)
+    {
+      ERROR_EXIT_1("Could not read the wbfs header",
+                   wbfs_helper_enum_lookup(result));
+    }
+  wbfs_file_header.disc_table
+    = malloc(wbfs_helper_disc_table_size(&wbfs_handle));
+  if(!wbfs_file_header.disc_table
+     || wbfs_file_disc_table_parse(&wbfs_handle) != e_wbfs_success)
+    {
+      ERROR_EXIT_1("Could not read the disc table", in_path);
+    }
+
+  FILE *out_fp = fopen(out_path, "w+b");
+  WbfsIo out_io;
+  void *memory = malloc(wbfs_helper_compact_size(&wbfs_handle));
+  if(!out_fp || !memory
+     || wbfs_io_init_file(&out_io, out_fp) != e_wbfs_success)
+    {
+      ERROR_EXIT_1("Could not create the wbfs file", out_path);
+    }
+  result = wbfs_file_compact(&wbfs_handle, &out_io, memory);
+
+  fflush(out_fp);
+  STAT_STRUCT in_info;
+  STAT_STRUCT out_info;
+  in_info.st_size = 0;
+  out_info.st_size = 0;
+  STAT(in_path, &in_info);
+  STAT(out_path, &out_info);
+  printf(" * compacted %u discs from %s (%lld MB) into %s (%lld MB): %s\n",
+         wbfs_handle.wii_disc_count, in_path, (long long)in_info.st_size >> 20,
+         out_path, (long long)out_info.st_size >> 20,
+         wbfs_helper_enum_lookup(result));
+
+  free(memory);
+  free(wbfs_file_header.disc_table);
+  fclose(out_fp);
+  fclose(in_fp);
+  return result == e_wbfs_success ? 0 : -1;
+}
+
+// Checks every cluster of a partition against its hash tree and reports the
+// ones that don't match
+static void verify_partition(const WiiPartition *partition, uint32_t index)
+{
+  uint64_t cluster_count = wbfs_partition_cluster_count(partition);
+  void *memory = malloc(wbfs_helper_verify_size());
+  uint8_t *status = malloc(cluster_count ? cluster_count : 1);
+  if(!memory || !status)
+    {
+      printf(" * not enough memory to verify partition %u\n", index);
+      free(memory);
+      free(status);
+      return;
+    }
+
+  WbfsVerifyReport report;
+  wbfs_enum result
+    = wbfs_partition_verify(partition, status, &report, memory, 0);
+  if(result != e_wbfs_success)
+    {
+      printf(" * could not verify partition %u: %s\n", index,
+             wbfs_helper_enum_lookup(result));
+    }
+  else
+    {
+      printf(" * partition %u: %llu good, %llu bad, %llu unreadable "
+             "clusters, H3 table %s (%s SHA-1)\n",
+             index, (unsigned long long)report.good_clusters,
+             (unsigned long long)report.bad_clusters,
+             (unsigned long long)report.unreadable_clusters,
+             report.h3_valid ? "valid" : "invalid",
+             wbfs_sha1_hardware_accelerated() ? "hardware" : "portable");
+      for(uint64_t i = 0; i < cluster_count; i++)
+        {
+          if(status[i])
+            {
+              printf("   cluster %llu failed with flags 0x%02x\n",
+                     (unsigned long long)i, status[i]);
+            }
+        }
+    }
+  free(status);
+  free(memory);
+}
+
+// Prints a line for every disc in the wbfs file
+static int list_discs(Wbfs *wbfs)
+{
+  WbfsCatalogEntry *entries
+    = malloc((wbfs->wii_disc_count ? wbfs->wii_disc_count : 1)
+             * sizeof(WbfsCatalogEntry));
+  void *memory = malloc(wbfs_helper_catalog_size(wbfs));
+  if(!entries || !memory)
+    {
+      ERROR_EXIT_0("Failed to allocate space for the catalog");
+    }
+
+  wbfs_enum result = wbfs_file_catalog(wbfs, entries, memory);
+  if(result != e_wbfs_success)
+    {
+      ERROR_EXIT_1("Could not list the discs", wbfs_helper_enum_lookup(result));
+    }
+  printf(" * %u discs\n", wbfs->wii_disc_count);
+  for(uint32_t i = 0; i < wbfs->wii_disc_count; i++)
+    {
+      printf("%4u  %-6s  %-6s  %6llu MB  %s\n", entries[i].slot,
+             entries[i].game_id, wbfs_helper_region_name(entries[i].game_id),
+             (unsigned long long)(entries[i].stored_size >> 20),
+             entries[i].title);
+    }
+  free(memory);
+  free(entries);
+  return 0;
+}
+
+// Hashes the rebuilt disc image with all three digests at once, the image is
+// only ever held a chunk at a time so nothing gets written out
+static void checksum_disc(WiiDisc *disc)
+{
+  void *buffer = malloc(ISO_BUFFER_SIZE);
+  if(!buffer)
+    {
+      printf(" * not enough memory to checksum the disc\n");
+      return;
+    }
+
+  WbfsDiscChecksum checksum;
+  uint64_t start = wbfs_thread_time_ns();
+  wbfs_enum result = wbfs_disc_checksum(disc, &checksum, buffer,
+                                        ISO_BUFFER_SIZE, WBFS_CHECKSUM_ASYNC);
+  double seconds = (double)(wbfs_thread_time_ns() - start) / 1e9;
+  free(buffer);
+  if(result != e_wbfs_success)
+    {
+      printf(" * could not checksum the disc: %s\n",
+             wbfs_helper_enum_lookup(result));
+      return;
+    }
+
+  printf(" * %llu byte disc image hashed in %.2fs (%.0f MB/s)\n",
+         (unsigned long long)checksum.size, seconds,
+         seconds > 0 ? (double)(checksum.size >> 20) / seconds : 0.0);
+  printf("   crc32 %08x\n   md5   ", checksum.crc32);
+  for(uint32_t i = 0; i < 16; i++)
+    {
+      printf("%02x", checksum.md5[i]);
+    }
+  printf("\n   sha1  ");
+  for(uint32_t i = 0; i < 20; i++)
+    {
+      printf("%02x", checksum.sha1[i]);
+    }
+  printf("\n");
+}
 
 int main(int argc, char *argv[])
 {
@@ -26,26 +248,81 @@ int main(int argc, char *argv[])
         "Argument count smaller than 2, did not recieve a file path\n");
     }
 
-  // Look for the passed in file, * not safe *
-  FILE *fp = fopen(argv[1], "rb");
-  if(!fp)
+  if(argc > 3 && strcmp(argv[1], "--build") == 0)
     {
-      ERROR_EXIT_1("Could not open file", argv[1]);
+      return build_wbfs(argv[2], argv[3]);
+    }
+  if(argc > 3 && strcmp(argv[1], "--compact") == 0)
+    {
+      return compact_wbfs(argv[2], argv[3]);
+    }
+  if(argc > 4 && strcmp(argv[1], "--patch") == 0)
+    {
+      return patch_file(argv[2], argv[3], argv[4], argc > 5 ? argv[5] : NULL);
+    }
+  if(argc > 2 && strcmp(argv[1], "--batch") == 0)
+    {
+      return batch_verify(argv[2],
+                          argc > 3 ? (uint32_t)strtoul(argv[3], NULL, 10) : 0,
+                          argc > 4 ? (uint32_t)strtoul(argv[4], NULL, 10) : 2);
+    }
+  if(argc > 3 && strcmp(argv[1], "--index") == 0)
+    {
+      // The extent maps can be left out for a smaller index that only lists
+      int no_extents = argc > 4 && strcmp(argv[4], "--no-extents") == 0;
+      return index_library(argv[2], argv[3], 0,
+                           no_extents ? 0 : WBFS_INDEX_EXTENTS);
     }
 
-  // Set up the aes decryption context to use the common key
-  uint8_t key[]
-    = {00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00, 00};
-  memcpy(aes_common.encryption_key, key, sizeof(k_wii_aes_common_key));
-  aes_common.encryption_key_size = sizeof(k_wii_aes_common_key);
-  aes_init_round_keys(&aes_common);
+  // Either extract the files into a directory, convert to a disc image,
+  // check the hashes of every partition, checksum every disc image or list
+  // the discs
+  const char *out_dir = NULL;
+  const char *iso_path = NULL;
+  int verify = 0;
+  int checksum = 0;
+  int list = 0;
+  if(argc > 3 && strcmp(argv[2], "--iso") == 0)
+    {
+      iso_path = argv[3];
+    }
+  else if(argc > 2 && strcmp(argv[2], "--verify") == 0)
+    {
+      verify = 1;
+    }
+  else if(argc > 2 && strcmp(argv[2], "--checksum") == 0)
+    {
+      checksum = 1;
+    }
+  else if(argc > 2 && strcmp(argv[2], "--list") == 0)
+    {
+      list = 1;
+    }
+  else if(argc > 2)
+    {
+      out_dir = argv[2];
+    }
+
+  // Look for the passed in file, * not safe *. It's read through the split
+  // backend, so a file split into .wbf1, .wbf2 pieces is read as one, and
+  // one that was never split is just the one piece
+  WbfsSplitFile split;
+  WbfsIo io;
+  if(wbfs_io_init_split(&io, &split, argv[1]) != e_wbfs_success)
+    {
+      ERROR_EXIT_1("Could not open file", argv[1]);
+    }
+  if(split.piece_count > 1)
+    {
+      printf(" * reading %u pieces of %s\n", split.piece_count, argv[1]);
+    }
 
   // Make space for the handle representing the WBFS and the file header and
   // then read in the raw bytes representing the header
   Wbfs wbfs_handle;
   WbfsFileHeader wbfs_file_header;
   wbfs_enum result
-    = wbfs_file_header_parse(&wbfs_handle, &wbfs_file_header, fp);
+    = wbfs_file_header_parse_io(&wbfs_handle, &wbfs_file_header, &io);
   if(result != e_wbfs_success)
     {
       ERROR_EXIT_1(
@@ -61,21 +338,27 @@ int main(int argc, char *argv[])
       ERROR_EXIT_0("Failed to allocate space for disc table");
     }
   wbfs_file_disc_table_parse(&wbfs_handle);
+  if(list)
+    {
+      return list_discs(&wbfs_handle);
+    }
 
   // Now that we've read the disc table, loop through all of the discs and
   // parse them
-  for(uint8_t i = 0; i < wbfs_handle.wii_disc_count; i++)
+  for(uint32_t i = 0; i < wbfs_handle.wii_disc_count; i++)
     {
-      printf(" * Opening Disc %d\n", i);
+      printf(" * Opening Disc %u\n", i);
 
       // Initalise the disc by finding out where it starts
       WiiDisc disc;
       memset(&disc, 0, sizeof(WiiDisc));
       wbfs_disc_get_offset(&disc, &wbfs_handle, i);
 
-      // Allocate space for the sector look up table for this disc
+      // Allocate space for the sector look up table for this disc, measuring
+      // it first means it only has to reach the last sector the disc uses
+      wbfs_disc_measure_sector_table(&disc);
       disc.wbfs_sector_lookup
-        = malloc(wbfs_helper_sector_table_size(&wbfs_handle));
+        = malloc(wbfs_helper_disc_sector_table_size(&disc));
       if(!disc.wbfs_sector_lookup)
         {
           ERROR_EXIT_0(
@@ -83,6 +366,33 @@ int main(int argc, char *argv[])
         }
       wbfs_disc_parse_sector_table(&disc);
 
+      // Rebuild the plain disc image if asked to, the buffer is split in two
+      // so reading the next chunk overlaps writing the last
+      if(iso_path)
+        {
+          FILE *iso_fp = fopen(iso_path, "wb");
+          WbfsIo iso_io;
+          void *iso_buffer = malloc(ISO_BUFFER_SIZE);
+          if(!iso_fp || !iso_buffer
+             || wbfs_io_init_file(&iso_io, iso_fp) != e_wbfs_success)
+            {
+              ERROR_EXIT_1("Could not create the disc image", iso_path);
+            }
+          result = wbfs_disc_write_iso(&disc, &iso_io, iso_buffer,
+                                       ISO_BUFFER_SIZE, WBFS_CONVERT_ASYNC);
+          printf(" * wrote %llu byte disc image to %s: %s\n",
+                 (unsigned long long)wbfs_disc_iso_size(&disc), iso_path,
+                 wbfs_helper_enum_lookup(result));
+          free(iso_buffer);
+          fclose(iso_fp);
+        }
+      if(checksum)
+        {
+          checksum_disc(&disc);
+          free(disc.wbfs_sector_lookup);
+          continue;
+        }
+
       // Once we have the sector table parsed we can now read any part of the
       // disc Read the partition information, which tells us where the
       // partition tables are located
@@ -93,17 +403,75 @@ int main(int argc, char *argv[])
       for(uint32_t j = 0; j < partition_info[0].partition_count; j++)
         {
           WiiDiscPartitionTableEntry partition_table_entry;
-          wbfs_disc_parse_partition_table(&disc, &partition_table_entry,
-                                          partition_info[i].offset);
+          wbfs_disc_parse_partition_table(
+            &disc, &partition_table_entry,
+            partition_info[0].offset
+              + j * sizeof(WiiDiscPartitionTableEntry));
           printf(" * partition %d starts at 0x%08x\n", j,
                  partition_table_entry.offset);
 
-          uint8_t encrypted_part_key[16];
-          uint8_t init_vector[16];
-          wbfs_disc_read_buffer(&disc, encrypted_part_key,
-                                partition_table_entry.offset + 0x1bf, 16);
-          wbfs_disc_read_buffer(&disc, init_vector,
-                                partition_table_entry.offset + 0x1dc, 16);
+          // Opening the partition decrypts the title key, after that any of
+          // the partition's data can be read
+          WiiPartition partition;
+          result
+            = wbfs_partition_open(&partition, &disc,
+                                  partition_table_entry.offset);
+          if(result != e_wbfs_success)
+            {
+              printf(" * could not open partition %d: %s\n", j,
+                     wbfs_helper_enum_lookup(result));
+              continue;
+            }
+
+          // The boot header at the start of the data starts with the game id
+          char game_id[7];
+          memset(game_id, 0, sizeof(game_id));
+          wbfs_partition_read(&partition, game_id, 0, 6);
+          printf(" * partition %d holds %s, %llu clusters (%s AES)\n", j,
+                 game_id,
+                 (unsigned long long)wbfs_partition_cluster_count(&partition),
+                 wbfs_aes_hardware_accelerated() ? "hardware" : "portable");
+
+          if(verify)
+            {
+              verify_partition(&partition, j);
+              continue;
+            }
+
+          // Index the partition's file system so files can be found by path
+          WiiFst fst;
+          result = wbfs_fst_parse_header(&fst, &partition);
+          if(result == e_wbfs_success)
+            {
+              void *fst_memory = malloc(wbfs_helper_fst_size(&fst));
+              if(!fst_memory)
+                {
+                  ERROR_EXIT_0("Failed to allocate space for the file system");
+                }
+              result = wbfs_fst_parse(&fst, &partition, fst_memory);
+              if(result == e_wbfs_success)
+                {
+                  printf(" * %s has %u file system entries\n", fst.title,
+                         fst.entry_count);
+                }
+
+              // Given somewhere to put them, dump the files of the game
+              // partition out
+              if(result == e_wbfs_success && out_dir
+                 && partition_table_entry.type == 0)
+                {
+                  if(extract_partition(&partition, &fst, out_dir, 0) != 0)
+                    {
+                      printf(" * extraction of partition %d failed\n", j);
+                    }
+                }
+              free(fst_memory);
+            }
+          if(result != e_wbfs_success)
+            {
+              printf(" * could not read the file system: %s\n",
+                     wbfs_helper_enum_lookup(result));
+            }
         }
     }
 }
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#define STAT_STRUCT struct __stat64
+#define STAT(PATH, BUF) _stat64(PATH, BUF)
+#else
+#define STAT_STRUCT struct stat
+#define STAT(PATH, BUF) stat(PATH, BUF)
+#endif
+#include "patch.h"
+
+// Disc images are written in large chunks, half of this buffer each
+#define PATCH_ISO_BUFFER_SIZE (16 * 1024 * 1024)
+
+// Where a file's size sits in its 12 byte file system table entry
+#define FST_ENTRY_SIZE (12)
+#define FST_ENTRY_FILE_SIZE (8)
+
+// Reads a whole file into memory. The size comes from stat, ftell is only
+// 32 bits on windows
+static void *read_replacement(const char *path, uint64_t *size)
+{
+  STAT_STRUCT info;
+  FILE *fp = fopen(path, "rb");
+  if(!fp || STAT(path, &info) != 0 || info.st_size < 0
+     || (uint64_t)info.st_size > (size_t)-1)
+    {
+      if(fp)
+        {
+          fclose(fp);
+        }
+      return NULL;
+    }
+  size_t length = (size_t)info.st_size;
+  void *data = malloc(length > 0 ? length : 1);
+  if(data && length > 0 && fread(data, 1, length, fp) != length)
+    {
+      free(data);
+      data = NULL;
+    }
+  fclose(fp);
+  *size = length;
+  return data;
+}
+
+// Opens the first game partition on the disc, the one holding the game
+// rather than an update or a channel
+static wbfs_enum open_game_partition(WiiDisc *disc, WiiPartition *partition)
+{
+  WiiDiscPartitionInfoEntry info[4];
+  wbfs_enum result = wbfs_disc_parse_partition_info(disc, info);
+  for(uint32_t i = 0; result == e_wbfs_success && i < info[0].partition_count;
+      i++)
+    {
+      WiiDiscPartitionTableEntry entry;
+      result = wbfs_disc_parse_partition_table(
+        disc, &entry,
+        info[0].offset + i * sizeof(WiiDiscPartitionTableEntry));
+      if(result == e_wbfs_success && entry.type == 0)
+        {
+          return wbfs_partition_open(partition, disc, entry.offset);
+        }
+    }
+  return result == e_wbfs_success ? e_wbfs_not_found : result;
+}
+
+// Finds the file and sets up the patches, the file's contents and, if it
+// got smaller, the size in its file system table entry
+static wbfs_enum plan_patches(const WiiPartition *partition,
+                              const char *game_path, const void *data,
+                              uint64_t size, WbfsRepackPatch patches[2],
+                              uint32_t *patch_count, uint8_t size_field[4])
+{
+  WiiFst fst;
+  wbfs_enum result = wbfs_fst_parse_header(&fst, partition);
+  void *fst_memory
+    = result == e_wbfs_success ? malloc(wbfs_helper_fst_size(&fst)) : NULL;
+  if(result == e_wbfs_success && !fst_memory)
+    {
+      result = e_wbfs_segfault;
+    }
+  if(result == e_wbfs_success)
+    {
+      result = wbfs_fst_parse(&fst, partition, fst_memory);
+    }
+
+  uint32_t index = 0;
+  WiiFileRange range;
+  if(result == e_wbfs_success)
+    {
+      result = wbfs_fst_lookup(&fst, game_path, &index);
+    }
+  if(result == e_wbfs_success)
+    {
+      result = wbfs_fst_file_range(&fst, index, &range);
+    }
+  if(result == e_wbfs_success && size > range.size)
+    {
+      fprintf(stderr, "The replacement is %llu bytes, %s only has room for "
+              "%llu\n", (unsigned long long)size, game_path,
+              (unsigned long long)range.size);
+      result = e_wbfs_out_of_space;
+    }
+
+  if(result == e_wbfs_success)
+    {
+      patches[0].address = range.offset;
+      patches[0].size = size;
+      patches[0].data = data;
+      *patch_count = 1;
+      if(size < range.size)
+        {
+          size_field[0] = (uint8_t)(size >> 24);
+          size_field[1] = (uint8_t)(size >> 16);
+          size_field[2] = (uint8_t)(size >> 8);
+          size_field[3] = (uint8_t)size;
+          patches[1].address
+            = fst.fst_offset + index * FST_ENTRY_SIZE + FST_ENTRY_FILE_SIZE;
+          patches[1].size = 4;
+          patches[1].data = size_field;
+          *patch_count = 2;
+        }
+    }
+  free(fst_memory);
+  return result;
+}
+
+// Rebuilds the disc image to patch, the groups that change are written again
+// over the top of it afterwards
+static int write_iso(WiiDisc *disc, FILE *iso_fp, WbfsIo *iso_io)
+{
+  void *buffer = malloc(PATCH_ISO_BUFFER_SIZE);
+  if(!buffer || wbfs_io_init_file(iso_io, iso_fp) != e_wbfs_success)
+    {
+      free(buffer);
+      return -1;
+    }
+  wbfs_enum result = wbfs_disc_write_iso(disc, iso_io, buffer,
+                                         PATCH_ISO_BUFFER_SIZE,
+                                         WBFS_CONVERT_ASYNC);
+  free(buffer);
+  return result == e_wbfs_success ? 0 : -1;
+}
+
+int patch_file(const char *wbfs_path, const char *game_path,
+               const char *replacement_path, const char *iso_path)
+{
+  uint64_t size = 0;
+  void *data = read_replacement(replacement_path, &size);
+  if(!data)
+    {
+      fprintf(stderr, "Could not read %s\n", replacement_path);
+      return -1;
+    }
+
+  // Patching in place needs to write to the wbfs file as well as read it
+  FILE *wbfs_fp = fopen(wbfs_path, iso_path ? "rb" : "r+b");
+  Wbfs wbfs;
+  WbfsFileHeader header;
+  header.disc_table = NULL;
+  WiiDisc disc;
+  memset(&disc, 0, sizeof(WiiDisc));
+  wbfs_enum result = wbfs_fp ? wbfs_file_header_parse(&wbfs, &header, wbfs_fp)
+                             : e_wbfs_invalid_io;
+  if(result == e_wbfs_success)
+    {
+      header.disc_table = malloc(wbfs_helper_disc_table_size(&wbfs));
+      result = header.disc_table ? wbfs_file_disc_table_parse(&wbfs)
+                                 : e_wbfs_segfault;
+    }
+  if(result == e_wbfs_success)
+    {
+      result = wbfs_disc_get_offset(&disc, &wbfs, 0);
+    }
+  if(result == e_wbfs_success)
+    {
+      wbfs_disc_measure_sector_table(&disc);
+      disc.wbfs_sector_lookup
+        = malloc(wbfs_helper_disc_sector_table_size(&disc));
+      result = disc.wbfs_sector_lookup ? wbfs_disc_parse_sector_table(&disc)
+                                       : e_wbfs_segfault;
+    }
+
+  WiiPartition partition;
+  WbfsRepackPatch patches[2];
+  uint32_t patch_count = 0;
+  uint8_t size_field[4];
+  if(result == e_wbfs_success)
+    {
+      result = open_game_partition(&disc, &partition);
+    }
+  if(result == e_wbfs_success)
+    {
+      result = plan_patches(&partition, game_path, data, size, patches,
+                            &patch_count, size_field);
+    }
+
+  // Either write into a fresh disc image, or straight into the disc's
+  // sectors in the wbfs file
+  FILE *iso_fp = NULL;
+  WbfsIo out_io;
+  if(result == e_wbfs_success && iso_path)
+    {
+      iso_fp = fopen(iso_path, "w+b");
+      if(!iso_fp || write_iso(&disc, iso_fp, &out_io) != 0)
+        {
+          fprintf(stderr, "Could not write the disc image %s\n", iso_path);
+          result = e_wbfs_failed_file_write;
+        }
+    }
+  else if(result == e_wbfs_success)
+    {
+      result = wbfs_io_init_disc(&out_io, &disc);
+    }
+
+  void *memory = NULL;
+  if(result == e_wbfs_success)
+    {
+      memory = malloc(wbfs_helper_repack_size());
+      result = memory ? e_wbfs_success : e_wbfs_segfault;
+    }
+  if(result == e_wbfs_success)
+    {
+      uint64_t start = wbfs_thread_time_ns();
+      result = wbfs_partition_repack(&partition, &out_io, patches,
+                                     patch_count, memory, 0);
+      printf(" * repacked %s with %llu bytes from %s into %s in %.2fs\n",
+             game_path, (unsigned long long)size, replacement_path,
+             iso_path ? iso_path : wbfs_path,
+             (double)(wbfs_thread_time_ns() - start) / 1e9);
+    }
+  printf(" * %s\n", wbfs_helper_enum_lookup(result));
+
+  free(memory);
+  if(iso_fp)
+    {
+      fclose(iso_fp);
+    }
+  free(disc.wbfs_sector_lookup);
+  free(header.disc_table);
+  if(wbfs_fp)
+    {
+      fclose(wbfs_fp);
+    }
+  free(data);
+  return result == e_wbfs_success ? 0 : -1;
+}
@@ -0,0 +1,20 @@
+#ifndef __WBFS_PATCH_H__
+#define __WBFS_PATCH_H__ (1)
+#include "wbfs.h"
+
+/**
+ * Replaces a file in the game partition of the first disc of a wbfs file
+ * and repacks the partition so its hashes match again. Only the groups of
+ * clusters the file and its file system entry sit in are written. The
+ * replacement can be smaller than the file but not larger, since the file
+ * keeps its place on the disc
+ * @returns 0 on success
+ * @param wbfs_path Wbfs file to read the disc from
+ * @param game_path Path of the file inside the game partition
+ * @param replacement_path File holding the new contents
+ * @param iso_path Disc image to write the patched disc to, if this is null
+ * the wbfs file is patched in place
+ */
+int patch_file(const char *wbfs_path, const char *game_path,
+               const char *replacement_path, const char *iso_path);
+#endif // !__WBFS_PATCH_H__
@@ -11,12 +11,24 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "wbfs_thread.h"
+
 /*************************************************************************************************************
  * Constants
  *************************************************************************************************************/
 #define WBFS_MAGIC ('W' << 24 | 'B' << 16 | 'F' << 8 | 'S')
 extern const uint8_t k_wii_aes_common_key[16];
 
+// Partition data is split into clusters, each starts with a block of hashes and then the actual data. Both
+// parts are encrypted separately
+#define WII_CLUSTER_SIZE (0x8000)
+#define WII_CLUSTER_HASH_SIZE (0x400)
+#define WII_CLUSTER_DATA_SIZE (0x7C00)
+
+// Clusters are hashed in groups of 64, the H3 table at the start of a partition holds a hash for every group
+#define WII_GROUP_CLUSTERS (64)
+#define WII_H3_TABLE_SIZE (0x18000)
+
 /*************************************************************************************************************
  * Structure definitions
  *************************************************************************************************************/
@@ -40,26 +52,143 @@ typedef struct WbfsFileHeader {
     uint8_t* disc_table;  // Lists all the Wii discs inside the partition, can store up to hd_sector_size - 12
 } WbfsFileHeader;
 
+/**
+ * Every read the library makes goes through this small I/O backend rather than a shared FILE*, which means
+ * there is no file position for readers to fight over. read_at fills size bytes from an absolute offset in the
+ * wbfs file, and has to be safe to call from several threads at once. The built in backend does this with
+ * positional reads on the file descriptor, users can also plug in their own by filling in read_at and user.
+ * Anything that writes a file out (like converting to an iso) goes through write_at and set_size, backends
+ * that are only ever read from can leave those null.
+ *
+ * Backends that read from operating system files can also fill in locate, which says which file descriptor a
+ * byte of the wbfs file lives in and how much of the wbfs file carries on in it. Readers that hand reads
+ * straight to the operating system, like the io_uring batch, go through this rather than read_at
+ */
+typedef struct WbfsIo {
+    int (*read_at)(struct WbfsIo* io, void* data, uint64_t offset, uint64_t size);         // 0 on success
+    int (*write_at)(struct WbfsIo* io, const void* data, uint64_t offset, uint64_t size);  // 0 on success
+    int (*set_size)(struct WbfsIo* io, uint64_t size);  // Truncates or extends the file, 0 on success
+    int (*locate)(struct WbfsIo* io, uint64_t offset, intptr_t* handle, uint64_t* handle_offset,
+                  uint64_t* handle_left);  // 0 on success
+    void* user;       // Free for custom backends to use
+    intptr_t handle;  // File descriptor (or HANDLE on windows) used by the built in backend
+
+    // If the whole file is mapped into memory these point at the mapping, reads can then hand out pointers
+    // straight into it rather than copying
+    const uint8_t* map;
+    uint64_t map_size;
+} WbfsIo;
+
+// Split wbfs files are made of the .wbfs file followed by .wbf1, .wbf2 and so on, each piece but the last has
+// to be the same size. Most tools split at just under 4GB so the pieces fit on FAT32
+#define WBFS_SPLIT_MAX_PIECES (10)
+#define WBFS_SPLIT_PATH_SIZE (1024)
+
+/**
+ * The pieces of a split wbfs file, seen through the backend as one file. Pieces are only opened the first
+ * time something is read from them
+ */
+typedef struct WbfsSplitFile {
+    char path[WBFS_SPLIT_PATH_SIZE];  // Path of the first piece, the others change the last character
+    uint32_t piece_count;
+    uint64_t piece_size;  // Size of every piece but the last
+    uint64_t total_size;  // Size of all the pieces together
+
+    volatile intptr_t handles[WBFS_SPLIT_MAX_PIECES];  // File descriptors (or HANDLEs), -1 until opened
+    WbfsMutex open_lock;                               // Held while a piece is being opened
+} WbfsSplitFile;
+
+// Read latencies are bucketed by powers of two nanoseconds, the last bucket catches anything slower
+#define WBFS_STATS_LATENCY_BUCKETS (32)
+
+/**
+ * One physical read, handed to the trace hook as it completes
+ */
+typedef struct WbfsIoEvent {
+    uint64_t offset;       // Where the read started in the wbfs file
+    uint64_t size;         // How many bytes were asked for
+    uint64_t nanoseconds;  // How long the backend took
+    int result;            // What the backend returned, 0 on success
+} WbfsIoEvent;
+
+/**
+ * Counters for everything a handle reads. These are only filled in when the library is built with WBFS_STATS
+ * defined, otherwise the read path doesn't touch them at all. Counters are bumped atomically, so one set can
+ * be shared by handles being read from several threads
+ */
+typedef struct WbfsStats {
+    uint64_t reads;                                // Physical reads issued to the backend
+    uint64_t seeks;                                // Physical reads that didn't start where the last one ended
+    uint64_t bytes_read;                           // Bytes asked of the backend
+    uint64_t failed_reads;                         // Physical reads the backend failed
+    uint64_t disc_reads;                           // Calls to wbfs_disc_read_buffer
+    uint64_t sector_crossings;                     // Wbfs sector boundaries crossed by disc reads
+    uint64_t split_reads;                          // Disc reads that needed more than one physical read
+    uint64_t cache_hits;                           // Clusters found in a cluster cache
+    uint64_t cache_misses;                         // Clusters a cluster cache had to read
+    uint64_t read_nanoseconds;                     // Total time spent in the backend
+    uint64_t next_offset;                          // Where the last physical read ended, used to spot seeks
+    uint64_t latency[WBFS_STATS_LATENCY_BUCKETS];  // Bucket n counts reads taking under 2 ^ n nanoseconds
+
+    // Optional hook called after every physical read, from whichever thread made it
+    void (*trace)(void* user, const WbfsIoEvent* event);
+    void* trace_user;
+} WbfsStats;
+
 /**
  * Define the Wbfs struct, this keeps track of all the information extracted from the header, such as tracking
  * the file pointer and the constants that remain the same between discs
  */
 typedef struct Wbfs {
-    FILE* fp;                     // The underlying wbfs file
+    FILE* fp;                     // The underlying wbfs file, can be null if opened through a custom backend
+    WbfsIo io;                    // Backend that all reads from the wbfs file go through
     WbfsFileHeader* file_header;  // Interpret the bytes of Wbfs header
 
     // Variables extracted from the binary file header
     uint64_t wbfs_file_size;         // How large the WBFS file is in bytes
     uint64_t wbfs_sector_size;       // How large the WBFS sectors are
     uint64_t hd_sector_size;         // How large the host hard drive sectors are
-    uint8_t wii_disc_count;          // How many Wii disks are in the file
+    uint32_t wii_disc_count;         // How many Wii disks are in the file
     uint32_t wbfs_sectors_per_disc;  // How many wbfs sectors a Wii disc takes up
+    uint32_t wbfs_sector_count;      // How many wbfs sectors the whole file covers, the header sector included
+
+    // Every slot in the disc table has its own disc info, one after the other from the second host sector.
+    // A disc info is the copy of the disc header and the sector table, rounded up to a whole host sector
+    uint64_t disc_info_size;   // Bytes taken up by each disc info
+    uint32_t disc_slot_count;  // How many slots of the disc table fit before the free block map
+
+    // Optional counters, attached with wbfs_stats_attach. Only used when built with WBFS_STATS
+    WbfsStats* stats;
 
     // Repeate the WBFS magic at the end of the struct, this is how we'll ensure the struct we've recieved is
     // propperly allocated
     uint32_t valid;
 } Wbfs;
 
+/**
+ * A run of wbfs sectors that sit back to back inside the wbfs file. Most discs are written out as a handful of
+ * long runs, so instead of looking up every wbfs sector on a read we can look up the run the address falls in
+ * and read the whole thing in one go. All the values are in wbfs sectors so the struct stays small
+ */
+typedef struct WbfsExtent {
+    uint32_t disc_sector;   // First wbfs sector local to the wii disc covered by this run
+    uint32_t file_sector;   // Where that sector lives inside the wbfs file
+    uint32_t sector_count;  // How many sectors are in the run
+} WbfsExtent;
+
+/**
+ * A summary of one disc in the wbfs file, enough to list what's on a drive without opening every disc
+ */
+typedef struct WbfsCatalogEntry {
+    uint32_t slot;            // Slot in the disc table, discs that get removed leave empty slots behind
+    uint64_t wbfs_offset;     // Where the disc info starts in the wbfs file
+    char game_id[7];          // Null terminated game id, the fourth letter is the region
+    char title[65];           // Null terminated game title
+    uint32_t stored_sectors;  // How many wbfs sectors the disc takes up in the wbfs file
+    uint64_t stored_size;     // Bytes the disc takes up in the wbfs file
+    uint64_t iso_size;        // Size of the disc as a plain disc image
+} WbfsCatalogEntry;
+
 /**
  * Define the Wii disc struct. Although the wbfs contains multiple wii disc, we don't store an array of wii
  * discs as it will be more memory efficient to parse one wii disc at a time and then make the disc hold a
@@ -70,8 +199,50 @@ typedef struct WiiDisc {
     Wbfs* wbfs;                    // Pointer to the parent wbfs container
     uint16_t* wbfs_sector_lookup;  // Wbfs sectors aren't guarenteed to be in the correct order
     uint64_t wbfs_offset;          // The offset into the wbfs file that this disc starts at
+
+    // Optional run length map of the sector lookup, if the user backs this with memory it gets filled in when
+    // the sector table is parsed and reads will walk the runs rather than individual sectors
+    WbfsExtent* extents;
+    uint32_t extent_count;
+
+    // Non zero for a plain disc image opened with wbfs_disc_open_plain, the disc addresses are then the file
+    // addresses and there is no sector table
+    uint64_t plain_size;
+
+    // Entries of the sector table up to and including the last stored sector, everything after it is a hole.
+    // Known once the table has been measured or loaded, which the first read does if the user hasn't
+    uint32_t sector_count;
+    volatile uint32_t table_state;  // One of WBFS_TABLE_*
 } WiiDisc;
 
+// How far a disc's sector table has got, it's measured and loaded by the user or on the first read
+#define WBFS_TABLE_UNLOADED (0)
+#define WBFS_TABLE_MEASURED (1)
+#define WBFS_TABLE_LOADING (2)
+#define WBFS_TABLE_LOADED (3)
+
+/**
+ * A block of memory handed out front to back. Nothing in it is freed on its own, resetting the arena gives it
+ * all back at once, so one block can be reused for file after file without going back to the heap
+ */
+typedef struct WbfsArena {
+    uint8_t* memory;
+    size_t size;
+    size_t used;
+    size_t needed;  // How large the arena has to be, set when something didn't fit
+} WbfsArena;
+
+/**
+ * A wbfs file opened in one call with wbfs_file_open_arena. The handle, the header, the disc table and every
+ * disc with its sector table and extent map all sit in the arena. They point into each other, so nothing in
+ * here can be copied out and used on its own
+ */
+typedef struct WbfsFile {
+    Wbfs wbfs;
+    WbfsFileHeader header;
+    WiiDisc* discs;  // wbfs.wii_disc_count discs in disc table order, already parsed
+} WbfsFile;
+
 /**
  * The Wii disc partition info starts at address 0x40000 local to the wii disc. This information tells us
  * where to look for the start of each of the partition tables. I think in total there are four of these
@@ -91,6 +262,318 @@ typedef struct WiiDiscPartitionTableEntry {
     uint32_t type;
 } WiiDiscPartitionTableEntry;
 
+/**
+ * Expanded AES-128 round keys, both directions are kept so one key can be used to decrypt and encrypt. The
+ * words are stored big endian so the portable and hardware paths can share them
+ */
+typedef struct WbfsAesKey {
+    uint32_t encrypt_keys[44];
+    uint32_t decrypt_keys[44];
+} WbfsAesKey;
+
+/**
+ * A partition on the wii disc. The partition starts with a ticket holding the encrypted title key, followed by
+ * a header saying where the TMD, certificates, H3 hashes and the encrypted data can be found. Everything is
+ * stored as a disc local address, so this can be passed straight to wbfs_disc_read_buffer
+ */
+typedef struct WiiPartition {
+    WiiDisc* disc;         // Disc the partition lives on
+    uint64_t offset;       // Where the partition starts on the disc
+    uint64_t tmd_offset;   // Where the title meta data starts
+    uint32_t tmd_size;     // Size of the title meta data
+    uint64_t cert_offset;  // Where the certificate chain starts
+    uint32_t cert_size;    // Size of the certificate chain
+    uint64_t h3_offset;    // Where the H3 hash table starts
+    uint64_t data_offset;  // Where the first encrypted cluster starts
+    uint64_t data_size;    // Size of all of the encrypted clusters
+
+    uint8_t title_id[8];    // Title id from the ticket, used as the IV for the title key
+    uint8_t title_key[16];  // Decrypted title key
+    WbfsAesKey key;         // Title key expanded ready to decrypt clusters
+} WiiPartition;
+
+/**
+ * What a library index record is looked up by. A record is only used while the file still has the same size
+ * and modification time, the time can be in whatever units the caller likes as long as they stay the same
+ */
+typedef struct WbfsIndexKey {
+    const char* path;
+    uint64_t file_size;
+    uint64_t mtime;
+} WbfsIndexKey;
+
+// Partitions kept for each disc in an index record, discs rarely have more than a game, update and channel
+#define WBFS_INDEX_MAX_PARTITIONS (8)
+
+/**
+ * The file level part of a library index record, what wbfs_file_header_parse and the disc table would give
+ */
+typedef struct WbfsIndexFile {
+    const char* path;  // Points into the record
+    uint64_t file_size;
+    uint64_t mtime;
+    uint8_t hd_sector_shift;
+    uint8_t wbfs_sector_shift;
+    uint32_t hd_sector_count;
+    uint32_t disc_count;
+    uint32_t flags;  // WBFS_INDEX_ flags the record was built with
+} WbfsIndexFile;
+
+/**
+ * One disc from a library index record. If the record was built with extents, they can be copied out into a
+ * disc's extent map and the disc read without its sector table ever being read
+ */
+typedef struct WbfsIndexDisc {
+    WbfsCatalogEntry catalog;
+    uint32_t partition_count;
+    WiiDiscPartitionTableEntry partitions[WBFS_INDEX_MAX_PARTITIONS];
+    uint32_t extent_count;  // 0 if the record was built without extents
+} WbfsIndexDisc;
+
+/**
+ * An index file loaded into memory, the records are sorted by path and handed out in place
+ */
+typedef struct WbfsIndex {
+    const uint8_t* data;
+    uint64_t size;
+    uint32_t record_count;
+} WbfsIndex;
+
+/**
+ * Running state of a SHA-1, for hashing something that arrives in pieces
+ */
+typedef struct WbfsSha1 {
+    uint32_t state[5];
+    uint64_t length;     // Bytes hashed so far
+    uint8_t buffer[64];  // Partial block waiting for more data
+    uint32_t buffered;
+} WbfsSha1;
+
+/**
+ * Running state of an MD5, laid out the same as the SHA-1
+ */
+typedef struct WbfsMd5 {
+    uint32_t state[4];
+    uint64_t length;     // Bytes hashed so far
+    uint8_t buffer[64];  // Partial block waiting for more data
+    uint32_t buffered;
+} WbfsMd5;
+
+/**
+ * Checksums of a whole plain disc image, what the dump databases list a disc by
+ */
+typedef struct WbfsDiscChecksum {
+    uint64_t size;  // Size of the disc image that was hashed
+    uint32_t crc32;
+    uint8_t md5[16];
+    uint8_t sha1[20];
+} WbfsDiscChecksum;
+
+/**
+ * New contents for a range of a partition's decrypted data, addressed the same way wbfs_partition_read is
+ */
+typedef struct WbfsRepackPatch {
+    uint64_t address;  // Address into the decrypted partition data
+    uint64_t size;     // Size of the range in bytes
+    const void* data;  // What the range should hold
+} WbfsRepackPatch;
+
+/**
+ * Totals from checking a partition's hash tree
+ */
+typedef struct WbfsVerifyReport {
+    uint64_t cluster_count;        // Clusters in the partition
+    uint64_t good_clusters;        // Clusters that passed every check
+    uint64_t bad_clusters;         // Clusters that failed at least one check
+    uint64_t unreadable_clusters;  // Clusters that couldn't be read at all
+    uint32_t h3_valid;             // 1 if the H3 table matches the hash in the TMD
+} WbfsVerifyReport;
+
+/**
+ * A slot in the decrypted cluster cache. Slots being filled in are marked as loading so nothing evicts them or
+ * reads them before they're ready
+ */
+typedef struct WbfsCacheEntry {
+    uint64_t cluster;    // Which cluster is held in this slot
+    uint64_t last_used;  // When the slot was last touched, the smallest is evicted first
+    uint8_t state;       // Empty, loading or ready
+} WbfsCacheEntry;
+
+/**
+ * A bounded least recently used cache of decrypted clusters sitting on top of a partition. Reads that keep
+ * landing in the same clusters only pay for the read and the decryption once. When reads walk forwards through
+ * the clusters a background thread starts decrypting the next few before they are asked for. The memory is
+ * supplied by the user and the struct can't be moved while the cache is running
+ */
+typedef struct WbfsClusterCache {
+    const WiiPartition* partition;  // Partition the clusters come from
+    WbfsCacheEntry* entries;        // One entry per slot
+    uint8_t* clusters;              // capacity * WII_CLUSTER_SIZE bytes of decrypted clusters
+    uint32_t capacity;              // How many clusters can be held at once
+    uint32_t read_ahead;            // How many clusters to prefetch once reads look sequential
+    uint64_t tick;                  // Counter used to order the slots for eviction
+
+    // Sequential access detection, and the range the prefetch thread still has to fill in
+    uint64_t last_cluster;
+    uint32_t sequential_run;
+    uint64_t prefetch_next;
+    uint64_t prefetch_end;
+
+    // Counters so the cache can be sized, a prefetch hit is a hit on a cluster loaded by the read ahead
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t prefetched;
+    uint64_t prefetch_hits;
+
+    WbfsMutex lock;
+    WbfsCond wake;    // Wakes the prefetch thread
+    WbfsCond loaded;  // Signalled whenever a slot finishes loading
+    WbfsThread thread;
+    int running;
+} WbfsClusterCache;
+
+/**
+ * One file or directory from the partition's file system table. The on disc entries are packed into 12 bytes
+ * and need decoding every time they're looked at, so they're expanded once into this. For files next is always
+ * the following entry, for directories it's the entry after the last thing inside them, so either way next is
+ * the entry's next sibling
+ */
+typedef struct WiiFstEntry {
+    uint32_t name_offset;   // Offset of the name in the string pool
+    uint32_t parent;        // Index of the directory holding this entry
+    uint32_t next;          // Index of the next sibling
+    uint32_t is_directory;  // 1 for directories, 0 for files
+    uint64_t offset;        // Address of the file in the decrypted partition data
+    uint64_t size;          // Size of the file in bytes
+    uint64_t path_hash;     // Hash of the full path, used by the path index
+} WiiFstEntry;
+
+/**
+ * The file system of a partition. Parsing happens in two steps like the rest of the library, first the boot
+ * header is read to find out how big everything is, then the user backs the table with memory and it gets
+ * parsed into a flat entry array, a string pool, and a hash table keyed by full path so files can be found
+ * without walking the tree
+ */
+typedef struct WiiFst {
+    // Pulled out of the boot header at the start of the partition data
+    char game_id[7];
+    char title[65];
+    uint64_t dol_offset;  // Where the main executable starts in the partition data
+    uint64_t dol_size;    // How large the main executable is
+    uint64_t fst_offset;  // Where the file system table starts in the partition data
+    uint64_t fst_size;    // How large the raw file system table is
+    uint32_t entry_count;
+
+    // Backed by the user's memory once the table is parsed
+    WiiFstEntry* entries;
+    const char* strings;  // Names of all the entries, each null terminated
+    uint32_t strings_size;
+    uint32_t* hash_table;  // Entry index + 1 for every used bucket, 0 for empty ones
+    uint32_t hash_size;    // Always a power of two
+} WiiFst;
+
+/**
+ * One read queued on a batch. The batch owns pending and result until the request has been reaped, the rest is
+ * left as the caller set it
+ */
+typedef struct WbfsReadRequest {
+    uint64_t address;  // Disc local address to read from
+    uint64_t size;     // How many bytes to read
+    void* data;        // Where the bytes go
+    void* user;        // Never touched, for matching completions back up with whatever asked for them
+    int result;        // The wbfs_enum the read finished with, filled in once the request has completed
+    uint32_t pending;  // Pieces of the request still being read
+} WbfsReadRequest;
+
+/**
+ * A contiguous piece of the wbfs file that one request needs. A request is split into a piece per run of wbfs
+ * sectors it covers
+ */
+typedef struct WbfsBatchPiece {
+    uint64_t offset;           // Where the piece starts in the wbfs file
+    uint64_t size;             // Size of the piece in bytes
+    uint8_t* data;             // Where in the request's buffer the piece goes
+    WbfsReadRequest* request;  // Request the piece belongs to
+} WbfsBatchPiece;
+
+/**
+ * Pieces that follow straight on from each other in the wbfs file, read with a single vectored read
+ */
+typedef struct WbfsBatchSpan {
+    uint32_t first;       // First piece, once the pieces have been sorted
+    uint32_t count;       // How many pieces the span covers
+    uint64_t offset;      // Where the span starts in the wbfs file
+    uint64_t size;        // Total size of the pieces
+    uint64_t started_ns;  // When the span was handed to the kernel, used for the statistics
+} WbfsBatchSpan;
+
+/**
+ * The kernel side of an io_uring, set up with raw system calls so there's nothing extra to link. The pointers
+ * all point into the rings the kernel shares with us
+ */
+typedef struct WbfsBatchRing {
+    int fd;              // Ring file descriptor, -1 when the batch runs on threads
+    uint32_t entries;    // Submission slots
+    uint32_t in_flight;  // Spans handed to the kernel that haven't completed
+    void* sq;            // Submission ring mapping
+    void* cq;            // Completion ring mapping, the same as sq on kernels with a single mapping
+    void* sqes;          // Submission entries
+    size_t sq_size;
+    size_t cq_size;
+    size_t sqes_size;
+    uint32_t* sq_tail;
+    uint32_t* sq_mask;
+    uint32_t* sq_array;
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t* cq_mask;
+    void* cqes;
+} WbfsBatchRing;
+
+/**
+ * Asynchronous batched reads from a disc. Requests are queued up, then on submit they're split into pieces of
+ * the wbfs file, sorted by where they sit in the file and merged where they follow on from each other. On
+ * linux the merged reads are handed to the kernel through io_uring so the drive sees them all at once,
+ * everywhere else (or when io_uring isn't allowed) a small pool of threads works through them in file order.
+ * Completed requests are reaped one at a time or in groups. The memory is supplied by the user and the struct
+ * can't be moved while a batch is running
+ */
+typedef struct WbfsBatch {
+    WiiDisc* disc;          // Disc the requests read from
+    uint32_t capacity;      // How many pieces can be queued at once
+    uint32_t thread_count;  // Workers used when reads don't go through io_uring
+    WbfsBatchPiece* pieces;
+    WbfsBatchSpan* spans;
+    WbfsReadRequest** completed;  // Requests that have finished and not been reaped, in completion order
+    void* iovecs;                 // One per piece, only used with io_uring
+
+    uint32_t piece_count;
+    uint32_t span_count;
+    uint32_t next_span;      // Next span to hand out
+    uint32_t request_count;  // Requests queued since the batch was last idle
+    uint32_t completed_count;
+    uint32_t reaped_count;
+    int running;  // Set from submit until every request has been reaped
+
+    WbfsBatchRing ring;
+    WbfsMutex lock;
+    WbfsCond wake;      // Wakes the workers when spans are submitted
+    WbfsCond finished;  // Signalled whenever a request completes
+    WbfsThread threads[WBFS_MAX_THREADS];
+    uint32_t threads_started;  // Workers kept running for the life of the batch, 0 with io_uring
+    int stopping;
+} WbfsBatch;
+
+/**
+ * Where a file's data lives, both as a range of decrypted partition data and as the clusters that hold it
+ */
+typedef struct WiiFileRange {
+    uint64_t offset;         // Address in the decrypted partition data
+    uint64_t size;           // Size in bytes
+    uint64_t first_cluster;  // First cluster holding any of the file
+    uint64_t cluster_count;  // How many clusters the file touches
+} WiiFileRange;
+
 /*************************************************************************************************************
  * Enums for return codes
  *************************************************************************************************************/
@@ -101,6 +584,17 @@ typedef enum wbfs_enum {
     e_wbfs_invalid_handle,
     e_wbfs_invalid_disc_table,
     e_wbfs_failed_file_read,
+    e_wbfs_invalid_io,
+    e_wbfs_not_contiguous,
+    e_wbfs_invalid_partition,
+    e_wbfs_unsupported_key,
+    e_wbfs_invalid_fst,
+    e_wbfs_not_found,
+    e_wbfs_failed_file_write,
+    e_wbfs_invalid_sector_size,
+    e_wbfs_batch_full,
+    e_wbfs_batch_busy,
+    e_wbfs_out_of_space,
 } wbfs_enum;
 /*************************************************************************************************************
  * Functions that do a large portion of the work. None of these functions should ever allocate memory, this is
@@ -121,35 +615,131 @@ typedef enum wbfs_enum {
  */
 wbfs_enum wbfs_file_header_parse(Wbfs* wbfs_handle, WbfsFileHeader* wbfs_fh, FILE* fp);
 
+/**
+ * @brief Same as wbfs_file_header_parse, but all reads go through the I/O backend passed in instead of a file
+ * pointer. The backend is copied into the handle
+ * @returns error code, 0 on success
+ * @param wbfs_handle Handle to be filled with data from the wbfs file
+ * @param wbfs_fh Memory backing the file header
+ * @param io Backend to read the wbfs file through
+ */
+wbfs_enum wbfs_file_header_parse_io(Wbfs* wbfs_handle, WbfsFileHeader* wbfs_fh, const WbfsIo* io);
+
+/**
+ * @brief Same as wbfs_file_header_parse, but maps the entire wbfs file into memory first. Reads become copies
+ * out of the mapping and wbfs_disc_view can hand out pointers straight into the file. The page cache is shared
+ * between processes, so several tools looking at the same file only pay for it once. The mapping has to be
+ * released with wbfs_file_unmap
+ * @returns error code, 0 on success
+ * @param wbfs_handle Handle to be filled with data from the wbfs file
+ * @param wbfs_fh Memory backing the file header
+ * @param fp File Pointer to the WBFS, has to be in RB mode
+ */
+wbfs_enum wbfs_file_header_parse_mapped(Wbfs* wbfs_handle, WbfsFileHeader* wbfs_fh, FILE* fp);
+
+/**
+ * @brief Releases the mapping made by wbfs_file_header_parse_mapped, any views handed out become invalid
+ * @returns error code, 0 on success
+ * @param wbfs Pointer to the WBFS handle
+ */
+wbfs_enum wbfs_file_unmap(Wbfs* wbfs);
+
 /**
  * @brief Once the user has allocated space for the disc table to be read in, and the file pointer has been
- * properly been read, this will read in the disc table
+ * properly been read, this will read in the disc table and count how many discs are in it
  * @returns error code, 0 on success
  * @param wbfs Pointer to the WBFS handle
  */
 wbfs_enum wbfs_file_disc_table_parse(Wbfs* wbfs);
 
+/**
+ * @brief Works out where the disc info for a slot of the disc table starts, this is where a disc's header copy
+ * and sector table are kept
+ * @returns Offset into the wbfs file
+ * @param wbfs Pointer to the WBFS handle
+ * @param slot Slot in the disc table, used or not
+ */
+uint64_t wbfs_file_disc_info_offset(const Wbfs* wbfs, uint32_t slot);
+
 /**
  * @brief Once the disc table has been read, users can find the offset into the wbfs file that the disc starts
  * at. This is usally the first call made to a Wii disc structure, so fill in the inital set up as well
  * @returns error code, 0 on success
  * @param disc Pointer to the Wii Disc to init
  * @param wbfs Pointer to the WBFS handle
- * @param index index into the disc table to evaluate
+ * @param index Which disc to open, counting only the used slots of the disc table, up to wii_disc_count
+ */
+wbfs_enum wbfs_disc_get_offset(WiiDisc* disc, Wbfs* wbfs, uint32_t index);
+
+/**
+ * @brief Lists every disc in the wbfs file. The disc infos are read straight through in batches, so a drive
+ * holding hundreds of discs is listed with a handful of large reads rather than a seek per disc
+ * @returns error code, 0 on success
+ * @param wbfs Pointer to the WBFS handle, with the disc table parsed
+ * @param entries Room for wii_disc_count entries, filled in disc table order
+ * @param memory Working memory of wbfs_helper_catalog_size bytes
+ */
+wbfs_enum wbfs_file_catalog(Wbfs* wbfs, WbfsCatalogEntry* entries, void* memory);
+
+/**
+ * @brief Counts the free wbfs sectors in the free block map. The map is read from where libwbfs reads it and
+ * counted the same way, a whole 32 bit word at a time, so this is what other wbfs tools will see
+ * @returns error code, 0 on success
+ * @param wbfs Pointer to the WBFS handle
+ * @param memory Working memory of wbfs_helper_free_map_size(hd_sector_shift, wbfs_sector_count) bytes
+ * @param free_count Filled with how many wbfs sectors are free
+ */
+wbfs_enum wbfs_file_count_free(Wbfs* wbfs, void* memory, uint32_t* free_count);
+
+/**
+ * @brief Opens a plain disc image so it can be read with the same disc, partition and file system functions as
+ * a disc inside a wbfs file. The wbfs handle only carries the backend, it has no header so it can't be used
+ * with the wbfs file functions
+ * @returns error code, 0 on success
+ * @param disc Disc to set up
+ * @param wbfs Handle to hold the backend, has to live as long as the disc
+ * @param io Backend reading the disc image, copied into the handle
+ * @param size Size of the disc image in bytes
+ */
+wbfs_enum wbfs_disc_open_plain(WiiDisc* disc, Wbfs* wbfs, const WbfsIo* io, uint64_t size);
+
+/**
+ * @brief Streams through the sector table without keeping it, to find how many entries are in use and how many
+ * runs they make. Afterwards wbfs_helper_disc_sector_table_size and wbfs_helper_disc_extent_table_size give
+ * the exact memory the disc needs rather than the worst case for a dual layer disc
+ * @returns error code, 0 on success
+ * @param disc Wii disc that has been through wbfs_disc_get_offset
  */
-wbfs_enum wbfs_disc_get_offset(WiiDisc* disc, Wbfs* wbfs, uint8_t index);
+wbfs_enum wbfs_disc_measure_sector_table(WiiDisc* disc);
 
 /**
  * @brief Once space has been allocated for the disc table, users can then read in the sector look up table at
- * the top of the wii disc info
+ * the top of the wii disc info. If the user has also backed the extents pointer with memory, the run length
+ * extent map is built from the sector table here as well. Either can be backed on its own, a disc with only
+ * extents is the compact form and never holds the table. If the disc was measured first only the used part
+ * of the table is read, and the memory only has to be as large as the measured sizes.
+ *
+ * Calling this is optional, the first read of a disc that hasn't been parsed does it. Threads reading the
+ * same disc at once wait for one of them to finish loading it
  * @returns error code, 0 on success
  * @param pointer to the wii disc to be looked up
  */
 wbfs_enum wbfs_disc_parse_sector_table(WiiDisc* disc);
 
+/**
+ * @brief Checks if a wbfs sector of the disc is stored in the wbfs file, loading the sector table if it hasn't
+ * been already. Works the same whether the disc has the table, the extent map or both. A plain disc has no
+ * wbfs sectors, so this is always 0 for one
+ * @returns 1 if the sector is stored, 0 if it's a hole or the table couldn't be loaded
+ * @param disc Pointer to the Wii disc
+ * @param sector Wbfs sector local to the disc
+ */
+int wbfs_disc_sector_stored(WiiDisc* disc, uint32_t sector);
+
 /**
  * @brief Reads a buffer from the wii disc with the address being local to the start of the actual disc, as
- * well as searching the different wbfs sectors across the boundries of the buffers
+ * well as searching the different wbfs sectors across the boundries of the buffers. Sectors that are stored
+ * next to each other in the wbfs file are read with a single read
  * @returns error code, 0 on success
  * @param disc Pointer to the Wii disc to be read
  * @param data buffer allocated by the user to store the read contents
@@ -158,6 +748,32 @@ wbfs_enum wbfs_disc_parse_sector_table(WiiDisc* disc);
  */
 wbfs_enum wbfs_disc_read_buffer(WiiDisc* disc, void* data, uint64_t address, uint64_t size);
 
+/**
+ * @brief Gets a read only view of a range of the wii disc. When the wbfs is mapped into memory and the range
+ * sits inside one run of the wbfs file, the view points straight into the mapping and nothing is copied.
+ * Otherwise the range is read into the scratch buffer and the view points there instead
+ * @returns error code, 0 on success. e_wbfs_not_contiguous if a copy was needed but no scratch was given
+ * @param disc Pointer to the Wii disc to be read
+ * @param address The starting address to be read local to the start of the Wii disc
+ * @param size The amount of bytes in the view
+ * @param scratch Optional buffer of at least size bytes used when the range can't be viewed in place
+ * @param view Filled with a pointer to the start of the range
+ */
+wbfs_enum wbfs_disc_view(WiiDisc* disc, uint64_t address, uint64_t size, void* scratch, const void** view);
+
+/**
+ * @brief Works out where a disc address is stored in the wbfs file, and how many bytes after it are stored
+ * straight after it. This is what the disc reads use to split a range up into reads of the wbfs file
+ * @returns error code, 0 on success. e_wbfs_invalid_disc_table if the address isn't stored
+ * @param disc Pointer to the Wii disc
+ * @param address Wii disc local address to look up
+ * @param size How far the caller is interested in, the sector table isn't followed any further than this
+ * @param file_address Filled with the offset into the wbfs file
+ * @param run_left Filled with how many bytes from there on are contiguous in the wbfs file
+ */
+wbfs_enum wbfs_disc_locate_run(WiiDisc* disc, uint64_t address, uint64_t size, uint64_t* file_address,
+                               uint64_t* run_left);
+
 /**
  * @brief Locates the partition information which tells us where the partition tables located
  * @returns error code, 0 on success
@@ -177,29 +793,987 @@ wbfs_enum wbfs_disc_parse_partition_info(WiiDisc* disc, WiiDiscPartitionInfoEntr
 wbfs_enum wbfs_disc_parse_partition_table(WiiDisc* disc, WiiDiscPartitionTableEntry* table, uint64_t address);
 
 /*************************************************************************************************************
- * Helper functions that don't have a return type, do something simple
+ * Arena opens, everything needed to read a wbfs file laid out in one block of memory
  *************************************************************************************************************/
 
+// Leaves the sector tables out, discs only hold their extent maps. This is the compact form, reads work the
+// same but the table itself can't be looked at
+#define WBFS_OPEN_EXTENTS_ONLY (1u << 0)
+
 /**
- * WBFS stores the data as Big endian, most PCs are little endian, most PCs are little endian. Provide a
- * function that swaps the endianness of a 32 bit integer
- * @param d The data to be reversed
+ * @brief Sets up an arena over a block of memory, it can be empty to find out how large it needs to be
+ * @returns error code, 0 on success
+ * @param arena Arena to set up
+ * @param memory Block to hand out, the user frees it once the arena isn't used any more
+ * @param size Size of the block in bytes
  */
-void wbfs_helper_reverse_endian_32(uint32_t* d);
+wbfs_enum wbfs_arena_init(WbfsArena* arena, void* memory, size_t size);
 
-void wbfs_helper_reverse_endian_16(uint16_t* d);
+/**
+ * @brief Takes a piece of the arena, pieces are aligned for any of the library's structs
+ * @returns The piece, or null if there isn't room. needed is then set to how large the arena has to be
+ * @param arena Arena set up with wbfs_arena_init
+ * @param size Size of the piece in bytes
+ */
+void* wbfs_arena_alloc(WbfsArena* arena, size_t size);
 
 /**
- * @brief Fetches the wbfs disc table size, added as users might not know how large the header should be
- * @returns Size of the Wbfs disc table in bytes, most likely 500 or 0 on error
- * @param wbfs Valid Wbfs handle
+ * @brief Hands everything back to the arena. Anything opened in it can't be used afterwards, but nothing else
+ * has to be freed first
+ * @param arena Arena set up with wbfs_arena_init
  */
-size_t wbfs_helper_disc_table_size(Wbfs* wbfs);
+void wbfs_arena_reset(WbfsArena* arena);
 
 /**
- * brief Fetches the size in bytes of the
+ * @brief Opens a wbfs file in one call. The header, the disc table and every disc are read, and each disc is
+ * measured before anything else is placed so its sector table and extent map take exactly the room they need.
+ * Everything is put in the arena, so closing it is a wbfs_arena_reset. The backend stays the user's to close.
+ *
+ * If the arena is too small nothing is kept, needed is set and e_wbfs_out_of_space is returned. To size an
+ * arena up front use wbfs_file_measure_arena, an arena with that much room left always fits the file
+ * @returns error code, 0 on success
+ * @param file Filled with the opened file, which lives in the arena
+ * @param arena Arena set up with wbfs_arena_init, other things can be in it already
+ * @param io Backend to read the wbfs file through, copied into the handle
+ * @param flags WBFS_OPEN_ flags, 0 keeps both the sector tables and the extent maps
  */
-size_t wbfs_helper_sector_table_size(Wbfs* wbfs);
+wbfs_enum wbfs_file_open_arena(WbfsFile** file, WbfsArena* arena, const WbfsIo* io, uint32_t flags);
+
+/**
+ * @brief Works out exactly how much arena wbfs_file_open_arena needs for a file, in one pass and without any
+ * memory from the caller. The header, the disc table, the disc list and every disc's sector table and extent
+ * map are all counted, the disc table and sector tables are streamed through the stack rather than kept
+ * @returns error code, 0 on success
+ * @param io Backend to read the wbfs file through
+ * @param flags WBFS_OPEN_ flags the file will be opened with
+ * @param size Filled with the bytes an empty arena needs to open the file
+ */
+wbfs_enum wbfs_file_measure_arena(const WbfsIo* io, uint32_t flags, size_t* size);
+
+/*************************************************************************************************************
+ * Partitions, these read and decrypt the data stored inside a partition. Cluster reads are always whole
+ * clusters, partition reads are addressed by the decrypted data with the hashes stripped out
+ *************************************************************************************************************/
+
+/**
+ * @brief Reads the ticket and partition header at the start of a partition, and decrypts the title key with
+ * the common key so the clusters can be decrypted. If the ticket needs a key we don't have the offsets and
+ * sizes are still filled in, but the partition can't be read
+ * @returns error code, 0 on success
+ * @param partition Partition to fill in
+ * @param disc Pointer to the wii disc the partition is on
+ * @param address Wii disc local address of the partition, this is the offset in the partition table
+ */
+wbfs_enum wbfs_partition_open(WiiPartition* partition, WiiDisc* disc, uint64_t address);
+
+/**
+ * @brief Fetches how many clusters of data the partition holds
+ * @returns Cluster count, 0 on error
+ * @param partition Opened partition
+ */
+uint64_t wbfs_partition_cluster_count(const WiiPartition* partition);
+
+/**
+ * @brief Decrypts a single cluster. The output keeps the same layout, the first WII_CLUSTER_HASH_SIZE bytes
+ * are the hashes and the rest is the data. in and out can be the same buffer
+ * @returns error code, 0 on success
+ * @param partition Opened partition
+ * @param in WII_CLUSTER_SIZE bytes of encrypted cluster
+ * @param out WII_CLUSTER_SIZE bytes to decrypt into
+ */
+wbfs_enum wbfs_partition_decrypt_cluster(const WiiPartition* partition, const void* in, void* out);
+
+/**
+ * @brief Encrypts a single decrypted cluster, the reverse of wbfs_partition_decrypt_cluster. The hashes have
+ * to already match the data, nothing is worked out here. in and out can be the same buffer
+ * @returns error code, 0 on success
+ * @param partition Opened partition
+ * @param in WII_CLUSTER_SIZE bytes of decrypted cluster
+ * @param out WII_CLUSTER_SIZE bytes to encrypt into
+ */
+wbfs_enum wbfs_partition_encrypt_cluster(const WiiPartition* partition, const void* in, void* out);
+
+/**
+ * @brief Decrypts a batch of clusters that are next to each other in memory, spread across a number of
+ * threads. in and out can be the same buffer
+ * @returns error code, 0 on success
+ * @param partition Opened partition
+ * @param in count * WII_CLUSTER_SIZE bytes of encrypted clusters
+ * @param out count * WII_CLUSTER_SIZE bytes to decrypt into
+ * @param count How many clusters to decrypt
+ * @param thread_count How many threads to use, 0 uses every hardware thread
+ */
+wbfs_enum wbfs_partition_decrypt_clusters(const WiiPartition* partition, const void* in, void* out,
+                                          uint32_t count, uint32_t thread_count);
+
+/**
+ * @brief Reads a run of clusters from the disc with a single read and decrypts them in place
+ * @returns error code, 0 on success
+ * @param partition Opened partition
+ * @param data count * WII_CLUSTER_SIZE bytes to read into
+ * @param cluster Index of the first cluster
+ * @param count How many clusters to read
+ * @param thread_count How many threads to decrypt with, 0 uses every hardware thread
+ */
+wbfs_enum wbfs_partition_read_clusters(const WiiPartition* partition, void* data, uint64_t cluster,
+                                       uint32_t count, uint32_t thread_count);
+
+/**
+ * @brief Reads decrypted partition data. The address is into the data alone, as if the hashes were never
+ * there, which is how everything inside the partition refers to itself. Only the AES blocks needed for the
+ * range are read and decrypted
+ * @returns error code, 0 on success
+ * @param partition Opened partition
+ * @param data buffer allocated by the user to store the read contents
+ * @param address Address into the decrypted partition data
+ * @param size The amount of bytes to read
+ */
+wbfs_enum wbfs_partition_read(const WiiPartition* partition, void* data, uint64_t address, uint64_t size);
+
+/*************************************************************************************************************
+ * Verification, checking the partition data against its hash tree. Each cluster's hash block has a SHA-1 of
+ * every 0x400 bytes of its data (H0), a hash of the H0 table of each cluster in its subgroup of 8 (H1), and a
+ * hash of the H1 table of each subgroup in its group of 8 (H2). The H3 table holds a hash of every group's H2
+ * table, and the TMD holds the hash of the H3 table
+ *************************************************************************************************************/
+
+// What went wrong with a cluster, a status of 0 means the cluster is good
+#define WBFS_VERIFY_H0 (1u << 0)          // A block of data doesn't match its H0 hash
+#define WBFS_VERIFY_H1 (1u << 1)          // The H0 table doesn't match its H1 hash
+#define WBFS_VERIFY_H2 (1u << 2)          // The H1 table doesn't match its H2 hash
+#define WBFS_VERIFY_H3 (1u << 3)          // The H2 table doesn't match its H3 hash
+#define WBFS_VERIFY_UNREADABLE (1u << 4)  // Couldn't be read, wbfs files leave out clusters nothing uses
+
+/**
+ * @brief Checks every cluster of a partition against the hash tree. Clusters are read in large batches, while
+ * one batch is decrypted and hashed across the worker threads the next one is being read. One reader thread
+ * and one set of workers are started for the whole partition
+ * @returns error code, 0 on success even if clusters fail, the report says how they did
+ * @param partition Opened partition
+ * @param cluster_status Optional, one byte per cluster that's filled in with WBFS_VERIFY_ flags
+ * @param report Totals to fill in
+ * @param memory Working memory of wbfs_helper_verify_size bytes
+ * @param thread_count How many threads to check with, 0 uses every hardware thread
+ */
+wbfs_enum wbfs_partition_verify(const WiiPartition* partition, uint8_t* cluster_status,
+                                WbfsVerifyReport* report, void* memory, uint32_t thread_count);
+
+/**
+ * @brief Reads a partition's H3 table and checks it against the hash the TMD holds for it. This is the first
+ * half of wbfs_partition_verify, for callers that schedule the clusters themselves
+ * @returns error code, 0 on success even if the table doesn't match
+ * @param partition Opened partition
+ * @param h3 WII_H3_TABLE_SIZE bytes to read the table into
+ * @param h3_valid Set to 1 if the table matches the TMD, 0 if it doesn't
+ */
+wbfs_enum wbfs_partition_read_h3(const WiiPartition* partition, void* h3, uint32_t* h3_valid);
+
+/**
+ * @brief Checks a run of clusters the caller has already read against the hash tree, on the calling thread.
+ * Together with wbfs_partition_read_h3 this lets clusters from many partitions be spread over one pool of
+ * threads, with the reads done however the caller likes
+ * @returns error code, 0 on success even if clusters fail
+ * @param partition Opened partition
+ * @param h3 The partition's H3 table from wbfs_partition_read_h3
+ * @param first_cluster Index of the first cluster in the run
+ * @param count How many clusters there are
+ * @param clusters count * WII_CLUSTER_SIZE bytes of encrypted clusters, they're decrypted in place
+ * @param cluster_status count bytes, clusters already marked WBFS_VERIFY_UNREADABLE are skipped and the rest
+ * are filled in with WBFS_VERIFY_ flags
+ */
+wbfs_enum wbfs_partition_check_clusters(const WiiPartition* partition, const void* h3, uint64_t first_cluster,
+                                        uint32_t count, void* clusters, uint8_t* cluster_status);
+
+/*************************************************************************************************************
+ * Repacking, writing changed data back into a partition. Everything above a changed cluster in the hash tree
+ * is worked out again, so only the H3 groups of 64 clusters that were patched get rewritten along with the H3
+ * table and the hash of it in the TMD. The TMD's signature isn't redone, so it only passes on a console or
+ * emulator that doesn't check it
+ *************************************************************************************************************/
+
+/**
+ * @brief Patches a partition's decrypted data and writes every H3 group a patch lands in back out, decrypted,
+ * patched, hashed and encrypted again across the worker threads while the next group is read. The output is
+ * addressed like the disc, so it can be a disc image already holding the disc (like one from
+ * wbfs_disc_write_iso), the disc's own backend to patch it in place, or a disc inside a wbfs file through
+ * wbfs_io_init_disc. Clusters that aren't stored are left as they are, patches can't land in them
+ * @returns error code, 0 on success. e_wbfs_invalid_partition if a patch runs past the end of the data,
+ * e_wbfs_invalid_disc_table if a patch lands in a cluster that isn't stored, nothing is written in either case
+ * @param partition Opened partition to read the current data from
+ * @param out Backend to write the changed groups, the H3 table and the TMD hash through, needs write_at
+ * @param patches Ranges to change, they can come in any order but shouldn't overlap
+ * @param patch_count How many patches there are
+ * @param memory Working memory of wbfs_helper_repack_size bytes
+ * @param thread_count How many threads to hash and encrypt with, 0 uses every hardware thread
+ */
+wbfs_enum wbfs_partition_repack(const WiiPartition* partition, WbfsIo* out, const WbfsRepackPatch* patches,
+                                uint32_t patch_count, void* memory, uint32_t thread_count);
+
+/*************************************************************************************************************
+ * File system table, finding files inside a partition
+ *************************************************************************************************************/
+
+/**
+ * @brief Reads the boot header and main executable header at the start of the partition data. This fills in
+ * where the file system table is and how many entries it has, so the user can back it with memory
+ * @returns error code, 0 on success
+ * @param fst File system table to fill in
+ * @param partition Opened partition
+ */
+wbfs_enum wbfs_fst_parse_header(WiiFst* fst, const WiiPartition* partition);
+
+/**
+ * @brief Reads the file system table into the user's memory and builds the path index
+ * @returns error code, 0 on success
+ * @param fst File system table with the header parsed
+ * @param partition Opened partition
+ * @param memory At least wbfs_helper_fst_size bytes, has to outlive the table
+ */
+wbfs_enum wbfs_fst_parse(WiiFst* fst, const WiiPartition* partition, void* memory);
+
+/**
+ * @brief Finds an entry by its full path, for example "Stage/golf/hole1.arc". A leading or trailing slash is
+ * ignored, and an empty path is the root directory
+ * @returns error code, 0 on success, e_wbfs_not_found if there is no such entry
+ * @param fst Parsed file system table
+ * @param path Path to look up, separated by forward slashes
+ * @param index Filled with the index of the entry
+ */
+wbfs_enum wbfs_fst_lookup(const WiiFst* fst, const char* path, uint32_t* index);
+
+/**
+ * @brief Lists a directory, the first child is found with wbfs_fst_first_child and the rest by following
+ * wbfs_fst_next_sibling until it returns 0
+ * @returns Index of the first entry inside the directory, 0 if it is empty or not a directory
+ * @param fst Parsed file system table
+ * @param directory Index of the directory
+ */
+uint32_t wbfs_fst_first_child(const WiiFst* fst, uint32_t directory);
+
+/**
+ * @returns Index of the next entry in the same directory, 0 if there are no more
+ * @param fst Parsed file system table
+ * @param index Index of the current entry
+ */
+uint32_t wbfs_fst_next_sibling(const WiiFst* fst, uint32_t index);
+
+/**
+ * @returns The name of an entry, without the directories above it
+ * @param fst Parsed file system table
+ * @param index Index of the entry
+ */
+const char* wbfs_fst_name(const WiiFst* fst, uint32_t index);
+
+/**
+ * @brief Writes the full path of an entry into a buffer, separated by forward slashes
+ * @returns error code, 0 on success
+ * @param fst Parsed file system table
+ * @param index Index of the entry
+ * @param path Buffer to write the null terminated path into
+ * @param path_size Size of the buffer, e_wbfs_segfault is returned if it is too small
+ */
+wbfs_enum wbfs_fst_path(const WiiFst* fst, uint32_t index, char* path, size_t path_size);
+
+/**
+ * @brief Works out where a file's data lives in the partition
+ * @returns error code, 0 on success
+ * @param fst Parsed file system table
+ * @param index Index of a file entry
+ * @param range Filled with the range of the file
+ */
+wbfs_enum wbfs_fst_file_range(const WiiFst* fst, uint32_t index, WiiFileRange* range);
+
+/*************************************************************************************************************
+ * Batched reads, queueing many disc reads up so they can be sorted, merged and handed over together
+ *************************************************************************************************************/
+
+// Don't use io_uring even where it's available, every read goes through the backend on the worker threads
+#define WBFS_BATCH_NO_URING (1u << 0)
+
+/**
+ * @brief Sets up a batch reading from a disc. On linux an io_uring is created when the disc is read through
+ * the built in file backend, otherwise a pool of worker threads is started. Either way the batch has to be
+ * torn down with wbfs_batch_destroy
+ * @returns error code, 0 on success
+ * @param batch Batch to set up
+ * @param disc Disc with the sector table parsed, has to outlive the batch
+ * @param memory Backing memory of at least wbfs_helper_batch_size(capacity) bytes
+ * @param capacity How many pieces can be queued at once, a request needs a piece per run of sectors it covers
+ * @param thread_count Workers to use when the batch doesn't run on io_uring, 0 uses every hardware thread
+ * @param flags WBFS_BATCH_ flags
+ */
+wbfs_enum wbfs_batch_init(WbfsBatch* batch, WiiDisc* disc, void* memory, uint32_t capacity,
+                          uint32_t thread_count, uint32_t flags);
+
+/**
+ * @brief Queues a read. Nothing is read until the batch is submitted, and the request has to stay where it is
+ * until it has been reaped
+ * @returns error code, 0 on success. e_wbfs_batch_full if there isn't room for every piece of the request,
+ * e_wbfs_batch_busy if the batch has been submitted and not fully reaped yet
+ * @param batch Batch set up with wbfs_batch_init
+ * @param request Read to queue, with the address, size and data filled in
+ */
+wbfs_enum wbfs_batch_add(WbfsBatch* batch, WbfsReadRequest* request);
+
+/**
+ * @brief Sorts and merges everything queued and starts reading it, this returns as soon as the reads are on
+ * their way
+ * @returns error code, 0 on success. e_wbfs_batch_busy if the batch is already running
+ * @param batch Batch set up with wbfs_batch_init
+ */
+wbfs_enum wbfs_batch_submit(WbfsBatch* batch);
+
+/**
+ * @brief Collects requests that have finished since the last call, each one has its result filled in. Once
+ * every submitted request has been reaped the batch is idle and more can be queued. Only one thread should
+ * reap a batch at a time
+ * @returns How many requests were written to completed
+ * @param batch Batch that has been submitted
+ * @param completed Filled with the finished requests
+ * @param max_count Room in completed
+ * @param wait Non zero to block until at least one request finishes, unless there's nothing left to wait for
+ */
+uint32_t wbfs_batch_reap(WbfsBatch* batch, WbfsReadRequest** completed, uint32_t max_count, int wait);
+
+/**
+ * @brief Waits for anything still running, then closes the ring or stops the workers and releases the locks.
+ * The backing memory is left for the user to free
+ * @param batch Batch set up with wbfs_batch_init
+ */
+void wbfs_batch_destroy(WbfsBatch* batch);
+
+/**
+ * @brief Reads every request in one go through a batch, for when there's nothing to do while waiting
+ * @returns error code, 0 if every request was read. Otherwise the first error, each request has its own result
+ * @param disc Disc to read from, its sector table is loaded first if it hasn't been
+ * @param requests Reads to make, all of them are queued at once
+ * @param count How many requests there are
+ * @param memory Backing memory of at least wbfs_helper_batch_size(capacity) bytes
+ * @param capacity Pieces the memory has room for, the requests need to fit in it
+ * @param thread_count Workers to use when the batch doesn't run on io_uring, 0 uses every hardware thread
+ */
+wbfs_enum wbfs_disc_read_batch(WiiDisc* disc, WbfsReadRequest* requests, uint32_t count, void* memory,
+                               uint32_t capacity, uint32_t thread_count);
+
+/*************************************************************************************************************
+ * Cluster cache, a bounded cache of decrypted clusters with sequential read ahead
+ *************************************************************************************************************/
+
+/**
+ * @brief Sets up a cluster cache over an opened partition. If read_ahead isn't 0 a background thread is
+ * started to prefetch clusters, so the cache has to be torn down with wbfs_cache_destroy
+ * @returns error code, 0 on success
+ * @param cache Cache to set up
+ * @param partition Opened partition, has to outlive the cache
+ * @param memory Backing memory of at least wbfs_helper_cluster_cache_size(capacity) bytes
+ * @param capacity How many clusters the cache holds
+ * @param read_ahead How many clusters to prefetch on sequential reads, this is capped at half the capacity
+ */
+wbfs_enum wbfs_cache_init(WbfsClusterCache* cache, const WiiPartition* partition, void* memory,
+                          uint32_t capacity, uint32_t read_ahead);
+
+/**
+ * @brief Reads decrypted partition data through the cache, the same as wbfs_partition_read. Safe to call from
+ * several threads at once
+ * @returns error code, 0 on success
+ * @param cache Cache set up with wbfs_cache_init
+ * @param data buffer allocated by the user to store the read contents
+ * @param address Address into the decrypted partition data
+ * @param size The amount of bytes to read
+ */
+wbfs_enum wbfs_cache_read(WbfsClusterCache* cache, void* data, uint64_t address, uint64_t size);
+
+/**
+ * @brief Stops the prefetch thread and releases the locks, the backing memory is left for the user to free
+ * @param cache Cache set up with wbfs_cache_init
+ */
+void wbfs_cache_destroy(WbfsClusterCache* cache);
+
+/*************************************************************************************************************
+ * Conversion, rebuilding a full disc image out of a disc stored in the wbfs file
+ *************************************************************************************************************/
+
+// Overlap reading the next chunk with writing the last one, the buffer gets split in two to do this
+#define WBFS_CONVERT_ASYNC (1u << 0)
+
+/**
+ * @brief Works out how large the plain disc image is, single layer unless anything is stored past the end of
+ * the first layer. For a disc opened with wbfs_disc_open_plain this is the size of the image
+ * @returns Size of the disc image in bytes, 0 on error
+ * @param disc Disc to size, its sector table is loaded first if it hasn't been
+ */
+uint64_t wbfs_disc_iso_size(WiiDisc* disc);
+
+/**
+ * @brief Writes the disc out as a plain disc image. Sectors the wbfs file doesn't store are never written,
+ * they're left as holes in the output so a sparse file system doesn't have to store them. The output is cut
+ * back to nothing first so no old data shows through the holes. Every write is a whole number of wbfs sectors
+ * at a wbfs sector aligned offset, so a buffer aligned to the sector size can be written straight through
+ * @returns error code, 0 on success
+ * @param disc Disc to write out, its sector table is loaded first if it hasn't been
+ * @param out Backend to write the image through, needs write_at and set_size
+ * @param buffer Staging memory, needs to hold at least one wbfs sector, or two with WBFS_CONVERT_ASYNC
+ * @param buffer_size Size of the staging memory in bytes, larger buffers mean fewer larger writes
+ * @param flags WBFS_CONVERT_ flags
+ */
+wbfs_enum wbfs_disc_write_iso(WiiDisc* disc, WbfsIo* out, void* buffer, uint64_t buffer_size, uint32_t flags);
+
+// Run the CRC32, MD5 and SHA-1 on threads of their own while the calling thread reads, the buffer gets split
+// in two to do this
+#define WBFS_CHECKSUM_ASYNC (1u << 0)
+
+/**
+ * @brief Works out the CRC32, MD5 and SHA-1 of the plain disc image in a single pass without writing it out.
+ * The image is rebuilt a chunk at a time the same way wbfs_disc_write_iso writes it, with zeros for every
+ * sector the wbfs file doesn't store, and each chunk is fed to all three digests before the next one is read
+ * @returns error code, 0 on success
+ * @param disc Disc to hash, a disc in a wbfs file or a plain image opened with wbfs_disc_open_plain
+ * @param checksum Filled in with the size of the image and its checksums
+ * @param buffer Staging memory, needs to hold at least 64 bytes, or 128 with WBFS_CHECKSUM_ASYNC
+ * @param buffer_size Size of the staging memory in bytes, larger buffers mean fewer larger reads
+ * @param flags WBFS_CHECKSUM_ flags
+ */
+wbfs_enum wbfs_disc_checksum(WiiDisc* disc, WbfsDiscChecksum* checksum, void* buffer, uint64_t buffer_size,
+                             uint32_t flags);
+
+/*************************************************************************************************************
+ * Building, writing a disc out as a new single disc wbfs file
+ *************************************************************************************************************/
+
+// 2MB wbfs sectors, what most tools use for a disc sized wbfs file
+#define WBFS_DEFAULT_SECTOR_SHIFT (21)
+
+/**
+ * @brief Writes a disc out as a wbfs file holding just that disc. Only the wbfs sectors that hold something
+ * are stored, which is worked out from the partition tables and each partition's file system. The stored
+ * sectors are given file sectors in disc order, so the source is read and the output written in one forward
+ * pass. The output is cut back to nothing first so the unused parts of the header sector are left as holes
+ * @returns error code, 0 on success
+ * @param disc Disc to write out, a plain image opened with wbfs_disc_open_plain or a disc in another wbfs file
+ * @param out Backend to write the wbfs file through, needs write_at and set_size. If it has read_at as well
+ * the free block map is read back the way libwbfs reads it, and e_wbfs_failed_file_write returned if it's
+ * wrong
+ * @param wbfs_sector_shift 2 ^ shift is the size of the wbfs sectors, has to be large enough for the sector
+ * table to fit in 16 bits
+ * @param memory Working memory of wbfs_helper_build_size bytes
+ */
+wbfs_enum wbfs_build_from_disc(WiiDisc* disc, WbfsIo* out, uint8_t wbfs_sector_shift, void* memory);
+
+/**
+ * @brief Rewrites a whole wbfs file with every disc scrubbed the same way wbfs_build_from_disc does, keeping
+ * only the sectors the partition tables and file systems reference. The discs are packed into the first slots
+ * of the disc table and their sectors laid out one disc after another in disc order, so the output has no
+ * gaps and reads front to back. The sector sizes and capacity are kept, so it takes as many discs as before
+ * @returns error code, 0 on success. e_wbfs_out_of_space if the discs somehow don't fit any more
+ * @param wbfs Pointer to the WBFS handle to compact, with the disc table parsed
+ * @param out Backend to write the new wbfs file through, needs write_at and set_size. It can't be the source
+ * @param memory Working memory of wbfs_helper_compact_size bytes
+ */
+wbfs_enum wbfs_file_compact(Wbfs* wbfs, WbfsIo* out, void* memory);
+
+/*************************************************************************************************************
+ * Library index, a cache of what's in a collection of wbfs files so they don't all have to be opened again
+ * just to be listed. Each file gets a flat record keyed by its path, size and modification time, holding the
+ * header fields and every disc's id, title, partitions and optionally its extent map. The records are
+ * written into a single index file, any that are still current can be carried over when it's rewritten
+ *************************************************************************************************************/
+
+// Also keep each disc's extent map in the record
+#define WBFS_INDEX_EXTENTS (1u << 0)
+
+/**
+ * @brief Builds the record for a wbfs file by opening every disc in it
+ * @returns error code, 0 on success
+ * @param wbfs Pointer to the WBFS handle, with the disc table parsed
+ * @param key What the record will be looked up by, the path is copied into the record
+ * @param flags WBFS_INDEX_ flags
+ * @param memory Working memory of wbfs_helper_index_build_size bytes
+ * @param record Space for the record, wbfs_helper_index_record_size bytes is always enough
+ */
+wbfs_enum wbfs_index_record_build(Wbfs* wbfs, const WbfsIndexKey* key, uint32_t flags, void* memory,
+                                  void* record);
+
+/**
+ * @returns How many bytes of the record are used, 0 on error
+ * @param record Record built with wbfs_index_record_build or found in an index
+ */
+uint32_t wbfs_index_record_size(const void* record);
+
+/**
+ * @brief Decodes the file level fields of a record
+ * @returns error code, 0 on success
+ * @param record Record to decode
+ * @param file Filled in with the fields, the path points into the record
+ */
+wbfs_enum wbfs_index_record_file(const void* record, WbfsIndexFile* file);
+
+/**
+ * @brief Decodes one disc of a record
+ * @returns error code, 0 on success
+ * @param record Record to decode
+ * @param index Which disc, up to the record's disc count
+ * @param disc Filled in with the disc's summary and partitions
+ * @param extents Optional, room for the disc's extent_count extents, call without it first to find the count
+ */
+wbfs_enum wbfs_index_record_disc(const void* record, uint32_t index, WbfsIndexDisc* disc, WbfsExtent* extents);
+
+/**
+ * @brief Writes an index file out of a set of records. The array of records is sorted by path in place
+ * @returns error code, 0 on success
+ * @param out Backend to write the index through, needs write_at and set_size
+ * @param records The records to write, these can point into an already loaded index
+ * @param count How many records there are
+ */
+wbfs_enum wbfs_index_write(WbfsIo* out, const void** records, uint32_t count);
+
+/**
+ * @brief Checks over an index file that's been loaded into memory. Every field of every record is checked
+ * to fit inside its record, so a corrupt or truncated file is turned away here rather than read out of bounds
+ * later
+ * @returns error code, 0 on success, e_wbfs_not_found if the data isn't an index this version can read
+ * @param index Index to set up
+ * @param data Contents of the index file, has to outlive the index
+ * @param size Size of the contents in bytes
+ */
+wbfs_enum wbfs_index_open(WbfsIndex* index, const void* data, uint64_t size);
+
+/**
+ * @returns The record at a position in the index, they're in path order. Null if out of range
+ * @param index Opened index
+ * @param i Position of the record
+ */
+const void* wbfs_index_record(const WbfsIndex* index, uint32_t i);
+
+/**
+ * @brief Looks up the record for a file with a binary search over the paths
+ * @returns error code, 0 on success, e_wbfs_not_found if there's no record or the file has changed since
+ * @param index Opened index
+ * @param key Path, size and modification time of the file as it is now
+ * @param record Filled with a pointer to the record inside the index
+ */
+wbfs_enum wbfs_index_find(const WbfsIndex* index, const WbfsIndexKey* key, const void** record);
+
+/*************************************************************************************************************
+ * AES, the partitions are all AES-128-CBC. When the cpu supports AES-NI that gets used, otherwise it falls
+ * back to a portable implementation
+ *************************************************************************************************************/
+
+/**
+ * @brief Expands an AES-128 key for both encryption and decryption
+ * @param key Round keys to fill in
+ * @param aes_key 16 byte key
+ */
+void wbfs_aes_set_key(WbfsAesKey* key, const uint8_t aes_key[16]);
+
+/**
+ * @brief AES-128-CBC decrypts a buffer, the size has to be a multiple of 16. in and out can be the same buffer
+ */
+void wbfs_aes_cbc_decrypt(const WbfsAesKey* key, const uint8_t iv[16], const void* in, void* out, size_t size);
+
+/**
+ * @brief AES-128-CBC encrypts a buffer, the size has to be a multiple of 16. in and out can be the same buffer
+ */
+void wbfs_aes_cbc_encrypt(const WbfsAesKey* key, const uint8_t iv[16], const void* in, void* out, size_t size);
+
+/**
+ * @brief Reports if the hardware AES path is being used
+ * @returns 1 if AES-NI is in use, 0 for the portable path
+ */
+int wbfs_aes_hardware_accelerated(void);
+
+/*************************************************************************************************************
+ * SHA-1, used by the partition hash tree. The SHA extensions are used when the cpu has them
+ *************************************************************************************************************/
+
+void wbfs_sha1_init(WbfsSha1* sha1);
+void wbfs_sha1_update(WbfsSha1* sha1, const void* data, size_t size);
+void wbfs_sha1_final(WbfsSha1* sha1, uint8_t digest[20]);
+
+/**
+ * @brief Hashes a buffer in one go
+ */
+void wbfs_sha1(const void* data, size_t size, uint8_t digest[20]);
+
+/**
+ * @brief Reports if the SHA extensions are being used
+ * @returns 1 if the SHA extensions are in use, 0 for the portable path
+ */
+int wbfs_sha1_hardware_accelerated(void);
+
+/*************************************************************************************************************
+ * CRC32 and MD5, only used to match discs against the dump databases
+ *************************************************************************************************************/
+
+/**
+ * @brief Carries a CRC32 on over more data, the same CRC32 zip uses
+ * @returns The CRC32 of everything so far
+ * @param crc 0 to start, or the CRC32 of everything before this data
+ * @param data Data to add
+ * @param size Size of the data in bytes
+ */
+uint32_t wbfs_crc32(uint32_t crc, const void* data, size_t size);
+
+void wbfs_md5_init(WbfsMd5* md5);
+void wbfs_md5_update(WbfsMd5* md5, const void* data, size_t size);
+void wbfs_md5_final(WbfsMd5* md5, uint8_t digest[16]);
+
+/**
+ * @brief Hashes a buffer in one go
+ */
+void wbfs_md5(const void* data, size_t size, uint8_t digest[16]);
+
+/*************************************************************************************************************
+ * I/O backends
+ *************************************************************************************************************/
+
+/**
+ * @brief Sets up the built in positional read backend on the file descriptor behind a file pointer. Reads use
+ * pread (or ReadFile with an offset on windows), so any number of threads can read through the backend at once
+ * without touching the FILE* position. Writes work the same way with pwrite, they only succeed if the file
+ * was opened for writing
+ * @returns error code, 0 on success
+ * @param io Backend to initialise
+ * @param fp File Pointer to the file, has to be opened in binary mode
+ */
+wbfs_enum wbfs_io_init_file(WbfsIo* io, FILE* fp);
+
+/**
+ * @brief Maps the whole file behind the file pointer into memory and sets up a backend that reads out of the
+ * mapping
+ * @returns error code, 0 on success
+ * @param io Backend to initialise
+ * @param fp File Pointer to the WBFS, has to be in RB mode
+ */
+wbfs_enum wbfs_io_init_mapped(WbfsIo* io, FILE* fp);
+
+/**
+ * @brief Releases the memory mapping held by a backend set up with wbfs_io_init_mapped
+ * @returns error code, 0 on success
+ * @param io Backend to release
+ */
+wbfs_enum wbfs_io_unmap(WbfsIo* io);
+
+/**
+ * @brief Sets up a read only backend over a wbfs file that has been split into pieces. The pieces are found
+ * from the path of the first one, which has to end in .wbfs, and are read as one file with positional reads.
+ * A file that was never split works as well, it's just one piece
+ * @returns error code, 0 on success. e_wbfs_invalid_io if the first piece can't be found or the pieces don't
+ * line up
+ * @param io Backend to initialise
+ * @param split Where the pieces are kept track of, has to live as long as the backend
+ * @param path Path of the first piece
+ */
+wbfs_enum wbfs_io_init_split(WbfsIo* io, WbfsSplitFile* split, const char* path);
+
+/**
+ * @brief Closes every piece a split backend opened
+ * @returns error code, 0 on success
+ * @param io Backend set up with wbfs_io_init_split
+ */
+wbfs_enum wbfs_io_close_split(WbfsIo* io);
+
+/**
+ * @brief Sets up a backend over one disc, addressed as if it were a plain disc image. Reads go through
+ * wbfs_disc_read_buffer, and writes are split up over the wbfs sectors holding the range and written through
+ * the backend of the disc's Wbfs handle, which needs write_at. Writes can only land in sectors the disc stores
+ * @returns error code, 0 on success
+ * @param io Backend to set up
+ * @param disc Disc to read and write, has to outlive the backend
+ */
+wbfs_enum wbfs_io_init_disc(WbfsIo* io, WiiDisc* disc);
+
+/**
+ * @brief Checks if a backend reads straight from file descriptors (or HANDLEs) that can be handed to the
+ * operating system's own asynchronous reads, which is the case for the file and split backends
+ * @returns 1 if it is, 0 for mapped and custom backends without locate
+ * @param io Backend to check
+ */
+int wbfs_io_is_file(const WbfsIo* io);
+
+/*************************************************************************************************************
+ * Statistics, counting what the read path does. The read path only reports into attached counters when the
+ * library is built with WBFS_STATS, so they cost nothing in a normal build
+ *************************************************************************************************************/
+
+/**
+ * @brief Attaches a set of counters to a handle, every disc, partition and cache on the handle reports into
+ * them. Attach after the header has been parsed, parsing clears the handle
+ * @returns error code, 0 on success
+ * @param wbfs Handle to count reads for
+ * @param stats Counters to report into, null detaches them
+ */
+wbfs_enum wbfs_stats_attach(Wbfs* wbfs, WbfsStats* stats);
+
+/**
+ * @brief Zeros the counters, the trace hook is kept
+ * @param stats Counters to clear
+ */
+void wbfs_stats_reset(WbfsStats* stats);
+
+/**
+ * @brief Counts one physical read. The library calls this for every read it makes, custom code reading
+ * through the handle's backend can call it too
+ * @param stats Counters to report into, can be null
+ * @param offset Where the read started
+ * @param size How many bytes were asked for
+ * @param nanoseconds How long the read took
+ * @param result What the backend returned
+ */
+void wbfs_stats_record_read(WbfsStats* stats, uint64_t offset, uint64_t size, uint64_t nanoseconds,
+                            int result);
+
+/**
+ * @brief Reads a range of the wbfs file through the handle's backend, timing it and counting it into the
+ * attached counters when built with WBFS_STATS. Every read the library makes goes through here
+ * @returns error code, 0 on success
+ * @param wbfs Handle to read through
+ * @param data Where to put the bytes
+ * @param offset Where in the wbfs file to start
+ * @param size How many bytes to read
+ */
+wbfs_enum wbfs_stats_read_at(Wbfs* wbfs, void* data, uint64_t offset, uint64_t size);
+
+/**
+ * @brief Prints a summary of the counters, with the averages and the latency histogram
+ * @param stats Counters to print
+ * @param out Where to print them
+ */
+void wbfs_stats_dump(const WbfsStats* stats, FILE* out);
+
+/*************************************************************************************************************
+ * Helper functions that don't have a return type, do something simple
+ *************************************************************************************************************/
+
+/**
+ * WBFS stores the data as Big endian, most PCs are little endian, most PCs are little endian. Provide a
+ * function that swaps the endianness of a 32 bit integer
+ * @param d The data to be reversed
+ */
+void wbfs_helper_reverse_endian_32(uint32_t* d);
+
+void wbfs_helper_reverse_endian_16(uint16_t* d);
+
+/**
+ * Reads a big endian value straight out of raw bytes, for when the data is sitting in a buffer rather than a
+ * struct
+ * @param p Pointer to the first byte
+ */
+uint32_t wbfs_helper_read_be32(const void* p);
+
+/**
+ * @brief Reads a big endian 16 bit value straight out of raw bytes
+ * @returns The value in host order
+ * @param p Pointer to the first byte, needs no particular alignment
+ */
+uint16_t wbfs_helper_read_be16(const void* p);
+
+/**
+ * @brief Reads a big endian 64 bit value straight out of raw bytes
+ * @returns The value in host order
+ * @param p Pointer to the first byte, needs no particular alignment
+ */
+uint64_t wbfs_helper_read_be64(const void* p);
+
+/**
+ * @brief Decodes an array of big endian 16 bit values into host order, a vector at a time where the cpu
+ * allows. The output can be the same buffer as the input to decode in place, but the two can't partly overlap
+ * @param out Where the decoded values go
+ * @param in Raw big endian bytes, needs no particular alignment
+ * @param count How many values to decode
+ */
+void wbfs_helper_decode_be16(uint16_t* out, const void* in, size_t count);
+
+/**
+ * @brief Decodes an array of big endian 32 bit values into host order, with the same rules as
+ * wbfs_helper_decode_be16
+ * @param out Where the decoded values go
+ * @param in Raw big endian bytes, needs no particular alignment
+ * @param count How many values to decode
+ */
+void wbfs_helper_decode_be32(uint32_t* out, const void* in, size_t count);
+
+/**
+ * @brief Decodes an array of big endian 64 bit values into host order, with the same rules as
+ * wbfs_helper_decode_be16
+ * @param out Where the decoded values go
+ * @param in Raw big endian bytes, needs no particular alignment
+ * @param count How many values to decode
+ */
+void wbfs_helper_decode_be64(uint64_t* out, const void* in, size_t count);
+
+/**
+ * @brief Encodes an array of host order 16 bit values as big endian, the reverse of wbfs_helper_decode_be16
+ * with the same rules about overlapping
+ * @param out Where the big endian bytes go, needs no particular alignment
+ * @param in Values to encode
+ * @param count How many values to encode
+ */
+void wbfs_helper_encode_be16(void* out, const uint16_t* in, size_t count);
+
+/**
+ * @brief Encodes an array of host order 32 bit values as big endian, the reverse of wbfs_helper_decode_be32
+ * @param out Where the big endian bytes go, needs no particular alignment
+ * @param in Values to encode
+ * @param count How many values to encode
+ */
+void wbfs_helper_encode_be32(void* out, const uint32_t* in, size_t count);
+
+/**
+ * @brief Encodes an array of host order 64 bit values as big endian, the reverse of wbfs_helper_decode_be64
+ * @param out Where the big endian bytes go, needs no particular alignment
+ * @param in Values to encode
+ * @param count How many values to encode
+ */
+void wbfs_helper_encode_be64(void* out, const uint64_t* in, size_t count);
+
+/**
+ * @brief Names the region a game was released in from the fourth letter of its game id
+ * @returns Short name of the region, "Unknown" if the letter isn't one we know
+ * @param game_id Game id, at least four characters long
+ */
+const char* wbfs_helper_region_name(const char* game_id);
+
+/**
+ * @brief Works out where the free block map starts. It takes up the end of the first wbfs sector, with its
+ * start rounded down to a host sector the way libwbfs does, which is where every other tool reads it from
+ * @returns Offset into the wbfs file
+ * @param hd_sector_shift 2 ^ shift is the size of the host sectors
+ * @param wbfs_sector_shift 2 ^ shift is the size of the wbfs sectors
+ * @param wbfs_sector_count How many wbfs sectors the whole file covers
+ */
+uint64_t wbfs_helper_free_map_offset(uint8_t hd_sector_shift, uint8_t wbfs_sector_shift,
+                                     uint32_t wbfs_sector_count);
+
+/**
+ * @brief Fetches the size in bytes of the free block map, a bit for every wbfs sector rounded up to whole host
+ * sectors. This is how much libwbfs reads, and the map always runs to the end of the first wbfs sector
+ * @returns Size in bytes
+ * @param hd_sector_shift 2 ^ shift is the size of the host sectors
+ * @param wbfs_sector_count How many wbfs sectors the whole file covers
+ */
+size_t wbfs_helper_free_map_size(uint8_t hd_sector_shift, uint32_t wbfs_sector_count);
+
+/**
+ * @brief Marks a wbfs sector as free in a free block map. Bit n of the map is wbfs sector n + 1, kept in big
+ * endian 32 bit words. Sectors whose word doesn't fit in the map are left as used
+ * @returns 1 if the sector was marked, 0 if it's the header sector or past the end of the map
+ * @param free_map Free block map of free_map_size bytes
+ * @param free_map_size Size of the map, from wbfs_helper_free_map_size
+ * @param sector Wbfs sector to mark as free
+ */
+int wbfs_helper_free_map_set(uint8_t* free_map, size_t free_map_size, uint32_t sector);
+
+/**
+ * @brief Fetches the wbfs disc table size, added as users might not know how large the header should be
+ * @returns Size of the Wbfs disc table in bytes, most likely 500 or 0 on error
+ * @param wbfs Valid Wbfs handle
+ */
+size_t wbfs_helper_disc_table_size(Wbfs* wbfs);
+
+/**
+ * brief Fetches the size in bytes of the
+ */
+size_t wbfs_helper_sector_table_size(Wbfs* wbfs);
+
+/**
+ * @brief Fetches the size in bytes needed to back the extent map of a disc. This is the worst case, where no
+ * two sectors are stored next to each other
+ * @returns Size of the extent map in bytes
+ * @param wbfs Valid Wbfs handle
+ */
+size_t wbfs_helper_extent_table_size(Wbfs* wbfs);
+
+/**
+ * @brief Fetches the size in bytes needed to back the sector table of one disc. After the disc has been
+ * measured this only covers up to its last stored sector, otherwise it's the size of the whole table
+ * @returns Size of the sector table in bytes
+ * @param disc Wii disc that has been through wbfs_disc_get_offset
+ */
+size_t wbfs_helper_disc_sector_table_size(const WiiDisc* disc);
+
+/**
+ * @brief Fetches the size in bytes needed to back the extent map of one disc. After the disc has been
+ * measured this is exactly the runs it has, otherwise it's the worst case
+ * @returns Size of the extent map in bytes
+ * @param disc Wii disc that has been through wbfs_disc_get_offset
+ */
+size_t wbfs_helper_disc_extent_table_size(const WiiDisc* disc);
+
+/**
+ * @brief Fetches the size in bytes needed to back a cluster cache
+ * @returns Size of the cache memory in bytes
+ * @param capacity How many clusters the cache will hold
+ */
+size_t wbfs_helper_cluster_cache_size(uint32_t capacity);
+
+/**
+ * @brief Fetches the size in bytes needed to back a batch
+ * @returns Size of the batch memory in bytes
+ * @param capacity How many pieces the batch can queue at once
+ */
+size_t wbfs_helper_batch_size(uint32_t capacity);
+
+/**
+ * @brief Fetches the size in bytes needed to back a file system table, covers the entries, the raw table and
+ * the path index
+ * @returns Size in bytes, 0 on error
+ * @param fst File system table with the header parsed
+ */
+size_t wbfs_helper_fst_size(const WiiFst* fst);
+
+/**
+ * @brief Fetches the size in bytes of the working memory needed to list the discs, a batch of disc infos
+ * @returns Size in bytes, 0 on error
+ * @param wbfs Valid Wbfs handle
+ */
+size_t wbfs_helper_catalog_size(Wbfs* wbfs);
+
+/**
+ * @brief Fetches the size in bytes of the working memory needed to build a library index record, a sector
+ * table and an extent map
+ * @returns Size in bytes, 0 on error
+ * @param wbfs Valid Wbfs handle
+ */
+size_t wbfs_helper_index_build_size(Wbfs* wbfs);
+
+/**
+ * @brief Fetches the most bytes a library index record for this wbfs file can take up
+ * @returns Size in bytes, 0 on error
+ * @param wbfs Valid Wbfs handle with the disc table parsed
+ * @param path Path the record will be keyed by
+ * @param flags WBFS_INDEX_ flags the record will be built with
+ */
+size_t wbfs_helper_index_record_size(Wbfs* wbfs, const char* path, uint32_t flags);
+
+/**
+ * @brief Fetches the size in bytes of the working memory needed to build a wbfs file, this holds the header,
+ * the disc info with its sector table, the free block map and one wbfs sector to copy through
+ * @returns Size in bytes, 0 if the sector size can't be used
+ * @param wbfs_sector_shift 2 ^ shift is the size of the wbfs sectors
+ */
+size_t wbfs_helper_build_size(uint8_t wbfs_sector_shift);
+
+/**
+ * @brief Fetches the size in bytes of the working memory needed to compact a wbfs file. On top of what a build
+ * needs it holds the sector table of the disc being copied
+ * @returns Size in bytes, 0 if the handle isn't valid
+ * @param wbfs Pointer to the WBFS handle to compact
+ */
+size_t wbfs_helper_compact_size(Wbfs* wbfs);
+
+/**
+ * @brief Fetches the size in bytes of the working memory needed to verify a partition, this holds the H3 table
+ * and two batches of clusters
+ * @returns Size in bytes
+ */
+size_t wbfs_helper_verify_size(void);
+
+/**
+ * @brief Fetches the size in bytes of the working memory needed to repack a partition, this holds the H3 table
+ * and two groups of clusters
+ * @returns Size in bytes
+ */
+size_t wbfs_helper_repack_size(void);
 
 const char* wbfs_helper_enum_lookup(wbfs_enum e);
 #endif  // !__WFBS_H__
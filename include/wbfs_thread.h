@@ -0,0 +1,144 @@
+/*************************************************************************************************************
+ * A very small portable layer over the platform threads. The library only needs a handful of things, starting
+ * and joining threads, a lock and a condition to wait on, so rather than pulling in a dependency these wrap
+ * pthreads and the win32 equivalents directly. The examples use these as well.
+ *
+ * Author : Illya L
+ * License : None
+ *************************************************************************************************************/
+#ifndef __WBFS_THREAD_H__
+#define __WBFS_THREAD_H__ (1)
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+/*************************************************************************************************************
+ * Constants
+ *************************************************************************************************************/
+
+// Upper bound on how many workers a single parallel call will spin up, thread handles live on the stack so
+// nothing has to be allocated
+#define WBFS_MAX_THREADS (64)
+
+// Relaxed atomic adds and swaps on 64 bit counters, for counters that every thread bumps without a lock
+#ifdef _MSC_VER
+#define WBFS_ATOMIC_ADD(TARGET, VALUE) \
+    _InterlockedExchangeAdd64((volatile long long*)(TARGET), (long long)(VALUE))
+#define WBFS_ATOMIC_EXCHANGE(TARGET, VALUE) \
+    (uint64_t) _InterlockedExchange64((volatile long long*)(TARGET), (long long)(VALUE))
+#else
+#define WBFS_ATOMIC_ADD(TARGET, VALUE) __atomic_fetch_add((TARGET), (VALUE), __ATOMIC_RELAXED)
+#define WBFS_ATOMIC_EXCHANGE(TARGET, VALUE) __atomic_exchange_n((TARGET), (VALUE), __ATOMIC_RELAXED)
+#endif
+
+// Ordered loads and compare and swaps on 32 bit state words, for handing something over between threads
+#ifdef _MSC_VER
+#define WBFS_ATOMIC_LOAD32(TARGET) (uint32_t) _InterlockedOr((volatile long*)(TARGET), 0)
+#define WBFS_ATOMIC_CAS32(TARGET, EXPECTED, DESIRED)                                           \
+    (_InterlockedCompareExchange((volatile long*)(TARGET), (long)(DESIRED), (long)(EXPECTED)) == \
+     (long)(EXPECTED))
+#else
+#define WBFS_ATOMIC_LOAD32(TARGET) __atomic_load_n((TARGET), __ATOMIC_ACQUIRE)
+#define WBFS_ATOMIC_CAS32(TARGET, EXPECTED, DESIRED) \
+    __sync_bool_compare_and_swap((TARGET), (EXPECTED), (DESIRED))
+#endif
+
+/*************************************************************************************************************
+ * Structure definitions
+ *************************************************************************************************************/
+
+/**
+ * A running thread, has to stay alive until it has been joined since the platform entry point reads the
+ * function and argument back out of it
+ */
+typedef struct WbfsThread {
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    void (*function)(void*);
+    void* argument;
+} WbfsThread;
+
+typedef struct WbfsMutex {
+#ifdef _WIN32
+    SRWLOCK lock;
+#else
+    pthread_mutex_t lock;
+#endif
+} WbfsMutex;
+
+typedef struct WbfsCond {
+#ifdef _WIN32
+    CONDITION_VARIABLE cond;
+#else
+    pthread_cond_t cond;
+#endif
+} WbfsCond;
+
+/*************************************************************************************************************
+ * Functions
+ *************************************************************************************************************/
+
+/**
+ * @brief Starts a thread running function(argument)
+ * @returns 0 on success
+ * @param thread Memory for the thread, has to outlive the thread
+ * @param function Entry point
+ * @param argument Passed straight to the entry point
+ */
+int wbfs_thread_create(WbfsThread* thread, void (*function)(void*), void* argument);
+
+/**
+ * @brief Waits for a thread to finish
+ * @param thread Thread started with wbfs_thread_create
+ */
+void wbfs_thread_join(WbfsThread* thread);
+
+/**
+ * @brief How many threads the machine can run at once, never less than 1
+ */
+uint32_t wbfs_thread_hardware_count(void);
+
+/**
+ * @brief Reads a monotonic clock, only useful for measuring how long something took
+ * @returns Nanoseconds since some fixed point in the past
+ */
+uint64_t wbfs_thread_time_ns(void);
+
+/**
+ * @brief Gives up the rest of the calling thread's time slice, for waits too short to be worth a condition
+ */
+void wbfs_thread_yield(void);
+
+void wbfs_mutex_init(WbfsMutex* mutex);
+void wbfs_mutex_destroy(WbfsMutex* mutex);
+void wbfs_mutex_lock(WbfsMutex* mutex);
+void wbfs_mutex_unlock(WbfsMutex* mutex);
+
+void wbfs_cond_init(WbfsCond* cond);
+void wbfs_cond_destroy(WbfsCond* cond);
+void wbfs_cond_wait(WbfsCond* cond, WbfsMutex* mutex);
+void wbfs_cond_signal(WbfsCond* cond);
+void wbfs_cond_broadcast(WbfsCond* cond);
+
+/**
+ * @brief Runs job(user, i) for every i in [0, job_count) across up to thread_count threads, including the
+ * calling thread, and returns once they have all finished. Jobs are handed out one at a time so uneven jobs
+ * still balance out
+ * @param thread_count How many threads to use, 0 uses every hardware thread
+ * @param job_count How many jobs to run
+ * @param job Function run for every job index
+ * @param user Passed to every job
+ */
+void wbfs_thread_parallel_for(uint32_t thread_count, uint64_t job_count,
+                              void (*job)(void* user, uint64_t index), void* user);
+#endif  // !__WBFS_THREAD_H__
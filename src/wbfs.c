@@ -14,6 +14,10 @@
 #define WII_DISC_1_SECTOR_COUNT (143432ull)
 #define WII_DISC_2_SECTOR_COUNT (260620ull)
 
+// Each disc info starts with a copy of the first part of the disc header, the sector table follows it
+#define DISC_HEADER_COPY_SIZE (256)
+#define WBFS_HEADER_SIZE (12)
+
 const uint8_t k_wii_aes_common_key[16] = {0xeb, 0xe4, 0x2a, 0x22, 0x5e, 0x85, 0x93, 0xe4,
                                           0x48, 0xd9, 0xc5, 0x45, 0x73, 0x81, 0xaa, 0xf7};
 
@@ -29,7 +33,7 @@ const uint8_t k_wii_aes_common_key[16] = {0xeb, 0xe4, 0x2a, 0x22, 0x5e, 0x85, 0x
 #define WBFS_VALID(WBFS)                                               \
     {                                                                  \
         if (!(WBFS)) return e_wbfs_segfault;                           \
-        if (!(WBFS)->fp) return e_wbfs_segfault;                       \
+        if (!(WBFS)->io.read_at) return e_wbfs_segfault;               \
         if (!(WBFS)->file_header) return e_wbfs_segfault;              \
         if ((WBFS)->valid != WBFS_MAGIC) return e_wbfs_invalid_handle; \
     }
@@ -38,28 +42,58 @@ const uint8_t k_wii_aes_common_key[16] = {0xeb, 0xe4, 0x2a, 0x22, 0x5e, 0x85, 0x
     (WBFS)->valid = WBFS_MAGIC_REVERSE; \
     return (ENUM);
 
+/*
+ * Reads a contiguous range straight out of the wbfs file, the counters are kept by wbfs_stats_read_at which
+ * every physical read in the library funnels through
+ */
+static wbfs_enum wbfs_file_read(Wbfs* wbfs, void* data, uint64_t file_address, uint64_t size)
+{
+    return wbfs_stats_read_at(wbfs, data, file_address, size);
+}
+
 wbfs_enum wbfs_file_header_parse(Wbfs* wbfs_handle, WbfsFileHeader* wbfs_fh, FILE* fp)
 {
-    // Check that all of these are not null, can't use the macro as we haven't marked it as valid yet
     if (!wbfs_handle || !wbfs_fh || !fp) return e_wbfs_segfault;
 
+    // Wrap the file pointer in the positional backend, then keep hold of it for anyone still using it
+    WbfsIo io;
+    wbfs_enum err = wbfs_io_init_file(&io, fp);
+    if (err != e_wbfs_success) return err;
+
+    err = wbfs_file_header_parse_io(wbfs_handle, wbfs_fh, &io);
+    wbfs_handle->fp = fp;
+    return err;
+}
+
+wbfs_enum wbfs_file_header_parse_io(Wbfs* wbfs_handle, WbfsFileHeader* wbfs_fh, const WbfsIo* io)
+{
+    // Check that all of these are not null, can't use the macro as we haven't marked it as valid yet
+    if (!wbfs_handle || !wbfs_fh || !io) return e_wbfs_segfault;
+    if (!io->read_at) return e_wbfs_invalid_io;
+
     // Memset the two user data structs and then associate the pointers together
     memset(wbfs_handle, 0, sizeof(Wbfs));
     memset(wbfs_fh, 0, sizeof(WbfsFileHeader));
     wbfs_handle->file_header = wbfs_fh;
-    wbfs_handle->fp = fp;
+    wbfs_handle->io = *io;
 
-    // Seek to the begining of the file and read in all the data that isn't the disc table
-    fseek(fp, 0, SEEK_SET);
-    fread(wbfs_fh, sizeof(WbfsFileHeader) - sizeof(uint8_t*), 1, fp);
+    // Read in all the data at the begining of the file that isn't the disc table. It goes into a plain buffer
+    // rather than straight into the struct, the struct has padding the file doesn't
+    uint8_t raw_header[WBFS_HEADER_SIZE];
+    if (wbfs_file_read(wbfs_handle, raw_header, 0, WBFS_HEADER_SIZE) != e_wbfs_success) {
+        WBFS_INVALIDATE(wbfs_handle, e_wbfs_failed_file_read);
+    }
 
     // This is the first time we encounter endianness as a problem, and we'll explain it here once. The file
     // format stores thing in big endian, which is most significant bytes first. However, most PCs are litle
-    // endian, when we try to stuff raw data into the uint32_t we put it in the wrong order. However fields
-    // that are only one byte long can't be in the wrong order, so we only need to swap bytes for the long
-    // fields
-    wbfs_helper_reverse_endian_32(&wbfs_fh->magic);
-    wbfs_helper_reverse_endian_32(&wbfs_fh->hd_sector_count);
+    // endian, so the bytes are put together most significant first whatever the host is. Fields that are only
+    // one byte long can't be in the wrong order, so they're copied straight across
+    wbfs_fh->magic = wbfs_helper_read_be32(raw_header);
+    wbfs_fh->hd_sector_count = wbfs_helper_read_be32(raw_header + 4);
+    wbfs_fh->hd_sector_shift = raw_header[8];
+    wbfs_fh->wbfs_sector_shift = raw_header[9];
+    wbfs_fh->wbfs_version = raw_header[10];
+    wbfs_fh->padding = raw_header[11];
 
     // Check that the magic number matched
     if (wbfs_fh->magic != WBFS_MAGIC) {
@@ -71,31 +105,110 @@ wbfs_enum wbfs_file_header_parse(Wbfs* wbfs_handle, WbfsFileHeader* wbfs_fh, FIL
     wbfs_handle->wbfs_sector_size = 1ull << wbfs_fh->wbfs_sector_shift;
     wbfs_handle->wbfs_file_size = wbfs_fh->hd_sector_count * wbfs_handle->hd_sector_size;
 
-    // Calculate the number of wbfs sectors required to fit in a 2 sided wii disk
-    uint64_t wii_disc_byte_count = WII_DISC_2_SECTOR_COUNT * WII_DISC_SECTOR_SIZE;
-    wbfs_handle->wbfs_sectors_per_disc =
-      (wii_disc_byte_count + wbfs_handle->wbfs_sector_size - 1) / wbfs_handle->wbfs_sector_size;
+    // Calculate the number of wbfs sectors in a disc's sector table. Every wbfs writer sizes the table the way
+    // libwbfs does, as two whole layers of the single layer sector count rounded down, rather than from the
+    // real dual layer size
+    uint64_t wii_disc_byte_count = WII_DISC_1_SECTOR_COUNT * 2 * WII_DISC_SECTOR_SIZE;
+    wbfs_handle->wbfs_sectors_per_disc = (uint32_t)(wii_disc_byte_count >> wbfs_fh->wbfs_sector_shift);
+
+    // The disc infos sit between the header and the free block map at the end of the first wbfs sector, the
+    // map has a bit for every wbfs sector on the drive. This is how many slots libwbfs will ever fill in
+    if (wbfs_fh->wbfs_sector_shift < wbfs_fh->hd_sector_shift) {
+        WBFS_INVALIDATE(wbfs_handle, e_wbfs_invalid_sector_size);
+    }
+    uint64_t mask = wbfs_handle->hd_sector_size - 1;
+    wbfs_handle->disc_info_size =
+        (DISC_HEADER_COPY_SIZE + wbfs_handle->wbfs_sectors_per_disc * sizeof(uint16_t) + mask) & ~mask;
+    uint32_t wbfs_sector_count =
+        wbfs_fh->hd_sector_count >> (wbfs_fh->wbfs_sector_shift - wbfs_fh->hd_sector_shift);
+    wbfs_handle->wbfs_sector_count = wbfs_sector_count;
+    if (wbfs_sector_count / 8 >= wbfs_handle->wbfs_sector_size) {
+        WBFS_INVALIDATE(wbfs_handle, e_wbfs_invalid_sector_size);
+    }
+    uint64_t free_map_start =
+        wbfs_helper_free_map_offset(wbfs_fh->hd_sector_shift, wbfs_fh->wbfs_sector_shift, wbfs_sector_count);
+    if (free_map_start < wbfs_handle->hd_sector_size + wbfs_handle->disc_info_size) {
+        WBFS_INVALIDATE(wbfs_handle, e_wbfs_invalid_sector_size);
+    }
+    uint64_t slot_count = (free_map_start - wbfs_handle->hd_sector_size) / wbfs_handle->disc_info_size;
+    if (slot_count > wbfs_handle->hd_sector_size - WBFS_HEADER_SIZE) {
+        slot_count = wbfs_handle->hd_sector_size - WBFS_HEADER_SIZE;
+    }
+    wbfs_handle->disc_slot_count = (uint32_t)slot_count;
 
     // Got to the end succssfully, mark the wbfs as sucessful
     wbfs_handle->valid = WBFS_MAGIC;
     return e_wbfs_success;
 }
 
+wbfs_enum wbfs_file_header_parse_mapped(Wbfs* wbfs_handle, WbfsFileHeader* wbfs_fh, FILE* fp)
+{
+    if (!wbfs_handle || !wbfs_fh || !fp) return e_wbfs_segfault;
+
+    WbfsIo io;
+    wbfs_enum err = wbfs_io_init_mapped(&io, fp);
+    if (err != e_wbfs_success) return err;
+
+    // If the header is bad there's nothing for the user to unmap with, so let go of the mapping here
+    err = wbfs_file_header_parse_io(wbfs_handle, wbfs_fh, &io);
+    if (err != e_wbfs_success) {
+        wbfs_io_unmap(&io);
+        wbfs_handle->io.read_at = 0;
+        return err;
+    }
+    wbfs_handle->fp = fp;
+    return err;
+}
+
+wbfs_enum wbfs_file_unmap(Wbfs* wbfs)
+{
+    if (!wbfs) return e_wbfs_segfault;
+    return wbfs_io_unmap(&wbfs->io);
+}
+
 wbfs_enum wbfs_file_disc_table_parse(Wbfs* wbfs)
 {
     WBFS_VALID(wbfs);
     if (!wbfs->file_header->disc_table) return e_wbfs_segfault;
 
-    // Seek to the start of the file, and then after those 12 bytes that make up the rest of the header
-    fseek(wbfs->fp, 12, SEEK_SET);
-    fread(wbfs->file_header->disc_table, 1, wbfs->hd_sector_size - 12, wbfs->fp);
+    // Read from after those 12 bytes that make up the rest of the header
+    wbfs_enum err = wbfs_file_read(wbfs, wbfs->file_header->disc_table, WBFS_HEADER_SIZE,
+                                   wbfs->hd_sector_size - WBFS_HEADER_SIZE);
+    if (err != e_wbfs_success) return err;
 
-    // I only know how to pass one disc at a time, so in this case evaluate that the first byte of the disc
-    // table is 0x1
-    if (wbfs->file_header->disc_table[0] != 0x1) {
-        return e_wbfs_invalid_disc_table;
+    // Any slot that isn't 0 holds a disc, removing a disc just clears its slot so there can be gaps
+    wbfs->wii_disc_count = 0;
+    for (uint32_t i = 0; i < wbfs->disc_slot_count; i++) {
+        if (wbfs->file_header->disc_table[i]) wbfs->wii_disc_count++;
+    }
+    return e_wbfs_success;
+}
+
+uint64_t wbfs_file_disc_info_offset(const Wbfs* wbfs, uint32_t slot)
+{
+    return wbfs->hd_sector_size + slot * wbfs->disc_info_size;
+}
+
+wbfs_enum wbfs_file_count_free(Wbfs* wbfs, void* memory, uint32_t* free_count)
+{
+    WBFS_VALID(wbfs);
+    if (!memory || !free_count) return e_wbfs_segfault;
+
+    uint8_t hd_shift = wbfs->file_header->hd_sector_shift;
+    uint8_t* free_map = (uint8_t*)memory;
+    size_t free_map_size = wbfs_helper_free_map_size(hd_shift, wbfs->wbfs_sector_count);
+    wbfs_enum err = wbfs_file_read(wbfs, free_map,
+                                   wbfs_helper_free_map_offset(hd_shift, wbfs->file_header->wbfs_sector_shift,
+                                                               wbfs->wbfs_sector_count),
+                                   free_map_size);
+    if (err != e_wbfs_success) return err;
+
+    // libwbfs only looks at the whole words of the map, a partial word at the end is never handed out
+    *free_count = 0;
+    for (uint32_t word = 0; word < wbfs->wbfs_sector_count / 32 && word * 4 + 4 <= free_map_size; word++) {
+        uint32_t bits = wbfs_helper_read_be32(free_map + word * 4);
+        for (; bits; bits &= bits - 1) (*free_count)++;
     }
-    wbfs->wii_disc_count = 1;
     return e_wbfs_success;
 }
 
@@ -103,15 +216,19 @@ wbfs_enum wbfs_file_disc_table_parse(Wbfs* wbfs)
  * Wii Disc Section
  */
 
-#define DISC_VALID(DISC)                                                \
-    {                                                                   \
-        if (!(DISC)) return e_wbfs_segfault;                            \
-        if ((DISC)->wbfs_offset == 0) return e_wbfs_invalid_disc_table; \
-        if (!(DISC)->wbfs) return e_wbfs_segfault;                      \
-        WBFS_VALID((DISC)->wbfs);                                       \
+#define DISC_VALID(DISC)                                                    \
+    {                                                                       \
+        if (!(DISC)) return e_wbfs_segfault;                                \
+        if (!(DISC)->wbfs) return e_wbfs_segfault;                          \
+        if ((DISC)->plain_size) {                                           \
+            if (!(DISC)->wbfs->io.read_at) return e_wbfs_segfault;          \
+        } else {                                                            \
+            if ((DISC)->wbfs_offset == 0) return e_wbfs_invalid_disc_table; \
+            WBFS_VALID((DISC)->wbfs);                                       \
+        }                                                                   \
     }
 
-wbfs_enum wbfs_disc_get_offset(WiiDisc* disc, Wbfs* wbfs, uint8_t index)
+wbfs_enum wbfs_disc_get_offset(WiiDisc* disc, Wbfs* wbfs, uint32_t index)
 {
     WBFS_VALID(wbfs);
     if (!wbfs->file_header->disc_table || !disc) return e_wbfs_segfault;
@@ -119,85 +236,350 @@ wbfs_enum wbfs_disc_get_offset(WiiDisc* disc, Wbfs* wbfs, uint8_t index)
     // Set up wii disc including associating it to a wbfs struct owner
     disc->wbfs = wbfs;
 
-    // look up offset sector in the wbfs file header
-    disc->wbfs_offset = wbfs->file_header->disc_table[index] * wbfs->hd_sector_size;
-    if (disc->wbfs_sector_lookup == 0) return e_wbfs_invalid_disc_table;
+    // Skip over the empty slots to find the disc, its disc info sits at a fixed place for its slot
+    uint32_t slot = 0;
+    for (; slot < wbfs->disc_slot_count; slot++) {
+        if (!wbfs->file_header->disc_table[slot]) continue;
+        if (index-- == 0) break;
+    }
+    if (slot == wbfs->disc_slot_count) return e_wbfs_invalid_disc_table;
+    disc->wbfs_offset = wbfs_file_disc_info_offset(wbfs, slot);
+
+    // Nothing is known about the sector table yet, the memory backing it can be given before or after this
+    disc->sector_count = 0;
+    disc->extent_count = 0;
+    disc->table_state = WBFS_TABLE_UNLOADED;
+    return e_wbfs_success;
+}
+
+wbfs_enum wbfs_disc_open_plain(WiiDisc* disc, Wbfs* wbfs, const WbfsIo* io, uint64_t size)
+{
+    if (!disc || !wbfs || !io) return e_wbfs_segfault;
+    if (!io->read_at || size == 0) return e_wbfs_invalid_io;
+
+    // Leave the handle without a header or magic, so it only works through the disc
+    memset(wbfs, 0, sizeof(Wbfs));
+    memset(disc, 0, sizeof(WiiDisc));
+    wbfs->io = *io;
+    wbfs->wbfs_file_size = size;
+    disc->wbfs = wbfs;
+    disc->plain_size = size;
+    return e_wbfs_success;
+}
+
+// When the whole table isn't being kept it's streamed through a buffer of this many entries on the stack
+#define SECTOR_TABLE_CHUNK (1024)
+
+/*
+ * Collapses every run of sectors that are stored one after the other in the wbfs file into a single extent.
+ * It's fed the sector table a block at a time so the table never has to be held in one piece. Unused sectors
+ * (a lookup of 0) are left out, so a gap between two extents is a hole in the disc
+ */
+typedef struct WbfsExtentBuilder {
+    WbfsExtent* extents;  // Null to only count the runs
+    uint32_t extent_capacity;
+    uint32_t extent_count;
+    uint32_t sector_count;      // Last stored sector plus one
+    uint32_t next_file_sector;  // File sector that would carry the current run on, 0 between runs
+} WbfsExtentBuilder;
+
+// Returns false if there are more runs than the extent map has room for
+static int wbfs_extent_builder_add(WbfsExtentBuilder* builder, const uint16_t* lookup, uint32_t first,
+                                   uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (lookup[i] == 0) {
+            builder->next_file_sector = 0;
+            continue;
+        }
+        builder->sector_count = first + i + 1;
+
+        // Carry on the current run if this sector directly follows the last one in both the disc and file
+        if (builder->next_file_sector == lookup[i]) {
+            if (builder->extents) builder->extents[builder->extent_count - 1].sector_count++;
+        } else {
+            if (builder->extents) {
+                if (builder->extent_count == builder->extent_capacity) return 0;
+                WbfsExtent* extent = builder->extents + builder->extent_count;
+                extent->disc_sector = first + i;
+                extent->file_sector = lookup[i];
+                extent->sector_count = 1;
+            }
+            builder->extent_count++;
+        }
+        builder->next_file_sector = lookup[i] + 1u;
+    }
+    return 1;
+}
+
+// Reads the first entries of the sector table a chunk at a time and hands them to the builder
+static wbfs_enum wbfs_disc_stream_table(WiiDisc* disc, uint32_t entries, WbfsExtentBuilder* builder)
+{
+    uint16_t chunk[SECTOR_TABLE_CHUNK];
+    uint64_t table_offset = disc->wbfs_offset + DISC_HEADER_COPY_SIZE;
+    for (uint32_t first = 0; first < entries; first += SECTOR_TABLE_CHUNK) {
+        uint32_t count = entries - first < SECTOR_TABLE_CHUNK ? entries - first : SECTOR_TABLE_CHUNK;
+        wbfs_enum err = wbfs_file_read(disc->wbfs, chunk, table_offset + (uint64_t)first * sizeof(uint16_t),
+                                       count * sizeof(uint16_t));
+        if (err != e_wbfs_success) return err;
+        wbfs_helper_decode_be16(chunk, chunk, count);
+        if (!wbfs_extent_builder_add(builder, chunk, first, count)) return e_wbfs_invalid_disc_table;
+    }
+    return e_wbfs_success;
+}
 
+wbfs_enum wbfs_disc_measure_sector_table(WiiDisc* disc)
+{
+    DISC_VALID(disc);
+    if (disc->plain_size) return e_wbfs_success;
+
+    WbfsExtentBuilder builder;
+    memset(&builder, 0, sizeof(WbfsExtentBuilder));
+    wbfs_enum err = wbfs_disc_stream_table(disc, disc->wbfs->wbfs_sectors_per_disc, &builder);
+    if (err != e_wbfs_success) return err;
+
+    disc->sector_count = builder.sector_count;
+    disc->extent_count = builder.extent_count;
+    disc->table_state = WBFS_TABLE_MEASURED;
     return e_wbfs_success;
 }
 
+/*
+ * Reads the sector table into whichever of the table and extent map the user backed. A measured disc only
+ * reads up to its last stored sector and its memory is only that large, otherwise the whole table is read.
+ * The disc is only changed once everything has been read, so a failed load leaves it as it was
+ */
+static wbfs_enum wbfs_disc_load_table(WiiDisc* disc, int measured)
+{
+    if (!disc->wbfs_sector_lookup && !disc->extents) return e_wbfs_segfault;
+
+    uint32_t entries = measured ? disc->sector_count : disc->wbfs->wbfs_sectors_per_disc;
+    WbfsExtentBuilder builder;
+    memset(&builder, 0, sizeof(WbfsExtentBuilder));
+    builder.extents = disc->extents;
+    builder.extent_capacity = measured ? disc->extent_count : disc->wbfs->wbfs_sectors_per_disc;
+
+    if (disc->wbfs_sector_lookup) {
+        // The wii disc - wbfs header is located at the start of the offset
+        // There is then a partial copy of the wii disc info, but not the entire thing
+        // So read from the offset plus the size of the partial header
+        uint16_t* table = disc->wbfs_sector_lookup;
+        if (entries > 0) {
+            wbfs_enum err = wbfs_file_read(disc->wbfs, table, disc->wbfs_offset + DISC_HEADER_COPY_SIZE,
+                                           entries * sizeof(uint16_t));
+            if (err != e_wbfs_success) return err;
+        }
+
+        // Every element of the table is larger than one byte so it has to be put into host order, this is done
+        // in place over the whole table at once
+        wbfs_helper_decode_be16(table, table, entries);
+        if (!wbfs_extent_builder_add(&builder, table, 0, entries)) return e_wbfs_invalid_disc_table;
+    } else {
+        // Only the extent map is kept, so the table goes straight into it
+        wbfs_enum err = wbfs_disc_stream_table(disc, entries, &builder);
+        if (err != e_wbfs_success) return err;
+    }
+
+    disc->sector_count = builder.sector_count;
+    disc->extent_count = builder.extent_count;
+    return e_wbfs_success;
+}
+
+/*
+ * Makes sure the sector table is loaded before it's used. Whoever moves the state on to loading does the work,
+ * anyone else reading the disc at the same time waits for them to finish. A failed load puts the state back so
+ * the next read tries again
+ */
+static wbfs_enum wbfs_disc_table_ready(WiiDisc* disc)
+{
+    for (;;) {
+        uint32_t state = WBFS_ATOMIC_LOAD32(&disc->table_state);
+        if (state == WBFS_TABLE_LOADED) return e_wbfs_success;
+        if (state == WBFS_TABLE_LOADING) {
+            wbfs_thread_yield();
+            continue;
+        }
+        if (!WBFS_ATOMIC_CAS32(&disc->table_state, state, WBFS_TABLE_LOADING)) continue;
+
+        wbfs_enum err = wbfs_disc_load_table(disc, state == WBFS_TABLE_MEASURED);
+        WBFS_ATOMIC_CAS32(&disc->table_state, WBFS_TABLE_LOADING,
+                          err == e_wbfs_success ? WBFS_TABLE_LOADED : state);
+        return err;
+    }
+}
+
 wbfs_enum wbfs_disc_parse_sector_table(WiiDisc* disc)
 {
     DISC_VALID(disc);
+    if (disc->plain_size) return e_wbfs_success;
+    return wbfs_disc_table_ready(disc);
+}
+
+/*
+ * Finds the run that holds the given disc sector with a binary search over the extent map, the extents are
+ * built in disc order so they're already sorted. Returns the index of the extent or extent_count if the sector
+ * falls in a hole
+ */
+static uint32_t wbfs_disc_find_extent(WiiDisc* disc, uint32_t sector)
+{
+    uint32_t low = 0;
+    uint32_t high = disc->extent_count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (disc->extents[mid].disc_sector + disc->extents[mid].sector_count <= sector) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low == disc->extent_count || disc->extents[low].disc_sector > sector) return disc->extent_count;
+    return low;
+}
 
-    // The wii disc - wbfs header is located at the start of the offset
-    // There is then a partial copy of the wii disc info, but not the entire thing
-    // So seek to the offset plus the size of the partial header
-    fseek(disc->wbfs->fp, disc->wbfs_offset + 256, SEEK_SET);
-    fread(disc->wbfs_sector_lookup, sizeof(uint16_t), disc->wbfs->wbfs_sectors_per_disc, disc->wbfs->fp);
+/*
+ * Works out where a disc address lives in the wbfs file and how many bytes after it are stored contiguously.
+ * Without an extent map the sector table is only followed far enough to cover size bytes. Returns
+ * e_wbfs_invalid_disc_table if the address falls in a hole, or whatever went wrong loading the sector table
+ */
+static wbfs_enum wbfs_disc_locate(WiiDisc* disc, uint64_t address, uint64_t size, uint64_t* file_address,
+                                  uint64_t* run_left)
+{
+    // A plain image is one long run
+    if (disc->plain_size) {
+        if (address >= disc->plain_size) return e_wbfs_invalid_disc_table;
+        *file_address = address;
+        *run_left = disc->plain_size - address;
+        return e_wbfs_success;
+    }
 
-    // For each element in the disc table we have to reverse the endianness since the type is larger than one
-    // byte
-    for (uint32_t i = 0; i < disc->wbfs->wbfs_sectors_per_disc; i++) {
-        wbfs_helper_reverse_endian_16(disc->wbfs_sector_lookup + i);
+    // The table is loaded by the first read that needs it, past the last stored sector is all holes
+    wbfs_enum err = wbfs_disc_table_ready(disc);
+    if (err != e_wbfs_success) return err;
+    Wbfs* wbfs = disc->wbfs;
+    uint8_t shift = wbfs->file_header->wbfs_sector_shift;
+    uint64_t mask = wbfs->wbfs_sector_size - 1;
+    if ((address >> shift) >= disc->sector_count) return e_wbfs_invalid_disc_table;
+    uint32_t sector_index = (uint32_t)(address >> shift);
+
+    uint32_t file_sector;
+    uint32_t run_length;
+    if (disc->extents) {
+        uint32_t extent = wbfs_disc_find_extent(disc, sector_index);
+        if (extent == disc->extent_count) return e_wbfs_invalid_disc_table;
+        file_sector = disc->extents[extent].file_sector + (sector_index - disc->extents[extent].disc_sector);
+        run_length = disc->extents[extent].sector_count - (sector_index - disc->extents[extent].disc_sector);
+    } else {
+        file_sector = disc->wbfs_sector_lookup[sector_index];
+        run_length = 1;
+        while (((uint64_t)run_length << shift) - (address & mask) < size &&
+               sector_index + run_length < disc->sector_count &&
+               disc->wbfs_sector_lookup[sector_index + run_length] == file_sector + run_length) {
+            run_length++;
+        }
     }
+    if (file_sector == 0) return e_wbfs_invalid_disc_table;
 
+    *file_address = ((uint64_t)file_sector << shift) + (address & mask);
+    *run_left = ((uint64_t)run_length << shift) - (address & mask);
     return e_wbfs_success;
 }
 
 wbfs_enum wbfs_disc_read_buffer(WiiDisc* disc, void* data, uint64_t address, uint64_t size)
 {
     DISC_VALID(disc);
-    Wbfs* wbfs = disc->wbfs;
 
-    // We need to be careful to ensure our reads don't cross a boundry of the wbfs sector
+#ifdef WBFS_STATS
+    WbfsStats* stats = disc->wbfs->stats;
+    if (stats && size > 0) {
+        WBFS_ATOMIC_ADD(&stats->disc_reads, 1);
+        if (!disc->plain_size) {
+            uint8_t shift = disc->wbfs->file_header->wbfs_sector_shift;
+            WBFS_ATOMIC_ADD(&stats->sector_crossings, ((address + size - 1) >> shift) - (address >> shift));
+        }
+    }
+#endif
+
     uint64_t bytes_read = 0;
     while (bytes_read < size) {
         // Advance the address to account for all of the reads that have taken place so far
         uint64_t local_address = address + bytes_read;
 
-        // The wbfs sectors are not in order. So we need to get which sector the address is in, and then
-        // lookup that index in the sector table. This will tell us where in the wbfs file this sector
-        // actually starts.
-        uint16_t sector_index = local_address / wbfs->wbfs_sector_size;
-        uint16_t lookup_index = disc->wbfs_sector_lookup[sector_index];
-
-        // We can't look in the first wbfs sector because that's where the wbfs header is stored
-        if (lookup_index == 0) return e_wbfs_invalid_disc_table;
-
-        // To navigate to the read from we take the remaing bytes from the address and add then to the new
-        // address since they are both local to the same sector count
-        uint64_t address_remainder = local_address % wbfs->wbfs_sector_size;
-        uint64_t read_address = lookup_index * wbfs->wbfs_sector_size + address_remainder;
-        fseek(wbfs->fp, read_address, SEEK_SET);
-
-        // Calculate how much space is left within this sector, and if that is enough space to fill the
-        // buffer. If there is not enough space to fill the buffer, we'll read the rest of this sector, and
-        // move over to the next one
-        uint64_t address_left = wbfs->wbfs_sector_size - address_remainder;
-        uint64_t req_read_size = ((size - bytes_read) <= address_left) ? size - bytes_read : address_left;
+        // The wbfs sectors are not in order, so find where this address actually lives in the wbfs file and
+        // how far the run of sectors it's in carries on for. We can't read holes, they have no backing sector
+        uint64_t read_address;
+        uint64_t address_left;
+        wbfs_enum err = wbfs_disc_locate(disc, local_address, size - bytes_read, &read_address, &address_left);
+        if (err != e_wbfs_success) return err;
 
-        uint64_t read_size = fread((uint8_t*)(data) + bytes_read, sizeof(uint8_t), req_read_size, wbfs->fp);
-        if (read_size != req_read_size) return e_wbfs_failed_file_read;
-        bytes_read += read_size;
+        // Read as much of the run as the buffer needs in one go, then move over to the next run
+        uint64_t req_read_size = ((size - bytes_read) <= address_left) ? size - bytes_read : address_left;
+        err = wbfs_file_read(disc->wbfs, (uint8_t*)(data) + bytes_read, read_address, req_read_size);
+        if (err != e_wbfs_success) return err;
+#ifdef WBFS_STATS
+        // Any file read after the first means the range wasn't stored in one run
+        if (stats && bytes_read != 0) WBFS_ATOMIC_ADD(&stats->split_reads, 1);
+#endif
+        bytes_read += req_read_size;
     }
 
     // Read al of the requested bytes without encountering an error.
     return e_wbfs_success;
 }
 
+wbfs_enum wbfs_disc_locate_run(WiiDisc* disc, uint64_t address, uint64_t size, uint64_t* file_address,
+                               uint64_t* run_left)
+{
+    DISC_VALID(disc);
+    if (!file_address || !run_left) return e_wbfs_segfault;
+    return wbfs_disc_locate(disc, address, size, file_address, run_left);
+}
+
+int wbfs_disc_sector_stored(WiiDisc* disc, uint32_t sector)
+{
+    if (!disc || !disc->wbfs || disc->plain_size || disc->wbfs_offset == 0) return 0;
+    if (disc->wbfs->valid != WBFS_MAGIC || wbfs_disc_table_ready(disc) != e_wbfs_success) return 0;
+    if (sector >= disc->sector_count) return 0;
+    if (disc->wbfs_sector_lookup) return disc->wbfs_sector_lookup[sector] != 0;
+    return wbfs_disc_find_extent(disc, sector) != disc->extent_count;
+}
+
+wbfs_enum wbfs_disc_view(WiiDisc* disc, uint64_t address, uint64_t size, void* scratch, const void** view)
+{
+    DISC_VALID(disc);
+    if (!view) return e_wbfs_segfault;
+
+    // Point straight into the mapping if the whole range is in one run
+    uint64_t file_address;
+    uint64_t run_left;
+    const WbfsIo* io = &disc->wbfs->io;
+    if (io->map && wbfs_disc_locate(disc, address, size, &file_address, &run_left) == e_wbfs_success &&
+        size <= run_left && file_address + size <= io->map_size) {
+        *view = io->map + file_address;
+        return e_wbfs_success;
+    }
+
+    // Otherwise fall back to copying the pieces into the scratch buffer
+    if (!scratch) return e_wbfs_not_contiguous;
+    wbfs_enum err = wbfs_disc_read_buffer(disc, scratch, address, size);
+    if (err != e_wbfs_success) return err;
+    *view = scratch;
+    return e_wbfs_success;
+}
+
 wbfs_enum wbfs_disc_parse_partition_info(WiiDisc* disc, WiiDiscPartitionInfoEntry info[4])
 {
-    // The partition info starts at offset 0x4000 into the disc, so we can use the buffer reader
-    wbfs_enum err = wbfs_disc_read_buffer(disc, info, 0x40000, 4 * sizeof(WiiDiscPartitionInfoEntry));
+    // The partition info starts at offset 0x4000 into the disc, so view it in place when we can
+    uint8_t scratch[4 * 8];
+    const void* view;
+    wbfs_enum err = wbfs_disc_view(disc, 0x40000, sizeof(scratch), scratch, &view);
+    if (err != e_wbfs_success) return err;
 
     for (uint32_t i = 0; i < 4; i++) {
-        // reverse all the endianness
-        wbfs_helper_reverse_endian_32(&info[i].offset);
-        wbfs_helper_reverse_endian_32(&info[i].partition_count);
-
-        // shift the partition offset
-        info[i].offset = info[i].offset << 2;
+        // decode the big endian fields, and shift the partition offset
+        const uint8_t* entry = (const uint8_t*)view + i * 8;
+        info[i].partition_count = wbfs_helper_read_be32(entry);
+        info[i].offset = wbfs_helper_read_be32(entry + 4) << 2;
     }
 
     return err;
@@ -205,12 +587,14 @@ wbfs_enum wbfs_disc_parse_partition_info(WiiDisc* disc, WiiDiscPartitionInfoEntr
 
 wbfs_enum wbfs_disc_parse_partition_table(WiiDisc* disc, WiiDiscPartitionTableEntry* table, uint64_t address)
 {
-    wbfs_enum err = wbfs_disc_read_buffer(disc, table, address, sizeof(WiiDiscPartitionTableEntry));
-
-    // reverse endianness and shift
-    wbfs_helper_reverse_endian_32(&table->type);
-    wbfs_helper_reverse_endian_32(&table->offset);
-    table->offset = table->offset << 2;
+    uint8_t scratch[8];
+    const void* view;
+    wbfs_enum err = wbfs_disc_view(disc, address, sizeof(scratch), scratch, &view);
+    if (err != e_wbfs_success) return err;
+
+    // decode the big endian fields and shift
+    table->offset = wbfs_helper_read_be32((const uint8_t*)view) << 2;
+    table->type = wbfs_helper_read_be32((const uint8_t*)view + 4);
 
     return err;
 }
@@ -0,0 +1,431 @@
+/*
+ * AES-128 for the wii partitions. Everything on the disc is AES-128-CBC, so that's all this implements. There
+ * are two paths, a portable table driven one, and one that uses the AES-NI instructions when the cpu has them.
+ * Which one is used is decided at runtime, so the same binary runs everywhere
+ */
+#include <string.h>
+
+#include "wbfs.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define WBFS_AES_X86 (1)
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define WBFS_TARGET_AES
+#else
+#include <cpuid.h>
+#define WBFS_TARGET_AES __attribute__((target("aes,sse2")))
+#endif
+#endif
+
+#define ROTR32(X, N) (((X) >> (N)) | ((X) << (32 - (N))))
+#define LOAD_BE32(P) \
+    (((uint32_t)(P)[0] << 24) | ((uint32_t)(P)[1] << 16) | ((uint32_t)(P)[2] << 8) | (uint32_t)(P)[3])
+#define STORE_BE32(P, V)                 \
+    {                                    \
+        (P)[0] = (uint8_t)((V) >> 24);   \
+        (P)[1] = (uint8_t)((V) >> 16);   \
+        (P)[2] = (uint8_t)((V) >> 8);    \
+        (P)[3] = (uint8_t)(V);           \
+    }
+
+/*
+ * The tables for the portable path. te0 and td0 fold the sbox and the mix columns step together for a whole
+ * column, the other three rows are the same tables rotated so they're worked out on the fly
+ */
+static const uint8_t k_aes_sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+static const uint8_t k_aes_inv_sbox[256] = {
+    0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
+    0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
+    0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
+    0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
+    0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
+    0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
+    0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
+    0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
+    0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
+    0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
+    0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
+    0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
+    0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
+    0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
+    0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
+    0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d,
+};
+
+static const uint32_t k_aes_te0[256] = {
+    0xc66363a5u, 0xf87c7c84u, 0xee777799u, 0xf67b7b8du, 0xfff2f20du, 0xd66b6bbdu, 0xde6f6fb1u, 0x91c5c554u,
+    0x60303050u, 0x02010103u, 0xce6767a9u, 0x562b2b7du, 0xe7fefe19u, 0xb5d7d762u, 0x4dababe6u, 0xec76769au,
+    0x8fcaca45u, 0x1f82829du, 0x89c9c940u, 0xfa7d7d87u, 0xeffafa15u, 0xb25959ebu, 0x8e4747c9u, 0xfbf0f00bu,
+    0x41adadecu, 0xb3d4d467u, 0x5fa2a2fdu, 0x45afafeau, 0x239c9cbfu, 0x53a4a4f7u, 0xe4727296u, 0x9bc0c05bu,
+    0x75b7b7c2u, 0xe1fdfd1cu, 0x3d9393aeu, 0x4c26266au, 0x6c36365au, 0x7e3f3f41u, 0xf5f7f702u, 0x83cccc4fu,
+    0x6834345cu, 0x51a5a5f4u, 0xd1e5e534u, 0xf9f1f108u, 0xe2717193u, 0xabd8d873u, 0x62313153u, 0x2a15153fu,
+    0x0804040cu, 0x95c7c752u, 0x46232365u, 0x9dc3c35eu, 0x30181828u, 0x379696a1u, 0x0a05050fu, 0x2f9a9ab5u,
+    0x0e070709u, 0x24121236u, 0x1b80809bu, 0xdfe2e23du, 0xcdebeb26u, 0x4e272769u, 0x7fb2b2cdu, 0xea75759fu,
+    0x1209091bu, 0x1d83839eu, 0x582c2c74u, 0x341a1a2eu, 0x361b1b2du, 0xdc6e6eb2u, 0xb45a5aeeu, 0x5ba0a0fbu,
+    0xa45252f6u, 0x763b3b4du, 0xb7d6d661u, 0x7db3b3ceu, 0x5229297bu, 0xdde3e33eu, 0x5e2f2f71u, 0x13848497u,
+    0xa65353f5u, 0xb9d1d168u, 0x00000000u, 0xc1eded2cu, 0x40202060u, 0xe3fcfc1fu, 0x79b1b1c8u, 0xb65b5bedu,
+    0xd46a6abeu, 0x8dcbcb46u, 0x67bebed9u, 0x7239394bu, 0x944a4adeu, 0x984c4cd4u, 0xb05858e8u, 0x85cfcf4au,
+    0xbbd0d06bu, 0xc5efef2au, 0x4faaaae5u, 0xedfbfb16u, 0x864343c5u, 0x9a4d4dd7u, 0x66333355u, 0x11858594u,
+    0x8a4545cfu, 0xe9f9f910u, 0x04020206u, 0xfe7f7f81u, 0xa05050f0u, 0x783c3c44u, 0x259f9fbau, 0x4ba8a8e3u,
+    0xa25151f3u, 0x5da3a3feu, 0x804040c0u, 0x058f8f8au, 0x3f9292adu, 0x219d9dbcu, 0x70383848u, 0xf1f5f504u,
+    0x63bcbcdfu, 0x77b6b6c1u, 0xafdada75u, 0x42212163u, 0x20101030u, 0xe5ffff1au, 0xfdf3f30eu, 0xbfd2d26du,
+    0x81cdcd4cu, 0x180c0c14u, 0x26131335u, 0xc3ecec2fu, 0xbe5f5fe1u, 0x359797a2u, 0x884444ccu, 0x2e171739u,
+    0x93c4c457u, 0x55a7a7f2u, 0xfc7e7e82u, 0x7a3d3d47u, 0xc86464acu, 0xba5d5de7u, 0x3219192bu, 0xe6737395u,
+    0xc06060a0u, 0x19818198u, 0x9e4f4fd1u, 0xa3dcdc7fu, 0x44222266u, 0x542a2a7eu, 0x3b9090abu, 0x0b888883u,
+    0x8c4646cau, 0xc7eeee29u, 0x6bb8b8d3u, 0x2814143cu, 0xa7dede79u, 0xbc5e5ee2u, 0x160b0b1du, 0xaddbdb76u,
+    0xdbe0e03bu, 0x64323256u, 0x743a3a4eu, 0x140a0a1eu, 0x924949dbu, 0x0c06060au, 0x4824246cu, 0xb85c5ce4u,
+    0x9fc2c25du, 0xbdd3d36eu, 0x43acacefu, 0xc46262a6u, 0x399191a8u, 0x319595a4u, 0xd3e4e437u, 0xf279798bu,
+    0xd5e7e732u, 0x8bc8c843u, 0x6e373759u, 0xda6d6db7u, 0x018d8d8cu, 0xb1d5d564u, 0x9c4e4ed2u, 0x49a9a9e0u,
+    0xd86c6cb4u, 0xac5656fau, 0xf3f4f407u, 0xcfeaea25u, 0xca6565afu, 0xf47a7a8eu, 0x47aeaee9u, 0x10080818u,
+    0x6fbabad5u, 0xf0787888u, 0x4a25256fu, 0x5c2e2e72u, 0x381c1c24u, 0x57a6a6f1u, 0x73b4b4c7u, 0x97c6c651u,
+    0xcbe8e823u, 0xa1dddd7cu, 0xe874749cu, 0x3e1f1f21u, 0x964b4bddu, 0x61bdbddcu, 0x0d8b8b86u, 0x0f8a8a85u,
+    0xe0707090u, 0x7c3e3e42u, 0x71b5b5c4u, 0xcc6666aau, 0x904848d8u, 0x06030305u, 0xf7f6f601u, 0x1c0e0e12u,
+    0xc26161a3u, 0x6a35355fu, 0xae5757f9u, 0x69b9b9d0u, 0x17868691u, 0x99c1c158u, 0x3a1d1d27u, 0x279e9eb9u,
+    0xd9e1e138u, 0xebf8f813u, 0x2b9898b3u, 0x22111133u, 0xd26969bbu, 0xa9d9d970u, 0x078e8e89u, 0x339494a7u,
+    0x2d9b9bb6u, 0x3c1e1e22u, 0x15878792u, 0xc9e9e920u, 0x87cece49u, 0xaa5555ffu, 0x50282878u, 0xa5dfdf7au,
+    0x038c8c8fu, 0x59a1a1f8u, 0x09898980u, 0x1a0d0d17u, 0x65bfbfdau, 0xd7e6e631u, 0x844242c6u, 0xd06868b8u,
+    0x824141c3u, 0x299999b0u, 0x5a2d2d77u, 0x1e0f0f11u, 0x7bb0b0cbu, 0xa85454fcu, 0x6dbbbbd6u, 0x2c16163au,
+};
+
+static const uint32_t k_aes_td0[256] = {
+    0x51f4a750u, 0x7e416553u, 0x1a17a4c3u, 0x3a275e96u, 0x3bab6bcbu, 0x1f9d45f1u, 0xacfa58abu, 0x4be30393u,
+    0x2030fa55u, 0xad766df6u, 0x88cc7691u, 0xf5024c25u, 0x4fe5d7fcu, 0xc52acbd7u, 0x26354480u, 0xb562a38fu,
+    0xdeb15a49u, 0x25ba1b67u, 0x45ea0e98u, 0x5dfec0e1u, 0xc32f7502u, 0x814cf012u, 0x8d4697a3u, 0x6bd3f9c6u,
+    0x038f5fe7u, 0x15929c95u, 0xbf6d7aebu, 0x955259dau, 0xd4be832du, 0x587421d3u, 0x49e06929u, 0x8ec9c844u,
+    0x75c2896au, 0xf48e7978u, 0x99583e6bu, 0x27b971ddu, 0xbee14fb6u, 0xf088ad17u, 0xc920ac66u, 0x7dce3ab4u,
+    0x63df4a18u, 0xe51a3182u, 0x97513360u, 0x62537f45u, 0xb16477e0u, 0xbb6bae84u, 0xfe81a01cu, 0xf9082b94u,
+    0x70486858u, 0x8f45fd19u, 0x94de6c87u, 0x527bf8b7u, 0xab73d323u, 0x724b02e2u, 0xe31f8f57u, 0x6655ab2au,
+    0xb2eb2807u, 0x2fb5c203u, 0x86c57b9au, 0xd33708a5u, 0x302887f2u, 0x23bfa5b2u, 0x02036abau, 0xed16825cu,
+    0x8acf1c2bu, 0xa779b492u, 0xf307f2f0u, 0x4e69e2a1u, 0x65daf4cdu, 0x0605bed5u, 0xd134621fu, 0xc4a6fe8au,
+    0x342e539du, 0xa2f355a0u, 0x058ae132u, 0xa4f6eb75u, 0x0b83ec39u, 0x4060efaau, 0x5e719f06u, 0xbd6e1051u,
+    0x3e218af9u, 0x96dd063du, 0xdd3e05aeu, 0x4de6bd46u, 0x91548db5u, 0x71c45d05u, 0x0406d46fu, 0x605015ffu,
+    0x1998fb24u, 0xd6bde997u, 0x894043ccu, 0x67d99e77u, 0xb0e842bdu, 0x07898b88u, 0xe7195b38u, 0x79c8eedbu,
+    0xa17c0a47u, 0x7c420fe9u, 0xf8841ec9u, 0x00000000u, 0x09808683u, 0x322bed48u, 0x1e1170acu, 0x6c5a724eu,
+    0xfd0efffbu, 0x0f853856u, 0x3daed51eu, 0x362d3927u, 0x0a0fd964u, 0x685ca621u, 0x9b5b54d1u, 0x24362e3au,
+    0x0c0a67b1u, 0x9357e70fu, 0xb4ee96d2u, 0x1b9b919eu, 0x80c0c54fu, 0x61dc20a2u, 0x5a774b69u, 0x1c121a16u,
+    0xe293ba0au, 0xc0a02ae5u, 0x3c22e043u, 0x121b171du, 0x0e090d0bu, 0xf28bc7adu, 0x2db6a8b9u, 0x141ea9c8u,
+    0x57f11985u, 0xaf75074cu, 0xee99ddbbu, 0xa37f60fdu, 0xf701269fu, 0x5c72f5bcu, 0x44663bc5u, 0x5bfb7e34u,
+    0x8b432976u, 0xcb23c6dcu, 0xb6edfc68u, 0xb8e4f163u, 0xd731dccau, 0x42638510u, 0x13972240u, 0x84c61120u,
+    0x854a247du, 0xd2bb3df8u, 0xaef93211u, 0xc729a16du, 0x1d9e2f4bu, 0xdcb230f3u, 0x0d8652ecu, 0x77c1e3d0u,
+    0x2bb3166cu, 0xa970b999u, 0x119448fau, 0x47e96422u, 0xa8fc8cc4u, 0xa0f03f1au, 0x567d2cd8u, 0x223390efu,
+    0x87494ec7u, 0xd938d1c1u, 0x8ccaa2feu, 0x98d40b36u, 0xa6f581cfu, 0xa57ade28u, 0xdab78e26u, 0x3fadbfa4u,
+    0x2c3a9de4u, 0x5078920du, 0x6a5fcc9bu, 0x547e4662u, 0xf68d13c2u, 0x90d8b8e8u, 0x2e39f75eu, 0x82c3aff5u,
+    0x9f5d80beu, 0x69d0937cu, 0x6fd52da9u, 0xcf2512b3u, 0xc8ac993bu, 0x10187da7u, 0xe89c636eu, 0xdb3bbb7bu,
+    0xcd267809u, 0x6e5918f4u, 0xec9ab701u, 0x834f9aa8u, 0xe6956e65u, 0xaaffe67eu, 0x21bccf08u, 0xef15e8e6u,
+    0xbae79bd9u, 0x4a6f36ceu, 0xea9f09d4u, 0x29b07cd6u, 0x31a4b2afu, 0x2a3f2331u, 0xc6a59430u, 0x35a266c0u,
+    0x744ebc37u, 0xfc82caa6u, 0xe090d0b0u, 0x33a7d815u, 0xf104984au, 0x41ecdaf7u, 0x7fcd500eu, 0x1791f62fu,
+    0x764dd68du, 0x43efb04du, 0xccaa4d54u, 0xe49604dfu, 0x9ed1b5e3u, 0x4c6a881bu, 0xc12c1fb8u, 0x4665517fu,
+    0x9d5eea04u, 0x018c355du, 0xfa877473u, 0xfb0b412eu, 0xb3671d5au, 0x92dbd252u, 0xe9105633u, 0x6dd64713u,
+    0x9ad7618cu, 0x37a10c7au, 0x59f8148eu, 0xeb133c89u, 0xcea927eeu, 0xb761c935u, 0xe11ce5edu, 0x7a47b13cu,
+    0x9cd2df59u, 0x55f2733fu, 0x1814ce79u, 0x73c737bfu, 0x53f7cdeau, 0x5ffdaa5bu, 0xdf3d6f14u, 0x7844db86u,
+    0xcaaff381u, 0xb968c43eu, 0x3824342cu, 0xc2a3405fu, 0x161dc372u, 0xbce2250cu, 0x283c498bu, 0xff0d9541u,
+    0x39a80171u, 0x080cb3deu, 0xd8b4e49cu, 0x6456c190u, 0x7bcb8461u, 0xd532b670u, 0x486c5c74u, 0xd0b85742u,
+};
+
+static const uint32_t k_aes_rcon[10] = {0x01000000u, 0x02000000u, 0x04000000u, 0x08000000u, 0x10000000u,
+                                        0x20000000u, 0x40000000u, 0x80000000u, 0x1b000000u, 0x36000000u};
+
+#define TE0(X) (k_aes_te0[(X)&0xff])
+#define TE1(X) ROTR32(k_aes_te0[(X)&0xff], 8)
+#define TE2(X) ROTR32(k_aes_te0[(X)&0xff], 16)
+#define TE3(X) ROTR32(k_aes_te0[(X)&0xff], 24)
+#define TD0(X) (k_aes_td0[(X)&0xff])
+#define TD1(X) ROTR32(k_aes_td0[(X)&0xff], 8)
+#define TD2(X) ROTR32(k_aes_td0[(X)&0xff], 16)
+#define TD3(X) ROTR32(k_aes_td0[(X)&0xff], 24)
+
+void wbfs_aes_set_key(WbfsAesKey* key, const uint8_t aes_key[16])
+{
+    uint32_t* rk = key->encrypt_keys;
+    for (uint32_t i = 0; i < 4; i++) rk[i] = LOAD_BE32(aes_key + i * 4);
+
+    // Standard AES-128 key expansion, each round key comes from the last one
+    for (uint32_t i = 0; i < 10; i++, rk += 4) {
+        uint32_t temp = rk[3];
+        rk[4] = rk[0] ^ k_aes_rcon[i] ^ ((uint32_t)k_aes_sbox[(temp >> 16) & 0xff] << 24) ^
+                ((uint32_t)k_aes_sbox[(temp >> 8) & 0xff] << 16) ^ ((uint32_t)k_aes_sbox[temp & 0xff] << 8) ^
+                (uint32_t)k_aes_sbox[temp >> 24];
+        rk[5] = rk[1] ^ rk[4];
+        rk[6] = rk[2] ^ rk[5];
+        rk[7] = rk[3] ^ rk[6];
+    }
+
+    // The decryption keys are the encryption keys backwards, with inverse mix columns applied to all but the
+    // first and last. Running the sbox through td0 cancels out its inverse sbox, leaving just the mix columns.
+    // This is the same layout AES-NI wants, so both paths share them
+    const uint32_t* ek = key->encrypt_keys;
+    uint32_t* dk = key->decrypt_keys;
+    for (uint32_t round = 0; round <= 10; round++) {
+        for (uint32_t j = 0; j < 4; j++) {
+            uint32_t w = ek[(10 - round) * 4 + j];
+            if (round != 0 && round != 10) {
+                w = TD0(k_aes_sbox[w >> 24]) ^ TD1(k_aes_sbox[(w >> 16) & 0xff]) ^
+                    TD2(k_aes_sbox[(w >> 8) & 0xff]) ^ TD3(k_aes_sbox[w & 0xff]);
+            }
+            dk[round * 4 + j] = w;
+        }
+    }
+}
+
+static void wbfs_aes_encrypt_block(const uint32_t* rk, const uint8_t in[16], uint8_t out[16])
+{
+    uint32_t s0 = LOAD_BE32(in) ^ rk[0];
+    uint32_t s1 = LOAD_BE32(in + 4) ^ rk[1];
+    uint32_t s2 = LOAD_BE32(in + 8) ^ rk[2];
+    uint32_t s3 = LOAD_BE32(in + 12) ^ rk[3];
+
+    for (uint32_t round = 1; round < 10; round++) {
+        rk += 4;
+        uint32_t t0 = TE0(s0 >> 24) ^ TE1(s1 >> 16) ^ TE2(s2 >> 8) ^ TE3(s3) ^ rk[0];
+        uint32_t t1 = TE0(s1 >> 24) ^ TE1(s2 >> 16) ^ TE2(s3 >> 8) ^ TE3(s0) ^ rk[1];
+        uint32_t t2 = TE0(s2 >> 24) ^ TE1(s3 >> 16) ^ TE2(s0 >> 8) ^ TE3(s1) ^ rk[2];
+        uint32_t t3 = TE0(s3 >> 24) ^ TE1(s0 >> 16) ^ TE2(s1 >> 8) ^ TE3(s2) ^ rk[3];
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    // The last round has no mix columns, so it's just the sbox
+    rk += 4;
+    uint32_t o0 = ((uint32_t)k_aes_sbox[s0 >> 24] << 24) ^ ((uint32_t)k_aes_sbox[(s1 >> 16) & 0xff] << 16) ^
+                  ((uint32_t)k_aes_sbox[(s2 >> 8) & 0xff] << 8) ^ (uint32_t)k_aes_sbox[s3 & 0xff] ^ rk[0];
+    uint32_t o1 = ((uint32_t)k_aes_sbox[s1 >> 24] << 24) ^ ((uint32_t)k_aes_sbox[(s2 >> 16) & 0xff] << 16) ^
+                  ((uint32_t)k_aes_sbox[(s3 >> 8) & 0xff] << 8) ^ (uint32_t)k_aes_sbox[s0 & 0xff] ^ rk[1];
+    uint32_t o2 = ((uint32_t)k_aes_sbox[s2 >> 24] << 24) ^ ((uint32_t)k_aes_sbox[(s3 >> 16) & 0xff] << 16) ^
+                  ((uint32_t)k_aes_sbox[(s0 >> 8) & 0xff] << 8) ^ (uint32_t)k_aes_sbox[s1 & 0xff] ^ rk[2];
+    uint32_t o3 = ((uint32_t)k_aes_sbox[s3 >> 24] << 24) ^ ((uint32_t)k_aes_sbox[(s0 >> 16) & 0xff] << 16) ^
+                  ((uint32_t)k_aes_sbox[(s1 >> 8) & 0xff] << 8) ^ (uint32_t)k_aes_sbox[s2 & 0xff] ^ rk[3];
+    STORE_BE32(out, o0);
+    STORE_BE32(out + 4, o1);
+    STORE_BE32(out + 8, o2);
+    STORE_BE32(out + 12, o3);
+}
+
+static void wbfs_aes_decrypt_block(const uint32_t* rk, const uint8_t in[16], uint8_t out[16])
+{
+    uint32_t s0 = LOAD_BE32(in) ^ rk[0];
+    uint32_t s1 = LOAD_BE32(in + 4) ^ rk[1];
+    uint32_t s2 = LOAD_BE32(in + 8) ^ rk[2];
+    uint32_t s3 = LOAD_BE32(in + 12) ^ rk[3];
+
+    for (uint32_t round = 1; round < 10; round++) {
+        rk += 4;
+        uint32_t t0 = TD0(s0 >> 24) ^ TD1(s3 >> 16) ^ TD2(s2 >> 8) ^ TD3(s1) ^ rk[0];
+        uint32_t t1 = TD0(s1 >> 24) ^ TD1(s0 >> 16) ^ TD2(s3 >> 8) ^ TD3(s2) ^ rk[1];
+        uint32_t t2 = TD0(s2 >> 24) ^ TD1(s1 >> 16) ^ TD2(s0 >> 8) ^ TD3(s3) ^ rk[2];
+        uint32_t t3 = TD0(s3 >> 24) ^ TD1(s2 >> 16) ^ TD2(s1 >> 8) ^ TD3(s0) ^ rk[3];
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    // The last round has no inverse mix columns, so it's just the inverse sbox
+    rk += 4;
+    uint32_t o0 = ((uint32_t)k_aes_inv_sbox[s0 >> 24] << 24) ^
+                  ((uint32_t)k_aes_inv_sbox[(s3 >> 16) & 0xff] << 16) ^
+                  ((uint32_t)k_aes_inv_sbox[(s2 >> 8) & 0xff] << 8) ^ (uint32_t)k_aes_inv_sbox[s1 & 0xff];
+    uint32_t o1 = ((uint32_t)k_aes_inv_sbox[s1 >> 24] << 24) ^
+                  ((uint32_t)k_aes_inv_sbox[(s0 >> 16) & 0xff] << 16) ^
+                  ((uint32_t)k_aes_inv_sbox[(s3 >> 8) & 0xff] << 8) ^ (uint32_t)k_aes_inv_sbox[s2 & 0xff];
+    uint32_t o2 = ((uint32_t)k_aes_inv_sbox[s2 >> 24] << 24) ^
+                  ((uint32_t)k_aes_inv_sbox[(s1 >> 16) & 0xff] << 16) ^
+                  ((uint32_t)k_aes_inv_sbox[(s0 >> 8) & 0xff] << 8) ^ (uint32_t)k_aes_inv_sbox[s3 & 0xff];
+    uint32_t o3 = ((uint32_t)k_aes_inv_sbox[s3 >> 24] << 24) ^
+                  ((uint32_t)k_aes_inv_sbox[(s2 >> 16) & 0xff] << 16) ^
+                  ((uint32_t)k_aes_inv_sbox[(s1 >> 8) & 0xff] << 8) ^ (uint32_t)k_aes_inv_sbox[s0 & 0xff];
+    o0 ^= rk[0];
+    o1 ^= rk[1];
+    o2 ^= rk[2];
+    o3 ^= rk[3];
+    STORE_BE32(out, o0);
+    STORE_BE32(out + 4, o1);
+    STORE_BE32(out + 8, o2);
+    STORE_BE32(out + 12, o3);
+}
+
+static void wbfs_aes_cbc_decrypt_portable(const WbfsAesKey* key, const uint8_t iv[16], const uint8_t* in,
+                                          uint8_t* out, size_t size)
+{
+    // Keep a copy of the previous cipher block, if in and out are the same buffer it gets overwritten
+    uint8_t chain[16];
+    uint8_t cipher[16];
+    memcpy(chain, iv, 16);
+
+    for (size_t offset = 0; offset < size; offset += 16) {
+        memcpy(cipher, in + offset, 16);
+        wbfs_aes_decrypt_block(key->decrypt_keys, cipher, out + offset);
+        for (uint32_t i = 0; i < 16; i++) out[offset + i] ^= chain[i];
+        memcpy(chain, cipher, 16);
+    }
+}
+
+static void wbfs_aes_cbc_encrypt_portable(const WbfsAesKey* key, const uint8_t iv[16], const uint8_t* in,
+                                          uint8_t* out, size_t size)
+{
+    uint8_t chain[16];
+    memcpy(chain, iv, 16);
+
+    for (size_t offset = 0; offset < size; offset += 16) {
+        for (uint32_t i = 0; i < 16; i++) chain[i] ^= in[offset + i];
+        wbfs_aes_encrypt_block(key->encrypt_keys, chain, chain);
+        memcpy(out + offset, chain, 16);
+    }
+}
+
+#ifdef WBFS_AES_X86
+/*
+ * The AES-NI path. Round keys are stored as big endian words for the portable path, so turn them back into
+ * bytes once per call
+ */
+WBFS_TARGET_AES static void wbfs_aes_ni_load_keys(const uint32_t* words, __m128i keys[11])
+{
+    uint8_t bytes[16];
+    for (uint32_t round = 0; round < 11; round++) {
+        for (uint32_t j = 0; j < 4; j++) STORE_BE32(bytes + j * 4, words[round * 4 + j]);
+        keys[round] = _mm_loadu_si128((const __m128i*)bytes);
+    }
+}
+
+/*
+ * CBC decryption doesn't depend on the previous block's output, only its cipher text, so eight blocks go
+ * through the pipeline at once to hide the latency of aesdec
+ */
+WBFS_TARGET_AES static void wbfs_aes_cbc_decrypt_ni(const WbfsAesKey* key, const uint8_t iv[16],
+                                                    const uint8_t* in, uint8_t* out, size_t size)
+{
+    __m128i k[11];
+    wbfs_aes_ni_load_keys(key->decrypt_keys, k);
+
+    __m128i chain = _mm_loadu_si128((const __m128i*)iv);
+    size_t blocks = size / 16;
+    size_t b = 0;
+
+    for (; b + 8 <= blocks; b += 8) {
+        __m128i c[8];
+        __m128i x[8];
+        for (uint32_t i = 0; i < 8; i++) {
+            c[i] = _mm_loadu_si128((const __m128i*)(in + (b + i) * 16));
+            x[i] = _mm_xor_si128(c[i], k[0]);
+        }
+        for (uint32_t round = 1; round < 10; round++) {
+            x[0] = _mm_aesdec_si128(x[0], k[round]);
+            x[1] = _mm_aesdec_si128(x[1], k[round]);
+            x[2] = _mm_aesdec_si128(x[2], k[round]);
+            x[3] = _mm_aesdec_si128(x[3], k[round]);
+            x[4] = _mm_aesdec_si128(x[4], k[round]);
+            x[5] = _mm_aesdec_si128(x[5], k[round]);
+            x[6] = _mm_aesdec_si128(x[6], k[round]);
+            x[7] = _mm_aesdec_si128(x[7], k[round]);
+        }
+        for (uint32_t i = 0; i < 8; i++) {
+            x[i] = _mm_aesdeclast_si128(x[i], k[10]);
+            x[i] = _mm_xor_si128(x[i], i == 0 ? chain : c[i - 1]);
+            _mm_storeu_si128((__m128i*)(out + (b + i) * 16), x[i]);
+        }
+        chain = c[7];
+    }
+
+    for (; b < blocks; b++) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(in + b * 16));
+        __m128i x = _mm_xor_si128(c, k[0]);
+        for (uint32_t round = 1; round < 10; round++) x = _mm_aesdec_si128(x, k[round]);
+        x = _mm_xor_si128(_mm_aesdeclast_si128(x, k[10]), chain);
+        _mm_storeu_si128((__m128i*)(out + b * 16), x);
+        chain = c;
+    }
+}
+
+WBFS_TARGET_AES static void wbfs_aes_cbc_encrypt_ni(const WbfsAesKey* key, const uint8_t iv[16],
+                                                    const uint8_t* in, uint8_t* out, size_t size)
+{
+    __m128i k[11];
+    wbfs_aes_ni_load_keys(key->encrypt_keys, k);
+
+    // Encryption is serial, every block needs the one before it
+    __m128i chain = _mm_loadu_si128((const __m128i*)iv);
+    for (size_t offset = 0; offset < size; offset += 16) {
+        __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + offset)), chain);
+        x = _mm_xor_si128(x, k[0]);
+        for (uint32_t round = 1; round < 10; round++) x = _mm_aesenc_si128(x, k[round]);
+        chain = _mm_aesenclast_si128(x, k[10]);
+        _mm_storeu_si128((__m128i*)(out + offset), chain);
+    }
+}
+
+static int wbfs_aes_ni_detect(void)
+{
+    // AES-NI is reported in bit 25 of ecx for leaf 1
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] >> 25) & 1;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    return (ecx >> 25) & 1;
+#endif
+}
+#endif
+
+/*
+ * Which path to take is worked out the first time it's needed. Every thread works out the same answer, so it
+ * doesn't matter if a few of them race to fill it in
+ */
+static volatile int s_aes_path = -1;
+
+int wbfs_aes_hardware_accelerated(void)
+{
+    if (s_aes_path < 0) {
+#ifdef WBFS_AES_X86
+        s_aes_path = wbfs_aes_ni_detect();
+#else
+        s_aes_path = 0;
+#endif
+    }
+    return s_aes_path;
+}
+
+void wbfs_aes_cbc_decrypt(const WbfsAesKey* key, const uint8_t iv[16], const void* in, void* out, size_t size)
+{
+#ifdef WBFS_AES_X86
+    if (wbfs_aes_hardware_accelerated()) {
+        wbfs_aes_cbc_decrypt_ni(key, iv, (const uint8_t*)in, (uint8_t*)out, size);
+        return;
+    }
+#endif
+    wbfs_aes_cbc_decrypt_portable(key, iv, (const uint8_t*)in, (uint8_t*)out, size);
+}
+
+void wbfs_aes_cbc_encrypt(const WbfsAesKey* key, const uint8_t iv[16], const void* in, void* out, size_t size)
+{
+#ifdef WBFS_AES_X86
+    if (wbfs_aes_hardware_accelerated()) {
+        wbfs_aes_cbc_encrypt_ni(key, iv, (const uint8_t*)in, (uint8_t*)out, size);
+        return;
+    }
+#endif
+    wbfs_aes_cbc_encrypt_portable(key, iv, (const uint8_t*)in, (uint8_t*)out, size);
+}
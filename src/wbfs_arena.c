@@ -0,0 +1,157 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "wbfs.h"
+
+// Every piece starts on a boundary that suits any of the structs and the 64 bit fields in them
+#define ARENA_ALIGN (16)
+#define ARENA_ROUND(SIZE) (((SIZE) + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1))
+
+wbfs_enum wbfs_arena_init(WbfsArena* arena, void* memory, size_t size)
+{
+    if (!arena || (!memory && size)) return e_wbfs_segfault;
+
+    // Pieces are aligned from the start of the arena, so skip ahead to the first boundary. Anything from
+    // malloc is on one already
+    size_t skip = memory ? ARENA_ROUND((uintptr_t)memory) - (uintptr_t)memory : 0;
+    arena->memory = (uint8_t*)memory + (skip < size ? skip : size);
+    arena->size = skip < size ? size - skip : 0;
+    arena->used = 0;
+    arena->needed = 0;
+    return e_wbfs_success;
+}
+
+void* wbfs_arena_alloc(WbfsArena* arena, size_t size)
+{
+    if (!arena) return 0;
+    size_t start = ARENA_ROUND(arena->used);
+    if (start > arena->size || arena->size - start < size) {
+        if (arena->needed < start + size) arena->needed = start + size;
+        return 0;
+    }
+    arena->used = start + size;
+    return arena->memory + start;
+}
+
+void wbfs_arena_reset(WbfsArena* arena)
+{
+    if (arena) arena->used = 0;
+}
+
+// What the sector table and extent map of a measured disc take up in the arena
+static size_t wbfs_arena_tables_size(const WiiDisc* disc, uint32_t flags)
+{
+    size_t tables = ARENA_ROUND(wbfs_helper_disc_extent_table_size(disc));
+    if (!(flags & WBFS_OPEN_EXTENTS_ONLY)) tables += ARENA_ROUND(wbfs_helper_disc_sector_table_size(disc));
+    return tables;
+}
+
+/*
+ * The sector tables are the only part of a file whose size isn't known from the header, so every disc is
+ * measured first and the room they all need is checked in one go. Once that passes placing them can't fail
+ */
+static wbfs_enum wbfs_arena_place_tables(WbfsFile* file, WbfsArena* arena, uint32_t flags)
+{
+    size_t tables = 0;
+    for (uint32_t i = 0; i < file->wbfs.wii_disc_count; i++) {
+        WiiDisc* disc = file->discs + i;
+        memset(disc, 0, sizeof(WiiDisc));
+        wbfs_enum err = wbfs_disc_get_offset(disc, &file->wbfs, i);
+        if (err == e_wbfs_success) err = wbfs_disc_measure_sector_table(disc);
+        if (err != e_wbfs_success) return err;
+
+        tables += wbfs_arena_tables_size(disc, flags);
+    }
+
+    size_t start = ARENA_ROUND(arena->used);
+    if (start > arena->size || arena->size - start < tables) {
+        if (arena->needed < start + tables) arena->needed = start + tables;
+        return e_wbfs_out_of_space;
+    }
+
+    for (uint32_t i = 0; i < file->wbfs.wii_disc_count; i++) {
+        WiiDisc* disc = file->discs + i;
+        if (!(flags & WBFS_OPEN_EXTENTS_ONLY)) {
+            disc->wbfs_sector_lookup = wbfs_arena_alloc(arena, wbfs_helper_disc_sector_table_size(disc));
+        }
+        disc->extents = wbfs_arena_alloc(arena, wbfs_helper_disc_extent_table_size(disc));
+        wbfs_enum err = wbfs_disc_parse_sector_table(disc);
+        if (err != e_wbfs_success) return err;
+    }
+    return e_wbfs_success;
+}
+
+// The disc table is streamed through a buffer this size on the stack when measuring, nothing is kept
+#define MEASURE_TABLE_CHUNK (512)
+
+wbfs_enum wbfs_file_measure_arena(const WbfsIo* io, uint32_t flags, size_t* size)
+{
+    if (!io || !size) return e_wbfs_segfault;
+    *size = 0;
+
+    Wbfs wbfs;
+    WbfsFileHeader header;
+    wbfs_enum err = wbfs_file_header_parse_io(&wbfs, &header, io);
+    if (err != e_wbfs_success) return err;
+
+    // The disc table is only read through here, so each disc is set up from its slot the way
+    // wbfs_disc_get_offset would and measured straight away
+    uint8_t chunk[MEASURE_TABLE_CHUNK];
+    uint64_t table_offset = wbfs.hd_sector_size - wbfs_helper_disc_table_size(&wbfs);
+    uint32_t disc_count = 0;
+    size_t tables = 0;
+    for (uint32_t first = 0; first < wbfs.disc_slot_count; first += MEASURE_TABLE_CHUNK) {
+        uint32_t count = wbfs.disc_slot_count - first;
+        if (count > MEASURE_TABLE_CHUNK) count = MEASURE_TABLE_CHUNK;
+        err = wbfs_stats_read_at(&wbfs, chunk, table_offset + first, count);
+        if (err != e_wbfs_success) return err;
+
+        for (uint32_t i = 0; i < count; i++) {
+            if (!chunk[i]) continue;
+            WiiDisc disc;
+            memset(&disc, 0, sizeof(WiiDisc));
+            disc.wbfs = &wbfs;
+            disc.wbfs_offset = wbfs_file_disc_info_offset(&wbfs, first + i);
+            err = wbfs_disc_measure_sector_table(&disc);
+            if (err != e_wbfs_success) return err;
+            tables += wbfs_arena_tables_size(&disc, flags);
+            disc_count++;
+        }
+    }
+
+    // The same pieces in the same order as wbfs_file_open_arena places them, each starting on a boundary
+    size_t needed = ARENA_ROUND(sizeof(WbfsFile));
+    needed = ARENA_ROUND(needed + wbfs_helper_disc_table_size(&wbfs));
+    needed = ARENA_ROUND(needed + disc_count * sizeof(WiiDisc));
+    *size = needed + tables;
+    return e_wbfs_success;
+}
+
+wbfs_enum wbfs_file_open_arena(WbfsFile** file, WbfsArena* arena, const WbfsIo* io, uint32_t flags)
+{
+    if (!file || !arena || !io) return e_wbfs_segfault;
+    *file = 0;
+
+    // Anything placed by an open that fails is handed back, so the arena is left as it was
+    size_t mark = arena->used;
+    WbfsFile* opened = wbfs_arena_alloc(arena, sizeof(WbfsFile));
+    if (!opened) return e_wbfs_out_of_space;
+    wbfs_enum err = wbfs_file_header_parse_io(&opened->wbfs, &opened->header, io);
+
+    // The disc table and the discs come first, the sector tables can't be measured without them
+    if (err == e_wbfs_success) {
+        opened->header.disc_table = wbfs_arena_alloc(arena, wbfs_helper_disc_table_size(&opened->wbfs));
+        err = opened->header.disc_table ? wbfs_file_disc_table_parse(&opened->wbfs) : e_wbfs_out_of_space;
+    }
+    if (err == e_wbfs_success) {
+        opened->discs = wbfs_arena_alloc(arena, opened->wbfs.wii_disc_count * sizeof(WiiDisc));
+        err = opened->discs ? wbfs_arena_place_tables(opened, arena, flags) : e_wbfs_out_of_space;
+    }
+
+    if (err != e_wbfs_success) {
+        arena->used = mark;
+        return err;
+    }
+    *file = opened;
+    return e_wbfs_success;
+}
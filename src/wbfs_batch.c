@@ -0,0 +1,473 @@
+/*
+ * Batched disc reads. Requests are split into the pieces of the wbfs file they need, the pieces are sorted by
+ * where they sit in the file, and pieces that follow straight on from each other are merged into one span.
+ * The spans are then either handed to the kernel through an io_uring, or worked through in file order by a
+ * few threads reading through the backend
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define WBFS_BATCH_URING (1)
+#endif
+#endif
+#endif
+
+#include "wbfs.h"
+
+// Most pieces merged into one span, readv won't take more buffers than this
+#define BATCH_MAX_MERGE (1024)
+
+// Most bytes merged into one span, the kernel reports how much was read as an int
+#define BATCH_MAX_SPAN (64ull * 1024 * 1024)
+
+// Most submission slots asked for, spans past this wait for earlier ones to complete
+#define BATCH_MAX_RING (256)
+
+size_t wbfs_helper_batch_size(uint32_t capacity)
+{
+    size_t size = sizeof(WbfsBatchPiece) + sizeof(WbfsBatchSpan) + sizeof(WbfsReadRequest*);
+#ifdef WBFS_BATCH_URING
+    size += sizeof(struct iovec);
+#endif
+    return (size_t)capacity * size;
+}
+
+static int wbfs_batch_piece_compare(const void* a, const void* b)
+{
+    uint64_t left = ((const WbfsBatchPiece*)a)->offset;
+    uint64_t right = ((const WbfsBatchPiece*)b)->offset;
+    return (left > right) - (left < right);
+}
+
+/*
+ * Reads a span one piece at a time through the backend. This is how the worker threads read, and what the ring
+ * falls back on if the kernel comes back short
+ */
+static wbfs_enum wbfs_batch_read_span(WbfsBatch* batch, const WbfsBatchSpan* span)
+{
+    Wbfs* wbfs = batch->disc->wbfs;
+    for (uint32_t i = span->first; i < span->first + span->count; i++) {
+        const WbfsBatchPiece* piece = batch->pieces + i;
+        wbfs_enum err = wbfs_stats_read_at(wbfs, piece->data, piece->offset, piece->size);
+        if (err != e_wbfs_success) return err;
+    }
+    return e_wbfs_success;
+}
+
+/*
+ * Marks every piece of a span as done, any request with nothing left to read moves over to the completed list.
+ * Expects the lock to be held
+ */
+static void wbfs_batch_complete_span(WbfsBatch* batch, const WbfsBatchSpan* span, wbfs_enum err)
+{
+    uint32_t completed_count = batch->completed_count;
+    for (uint32_t i = span->first; i < span->first + span->count; i++) {
+        WbfsReadRequest* request = batch->pieces[i].request;
+        if (err != e_wbfs_success && request->result == e_wbfs_success) request->result = err;
+        if (--request->pending == 0) batch->completed[batch->completed_count++] = request;
+    }
+    if (batch->completed_count != completed_count) wbfs_cond_broadcast(&batch->finished);
+}
+
+/*
+ * Works through the spans until there are none left to hand out, expects the lock to be held. Spans are taken
+ * in file order, so even a single worker reads the file front to back
+ */
+static void wbfs_batch_work(WbfsBatch* batch)
+{
+    while (batch->next_span < batch->span_count) {
+        const WbfsBatchSpan* span = batch->spans + batch->next_span++;
+        wbfs_mutex_unlock(&batch->lock);
+        wbfs_enum err = wbfs_batch_read_span(batch, span);
+        wbfs_mutex_lock(&batch->lock);
+        wbfs_batch_complete_span(batch, span, err);
+    }
+}
+
+static void wbfs_batch_worker(void* argument)
+{
+    WbfsBatch* batch = (WbfsBatch*)argument;
+
+    wbfs_mutex_lock(&batch->lock);
+    while (!batch->stopping) {
+        if (batch->next_span >= batch->span_count) {
+            wbfs_cond_wait(&batch->wake, &batch->lock);
+            continue;
+        }
+        wbfs_batch_work(batch);
+    }
+    wbfs_mutex_unlock(&batch->lock);
+}
+
+#ifdef WBFS_BATCH_URING
+static void wbfs_batch_ring_close(WbfsBatchRing* ring)
+{
+    if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq && ring->cq != MAP_FAILED && ring->cq != ring->sq) munmap(ring->cq, ring->cq_size);
+    if (ring->sq && ring->sq != MAP_FAILED) munmap(ring->sq, ring->sq_size);
+    if (ring->fd >= 0) close(ring->fd);
+    memset(ring, 0, sizeof(WbfsBatchRing));
+    ring->fd = -1;
+}
+
+/*
+ * Sets up the ring with the raw system calls. If the kernel is too old, or io_uring has been turned off, the
+ * descriptor stays at -1 and the batch runs on threads instead
+ */
+static void wbfs_batch_ring_open(WbfsBatchRing* ring, uint32_t capacity)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(WbfsBatchRing));
+    uint32_t entries = capacity < BATCH_MAX_RING ? capacity : BATCH_MAX_RING;
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        ring->fd = -1;
+        return;
+    }
+
+    ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Newer kernels share one mapping between both rings
+    int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) ring->sq_size = ring->cq_size = ring->sq_size > ring->cq_size ? ring->sq_size : ring->cq_size;
+    ring->sq = mmap(0, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                    IORING_OFF_SQ_RING);
+    ring->cq = single ? ring->sq
+                      : mmap(0, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                             IORING_OFF_CQ_RING);
+    ring->sqes = mmap(0, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->sq == MAP_FAILED || ring->cq == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        wbfs_batch_ring_close(ring);
+        return;
+    }
+
+    uint8_t* sq = (uint8_t*)ring->sq;
+    uint8_t* cq = (uint8_t*)ring->cq;
+    ring->entries = params.sq_entries;
+    ring->sq_tail = (uint32_t*)(sq + params.sq_off.tail);
+    ring->sq_mask = (uint32_t*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (uint32_t*)(sq + params.sq_off.array);
+    ring->cq_head = (uint32_t*)(cq + params.cq_off.head);
+    ring->cq_tail = (uint32_t*)(cq + params.cq_off.tail);
+    ring->cq_mask = (uint32_t*)(cq + params.cq_off.ring_mask);
+    ring->cqes = cq + params.cq_off.cqes;
+}
+
+/*
+ * Hands the kernel as many of the remaining spans as there are free slots. Anything the kernel turns down is
+ * taken back off the ring and read through the backend instead
+ */
+static void wbfs_batch_ring_push(WbfsBatch* batch)
+{
+    WbfsBatchRing* ring = &batch->ring;
+    struct io_uring_sqe* sqes = (struct io_uring_sqe*)ring->sqes;
+    struct iovec* iovecs = (struct iovec*)batch->iovecs;
+    uint32_t tail = *ring->sq_tail;
+    uint32_t first_span = batch->next_span;
+    uint32_t count = 0;
+    while (batch->next_span < batch->span_count && ring->in_flight + count < ring->entries) {
+        WbfsBatchSpan* span = batch->spans + batch->next_span;
+        for (uint32_t i = span->first; i < span->first + span->count; i++) {
+            iovecs[i].iov_base = batch->pieces[i].data;
+            iovecs[i].iov_len = (size_t)batch->pieces[i].size;
+        }
+
+        // A span that runs off the end of one piece of a split file comes back short, and gets finished
+        // through the backend the same as any other short read
+        WbfsIo* io = &batch->disc->wbfs->io;
+        intptr_t handle = -1;
+        uint64_t handle_offset = 0;
+        uint64_t handle_left;
+        io->locate(io, span->offset, &handle, &handle_offset, &handle_left);
+
+        uint32_t index = (tail + count) & *ring->sq_mask;
+        struct io_uring_sqe* sqe = sqes + index;
+        memset(sqe, 0, sizeof(struct io_uring_sqe));
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = (int)handle;
+        sqe->off = handle_offset;
+        sqe->addr = (uint64_t)(uintptr_t)(iovecs + span->first);
+        sqe->len = span->count;
+        sqe->user_data = batch->next_span;
+        ring->sq_array[index] = index;
+#ifdef WBFS_STATS
+        if (batch->disc->wbfs->stats) span->started_ns = wbfs_thread_time_ns();
+#endif
+        batch->next_span++;
+        count++;
+    }
+    if (count == 0) return;
+
+    __atomic_store_n(ring->sq_tail, tail + count, __ATOMIC_RELEASE);
+    long submitted = syscall(__NR_io_uring_enter, ring->fd, count, 0, 0, NULL, 0);
+    if (submitted < 0) submitted = 0;
+    ring->in_flight += (uint32_t)submitted;
+    if ((uint32_t)submitted == count) return;
+
+    // The kernel only ever takes entries from the head, so the ones it didn't take are the last few
+    __atomic_store_n(ring->sq_tail, tail + (uint32_t)submitted, __ATOMIC_RELEASE);
+    for (uint32_t i = first_span + (uint32_t)submitted; i < first_span + count; i++) {
+        wbfs_enum err = wbfs_batch_read_span(batch, batch->spans + i);
+        wbfs_mutex_lock(&batch->lock);
+        wbfs_batch_complete_span(batch, batch->spans + i, err);
+        wbfs_mutex_unlock(&batch->lock);
+    }
+}
+
+/*
+ * Collects whatever the kernel has finished and keeps the ring topped up. A span that comes back short or
+ * failed is read again through the backend, which knows how to carry on from a short read
+ */
+static void wbfs_batch_ring_poll(WbfsBatch* batch, int wait)
+{
+    WbfsBatchRing* ring = &batch->ring;
+    const struct io_uring_cqe* cqes = (const struct io_uring_cqe*)ring->cqes;
+    for (;;) {
+        uint32_t head = *ring->cq_head;
+        uint32_t tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            const struct io_uring_cqe* cqe = cqes + (head & *ring->cq_mask);
+            const WbfsBatchSpan* span = batch->spans + cqe->user_data;
+            wbfs_enum err = e_wbfs_success;
+            if (cqe->res < 0 || (uint64_t)cqe->res != span->size) err = wbfs_batch_read_span(batch, span);
+#ifdef WBFS_STATS
+            else if (batch->disc->wbfs->stats) {
+                wbfs_stats_record_read(batch->disc->wbfs->stats, span->offset, span->size,
+                                       wbfs_thread_time_ns() - span->started_ns, 0);
+            }
+#endif
+            wbfs_mutex_lock(&batch->lock);
+            wbfs_batch_complete_span(batch, span, err);
+            wbfs_mutex_unlock(&batch->lock);
+            ring->in_flight--;
+            head++;
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+        wbfs_batch_ring_push(batch);
+        if (!wait || batch->completed_count > batch->reaped_count || ring->in_flight == 0) return;
+        syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+}
+#endif
+
+wbfs_enum wbfs_batch_init(WbfsBatch* batch, WiiDisc* disc, void* memory, uint32_t capacity,
+                          uint32_t thread_count, uint32_t flags)
+{
+    if (!batch || !disc || !disc->wbfs || !memory) return e_wbfs_segfault;
+    if (!disc->wbfs->io.read_at) return e_wbfs_invalid_io;
+    if (capacity == 0) return e_wbfs_batch_full;
+
+    memset(batch, 0, sizeof(WbfsBatch));
+    batch->disc = disc;
+    batch->capacity = capacity;
+    batch->thread_count = thread_count ? thread_count : wbfs_thread_hardware_count();
+    if (batch->thread_count > WBFS_MAX_THREADS) batch->thread_count = WBFS_MAX_THREADS;
+    batch->pieces = (WbfsBatchPiece*)memory;
+    batch->spans = (WbfsBatchSpan*)(batch->pieces + capacity);
+    batch->completed = (WbfsReadRequest**)(batch->spans + capacity);
+    batch->iovecs = batch->completed + capacity;
+    batch->ring.fd = -1;
+
+    wbfs_mutex_init(&batch->lock);
+    wbfs_cond_init(&batch->wake);
+    wbfs_cond_init(&batch->finished);
+
+    // The ring reads from the file descriptors directly, so it's only any use with backends that can say
+    // which descriptor each part of the file is in
+#ifdef WBFS_BATCH_URING
+    if (!(flags & WBFS_BATCH_NO_URING) && wbfs_io_is_file(&disc->wbfs->io)) {
+        wbfs_batch_ring_open(&batch->ring, capacity);
+    }
+    if (batch->ring.fd >= 0) return e_wbfs_success;
+#else
+    (void)flags;
+#endif
+
+    // Without a ring the workers are started once and wait for spans, if none will start submit reads inline
+    while (batch->threads_started < batch->thread_count &&
+           wbfs_thread_create(batch->threads + batch->threads_started, wbfs_batch_worker, batch) == 0) {
+        batch->threads_started++;
+    }
+    return e_wbfs_success;
+}
+
+wbfs_enum wbfs_batch_add(WbfsBatch* batch, WbfsReadRequest* request)
+{
+    if (!batch || !batch->pieces || !request) return e_wbfs_segfault;
+    if (!request->data && request->size) return e_wbfs_segfault;
+    if (batch->running) return e_wbfs_batch_busy;
+
+    // A request always takes at least one piece, even an empty one, so it still comes back out of reap
+    uint32_t first = batch->piece_count;
+    uint64_t queued = 0;
+    do {
+        if (batch->piece_count == batch->capacity) {
+            batch->piece_count = first;
+            return e_wbfs_batch_full;
+        }
+
+        uint64_t file_address = 0;
+        uint64_t run_left = 0;
+        if (request->size) {
+            uint64_t address = request->address + queued;
+            wbfs_enum err = wbfs_disc_locate_run(batch->disc, address, request->size - queued, &file_address,
+                                                 &run_left);
+            if (err != e_wbfs_success) {
+                batch->piece_count = first;
+                return err;
+            }
+        }
+
+        WbfsBatchPiece* piece = batch->pieces + batch->piece_count++;
+        piece->offset = file_address;
+        piece->size = (request->size - queued) < run_left ? request->size - queued : run_left;
+        piece->data = (uint8_t*)request->data + queued;
+        piece->request = request;
+        queued += piece->size;
+    } while (queued < request->size);
+
+    request->pending = batch->piece_count - first;
+    request->result = e_wbfs_success;
+    batch->request_count++;
+    return e_wbfs_success;
+}
+
+wbfs_enum wbfs_batch_submit(WbfsBatch* batch)
+{
+    if (!batch || !batch->pieces) return e_wbfs_segfault;
+    if (batch->running) return e_wbfs_batch_busy;
+    if (batch->request_count == 0) return e_wbfs_success;
+
+    // With the pieces in file order, anything that carries straight on from the last piece joins its span. The
+    // workers are idle with no spans to look at until the count is handed over below
+    qsort(batch->pieces, batch->piece_count, sizeof(WbfsBatchPiece), wbfs_batch_piece_compare);
+    uint32_t span_count = 0;
+    for (uint32_t i = 0; i < batch->piece_count; i++) {
+        const WbfsBatchPiece* piece = batch->pieces + i;
+        WbfsBatchSpan* span = span_count ? batch->spans + span_count - 1 : 0;
+        if (span && span->offset + span->size == piece->offset && span->count < BATCH_MAX_MERGE &&
+            span->size + piece->size <= BATCH_MAX_SPAN) {
+            span->count++;
+            span->size += piece->size;
+            continue;
+        }
+
+        span = batch->spans + span_count++;
+        span->first = i;
+        span->count = 1;
+        span->offset = piece->offset;
+        span->size = piece->size;
+    }
+
+    wbfs_mutex_lock(&batch->lock);
+    batch->completed_count = 0;
+    batch->reaped_count = 0;
+    batch->running = 1;
+    batch->next_span = 0;
+    batch->span_count = span_count;
+
+#ifdef WBFS_BATCH_URING
+    if (batch->ring.fd >= 0) {
+        wbfs_mutex_unlock(&batch->lock);
+        wbfs_batch_ring_push(batch);
+        return e_wbfs_success;
+    }
+#endif
+
+    if (batch->threads_started) {
+        wbfs_cond_broadcast(&batch->wake);
+    } else {
+        wbfs_batch_work(batch);
+    }
+    wbfs_mutex_unlock(&batch->lock);
+    return e_wbfs_success;
+}
+
+uint32_t wbfs_batch_reap(WbfsBatch* batch, WbfsReadRequest** completed, uint32_t max_count, int wait)
+{
+    if (!batch || !completed || !batch->running) return 0;
+
+#ifdef WBFS_BATCH_URING
+    if (batch->ring.fd >= 0) wbfs_batch_ring_poll(batch, wait);
+#endif
+
+    wbfs_mutex_lock(&batch->lock);
+    // The ring has already waited above, only the workers signal
+    while (wait && batch->ring.fd < 0 && batch->completed_count == batch->reaped_count &&
+           batch->reaped_count < batch->request_count) {
+        wbfs_cond_wait(&batch->finished, &batch->lock);
+    }
+    uint32_t count = 0;
+    while (count < max_count && batch->reaped_count < batch->completed_count) {
+        completed[count++] = batch->completed[batch->reaped_count++];
+    }
+    // Everything is back, so the workers have run out of spans and the batch can take more
+    if (batch->reaped_count == batch->request_count) {
+        batch->piece_count = 0;
+        batch->span_count = 0;
+        batch->next_span = 0;
+        batch->request_count = 0;
+        batch->running = 0;
+    }
+    wbfs_mutex_unlock(&batch->lock);
+    return count;
+}
+
+void wbfs_batch_destroy(WbfsBatch* batch)
+{
+    if (!batch || !batch->pieces) return;
+
+    // The kernel and the workers are still writing into the requests' buffers until they've been reaped
+    WbfsReadRequest* completed[16];
+    while (batch->running) wbfs_batch_reap(batch, completed, 16, 1);
+
+#ifdef WBFS_BATCH_URING
+    if (batch->ring.fd >= 0) wbfs_batch_ring_close(&batch->ring);
+#endif
+    wbfs_mutex_lock(&batch->lock);
+    batch->stopping = 1;
+    wbfs_cond_broadcast(&batch->wake);
+    wbfs_mutex_unlock(&batch->lock);
+    for (uint32_t i = 0; i < batch->threads_started; i++) wbfs_thread_join(batch->threads + i);
+
+    wbfs_cond_destroy(&batch->wake);
+    wbfs_cond_destroy(&batch->finished);
+    wbfs_mutex_destroy(&batch->lock);
+    batch->pieces = 0;
+}
+
+wbfs_enum wbfs_disc_read_batch(WiiDisc* disc, WbfsReadRequest* requests, uint32_t count, void* memory,
+                               uint32_t capacity, uint32_t thread_count)
+{
+    if (!requests && count) return e_wbfs_segfault;
+
+    WbfsBatch batch;
+    wbfs_enum err = wbfs_batch_init(&batch, disc, memory, capacity, thread_count, 0);
+    if (err != e_wbfs_success) return err;
+    for (uint32_t i = 0; i < count && err == e_wbfs_success; i++) err = wbfs_batch_add(&batch, requests + i);
+    if (err == e_wbfs_success) err = wbfs_batch_submit(&batch);
+
+    // Every request gets reaped even after an error, the first error found is the one handed back
+    WbfsReadRequest* completed[16];
+    uint32_t reaped;
+    while (batch.running && (reaped = wbfs_batch_reap(&batch, completed, 16, 1)) != 0) {
+        for (uint32_t i = 0; i < reaped; i++) {
+            if (err == e_wbfs_success) err = (wbfs_enum)completed[i]->result;
+        }
+    }
+    wbfs_batch_destroy(&batch);
+    return err;
+}
@@ -0,0 +1,446 @@
+#include <string.h>
+
+#include "wbfs.h"
+
+// A built file always uses 512 byte host sectors, a compacted one keeps the host sectors of the source
+#define HD_SECTOR_SHIFT (9)
+#define HD_SECTOR_SIZE (1u << HD_SECTOR_SHIFT)
+#define WBFS_HEADER_SIZE (12)
+
+// libwbfs sizes every disc's sector table for two layers of this many wii sectors
+#define WII_SECTOR_SHIFT (15)
+#define WII_DISC_SECTOR_COUNT (143432ull * 2)
+
+// The disc info starts with a copy of the disc header, then the sector table
+#define DISC_HEADER_COPY_SIZE (0x100)
+
+// Everything up to the end of the region settings belongs to the disc rather than a partition
+#define DISC_SYSTEM_AREA (0x50000)
+#define PARTITION_TABLE_COUNT (4)
+#define PARTITION_TABLE_MAX_ENTRIES (64)
+
+// The apploader follows the boot header and bi2, its header gives the size of the code and of the trailer
+#define APPLOADER_OFFSET (0x2440)
+#define APPLOADER_HEADER_SIZE (0x20)
+#define APPLOADER_SIZE (0x14)
+#define APPLOADER_TRAILER_SIZE (0x18)
+
+// File system table entries are read in batches this big
+#define FST_ENTRY_SIZE (12)
+#define FST_BATCH (256)
+
+/*
+ * Where everything goes in the built file. Wbfs sector 0 holds the header in the first host sector, the disc
+ * infos straight after it, and the free block map right at the end of it. Data starts at wbfs sector 1
+ */
+typedef struct WbfsBuildLayout {
+    uint8_t hd_shift;
+    uint64_t hd_sector_size;
+    uint8_t shift;
+    uint64_t sector_size;
+    uint32_t sectors_per_disc;  // Entries in the sector table
+    uint32_t sector_count;      // Wbfs sectors in the whole file, including the header sector
+    uint64_t disc_info_size;
+    uint64_t free_map_size;
+} WbfsBuildLayout;
+
+typedef struct WbfsBuild {
+    WbfsBuildLayout layout;
+    WiiDisc* disc;
+    uint64_t disc_size;
+    uint32_t next_sector;  // File sector the next used sector goes to
+
+    // Pieces of the working memory
+    uint8_t* header;
+    uint8_t* disc_info;
+    uint16_t* table;  // Inside the disc info, host order until it's written
+    uint8_t* free_map;
+    uint8_t* copy;
+} WbfsBuild;
+
+static int wbfs_build_layout(uint8_t shift, WbfsBuildLayout* layout)
+{
+    if (shift < WII_SECTOR_SHIFT || shift > 31) return 0;
+
+    memset(layout, 0, sizeof(WbfsBuildLayout));
+    layout->hd_shift = HD_SECTOR_SHIFT;
+    layout->hd_sector_size = HD_SECTOR_SIZE;
+    layout->shift = shift;
+    layout->sector_size = 1ull << shift;
+    layout->sectors_per_disc = (uint32_t)(WII_DISC_SECTOR_COUNT >> (shift - WII_SECTOR_SHIFT));
+
+    // Room for the header sector and a full disc, rounded up so the free map is whole 32 bit words
+    layout->sector_count = (layout->sectors_per_disc + 1 + 31) & ~31u;
+    layout->disc_info_size = (DISC_HEADER_COPY_SIZE + layout->sectors_per_disc * sizeof(uint16_t) +
+                              HD_SECTOR_SIZE - 1) & ~(uint64_t)(HD_SECTOR_SIZE - 1);
+    layout->free_map_size = wbfs_helper_free_map_size(HD_SECTOR_SHIFT, layout->sector_count);
+
+    // Sector numbers have to fit the 16 bit table, and the header pieces have to fit in the first sector
+    if (layout->sector_count > 0xFFFF) return 0;
+    if (HD_SECTOR_SIZE + layout->disc_info_size + layout->free_map_size > layout->sector_size) return 0;
+    return 1;
+}
+
+/*
+ * A compacted file keeps the sector sizes and capacity of the one it came from, so every disc info stays the
+ * same size and it can take as many discs as before
+ */
+static int wbfs_build_compact_layout(Wbfs* wbfs, WbfsBuildLayout* layout)
+{
+    memset(layout, 0, sizeof(WbfsBuildLayout));
+    layout->hd_shift = wbfs->file_header->hd_sector_shift;
+    layout->hd_sector_size = wbfs->hd_sector_size;
+    layout->shift = wbfs->file_header->wbfs_sector_shift;
+    layout->sector_size = wbfs->wbfs_sector_size;
+    layout->sectors_per_disc = wbfs->wbfs_sectors_per_disc;
+    layout->sector_count =
+        (uint32_t)(wbfs->file_header->hd_sector_count >> (layout->shift - layout->hd_shift));
+    layout->disc_info_size = wbfs->disc_info_size;
+    layout->free_map_size = wbfs_helper_free_map_size(layout->hd_shift, layout->sector_count);
+    return layout->sector_count > 1;
+}
+
+size_t wbfs_helper_build_size(uint8_t wbfs_sector_shift)
+{
+    WbfsBuildLayout layout;
+    if (!wbfs_build_layout(wbfs_sector_shift, &layout)) return 0;
+    return HD_SECTOR_SIZE + layout.disc_info_size + layout.free_map_size + layout.sector_size;
+}
+
+size_t wbfs_helper_compact_size(Wbfs* wbfs)
+{
+    WbfsBuildLayout layout;
+    if (!wbfs || wbfs->valid != WBFS_MAGIC || !wbfs_build_compact_layout(wbfs, &layout)) return 0;
+    return layout.hd_sector_size + layout.disc_info_size + layout.free_map_size + layout.sector_size +
+           wbfs_helper_sector_table_size(wbfs);
+}
+
+// Marks the wbfs sectors covering a range of the disc as in use
+static void wbfs_build_mark(WbfsBuild* build, uint64_t address, uint64_t size)
+{
+    if (size == 0) return;
+    uint64_t first = address >> build->layout.shift;
+    uint64_t last = (address + size - 1) >> build->layout.shift;
+    for (uint64_t i = first; i <= last && i < build->layout.sectors_per_disc; i++) build->table[i] = 1;
+}
+
+// Marks the clusters holding a range of decrypted partition data as in use
+static void wbfs_build_mark_data(WbfsBuild* build, const WiiPartition* partition, uint64_t address,
+                                 uint64_t size)
+{
+    if (size == 0) return;
+    uint64_t first = address / WII_CLUSTER_DATA_SIZE;
+    uint64_t last = (address + size - 1) / WII_CLUSTER_DATA_SIZE;
+    uint64_t cluster_count = wbfs_partition_cluster_count(partition);
+    if (first >= cluster_count) return;
+    if (last >= cluster_count) last = cluster_count - 1;
+    wbfs_build_mark(build, partition->data_offset + first * WII_CLUSTER_SIZE,
+                    (last - first + 1) * WII_CLUSTER_SIZE);
+}
+
+/*
+ * Marks the parts of a partition that are actually used, the partition header area, the boot files and every
+ * file in the file system table. The raw table is walked in batches so none of it has to be kept
+ */
+static wbfs_enum wbfs_build_mark_files(WbfsBuild* build, const WiiPartition* partition)
+{
+    uint8_t apploader[APPLOADER_HEADER_SIZE];
+    wbfs_enum err = wbfs_partition_read(partition, apploader, APPLOADER_OFFSET, sizeof(apploader));
+    if (err != e_wbfs_success) return err;
+    wbfs_build_mark_data(build, partition, 0,
+                         APPLOADER_OFFSET + APPLOADER_HEADER_SIZE +
+                           (uint64_t)wbfs_helper_read_be32(apploader + APPLOADER_SIZE) +
+                           wbfs_helper_read_be32(apploader + APPLOADER_TRAILER_SIZE));
+
+    WiiFst fst;
+    err = wbfs_fst_parse_header(&fst, partition);
+    if (err != e_wbfs_success) return err;
+    wbfs_build_mark_data(build, partition, fst.dol_offset, fst.dol_size);
+    wbfs_build_mark_data(build, partition, fst.fst_offset, fst.fst_size);
+
+    uint8_t raw[FST_BATCH * FST_ENTRY_SIZE];
+    for (uint32_t i = 0; i < fst.entry_count; i += FST_BATCH) {
+        uint32_t count = fst.entry_count - i < FST_BATCH ? fst.entry_count - i : FST_BATCH;
+        err = wbfs_partition_read(partition, raw, fst.fst_offset + (uint64_t)i * FST_ENTRY_SIZE,
+                                  (uint64_t)count * FST_ENTRY_SIZE);
+        if (err != e_wbfs_success) return err;
+
+        for (uint32_t j = 0; j < count; j++) {
+            const uint8_t* entry = raw + j * FST_ENTRY_SIZE;
+            if (entry[0] != 0) continue;
+            wbfs_build_mark_data(build, partition, (uint64_t)wbfs_helper_read_be32(entry + 4) << 2,
+                                 wbfs_helper_read_be32(entry + 8));
+        }
+    }
+    return e_wbfs_success;
+}
+
+static wbfs_enum wbfs_build_mark_partition(WbfsBuild* build, uint64_t address)
+{
+    WiiPartition partition;
+    wbfs_enum err = wbfs_partition_open(&partition, build->disc, address);
+
+    // If the partition can't be decrypted there's no telling what's used, so keep all of it
+    if (err == e_wbfs_unsupported_key) {
+        wbfs_build_mark(build, address, partition.data_offset + partition.data_size - address);
+        return e_wbfs_success;
+    }
+    if (err != e_wbfs_success) return err;
+
+    // The ticket, TMD, certificates and H3 table all sit before the data
+    wbfs_build_mark(build, address, partition.data_offset - address);
+
+    // Same for a partition whose files can't be made sense of
+    if (wbfs_build_mark_files(build, &partition) != e_wbfs_success) {
+        wbfs_build_mark(build, partition.data_offset, partition.data_size);
+    }
+    return e_wbfs_success;
+}
+
+static wbfs_enum wbfs_build_mark_disc(WbfsBuild* build)
+{
+    wbfs_build_mark(build, 0, DISC_SYSTEM_AREA);
+
+    WiiDiscPartitionInfoEntry info[PARTITION_TABLE_COUNT];
+    wbfs_enum err = wbfs_disc_parse_partition_info(build->disc, info);
+    if (err != e_wbfs_success) return err;
+
+    for (uint32_t i = 0; i < PARTITION_TABLE_COUNT; i++) {
+        if (info[i].partition_count > PARTITION_TABLE_MAX_ENTRIES) return e_wbfs_invalid_partition;
+        for (uint32_t j = 0; j < info[i].partition_count; j++) {
+            WiiDiscPartitionTableEntry entry;
+            err = wbfs_disc_parse_partition_table(build->disc, &entry,
+                                                  info[i].offset + j * sizeof(WiiDiscPartitionTableEntry));
+            if (err != e_wbfs_success) return err;
+            err = wbfs_build_mark_partition(build, entry.offset);
+            if (err != e_wbfs_success) return err;
+        }
+    }
+    return e_wbfs_success;
+}
+
+/*
+ * Reads part of the source disc. A plain image can be read straight through, but a disc from another wbfs file
+ * may not store every sector the new layout covers, anything it doesn't have reads back as zeros
+ */
+static wbfs_enum wbfs_build_read(WbfsBuild* build, uint8_t* data, uint64_t address, uint64_t size)
+{
+    WiiDisc* disc = build->disc;
+    if (disc->plain_size) return wbfs_disc_read_buffer(disc, data, address, size);
+
+    uint64_t source_sector_size = disc->wbfs->wbfs_sector_size;
+    uint64_t done = 0;
+    while (done < size) {
+        uint64_t local_address = address + done;
+        uint64_t chunk = source_sector_size - (local_address & (source_sector_size - 1));
+        if (chunk > size - done) chunk = size - done;
+
+        uint64_t sector = local_address >> disc->wbfs->file_header->wbfs_sector_shift;
+        if (!wbfs_disc_sector_stored(disc, (uint32_t)sector)) {
+            memset(data + done, 0, chunk);
+        } else {
+            wbfs_enum err = wbfs_disc_read_buffer(disc, data + done, local_address, chunk);
+            if (err != e_wbfs_success) return err;
+        }
+        done += chunk;
+    }
+    return e_wbfs_success;
+}
+
+/*
+ * A disc from another wbfs file reads back zeros wherever it doesn't store anything, so a sector of the new
+ * layout is only worth writing if the source stores some part of it
+ */
+static int wbfs_build_source_stored(const WbfsBuild* build, uint32_t sector)
+{
+    WiiDisc* disc = build->disc;
+    if (disc->plain_size) return 1;
+
+    uint8_t source_shift = disc->wbfs->file_header->wbfs_sector_shift;
+    uint64_t first = ((uint64_t)sector << build->layout.shift) >> source_shift;
+    uint64_t last = (((uint64_t)sector + 1) << build->layout.shift) - 1;
+    for (uint64_t i = first; i <= (last >> source_shift) && i < disc->sector_count; i++) {
+        if (wbfs_disc_sector_stored(disc, (uint32_t)i)) return 1;
+    }
+    return 0;
+}
+
+static void wbfs_build_write_be32(uint8_t* p, uint32_t value)
+{
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+// Splits the working memory up and clears the header, disc info and free map
+static void wbfs_build_place(WbfsBuild* build, void* memory)
+{
+    const WbfsBuildLayout* layout = &build->layout;
+    build->header = (uint8_t*)memory;
+    build->disc_info = build->header + layout->hd_sector_size;
+    build->table = (uint16_t*)(build->disc_info + DISC_HEADER_COPY_SIZE);
+    build->free_map = build->disc_info + layout->disc_info_size;
+    build->copy = build->free_map + layout->free_map_size;
+    memset(memory, 0, layout->hd_sector_size + layout->disc_info_size + layout->free_map_size);
+    build->next_sector = 1;
+}
+
+/*
+ * Writes one disc out. The sectors it uses are worked out, then numbered in disc order from the next free file
+ * sector so the copy is one forward pass. The disc info goes to info_offset
+ */
+static wbfs_enum wbfs_build_disc(WbfsBuild* build, WbfsIo* out, uint64_t info_offset)
+{
+    const WbfsBuildLayout* layout = &build->layout;
+    WiiDisc* disc = build->disc;
+    if (!disc->plain_size) {
+        wbfs_enum err = wbfs_disc_parse_sector_table(disc);
+        if (err != e_wbfs_success) return err;
+    }
+    build->disc_size = wbfs_disc_iso_size(disc);
+    memset(build->disc_info, 0, layout->disc_info_size);
+
+    wbfs_enum err = wbfs_build_mark_disc(build);
+    if (err != e_wbfs_success) return err;
+
+    // The last sector a wbfs source stores is kept whether it's used or not, it's what decides how large the
+    // disc image is. Sectors the source doesn't store are left out, they'd only be zeros
+    if (!disc->plain_size && disc->sector_count > 0) {
+        uint64_t source_sector_size = disc->wbfs->wbfs_sector_size;
+        wbfs_build_mark(build, (uint64_t)(disc->sector_count - 1) * source_sector_size, source_sector_size);
+    }
+    for (uint32_t i = 0; i < layout->sectors_per_disc; i++) {
+        if (build->table[i] && !wbfs_build_source_stored(build, i)) build->table[i] = 0;
+        if (!build->table[i]) continue;
+        if (build->next_sector >= layout->sector_count || build->next_sector > 0xFFFF) {
+            return e_wbfs_out_of_space;
+        }
+        build->table[i] = (uint16_t)build->next_sector++;
+    }
+
+    // Disc info, the table goes out big endian. A wbfs source already has a copy of the disc header, which is
+    // carried over as it is
+    if (disc->plain_size) {
+        err = wbfs_disc_read_buffer(disc, build->disc_info, 0, DISC_HEADER_COPY_SIZE);
+        if (err != e_wbfs_success) return err;
+    } else if (disc->wbfs->io.read_at(&disc->wbfs->io, build->disc_info, disc->wbfs_offset,
+                                      DISC_HEADER_COPY_SIZE) != 0) {
+        return e_wbfs_failed_file_read;
+    }
+    wbfs_helper_encode_be16(build->table, build->table, layout->sectors_per_disc);
+    if (out->write_at(out, build->disc_info, info_offset, layout->disc_info_size) != 0) {
+        return e_wbfs_failed_file_write;
+    }
+
+    // Copy the used sectors across, anything past the end of the source is padded with zeros
+    for (uint32_t i = 0; i < layout->sectors_per_disc; i++) {
+        uint8_t* table_entry = (uint8_t*)build->table + i * 2;
+        uint32_t lookup = (uint32_t)table_entry[0] << 8 | table_entry[1];
+        if (lookup == 0) continue;
+
+        uint64_t address = (uint64_t)i << layout->shift;
+        uint64_t size = address < build->disc_size ? build->disc_size - address : 0;
+        if (size > layout->sector_size) size = layout->sector_size;
+        memset(build->copy + size, 0, layout->sector_size - size);
+        err = wbfs_build_read(build, build->copy, address, size);
+        if (err != e_wbfs_success) return err;
+
+        if (out->write_at(out, build->copy, (uint64_t)lookup << layout->shift, layout->sector_size) != 0) {
+            return e_wbfs_failed_file_write;
+        }
+    }
+    return e_wbfs_success;
+}
+
+/*
+ * Writes the header and the free block map once every disc is out, then cuts the file off after the last used
+ * sector. disc_count discs are in the first slots of the disc table. If the output can be read the map is read
+ * back through the header the same way libwbfs finds it, so a map other tools would miss is caught here
+ */
+static wbfs_enum wbfs_build_finish(WbfsBuild* build, WbfsIo* out, uint32_t disc_count)
+{
+    const WbfsBuildLayout* layout = &build->layout;
+    wbfs_build_write_be32(build->header, WBFS_MAGIC);
+    wbfs_build_write_be32(build->header + 4, layout->sector_count << (layout->shift - layout->hd_shift));
+    build->header[8] = layout->hd_shift;
+    build->header[9] = layout->shift;
+    memset(build->header + WBFS_HEADER_SIZE, 1, disc_count);
+
+    // A set bit in the free map is a free block. libwbfs only hands out blocks from whole 32 bit words of the
+    // map, so if the sector count isn't a multiple of 32 the last few are left marked as used
+    uint32_t free_count = 0;
+    uint32_t free_end = layout->sector_count / 32 * 32 + 1;
+    if (free_end > layout->sector_count) free_end = layout->sector_count;
+    for (uint32_t block = build->next_sector; block < free_end; block++) {
+        free_count += (uint32_t)wbfs_helper_free_map_set(build->free_map, layout->free_map_size, block);
+    }
+
+    uint64_t free_map_offset =
+        wbfs_helper_free_map_offset(layout->hd_shift, layout->shift, layout->sector_count);
+    if (out->write_at(out, build->header, 0, layout->hd_sector_size) != 0 ||
+        out->write_at(out, build->free_map, free_map_offset, layout->free_map_size) != 0) {
+        return e_wbfs_failed_file_write;
+    }
+
+    // Make sure the file covers the header sector even if nothing was used
+    uint64_t file_size = (uint64_t)build->next_sector << layout->shift;
+    if (out->set_size(out, file_size) != 0) return e_wbfs_failed_file_write;
+    if (!out->read_at) return e_wbfs_success;
+
+    // The copy buffer is a whole wbfs sector, so it has room for the map
+    Wbfs written;
+    WbfsFileHeader written_header;
+    uint32_t written_free = 0;
+    wbfs_enum err = wbfs_file_header_parse_io(&written, &written_header, out);
+    if (err == e_wbfs_success) err = wbfs_file_count_free(&written, build->copy, &written_free);
+    if (err != e_wbfs_success) return err;
+    return written_free == free_count ? e_wbfs_success : e_wbfs_failed_file_write;
+}
+
+wbfs_enum wbfs_build_from_disc(WiiDisc* disc, WbfsIo* out, uint8_t wbfs_sector_shift, void* memory)
+{
+    if (!disc || !disc->wbfs || !out || !memory) return e_wbfs_segfault;
+    if (!out->write_at || !out->set_size) return e_wbfs_invalid_io;
+
+    WbfsBuild build;
+    memset(&build, 0, sizeof(WbfsBuild));
+    if (!wbfs_build_layout(wbfs_sector_shift, &build.layout)) return e_wbfs_invalid_sector_size;
+    wbfs_build_place(&build, memory);
+    build.disc = disc;
+
+    if (out->set_size(out, 0) != 0) return e_wbfs_failed_file_write;
+    wbfs_enum err = wbfs_build_disc(&build, out, build.layout.hd_sector_size);
+    if (err != e_wbfs_success) return err;
+    return wbfs_build_finish(&build, out, 1);
+}
+
+wbfs_enum wbfs_file_compact(Wbfs* wbfs, WbfsIo* out, void* memory)
+{
+    if (!wbfs || !out || !memory) return e_wbfs_segfault;
+    if (!wbfs->file_header || !wbfs->file_header->disc_table) return e_wbfs_segfault;
+    if (wbfs->valid != WBFS_MAGIC) return e_wbfs_invalid_handle;
+    if (!out->write_at || !out->set_size) return e_wbfs_invalid_io;
+
+    WbfsBuild build;
+    memset(&build, 0, sizeof(WbfsBuild));
+    if (!wbfs_build_compact_layout(wbfs, &build.layout)) return e_wbfs_invalid_sector_size;
+    wbfs_build_place(&build, memory);
+    uint16_t* source_table = (uint16_t*)(build.copy + build.layout.sector_size);
+
+    // Every disc goes into the next slot along, whatever slot it had before, so the discs and their sectors
+    // both end up packed at the front of the file
+    if (out->set_size(out, 0) != 0) return e_wbfs_failed_file_write;
+    for (uint32_t i = 0; i < wbfs->wii_disc_count; i++) {
+        WiiDisc disc;
+        memset(&disc, 0, sizeof(WiiDisc));
+        disc.wbfs_sector_lookup = source_table;
+        wbfs_enum err = wbfs_disc_get_offset(&disc, wbfs, i);
+        if (err != e_wbfs_success) return err;
+
+        build.disc = &disc;
+        err = wbfs_build_disc(&build, out, build.layout.hd_sector_size + i * build.layout.disc_info_size);
+        if (err != e_wbfs_success) return err;
+    }
+    return wbfs_build_finish(&build, out, wbfs->wii_disc_count);
+}
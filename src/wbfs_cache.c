@@ -0,0 +1,215 @@
+#include <string.h>
+
+#include "wbfs.h"
+
+#define CACHE_EMPTY (0)
+#define CACHE_LOADING (1)
+#define CACHE_READY (2)
+
+// Set on a slot filled by the read ahead, cleared the first time it's read so prefetch hits can be counted
+#define CACHE_PREFETCHED (0x80)
+#define CACHE_STATE(ENTRY) ((ENTRY)->state & ~CACHE_PREFETCHED)
+
+/*
+ * All of these expect the cache lock to be held. The slots are searched linearly, the entries are small and
+ * tightly packed so even a few thousand of them is nothing next to decrypting a cluster
+ */
+static WbfsCacheEntry* wbfs_cache_find(WbfsClusterCache* cache, uint64_t cluster)
+{
+    for (uint32_t i = 0; i < cache->capacity; i++) {
+        WbfsCacheEntry* entry = cache->entries + i;
+        if (CACHE_STATE(entry) != CACHE_EMPTY && entry->cluster == cluster) return entry;
+    }
+    return 0;
+}
+
+static WbfsCacheEntry* wbfs_cache_evict(WbfsClusterCache* cache)
+{
+    // Empty slots are free to take, otherwise the least recently used slot that isn't still loading
+    WbfsCacheEntry* oldest = 0;
+    for (uint32_t i = 0; i < cache->capacity; i++) {
+        WbfsCacheEntry* entry = cache->entries + i;
+        if (CACHE_STATE(entry) == CACHE_EMPTY) return entry;
+        if (CACHE_STATE(entry) == CACHE_LOADING) continue;
+        if (!oldest || entry->last_used < oldest->last_used) oldest = entry;
+    }
+    return oldest;
+}
+
+static uint8_t* wbfs_cache_slot(WbfsClusterCache* cache, WbfsCacheEntry* entry)
+{
+    return cache->clusters + (uint64_t)(entry - cache->entries) * WII_CLUSTER_SIZE;
+}
+
+/*
+ * Fills a slot that's been marked as loading. The lock is dropped while reading and decrypting so other
+ * readers can carry on with the rest of the cache
+ */
+static wbfs_enum wbfs_cache_load(WbfsClusterCache* cache, WbfsCacheEntry* entry, uint64_t cluster,
+                                 int prefetch)
+{
+    entry->cluster = cluster;
+    entry->state = CACHE_LOADING;
+    entry->last_used = ++cache->tick;
+    wbfs_mutex_unlock(&cache->lock);
+
+    uint8_t* slot = wbfs_cache_slot(cache, entry);
+    wbfs_enum err = wbfs_partition_read_clusters(cache->partition, slot, cluster, 1, 1);
+
+    wbfs_mutex_lock(&cache->lock);
+    entry->state = (err == e_wbfs_success) ? CACHE_READY : CACHE_EMPTY;
+    if (err == e_wbfs_success && prefetch) entry->state |= CACHE_PREFETCHED;
+    wbfs_cond_broadcast(&cache->loaded);
+    return err;
+}
+
+static void wbfs_cache_prefetch_thread(void* argument)
+{
+    WbfsClusterCache* cache = (WbfsClusterCache*)argument;
+    uint64_t cluster_count = wbfs_partition_cluster_count(cache->partition);
+
+    wbfs_mutex_lock(&cache->lock);
+    while (cache->running) {
+        if (cache->prefetch_next >= cache->prefetch_end || cache->prefetch_next >= cluster_count) {
+            wbfs_cond_wait(&cache->wake, &cache->lock);
+            continue;
+        }
+
+        uint64_t cluster = cache->prefetch_next++;
+        if (wbfs_cache_find(cache, cluster)) continue;
+
+        // If every slot is loading there's nowhere to put it, the reader has moved on anyway by then
+        WbfsCacheEntry* entry = wbfs_cache_evict(cache);
+        if (!entry) continue;
+        if (wbfs_cache_load(cache, entry, cluster, 1) == e_wbfs_success) cache->prefetched++;
+    }
+    wbfs_mutex_unlock(&cache->lock);
+}
+
+wbfs_enum wbfs_cache_init(WbfsClusterCache* cache, const WiiPartition* partition, void* memory,
+                          uint32_t capacity, uint32_t read_ahead)
+{
+    if (!cache || !partition || !memory) return e_wbfs_segfault;
+    if (capacity == 0 || partition->data_size == 0) return e_wbfs_invalid_partition;
+
+    memset(cache, 0, sizeof(WbfsClusterCache));
+    cache->partition = partition;
+    cache->clusters = (uint8_t*)memory;
+    cache->entries = (WbfsCacheEntry*)(cache->clusters + (uint64_t)capacity * WII_CLUSTER_SIZE);
+    cache->capacity = capacity;
+    cache->read_ahead = read_ahead > capacity / 2 ? capacity / 2 : read_ahead;
+    cache->last_cluster = UINT64_MAX;
+    memset(cache->entries, 0, capacity * sizeof(WbfsCacheEntry));
+
+    wbfs_mutex_init(&cache->lock);
+    wbfs_cond_init(&cache->wake);
+    wbfs_cond_init(&cache->loaded);
+
+    // Without a background thread the cache still works, it just doesn't read ahead
+    if (cache->read_ahead) {
+        cache->running = 1;
+        if (wbfs_thread_create(&cache->thread, wbfs_cache_prefetch_thread, cache) != 0) {
+            cache->running = 0;
+            cache->read_ahead = 0;
+        }
+    }
+    return e_wbfs_success;
+}
+
+/*
+ * Watches the order clusters are asked for in. A single read crossing into the next cluster isn't enough to
+ * go on, but once three clusters in a row follow each other the window after the current cluster is handed to
+ * the prefetch thread. Expects the lock to be held
+ */
+static void wbfs_cache_track_access(WbfsClusterCache* cache, uint64_t cluster)
+{
+    if (cluster == cache->last_cluster) return;
+    cache->sequential_run = (cluster == cache->last_cluster + 1) ? cache->sequential_run + 1 : 0;
+    cache->last_cluster = cluster;
+
+    if (!cache->read_ahead || cache->sequential_run < 2) return;
+    if (cache->prefetch_next <= cluster || cache->prefetch_next > cluster + cache->read_ahead) {
+        cache->prefetch_next = cluster + 1;
+    }
+    cache->prefetch_end = cluster + 1 + cache->read_ahead;
+    wbfs_cond_signal(&cache->wake);
+}
+
+wbfs_enum wbfs_cache_read(WbfsClusterCache* cache, void* data, uint64_t address, uint64_t size)
+{
+    if (!cache || !cache->partition || !data) return e_wbfs_segfault;
+
+#ifdef WBFS_STATS
+    WbfsStats* stats = cache->partition->disc->wbfs->stats;
+#endif
+
+    wbfs_enum err = e_wbfs_success;
+    uint64_t bytes_read = 0;
+    wbfs_mutex_lock(&cache->lock);
+    while (bytes_read < size && err == e_wbfs_success) {
+        uint64_t local_address = address + bytes_read;
+        uint64_t cluster = local_address / WII_CLUSTER_DATA_SIZE;
+        uint64_t offset = local_address % WII_CLUSTER_DATA_SIZE;
+        uint64_t chunk = WII_CLUSTER_DATA_SIZE - offset;
+        if (chunk > size - bytes_read) chunk = size - bytes_read;
+        if (cluster >= wbfs_partition_cluster_count(cache->partition)) {
+            err = e_wbfs_invalid_partition;
+            break;
+        }
+
+        WbfsCacheEntry* entry = wbfs_cache_find(cache, cluster);
+        if (entry && CACHE_STATE(entry) == CACHE_LOADING) {
+            // Someone else is already loading it, wait for them rather than doing the work twice
+            wbfs_cond_wait(&cache->loaded, &cache->lock);
+            continue;
+        }
+
+        if (entry) {
+            cache->hits++;
+#ifdef WBFS_STATS
+            if (stats) WBFS_ATOMIC_ADD(&stats->cache_hits, 1);
+#endif
+            if (entry->state & CACHE_PREFETCHED) cache->prefetch_hits++;
+            entry->state = CACHE_READY;
+        } else {
+            entry = wbfs_cache_evict(cache);
+            if (!entry) {
+                wbfs_cond_wait(&cache->loaded, &cache->lock);
+                continue;
+            }
+            cache->misses++;
+#ifdef WBFS_STATS
+            if (stats) WBFS_ATOMIC_ADD(&stats->cache_misses, 1);
+#endif
+            err = wbfs_cache_load(cache, entry, cluster, 0);
+            if (err != e_wbfs_success) break;
+        }
+
+        // Copy out while holding the lock so the slot can't be evicted under us
+        entry->last_used = ++cache->tick;
+        uint8_t* slot = wbfs_cache_slot(cache, entry);
+        memcpy((uint8_t*)data + bytes_read, slot + WII_CLUSTER_HASH_SIZE + offset, chunk);
+        bytes_read += chunk;
+        wbfs_cache_track_access(cache, cluster);
+    }
+    wbfs_mutex_unlock(&cache->lock);
+    return err;
+}
+
+void wbfs_cache_destroy(WbfsClusterCache* cache)
+{
+    if (!cache || !cache->partition) return;
+
+    if (cache->running) {
+        wbfs_mutex_lock(&cache->lock);
+        cache->running = 0;
+        wbfs_cond_signal(&cache->wake);
+        wbfs_mutex_unlock(&cache->lock);
+        wbfs_thread_join(&cache->thread);
+    }
+
+    wbfs_cond_destroy(&cache->loaded);
+    wbfs_cond_destroy(&cache->wake);
+    wbfs_mutex_destroy(&cache->lock);
+    cache->partition = 0;
+}
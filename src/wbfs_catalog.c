@@ -0,0 +1,96 @@
+#include <string.h>
+
+#include "wbfs.h"
+
+// The disc info starts with a copy of the disc header, then the sector table
+#define DISC_HEADER_COPY_SIZE (0x100)
+#define GAME_ID_SIZE (6)
+#define TITLE_OFFSET (0x20)
+#define TITLE_SIZE (64)
+
+// Disc infos are read this many bytes at a time, at least one whole disc info goes into every read
+#define CATALOG_BATCH_SIZE (1024 * 1024)
+
+static uint32_t wbfs_catalog_batch_slots(const Wbfs* wbfs)
+{
+    uint64_t slots = CATALOG_BATCH_SIZE / wbfs->disc_info_size;
+    return slots == 0 ? 1 : (uint32_t)slots;
+}
+
+size_t wbfs_helper_catalog_size(Wbfs* wbfs)
+{
+    if (!wbfs || wbfs->valid != WBFS_MAGIC || wbfs->disc_info_size == 0) return 0;
+    return wbfs_catalog_batch_slots(wbfs) * wbfs->disc_info_size;
+}
+
+/*
+ * Fills in an entry from a disc info sitting in memory. The sector table is swapped in place, then the same
+ * size calculation the conversion uses is run over it
+ */
+static void wbfs_catalog_fill(Wbfs* wbfs, WbfsCatalogEntry* entry, uint8_t* info)
+{
+    memcpy(entry->game_id, info, GAME_ID_SIZE);
+    entry->game_id[GAME_ID_SIZE] = 0;
+    memcpy(entry->title, info + TITLE_OFFSET, TITLE_SIZE);
+    entry->title[TITLE_SIZE] = 0;
+
+    uint16_t* table = (uint16_t*)(info + DISC_HEADER_COPY_SIZE);
+    wbfs_helper_decode_be16(table, table, wbfs->wbfs_sectors_per_disc);
+    entry->stored_sectors = 0;
+    uint32_t sector_count = 0;
+    for (uint32_t i = 0; i < wbfs->wbfs_sectors_per_disc; i++) {
+        if (!table[i]) continue;
+        entry->stored_sectors++;
+        sector_count = i + 1;
+    }
+    entry->stored_size = entry->stored_sectors * wbfs->wbfs_sector_size;
+
+    // The table is already here, so hand it over as loaded rather than have the disc read it again
+    WiiDisc disc;
+    memset(&disc, 0, sizeof(WiiDisc));
+    disc.wbfs = wbfs;
+    disc.wbfs_sector_lookup = table;
+    disc.sector_count = sector_count;
+    disc.table_state = WBFS_TABLE_LOADED;
+    entry->iso_size = wbfs_disc_iso_size(&disc);
+}
+
+wbfs_enum wbfs_file_catalog(Wbfs* wbfs, WbfsCatalogEntry* entries, void* memory)
+{
+    if (!wbfs || !entries || !memory) return e_wbfs_segfault;
+    if (!wbfs->io.read_at || !wbfs->file_header || !wbfs->file_header->disc_table) return e_wbfs_segfault;
+    if (wbfs->valid != WBFS_MAGIC) return e_wbfs_invalid_handle;
+
+    // The disc infos are laid out in slot order, so walking the slots walks the file forwards. Each read runs
+    // from a used slot to the last used slot that still fits in the batch, any empty slots in between are
+    // cheaper to read over than to seek past
+    const uint8_t* disc_table = wbfs->file_header->disc_table;
+    uint32_t batch_slots = wbfs_catalog_batch_slots(wbfs);
+    uint32_t found = 0;
+    uint32_t slot = 0;
+    while (slot < wbfs->disc_slot_count && found < wbfs->wii_disc_count) {
+        if (!disc_table[slot]) {
+            slot++;
+            continue;
+        }
+
+        uint32_t last = slot;
+        for (uint32_t i = slot + 1; i < slot + batch_slots && i < wbfs->disc_slot_count; i++) {
+            if (disc_table[i]) last = i;
+        }
+        uint64_t offset = wbfs_file_disc_info_offset(wbfs, slot);
+        uint64_t size = (uint64_t)(last - slot + 1) * wbfs->disc_info_size;
+        wbfs_enum err = wbfs_stats_read_at(wbfs, memory, offset, size);
+        if (err != e_wbfs_success) return err;
+
+        for (uint32_t i = slot; i <= last; i++) {
+            if (!disc_table[i]) continue;
+            WbfsCatalogEntry* entry = entries + found++;
+            entry->slot = i;
+            entry->wbfs_offset = wbfs_file_disc_info_offset(wbfs, i);
+            wbfs_catalog_fill(wbfs, entry, (uint8_t*)memory + (uint64_t)(i - slot) * wbfs->disc_info_size);
+        }
+        slot = last + 1;
+    }
+    return e_wbfs_success;
+}
@@ -0,0 +1,403 @@
+/*
+ * CRC32 and MD5 for matching a disc against the dump databases, which list CRC32, MD5 and SHA-1 of the plain
+ * disc image. Neither is needed anywhere else so they only have a portable path. The disc checksum rebuilds
+ * the image a chunk at a time in memory and feeds every chunk to all three digests, so the image is read once
+ * and never written anywhere
+ */
+#include <string.h>
+
+#include "wbfs.h"
+
+/*************************************************************************************************************
+ * CRC32, the reflected 0xEDB88320 polynomial used by zip and the dump databases
+ *************************************************************************************************************/
+
+// Eight tables so eight bytes are folded in per step, the first is the usual byte at a time table
+static uint32_t s_crc32_tables[8][256];
+static volatile uint32_t s_crc32_ready = 0;
+
+static void wbfs_crc32_build_tables(void)
+{
+    // Racing threads all write the same values, ready is only set once a whole set of tables is in place
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (uint32_t bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+        s_crc32_tables[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (uint32_t table = 1; table < 8; table++) {
+            uint32_t previous = s_crc32_tables[table - 1][i];
+            s_crc32_tables[table][i] = (previous >> 8) ^ s_crc32_tables[0][previous & 0xFF];
+        }
+    }
+    WBFS_ATOMIC_CAS32(&s_crc32_ready, 0, 1);
+}
+
+uint32_t wbfs_crc32(uint32_t crc, const void* data, size_t size)
+{
+    if (!WBFS_ATOMIC_LOAD32(&s_crc32_ready)) wbfs_crc32_build_tables();
+
+    const uint8_t* in = (const uint8_t*)data;
+    crc = ~crc;
+    for (; size >= 8; size -= 8, in += 8) {
+        uint32_t low = crc ^ ((uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) |
+                              ((uint32_t)in[3] << 24));
+        crc = s_crc32_tables[7][low & 0xFF] ^ s_crc32_tables[6][(low >> 8) & 0xFF] ^
+              s_crc32_tables[5][(low >> 16) & 0xFF] ^ s_crc32_tables[4][low >> 24] ^ s_crc32_tables[3][in[4]] ^
+              s_crc32_tables[2][in[5]] ^ s_crc32_tables[1][in[6]] ^ s_crc32_tables[0][in[7]];
+    }
+    for (; size > 0; size--, in++) crc = (crc >> 8) ^ s_crc32_tables[0][(crc ^ *in) & 0xFF];
+    return ~crc;
+}
+
+/*************************************************************************************************************
+ * MD5
+ *************************************************************************************************************/
+
+#define ROTL32(X, N) (((X) << (N)) | ((X) >> (32 - (N))))
+#define LOAD_LE32(P) \
+    ((uint32_t)(P)[0] | ((uint32_t)(P)[1] << 8) | ((uint32_t)(P)[2] << 16) | ((uint32_t)(P)[3] << 24))
+
+#define MD5_ROUND(A, B, F, W, K, S) \
+    {                               \
+        A += (F) + (W) + (K);       \
+        A = ROTL32(A, S) + (B);     \
+    }
+#define MD5_F(B, C, D) ((D) ^ ((B) & ((C) ^ (D))))
+#define MD5_G(B, C, D) ((C) ^ ((D) & ((B) ^ (C))))
+#define MD5_H(B, C, D) ((B) ^ (C) ^ (D))
+#define MD5_I(B, C, D) ((C) ^ ((B) | ~(D)))
+
+static const uint32_t s_md5_constants[64] = {
+    0xd76aa478u, 0xe8c7b756u, 0x242070dbu, 0xc1bdceeeu, 0xf57c0fafu, 0x4787c62au, 0xa8304613u, 0xfd469501u,
+    0x698098d8u, 0x8b44f7afu, 0xffff5bb1u, 0x895cd7beu, 0x6b901122u, 0xfd987193u, 0xa679438eu, 0x49b40821u,
+    0xf61e2562u, 0xc040b340u, 0x265e5a51u, 0xe9b6c7aau, 0xd62f105du, 0x02441453u, 0xd8a1e681u, 0xe7d3fbc8u,
+    0x21e1cde6u, 0xc33707d6u, 0xf4d50d87u, 0x455a14edu, 0xa9e3e905u, 0xfcefa3f8u, 0x676f02d9u, 0x8d2a4c8au,
+    0xfffa3942u, 0x8771f681u, 0x6d9d6122u, 0xfde5380cu, 0xa4beea44u, 0x4bdecfa9u, 0xf6bb4b60u, 0xbebfbc70u,
+    0x289b7ec6u, 0xeaa127fau, 0xd4ef3085u, 0x04881d05u, 0xd9d4d039u, 0xe6db99e5u, 0x1fa27cf8u, 0xc4ac5665u,
+    0xf4292244u, 0x432aff97u, 0xab9423a7u, 0xfc93a039u, 0x655b59c3u, 0x8f0ccc92u, 0xffeff47du, 0x85845dd1u,
+    0x6fa87e4fu, 0xfe2ce6e0u, 0xa3014314u, 0x4e0811a1u, 0xf7537e82u, 0xbd3af235u, 0x2ad7d2bbu, 0xeb86d391u,
+};
+
+// How far each round rotates by, the pattern repeats every four rounds within each of the four groups
+static const uint8_t s_md5_shifts[4][4] = {
+    { 7, 12, 17, 22 },
+    { 5, 9, 14, 20 },
+    { 4, 11, 16, 23 },
+    { 6, 10, 15, 21 },
+};
+
+static void wbfs_md5_blocks(uint32_t state[4], const uint8_t* data, size_t blocks)
+{
+    for (; blocks > 0; blocks--, data += 64) {
+        uint32_t w[16];
+        for (uint32_t i = 0; i < 16; i++) w[i] = LOAD_LE32(data + i * 4);
+
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+
+        // Each round only changes one word, so rotating the names round by four rounds at a time saves the
+        // shuffling. The groups only differ in the function and which message word each round picks
+        for (uint32_t i = 0; i < 16; i += 4) {
+            const uint8_t* s = s_md5_shifts[0];
+            MD5_ROUND(a, b, MD5_F(b, c, d), w[i], s_md5_constants[i], s[0]);
+            MD5_ROUND(d, a, MD5_F(a, b, c), w[i + 1], s_md5_constants[i + 1], s[1]);
+            MD5_ROUND(c, d, MD5_F(d, a, b), w[i + 2], s_md5_constants[i + 2], s[2]);
+            MD5_ROUND(b, c, MD5_F(c, d, a), w[i + 3], s_md5_constants[i + 3], s[3]);
+        }
+        for (uint32_t i = 16; i < 32; i += 4) {
+            const uint8_t* s = s_md5_shifts[1];
+            MD5_ROUND(a, b, MD5_G(b, c, d), w[(5 * i + 1) & 15], s_md5_constants[i], s[0]);
+            MD5_ROUND(d, a, MD5_G(a, b, c), w[(5 * i + 6) & 15], s_md5_constants[i + 1], s[1]);
+            MD5_ROUND(c, d, MD5_G(d, a, b), w[(5 * i + 11) & 15], s_md5_constants[i + 2], s[2]);
+            MD5_ROUND(b, c, MD5_G(c, d, a), w[(5 * i + 16) & 15], s_md5_constants[i + 3], s[3]);
+        }
+        for (uint32_t i = 32; i < 48; i += 4) {
+            const uint8_t* s = s_md5_shifts[2];
+            MD5_ROUND(a, b, MD5_H(b, c, d), w[(3 * i + 5) & 15], s_md5_constants[i], s[0]);
+            MD5_ROUND(d, a, MD5_H(a, b, c), w[(3 * i + 8) & 15], s_md5_constants[i + 1], s[1]);
+            MD5_ROUND(c, d, MD5_H(d, a, b), w[(3 * i + 11) & 15], s_md5_constants[i + 2], s[2]);
+            MD5_ROUND(b, c, MD5_H(c, d, a), w[(3 * i + 14) & 15], s_md5_constants[i + 3], s[3]);
+        }
+        for (uint32_t i = 48; i < 64; i += 4) {
+            const uint8_t* s = s_md5_shifts[3];
+            MD5_ROUND(a, b, MD5_I(b, c, d), w[(7 * i) & 15], s_md5_constants[i], s[0]);
+            MD5_ROUND(d, a, MD5_I(a, b, c), w[(7 * i + 7) & 15], s_md5_constants[i + 1], s[1]);
+            MD5_ROUND(c, d, MD5_I(d, a, b), w[(7 * i + 14) & 15], s_md5_constants[i + 2], s[2]);
+            MD5_ROUND(b, c, MD5_I(c, d, a), w[(7 * i + 21) & 15], s_md5_constants[i + 3], s[3]);
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+    }
+}
+
+void wbfs_md5_init(WbfsMd5* md5)
+{
+    md5->state[0] = 0x67452301u;
+    md5->state[1] = 0xEFCDAB89u;
+    md5->state[2] = 0x98BADCFEu;
+    md5->state[3] = 0x10325476u;
+    md5->length = 0;
+    md5->buffered = 0;
+}
+
+void wbfs_md5_update(WbfsMd5* md5, const void* data, size_t size)
+{
+    const uint8_t* in = (const uint8_t*)data;
+    md5->length += size;
+
+    // Top up a partial block first, then run whole blocks straight from the input
+    if (md5->buffered > 0) {
+        size_t take = 64 - md5->buffered < size ? 64 - md5->buffered : size;
+        memcpy(md5->buffer + md5->buffered, in, take);
+        md5->buffered += (uint32_t)take;
+        in += take;
+        size -= take;
+        if (md5->buffered < 64) return;
+        wbfs_md5_blocks(md5->state, md5->buffer, 1);
+        md5->buffered = 0;
+    }
+
+    if (size >= 64) {
+        wbfs_md5_blocks(md5->state, in, size / 64);
+        in += size & ~(size_t)63;
+        size &= 63;
+    }
+    memcpy(md5->buffer, in, size);
+    md5->buffered = (uint32_t)size;
+}
+
+void wbfs_md5_final(WbfsMd5* md5, uint8_t digest[16])
+{
+    // Same padding as SHA-1, except the length goes in little endian
+    uint64_t bit_length = md5->length * 8;
+    uint8_t padding[72];
+    size_t pad_size = (md5->buffered < 56 ? 56 : 120) - md5->buffered;
+    memset(padding, 0, sizeof(padding));
+    padding[0] = 0x80;
+    for (uint32_t i = 0; i < 8; i++) padding[pad_size + i] = (uint8_t)(bit_length >> (i * 8));
+    wbfs_md5_update(md5, padding, pad_size + 8);
+
+    for (uint32_t i = 0; i < 4; i++) {
+        digest[i * 4] = (uint8_t)md5->state[i];
+        digest[i * 4 + 1] = (uint8_t)(md5->state[i] >> 8);
+        digest[i * 4 + 2] = (uint8_t)(md5->state[i] >> 16);
+        digest[i * 4 + 3] = (uint8_t)(md5->state[i] >> 24);
+    }
+}
+
+void wbfs_md5(const void* data, size_t size, uint8_t digest[16])
+{
+    WbfsMd5 md5;
+    wbfs_md5_init(&md5);
+    wbfs_md5_update(&md5, data, size);
+    wbfs_md5_final(&md5, digest);
+}
+
+/*************************************************************************************************************
+ * Disc checksums
+ *************************************************************************************************************/
+
+#define CHECKSUM_CRC32 (0)
+#define CHECKSUM_MD5 (1)
+#define CHECKSUM_SHA1 (2)
+#define CHECKSUM_DIGEST_COUNT (3)
+
+/*
+ * The hand over between the reading thread and the digest threads. Chunks go into the two halves of the
+ * buffer in turn, and a half can only be filled again once every digest has finished with what was in it, so
+ * the reader runs at most one chunk ahead of the slowest digest
+ */
+typedef struct WbfsChecksumPipe {
+    WbfsMutex lock;
+    WbfsCond changed;
+    const uint8_t* data[2];
+    uint64_t size[2];
+    uint32_t waiting[2];  // Digests still working through each half
+    uint64_t published;   // Chunks handed over so far, chunk n sits in half n & 1
+    uint32_t digest_count;
+    int running;
+} WbfsChecksumPipe;
+
+// One digest, only the state matching its kind is used
+typedef struct WbfsChecksumDigest {
+    WbfsChecksumPipe* pipe;
+    uint32_t kind;
+    uint32_t crc32;
+    WbfsMd5 md5;
+    WbfsSha1 sha1;
+    WbfsThread thread;
+} WbfsChecksumDigest;
+
+static void wbfs_checksum_feed(WbfsChecksumDigest* digest, const uint8_t* data, uint64_t size)
+{
+    if (digest->kind == CHECKSUM_CRC32) {
+        digest->crc32 = wbfs_crc32(digest->crc32, data, (size_t)size);
+    } else if (digest->kind == CHECKSUM_MD5) {
+        wbfs_md5_update(&digest->md5, data, (size_t)size);
+    } else {
+        wbfs_sha1_update(&digest->sha1, data, (size_t)size);
+    }
+}
+
+static void wbfs_checksum_digest_thread(void* argument)
+{
+    WbfsChecksumDigest* digest = (WbfsChecksumDigest*)argument;
+    WbfsChecksumPipe* pipe = digest->pipe;
+    uint64_t next = 0;
+
+    wbfs_mutex_lock(&pipe->lock);
+    for (;;) {
+        // Everything that was handed over gets hashed before stopping, or the digest would be missing the end
+        while (next == pipe->published && pipe->running) wbfs_cond_wait(&pipe->changed, &pipe->lock);
+        if (next == pipe->published) break;
+
+        uint32_t half = (uint32_t)(next & 1);
+        const uint8_t* data = pipe->data[half];
+        uint64_t size = pipe->size[half];
+        wbfs_mutex_unlock(&pipe->lock);
+        wbfs_checksum_feed(digest, data, size);
+        wbfs_mutex_lock(&pipe->lock);
+
+        next++;
+        if (--pipe->waiting[half] == 0) wbfs_cond_broadcast(&pipe->changed);
+    }
+    wbfs_mutex_unlock(&pipe->lock);
+}
+
+static void wbfs_checksum_pipe_stop(WbfsChecksumPipe* pipe, WbfsChecksumDigest* digests)
+{
+    wbfs_mutex_lock(&pipe->lock);
+    pipe->running = 0;
+    wbfs_cond_broadcast(&pipe->changed);
+    wbfs_mutex_unlock(&pipe->lock);
+    for (uint32_t i = 0; i < pipe->digest_count; i++) wbfs_thread_join(&digests[i].thread);
+
+    wbfs_cond_destroy(&pipe->changed);
+    wbfs_mutex_destroy(&pipe->lock);
+}
+
+/*
+ * Rebuilds one chunk of the disc image. Runs of stored sectors are read in one go and everything the wbfs file
+ * doesn't store, including everything past the last stored sector, comes out as zeros
+ */
+static wbfs_enum wbfs_checksum_fill(WiiDisc* disc, uint8_t* chunk, uint64_t offset, uint64_t size)
+{
+    if (disc->plain_size) return wbfs_disc_read_buffer(disc, chunk, offset, size);
+
+    uint8_t shift = disc->wbfs->file_header->wbfs_sector_shift;
+    uint64_t end = offset + size;
+    uint64_t address = offset;
+    while (address < end) {
+        uint32_t sector = (uint32_t)(address >> shift);
+        int stored = wbfs_disc_sector_stored(disc, sector);
+        uint32_t last = sector + 1;
+        while (((uint64_t)last << shift) < end && wbfs_disc_sector_stored(disc, last) == stored) last++;
+
+        uint64_t run = ((uint64_t)last << shift) - address;
+        if (run > end - address) run = end - address;
+        if (stored) {
+            wbfs_enum err = wbfs_disc_read_buffer(disc, chunk + (address - offset), address, run);
+            if (err != e_wbfs_success) return err;
+        } else {
+            memset(chunk + (address - offset), 0, (size_t)run);
+        }
+        address += run;
+    }
+    return e_wbfs_success;
+}
+
+wbfs_enum wbfs_disc_checksum(WiiDisc* disc, WbfsDiscChecksum* checksum, void* buffer, uint64_t buffer_size,
+                             uint32_t flags)
+{
+    if (!disc || !disc->wbfs || !checksum || !buffer) return e_wbfs_segfault;
+    if (!disc->plain_size) {
+        wbfs_enum load_err = wbfs_disc_parse_sector_table(disc);
+        if (load_err != e_wbfs_success) return load_err;
+    }
+    uint64_t iso_size = wbfs_disc_iso_size(disc);
+    if (iso_size == 0) return e_wbfs_invalid_disc_table;
+
+    // With the digests on their own threads each half of the buffer holds one chunk. Chunks are kept to a
+    // multiple of the SHA-1 and MD5 block size so the digests never have to buffer a partial block
+    int async = (flags & WBFS_CHECKSUM_ASYNC) != 0;
+    uint64_t chunk_capacity = (async ? buffer_size / 2 : buffer_size) & ~(uint64_t)63;
+    if (chunk_capacity == 0) return e_wbfs_segfault;
+
+    WbfsChecksumPipe pipe;
+    WbfsChecksumDigest digests[CHECKSUM_DIGEST_COUNT];
+    memset(&pipe, 0, sizeof(WbfsChecksumPipe));
+    for (uint32_t i = 0; i < CHECKSUM_DIGEST_COUNT; i++) {
+        digests[i].pipe = &pipe;
+        digests[i].kind = i;
+        digests[i].crc32 = 0;
+        wbfs_md5_init(&digests[i].md5);
+        wbfs_sha1_init(&digests[i].sha1);
+    }
+
+    if (async) {
+        pipe.running = 1;
+        wbfs_mutex_init(&pipe.lock);
+        wbfs_cond_init(&pipe.changed);
+
+        // Nothing has been handed over yet, so if a digest can't be started the ones that did are stopped
+        // straight away and everything is hashed on this thread instead
+        while (pipe.digest_count < CHECKSUM_DIGEST_COUNT &&
+               wbfs_thread_create(&digests[pipe.digest_count].thread, wbfs_checksum_digest_thread,
+                                  &digests[pipe.digest_count]) == 0) {
+            pipe.digest_count++;
+        }
+        if (pipe.digest_count < CHECKSUM_DIGEST_COUNT) {
+            wbfs_checksum_pipe_stop(&pipe, digests);
+            async = 0;
+        }
+    }
+
+    wbfs_enum err = e_wbfs_success;
+    uint64_t offset = 0;
+    uint64_t chunk_index = 0;
+    while (offset < iso_size) {
+        uint64_t size = iso_size - offset < chunk_capacity ? iso_size - offset : chunk_capacity;
+        uint32_t half = async ? (uint32_t)(chunk_index & 1) : 0;
+        uint8_t* chunk = (uint8_t*)buffer + half * chunk_capacity;
+
+        // Don't write over a half until every digest is done with the chunk that was in it
+        if (async) {
+            wbfs_mutex_lock(&pipe.lock);
+            while (pipe.waiting[half]) wbfs_cond_wait(&pipe.changed, &pipe.lock);
+            wbfs_mutex_unlock(&pipe.lock);
+        }
+
+        err = wbfs_checksum_fill(disc, chunk, offset, size);
+        if (err != e_wbfs_success) break;
+
+        if (async) {
+            wbfs_mutex_lock(&pipe.lock);
+            pipe.data[half] = chunk;
+            pipe.size[half] = size;
+            pipe.waiting[half] = CHECKSUM_DIGEST_COUNT;
+            pipe.published++;
+            wbfs_cond_broadcast(&pipe.changed);
+            wbfs_mutex_unlock(&pipe.lock);
+        } else {
+            for (uint32_t i = 0; i < CHECKSUM_DIGEST_COUNT; i++) wbfs_checksum_feed(&digests[i], chunk, size);
+        }
+        offset += size;
+        chunk_index++;
+    }
+
+    // The digest threads finish off whatever was handed over before they stop
+    if (async) wbfs_checksum_pipe_stop(&pipe, digests);
+    if (err != e_wbfs_success) return err;
+
+    checksum->size = iso_size;
+    checksum->crc32 = digests[CHECKSUM_CRC32].crc32;
+    wbfs_md5_final(&digests[CHECKSUM_MD5].md5, checksum->md5);
+    wbfs_sha1_final(&digests[CHECKSUM_SHA1].sha1, checksum->sha1);
+    return e_wbfs_success;
+}
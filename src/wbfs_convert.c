@@ -0,0 +1,176 @@
+#include <string.h>
+
+#include "wbfs.h"
+
+// A wii disc is either single layer or dual layer, nothing in between
+#define WII_DISC_SECTOR_SIZE (0x8000ull)
+#define WII_DISC_1_SECTOR_COUNT (143432ull)
+#define WII_DISC_2_SECTOR_COUNT (260620ull)
+
+uint64_t wbfs_disc_iso_size(WiiDisc* disc)
+{
+    if (!disc || !disc->wbfs) return 0;
+    if (disc->plain_size) return disc->plain_size;
+    if (disc->table_state != WBFS_TABLE_LOADED && wbfs_disc_parse_sector_table(disc) != e_wbfs_success) {
+        return 0;
+    }
+
+    // Only the start of the last stored sector matters, with large wbfs sectors the sector holding the end of
+    // the first layer runs on past it
+    uint64_t single_layer = WII_DISC_1_SECTOR_COUNT * WII_DISC_SECTOR_SIZE;
+    uint64_t sector_size = disc->wbfs->wbfs_sector_size;
+    if (disc->sector_count > 0 && (uint64_t)(disc->sector_count - 1) * sector_size >= single_layer) {
+        return WII_DISC_2_SECTOR_COUNT * WII_DISC_SECTOR_SIZE;
+    }
+    return single_layer;
+}
+
+/*
+ * The write half of a double buffered conversion. The converting thread hands over one chunk at a time, and
+ * only waits if the previous chunk still hasn't been written by the time the next one has been read
+ */
+typedef struct WbfsIsoWriter {
+    WbfsIo* out;
+    WbfsMutex lock;
+    WbfsCond changed;
+    const uint8_t* data;  // Chunk waiting to be written, null when the writer is idle
+    uint64_t offset;
+    uint64_t size;
+    int running;
+    int failed;
+} WbfsIsoWriter;
+
+static void wbfs_iso_writer_thread(void* argument)
+{
+    WbfsIsoWriter* writer = (WbfsIsoWriter*)argument;
+
+    wbfs_mutex_lock(&writer->lock);
+    for (;;) {
+        while (!writer->data && writer->running) wbfs_cond_wait(&writer->changed, &writer->lock);
+        if (!writer->data) break;
+
+        // Leave the chunk marked as pending until it's written so its buffer isn't reused under us
+        const uint8_t* data = writer->data;
+        uint64_t offset = writer->offset;
+        uint64_t size = writer->size;
+        wbfs_mutex_unlock(&writer->lock);
+        int result = writer->out->write_at(writer->out, data, offset, size);
+        wbfs_mutex_lock(&writer->lock);
+
+        if (result != 0) writer->failed = 1;
+        writer->data = 0;
+        wbfs_cond_broadcast(&writer->changed);
+    }
+    wbfs_mutex_unlock(&writer->lock);
+}
+
+// Returns non zero once any write has failed
+static int wbfs_iso_writer_submit(WbfsIsoWriter* writer, const uint8_t* data, uint64_t offset, uint64_t size)
+{
+    wbfs_mutex_lock(&writer->lock);
+    while (writer->data) wbfs_cond_wait(&writer->changed, &writer->lock);
+    writer->data = data;
+    writer->offset = offset;
+    writer->size = size;
+    wbfs_cond_broadcast(&writer->changed);
+    int failed = writer->failed;
+    wbfs_mutex_unlock(&writer->lock);
+    return failed;
+}
+
+static void wbfs_iso_writer_stop(WbfsIsoWriter* writer, WbfsThread* thread)
+{
+    wbfs_mutex_lock(&writer->lock);
+    writer->running = 0;
+    wbfs_cond_broadcast(&writer->changed);
+    wbfs_mutex_unlock(&writer->lock);
+    wbfs_thread_join(thread);
+
+    wbfs_cond_destroy(&writer->changed);
+    wbfs_mutex_destroy(&writer->lock);
+}
+
+wbfs_enum wbfs_disc_write_iso(WiiDisc* disc, WbfsIo* out, void* buffer, uint64_t buffer_size, uint32_t flags)
+{
+    if (!disc || !disc->wbfs || disc->plain_size || !out || !buffer) return e_wbfs_segfault;
+    if (!out->write_at || !out->set_size) return e_wbfs_invalid_io;
+    wbfs_enum load_err = wbfs_disc_parse_sector_table(disc);
+    if (load_err != e_wbfs_success) return load_err;
+
+    Wbfs* wbfs = disc->wbfs;
+    uint64_t sector_size = wbfs->wbfs_sector_size;
+    uint64_t iso_size = wbfs_disc_iso_size(disc);
+
+    // With double buffering each half of the buffer holds one chunk
+    int async = (flags & WBFS_CONVERT_ASYNC) != 0;
+    uint64_t chunk_capacity = async ? buffer_size / 2 : buffer_size;
+    uint64_t sectors_per_chunk = chunk_capacity / sector_size;
+    if (sectors_per_chunk == 0) return e_wbfs_segfault;
+
+    // Start from an empty file so anything we skip over reads back as zeros
+    if (out->set_size(out, 0) != 0) return e_wbfs_failed_file_write;
+
+    WbfsIsoWriter writer;
+    WbfsThread writer_thread;
+    if (async) {
+        memset(&writer, 0, sizeof(WbfsIsoWriter));
+        writer.out = out;
+        writer.running = 1;
+        wbfs_mutex_init(&writer.lock);
+        wbfs_cond_init(&writer.changed);
+
+        // Without a thread everything still gets written, just one chunk after another
+        if (wbfs_thread_create(&writer_thread, wbfs_iso_writer_thread, &writer) != 0) {
+            wbfs_cond_destroy(&writer.changed);
+            wbfs_mutex_destroy(&writer.lock);
+            async = 0;
+        }
+    }
+
+    wbfs_enum err = e_wbfs_success;
+    uint32_t half = 0;
+    uint32_t sector = 0;
+    while (sector < disc->sector_count) {
+        // Unused sectors are never written, they stay as holes in the output
+        if (!wbfs_disc_sector_stored(disc, sector)) {
+            sector++;
+            continue;
+        }
+
+        // Gather a run of stored sectors that follow each other on the disc, the read underneath splits it up
+        // wherever they aren't next to each other in the wbfs file
+        uint32_t first = sector;
+        while (sector < disc->sector_count && wbfs_disc_sector_stored(disc, sector) &&
+               sector - first < sectors_per_chunk) {
+            sector++;
+        }
+
+        uint64_t offset = (uint64_t)first * sector_size;
+        if (offset >= iso_size) break;
+        uint64_t size = (uint64_t)(sector - first) * sector_size;
+        if (size > iso_size - offset) size = iso_size - offset;
+
+        uint8_t* chunk = (uint8_t*)buffer + half * chunk_capacity;
+        err = wbfs_disc_read_buffer(disc, chunk, offset, size);
+        if (err != e_wbfs_success) break;
+
+        if (async) {
+            if (wbfs_iso_writer_submit(&writer, chunk, offset, size) != 0) break;
+            half ^= 1;
+        } else if (out->write_at(out, chunk, offset, size) != 0) {
+            err = e_wbfs_failed_file_write;
+            break;
+        }
+    }
+
+    // Wait for the last chunk to go out before deciding how it went
+    if (async) {
+        wbfs_iso_writer_stop(&writer, &writer_thread);
+        if (writer.failed && err == e_wbfs_success) err = e_wbfs_failed_file_write;
+    }
+    if (err != e_wbfs_success) return err;
+
+    // Growing the file out to the full size turns everything that wasn't written into holes
+    if (out->set_size(out, iso_size) != 0) return e_wbfs_failed_file_write;
+    return e_wbfs_success;
+}
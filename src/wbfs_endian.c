@@ -0,0 +1,197 @@
+/*
+ * Bulk big endian decoding. Sector tables are tens of thousands of 16 bit values, so rather than swapping them
+ * one at a time they're swapped a vector at a time. Like the AES and SHA-1 the vector path is picked at
+ * runtime on x86, AVX2 when the cpu and OS support it and SSSE3 otherwise, arm64 always has NEON. Whatever is
+ * left over at the end goes through the portable path a byte at a time
+ */
+#include <string.h>
+
+#include "wbfs.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define WBFS_ENDIAN_X86 (1)
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define WBFS_TARGET_SSSE3
+#define WBFS_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define WBFS_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define WBFS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define WBFS_ENDIAN_NEON (1)
+#include <arm_neon.h>
+#endif
+
+// Hosts that are big endian already have everything in the right order
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define WBFS_ENDIAN_BIG_HOST (1)
+#endif
+
+#define ENDIAN_PATH_PORTABLE (0)
+#define ENDIAN_PATH_SSSE3 (1)
+#define ENDIAN_PATH_AVX2 (2)
+
+/*
+ * The portable path, reversing the bytes of every value one at a time. Each value is read out before anything
+ * is written, so this is safe in place
+ */
+static void wbfs_endian_swap_portable(uint8_t* out, const uint8_t* in, size_t count, size_t width)
+{
+    for (size_t i = 0; i < count; i++) {
+        uint8_t value[8];
+        memcpy(value, in + i * width, width);
+        for (size_t j = 0; j < width; j++) out[i * width + j] = value[width - 1 - j];
+    }
+}
+
+#ifdef WBFS_ENDIAN_X86
+// Shuffle masks that reverse the bytes inside every 2, 4 and 8 byte lane, AVX2 uses the same mask twice
+static const uint8_t s_swap_masks[3][16] = {
+    { 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 },
+    { 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12 },
+    { 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8 },
+};
+
+static WBFS_TARGET_SSSE3 size_t wbfs_endian_swap_ssse3(uint8_t* out, const uint8_t* in, size_t bytes,
+                                                       const uint8_t* mask)
+{
+    __m128i shuffle = _mm_loadu_si128((const __m128i*)mask);
+    size_t done = 0;
+    for (; done + 16 <= bytes; done += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(in + done));
+        _mm_storeu_si128((__m128i*)(out + done), _mm_shuffle_epi8(block, shuffle));
+    }
+    return done;
+}
+
+static WBFS_TARGET_AVX2 size_t wbfs_endian_swap_avx2(uint8_t* out, const uint8_t* in, size_t bytes,
+                                                     const uint8_t* mask)
+{
+    __m256i shuffle = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)mask));
+    size_t done = 0;
+    for (; done + 64 <= bytes; done += 64) {
+        __m256i first = _mm256_loadu_si256((const __m256i*)(in + done));
+        __m256i second = _mm256_loadu_si256((const __m256i*)(in + done + 32));
+        _mm256_storeu_si256((__m256i*)(out + done), _mm256_shuffle_epi8(first, shuffle));
+        _mm256_storeu_si256((__m256i*)(out + done + 32), _mm256_shuffle_epi8(second, shuffle));
+    }
+    for (; done + 32 <= bytes; done += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(in + done));
+        _mm256_storeu_si256((__m256i*)(out + done), _mm256_shuffle_epi8(block, shuffle));
+    }
+    return done;
+}
+
+static int wbfs_endian_detect(void)
+{
+    // SSSE3 is bit 9 of ecx for leaf 1. AVX2 is bit 5 of ebx for leaf 7, but it's only usable if the OS saves
+    // the upper halves of the registers, which it says through OSXSAVE and the XCR0 register
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    if (!((info[2] >> 9) & 1)) return ENDIAN_PATH_PORTABLE;
+    int os_saves_ymm = ((info[2] >> 27) & 1) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return (os_saves_ymm && ((info[1] >> 5) & 1)) ? ENDIAN_PATH_AVX2 : ENDIAN_PATH_SSSE3;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return ENDIAN_PATH_PORTABLE;
+    if (!((ecx >> 9) & 1)) return ENDIAN_PATH_PORTABLE;
+    int os_saves_ymm = 0;
+    if ((ecx >> 27) & 1) {
+        unsigned int xcr0_low;
+        unsigned int xcr0_high;
+        __asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+        os_saves_ymm = (xcr0_low & 6) == 6;
+    }
+    if (!os_saves_ymm || !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return ENDIAN_PATH_SSSE3;
+    return ((ebx >> 5) & 1) ? ENDIAN_PATH_AVX2 : ENDIAN_PATH_SSSE3;
+#endif
+}
+
+// Worked out the first time it's needed, racing threads all come up with the same answer
+static volatile int s_endian_path = -1;
+#endif
+
+#ifdef WBFS_ENDIAN_NEON
+static size_t wbfs_endian_swap_neon(uint8_t* out, const uint8_t* in, size_t bytes, size_t width)
+{
+    size_t done = 0;
+    for (; done + 16 <= bytes; done += 16) {
+        uint8x16_t block = vld1q_u8(in + done);
+        if (width == 2) {
+            block = vrev16q_u8(block);
+        } else if (width == 4) {
+            block = vrev32q_u8(block);
+        } else {
+            block = vrev64q_u8(block);
+        }
+        vst1q_u8(out + done, block);
+    }
+    return done;
+}
+#endif
+
+/*
+ * Swaps count values of width bytes from in to out, which can be the same buffer. The vector paths take as
+ * many whole vectors as they can and hand back how many bytes that was
+ */
+static void wbfs_endian_swap(void* out, const void* in, size_t count, size_t width)
+{
+    if (!out || !in || count == 0) return;
+
+#ifdef WBFS_ENDIAN_BIG_HOST
+    if (out != in) memmove(out, in, count * width);
+#else
+    uint8_t* out_bytes = (uint8_t*)out;
+    const uint8_t* in_bytes = (const uint8_t*)in;
+    size_t bytes = count * width;
+    size_t done = 0;
+#ifdef WBFS_ENDIAN_X86
+    if (s_endian_path < 0) s_endian_path = wbfs_endian_detect();
+    const uint8_t* mask = s_swap_masks[width == 2 ? 0 : (width == 4 ? 1 : 2)];
+    if (s_endian_path == ENDIAN_PATH_AVX2) {
+        done = wbfs_endian_swap_avx2(out_bytes, in_bytes, bytes, mask);
+    }
+    if (s_endian_path >= ENDIAN_PATH_SSSE3) {
+        done += wbfs_endian_swap_ssse3(out_bytes + done, in_bytes + done, bytes - done, mask);
+    }
+#elif defined(WBFS_ENDIAN_NEON)
+    done = wbfs_endian_swap_neon(out_bytes, in_bytes, bytes, width);
+#endif
+    wbfs_endian_swap_portable(out_bytes + done, in_bytes + done, (bytes - done) / width, width);
+#endif
+}
+
+void wbfs_helper_decode_be16(uint16_t* out, const void* in, size_t count)
+{
+    wbfs_endian_swap(out, in, count, 2);
+}
+
+void wbfs_helper_decode_be32(uint32_t* out, const void* in, size_t count)
+{
+    wbfs_endian_swap(out, in, count, 4);
+}
+
+void wbfs_helper_decode_be64(uint64_t* out, const void* in, size_t count)
+{
+    wbfs_endian_swap(out, in, count, 8);
+}
+
+void wbfs_helper_encode_be16(void* out, const uint16_t* in, size_t count)
+{
+    wbfs_endian_swap(out, in, count, 2);
+}
+
+void wbfs_helper_encode_be32(void* out, const uint32_t* in, size_t count)
+{
+    wbfs_endian_swap(out, in, count, 4);
+}
+
+void wbfs_helper_encode_be64(void* out, const uint64_t* in, size_t count)
+{
+    wbfs_endian_swap(out, in, count, 8);
+}
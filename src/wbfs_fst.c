@@ -0,0 +1,252 @@
+#include <string.h>
+
+#include "wbfs.h"
+
+// Where things live in the boot header at the start of the partition data
+#define BOOT_HEADER_SIZE (0x440)
+#define BOOT_TITLE (0x20)
+#define BOOT_DOL_OFFSET (0x420)
+#define BOOT_FST_OFFSET (0x424)
+#define BOOT_FST_SIZE (0x428)
+
+// The main executable header lists 7 text sections and 11 data sections
+#define DOL_HEADER_SIZE (0x100)
+#define DOL_SECTION_COUNT (18)
+#define DOL_SECTION_OFFSETS (0x00)
+#define DOL_SECTION_SIZES (0x90)
+
+// Each raw file system table entry is 12 bytes
+#define FST_ENTRY_SIZE (12)
+
+// FNV-1a, quick to compute a character at a time which is how paths get built up
+#define FNV_OFFSET_BASIS (0xcbf29ce484222325ull)
+#define FNV_PRIME (0x100000001b3ull)
+
+static uint64_t wbfs_fst_hash(uint64_t hash, const char* s, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t)s[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+wbfs_enum wbfs_fst_parse_header(WiiFst* fst, const WiiPartition* partition)
+{
+    if (!fst || !partition) return e_wbfs_segfault;
+    memset(fst, 0, sizeof(WiiFst));
+
+    uint8_t boot[BOOT_HEADER_SIZE];
+    wbfs_enum err = wbfs_partition_read(partition, boot, 0, sizeof(boot));
+    if (err != e_wbfs_success) return err;
+
+    memcpy(fst->game_id, boot, 6);
+    memcpy(fst->title, boot + BOOT_TITLE, 64);
+    fst->dol_offset = (uint64_t)wbfs_helper_read_be32(boot + BOOT_DOL_OFFSET) << 2;
+    fst->fst_offset = (uint64_t)wbfs_helper_read_be32(boot + BOOT_FST_OFFSET) << 2;
+    fst->fst_size = (uint64_t)wbfs_helper_read_be32(boot + BOOT_FST_SIZE) << 2;
+    if (fst->fst_size < FST_ENTRY_SIZE) return e_wbfs_invalid_fst;
+
+    // The table has to fit in the partition's decrypted data, which also keeps the entry count below in check
+    uint64_t data_size = wbfs_partition_cluster_count(partition) * WII_CLUSTER_DATA_SIZE;
+    if (fst->fst_offset > data_size || data_size - fst->fst_offset < fst->fst_size) return e_wbfs_invalid_fst;
+
+    // The executable's size isn't stored anywhere, it ends wherever its furthest section ends
+    uint8_t dol[DOL_HEADER_SIZE];
+    err = wbfs_partition_read(partition, dol, fst->dol_offset, sizeof(dol));
+    if (err != e_wbfs_success) return err;
+    fst->dol_size = DOL_HEADER_SIZE;
+    for (uint32_t i = 0; i < DOL_SECTION_COUNT; i++) {
+        uint64_t end = (uint64_t)wbfs_helper_read_be32(dol + DOL_SECTION_OFFSETS + i * 4) +
+                       wbfs_helper_read_be32(dol + DOL_SECTION_SIZES + i * 4);
+        if (end > fst->dol_size) fst->dol_size = end;
+    }
+
+    // The root entry's size is the number of entries in the whole table
+    uint8_t root[FST_ENTRY_SIZE];
+    err = wbfs_partition_read(partition, root, fst->fst_offset, sizeof(root));
+    if (err != e_wbfs_success) return err;
+    fst->entry_count = wbfs_helper_read_be32(root + 8);
+    if (fst->entry_count == 0 || (uint64_t)fst->entry_count * FST_ENTRY_SIZE > fst->fst_size) {
+        return e_wbfs_invalid_fst;
+    }
+
+    // Keep the hash table at most half full so probes stay short. Past 2^30 entries the table can't be
+    // sized in 32 bits, which no real disc gets anywhere near
+    if (fst->entry_count > (1u << 30)) return e_wbfs_invalid_fst;
+    fst->hash_size = 16;
+    while ((uint64_t)fst->hash_size < (uint64_t)fst->entry_count * 2) fst->hash_size <<= 1;
+    return e_wbfs_success;
+}
+
+/*
+ * Walks back up the parents of an entry checking each name against the end of the path, this confirms a hash
+ * match without having to build the entry's path anywhere
+ */
+static int wbfs_fst_path_matches(const WiiFst* fst, uint32_t index, const char* path, size_t length)
+{
+    while (index != 0) {
+        const char* name = fst->strings + fst->entries[index].name_offset;
+        size_t name_length = strlen(name);
+        if (name_length > length || memcmp(path + length - name_length, name, name_length) != 0) return 0;
+        length -= name_length;
+
+        index = fst->entries[index].parent;
+        if (index != 0) {
+            if (length == 0 || path[length - 1] != '/') return 0;
+            length--;
+        }
+    }
+    return length == 0;
+}
+
+static void wbfs_fst_insert(WiiFst* fst, uint32_t index)
+{
+    uint32_t mask = fst->hash_size - 1;
+    uint32_t bucket = (uint32_t)fst->entries[index].path_hash & mask;
+    while (fst->hash_table[bucket] != 0) bucket = (bucket + 1) & mask;
+    fst->hash_table[bucket] = index + 1;
+}
+
+wbfs_enum wbfs_fst_parse(WiiFst* fst, const WiiPartition* partition, void* memory)
+{
+    if (!fst || !partition || !memory) return e_wbfs_segfault;
+    if (fst->entry_count == 0 || fst->hash_size == 0) return e_wbfs_invalid_fst;
+
+    // Lay the memory out as the entries, then the hash table, then the raw table which the string pool is
+    // part of. The raw table gets an extra null on the end in case the last name runs right up to the end
+    fst->entries = (WiiFstEntry*)memory;
+    fst->hash_table = (uint32_t*)(fst->entries + fst->entry_count);
+    uint8_t* raw = (uint8_t*)(fst->hash_table + fst->hash_size);
+    memset(fst->hash_table, 0, fst->hash_size * sizeof(uint32_t));
+
+    wbfs_enum err = wbfs_partition_read(partition, raw, fst->fst_offset, fst->fst_size);
+    if (err != e_wbfs_success) return err;
+    raw[fst->fst_size] = 0;
+    fst->strings = (const char*)raw + (uint64_t)fst->entry_count * FST_ENTRY_SIZE;
+    fst->strings_size = (uint32_t)(fst->fst_size - (uint64_t)fst->entry_count * FST_ENTRY_SIZE);
+
+    // Files don't record which directory they're in, only directories do. Since everything inside a directory
+    // comes straight after it, keep a stack of the directories we're inside and pop them once we're past the
+    // end of them
+    uint32_t stack[256];
+    uint32_t depth = 0;
+    for (uint32_t i = 0; i < fst->entry_count; i++) {
+        const uint8_t* raw_entry = raw + (uint64_t)i * FST_ENTRY_SIZE;
+        WiiFstEntry* entry = fst->entries + i;
+        memset(entry, 0, sizeof(WiiFstEntry));
+
+        while (depth > 0 && i >= fst->entries[stack[depth - 1]].next) depth--;
+
+        entry->is_directory = raw_entry[0] != 0;
+        entry->name_offset = wbfs_helper_read_be32(raw_entry) & 0x00FFFFFF;
+        entry->parent = depth > 0 ? stack[depth - 1] : 0;
+        if (entry->name_offset >= fst->strings_size) return e_wbfs_invalid_fst;
+
+        if (entry->is_directory) {
+            entry->next = wbfs_helper_read_be32(raw_entry + 8);
+            if (entry->next <= i || entry->next > fst->entry_count) return e_wbfs_invalid_fst;
+            if (depth == sizeof(stack) / sizeof(stack[0])) return e_wbfs_invalid_fst;
+            stack[depth++] = i;
+        } else {
+            entry->next = i + 1;
+            entry->offset = (uint64_t)wbfs_helper_read_be32(raw_entry + 4) << 2;
+            entry->size = wbfs_helper_read_be32(raw_entry + 8);
+        }
+
+        // A child's hash carries on from its parent's, so full paths never have to be built
+        if (i == 0) {
+            entry->path_hash = FNV_OFFSET_BASIS;
+            continue;
+        }
+        const char* name = fst->strings + entry->name_offset;
+        uint64_t hash = fst->entries[entry->parent].path_hash;
+        if (entry->parent != 0) hash = wbfs_fst_hash(hash, "/", 1);
+        entry->path_hash = wbfs_fst_hash(hash, name, strlen(name));
+    }
+
+    for (uint32_t i = 0; i < fst->entry_count; i++) wbfs_fst_insert(fst, i);
+    return e_wbfs_success;
+}
+
+wbfs_enum wbfs_fst_lookup(const WiiFst* fst, const char* path, uint32_t* index)
+{
+    if (!fst || !fst->entries || !path || !index) return e_wbfs_segfault;
+
+    // Ignore slashes at either end
+    while (*path == '/') path++;
+    size_t length = strlen(path);
+    while (length > 0 && path[length - 1] == '/') length--;
+
+    uint64_t hash = wbfs_fst_hash(FNV_OFFSET_BASIS, path, length);
+    uint32_t mask = fst->hash_size - 1;
+    for (uint32_t bucket = (uint32_t)hash & mask; fst->hash_table[bucket] != 0; bucket = (bucket + 1) & mask) {
+        uint32_t candidate = fst->hash_table[bucket] - 1;
+        if (fst->entries[candidate].path_hash != hash) continue;
+        if (!wbfs_fst_path_matches(fst, candidate, path, length)) continue;
+
+        *index = candidate;
+        return e_wbfs_success;
+    }
+    return e_wbfs_not_found;
+}
+
+uint32_t wbfs_fst_first_child(const WiiFst* fst, uint32_t directory)
+{
+    if (!fst || !fst->entries || directory >= fst->entry_count) return 0;
+    if (!fst->entries[directory].is_directory) return 0;
+    return directory + 1 < fst->entries[directory].next ? directory + 1 : 0;
+}
+
+uint32_t wbfs_fst_next_sibling(const WiiFst* fst, uint32_t index)
+{
+    if (!fst || !fst->entries || index == 0 || index >= fst->entry_count) return 0;
+    uint32_t next = fst->entries[index].next;
+    return next < fst->entries[fst->entries[index].parent].next ? next : 0;
+}
+
+const char* wbfs_fst_name(const WiiFst* fst, uint32_t index)
+{
+    if (!fst || !fst->entries || index >= fst->entry_count) return 0;
+    return fst->strings + fst->entries[index].name_offset;
+}
+
+wbfs_enum wbfs_fst_path(const WiiFst* fst, uint32_t index, char* path, size_t path_size)
+{
+    if (!fst || !fst->entries || !path) return e_wbfs_segfault;
+    if (index >= fst->entry_count) return e_wbfs_not_found;
+
+    // Work out how long the path is first, then fill it in from the end backwards
+    size_t length = 0;
+    for (uint32_t i = index; i != 0; i = fst->entries[i].parent) {
+        length += strlen(wbfs_fst_name(fst, i)) + (fst->entries[i].parent != 0 ? 1 : 0);
+    }
+    if (length + 1 > path_size) return e_wbfs_segfault;
+
+    path[length] = 0;
+    for (uint32_t i = index; i != 0; i = fst->entries[i].parent) {
+        const char* name = wbfs_fst_name(fst, i);
+        size_t name_length = strlen(name);
+        length -= name_length;
+        memcpy(path + length, name, name_length);
+        if (fst->entries[i].parent != 0) path[--length] = '/';
+    }
+    return e_wbfs_success;
+}
+
+wbfs_enum wbfs_fst_file_range(const WiiFst* fst, uint32_t index, WiiFileRange* range)
+{
+    if (!fst || !fst->entries || !range) return e_wbfs_segfault;
+    if (index >= fst->entry_count || fst->entries[index].is_directory) return e_wbfs_not_found;
+
+    const WiiFstEntry* entry = fst->entries + index;
+    range->offset = entry->offset;
+    range->size = entry->size;
+    range->first_cluster = entry->offset / WII_CLUSTER_DATA_SIZE;
+    range->cluster_count = 0;
+    if (entry->size > 0) {
+        uint64_t last_cluster = (entry->offset + entry->size - 1) / WII_CLUSTER_DATA_SIZE;
+        range->cluster_count = last_cluster - range->first_cluster + 1;
+    }
+    return e_wbfs_success;
+}
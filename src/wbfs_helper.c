@@ -8,6 +8,46 @@ void wbfs_helper_reverse_endian_32(uint32_t* d)
 
 void wbfs_helper_reverse_endian_16(uint16_t* d) { *d = ((0xFF00 & *d) >> 8) | ((0x00FF & *d) << 8); }
 
+uint32_t wbfs_helper_read_be32(const void* p)
+{
+    const uint8_t* b = (const uint8_t*)p;
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | (uint32_t)b[3];
+}
+
+uint16_t wbfs_helper_read_be16(const void* p)
+{
+    const uint8_t* b = (const uint8_t*)p;
+    return (uint16_t)((b[0] << 8) | b[1]);
+}
+
+uint64_t wbfs_helper_read_be64(const void* p)
+{
+    return ((uint64_t)wbfs_helper_read_be32(p) << 32) | wbfs_helper_read_be32((const uint8_t*)p + 4);
+}
+
+uint64_t wbfs_helper_free_map_offset(uint8_t hd_sector_shift, uint8_t wbfs_sector_shift,
+                                     uint32_t wbfs_sector_count)
+{
+    uint64_t start = (1ull << wbfs_sector_shift) - wbfs_sector_count / 8;
+    return (start >> hd_sector_shift) << hd_sector_shift;
+}
+
+size_t wbfs_helper_free_map_size(uint8_t hd_sector_shift, uint32_t wbfs_sector_count)
+{
+    uint64_t mask = (1ull << hd_sector_shift) - 1;
+    return (size_t)((wbfs_sector_count / 8 + mask) & ~mask);
+}
+
+int wbfs_helper_free_map_set(uint8_t* free_map, size_t free_map_size, uint32_t sector)
+{
+    if (sector == 0) return 0;
+    uint32_t bit = sector - 1;
+    size_t word = (size_t)(bit / 32) * 4;
+    if (word + 4 > free_map_size) return 0;
+    free_map[word + 3 - (bit % 32) / 8] |= (uint8_t)(1u << (bit % 8));
+    return 1;
+}
+
 size_t wbfs_helper_disc_table_size(Wbfs* wbfs)
 {
     // The wbfs file header takes up the first hard drive sector, every that isn't the disc table takes up 12
@@ -21,6 +61,69 @@ size_t wbfs_helper_sector_table_size(Wbfs* wbfs)
     return wbfs->wbfs_sectors_per_disc * sizeof(uint16_t);
 }
 
+size_t wbfs_helper_extent_table_size(Wbfs* wbfs)
+{
+    // At worst every sector is its own run
+    return wbfs->wbfs_sectors_per_disc * sizeof(WbfsExtent);
+}
+
+size_t wbfs_helper_disc_sector_table_size(const WiiDisc* disc)
+{
+    if (!disc || !disc->wbfs) return 0;
+    // Until the disc has been measured there's no telling where its last stored sector is
+    if (disc->table_state == WBFS_TABLE_UNLOADED) return wbfs_helper_sector_table_size(disc->wbfs);
+    return disc->sector_count * sizeof(uint16_t);
+}
+
+size_t wbfs_helper_disc_extent_table_size(const WiiDisc* disc)
+{
+    if (!disc || !disc->wbfs) return 0;
+    if (disc->table_state == WBFS_TABLE_UNLOADED) return wbfs_helper_extent_table_size(disc->wbfs);
+    return disc->extent_count * sizeof(WbfsExtent);
+}
+
+size_t wbfs_helper_cluster_cache_size(uint32_t capacity)
+{
+    // The clusters go first so they stay aligned, the entries follow
+    return (size_t)capacity * (WII_CLUSTER_SIZE + sizeof(WbfsCacheEntry));
+}
+
+size_t wbfs_helper_fst_size(const WiiFst* fst)
+{
+    // The entries, the path index, and the raw table with room for a null on the end
+    if (!fst || fst->entry_count == 0) return 0;
+    return fst->entry_count * sizeof(WiiFstEntry) + fst->hash_size * sizeof(uint32_t) + fst->fst_size + 1;
+}
+
+const char* wbfs_helper_region_name(const char* game_id)
+{
+    // The fourth letter of the game id says which market the disc was made for
+    if (!game_id) return "Unknown";
+    switch (game_id[3]) {
+        case 'E':
+            return "NTSC-U";
+        case 'J':
+            return "NTSC-J";
+        case 'K':
+            return "NTSC-K";
+        case 'P':
+        case 'D':
+        case 'F':
+        case 'I':
+        case 'S':
+        case 'H':
+        case 'U':
+        case 'X':
+        case 'Y':
+        case 'Z':
+            return "PAL";
+        case 'W':
+            return "NTSC-T";
+        default:
+            return "Unknown";
+    }
+}
+
 const char* wbfs_helper_enum_lookup(wbfs_enum e)
 {
     switch (e) {
@@ -40,8 +143,49 @@ const char* wbfs_helper_enum_lookup(wbfs_enum e)
                    "the pointer passed to the function wasn't null but didn't point to valid memory";
             break;
         case e_wbfs_invalid_disc_table:
-            return "Currently I only know how to read one disc on the disc table, so good luck checking "
-                   "anything else";
+            return "There's no disc at that index of the disc table, or the disc hasn't been set up from the "
+                   "disc table yet";
+            break;
+        case e_wbfs_failed_file_read:
+            return "Reading from the WBFS file failed, either the file is truncated or the read itself "
+                   "errored";
+            break;
+        case e_wbfs_invalid_io:
+            return "The I/O backend could not be set up, or is missing its read function";
+            break;
+        case e_wbfs_not_contiguous:
+            return "The range asked for is split across the wbfs file, so it can't be viewed without a copy";
+            break;
+        case e_wbfs_invalid_partition:
+            return "The partition header doesn't make sense, the address probably isn't the start of a "
+                   "partition";
+            break;
+        case e_wbfs_unsupported_key:
+            return "The partition's ticket asks for a common key other than the standard wii one";
+            break;
+        case e_wbfs_invalid_fst:
+            return "The file system table is corrupt, an entry points outside of the table";
+            break;
+        case e_wbfs_not_found:
+            return "Nothing in the file system table matched";
+            break;
+        case e_wbfs_failed_file_write:
+            return "Writing to the output failed, the disk may be full or the file wasn't opened for writing";
+            break;
+        case e_wbfs_invalid_sector_size:
+            return "The wbfs sector size is too small for a disc's sector table to fit in 16 bits, or too "
+                   "large for the header to fit in";
+            break;
+        case e_wbfs_batch_full:
+            return "The batch has no room left for every piece of the read, reap what's queued first or back "
+                   "it with more memory";
+            break;
+        case e_wbfs_batch_busy:
+            return "The batch is still running, everything submitted has to be reaped before more can be "
+                   "queued";
+            break;
+        case e_wbfs_out_of_space:
+            return "There isn't enough room left to write everything to";
             break;
         default:
             return "Unknown error code???";
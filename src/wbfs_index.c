@@ -0,0 +1,366 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "wbfs.h"
+
+// Index files start with this, followed by the version, the record count and a table of record offsets
+#define WBFS_INDEX_MAGIC ('W' << 24 | 'B' << 16 | 'I' << 8 | 'X')
+#define WBFS_INDEX_VERSION (1)
+#define INDEX_HEADER_SIZE (12)
+#define INDEX_OFFSET_SIZE (8)
+
+/*
+ * A record is a flat run of big endian fields so it can be copied around and written out as is:
+ *   u32 record size, u64 file size, u64 mtime, u32 path length, path and its null,
+ *   u8 hd sector shift, u8 wbfs sector shift, u16 flags, u32 hd sector count, u32 disc count
+ * then for every disc:
+ *   u32 slot, u64 wbfs offset, 6 byte game id, 64 byte title, u32 stored sectors, u64 iso size,
+ *   u32 partition count, (u32 offset, u32 type) for each partition,
+ *   u32 extent count, (u32 disc sector, u32 file sector, u32 sector count) for each extent
+ */
+#define RECORD_FILE_SIZE (4 + 8 + 8 + 4 + 1 + 1 + 2 + 4 + 4)
+#define RECORD_DISC_SIZE (4 + 8 + 6 + 64 + 4 + 8 + 4 + 4)
+#define RECORD_PARTITION_SIZE (8)
+#define RECORD_EXTENT_SIZE (12)
+#define GAME_ID_SIZE (6)
+#define TITLE_OFFSET (0x20)
+#define TITLE_SIZE (64)
+
+// Where the partition tables are, the same place wbfs_disc_parse_partition_info looks
+#define PARTITION_TABLE_COUNT (4)
+#define PARTITION_TABLE_MAX_ENTRIES (64)
+
+static uint8_t* wbfs_index_put32(uint8_t* p, uint32_t value)
+{
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+    return p + 4;
+}
+
+static uint8_t* wbfs_index_put64(uint8_t* p, uint64_t value)
+{
+    p = wbfs_index_put32(p, (uint32_t)(value >> 32));
+    return wbfs_index_put32(p, (uint32_t)value);
+}
+
+size_t wbfs_helper_index_build_size(Wbfs* wbfs)
+{
+    // A sector table and an extent map, reused for every disc in turn
+    if (!wbfs) return 0;
+    return wbfs_helper_sector_table_size(wbfs) + wbfs_helper_extent_table_size(wbfs);
+}
+
+size_t wbfs_helper_index_record_size(Wbfs* wbfs, const char* path, uint32_t flags)
+{
+    // The worst case, every partition table full and every sector its own extent
+    if (!wbfs || !path) return 0;
+    size_t disc_size = RECORD_DISC_SIZE + WBFS_INDEX_MAX_PARTITIONS * RECORD_PARTITION_SIZE;
+    if (flags & WBFS_INDEX_EXTENTS) disc_size += (size_t)wbfs->wbfs_sectors_per_disc * RECORD_EXTENT_SIZE;
+    return RECORD_FILE_SIZE + strlen(path) + 1 + wbfs->wii_disc_count * disc_size;
+}
+
+// Writes the partitions of a disc into the record, walking the partition tables in disc order
+static wbfs_enum wbfs_index_put_partitions(WiiDisc* disc, uint8_t** cursor)
+{
+    WiiDiscPartitionInfoEntry info[PARTITION_TABLE_COUNT];
+    wbfs_enum err = wbfs_disc_parse_partition_info(disc, info);
+    if (err != e_wbfs_success) return err;
+
+    uint8_t* count_field = *cursor;
+    uint8_t* p = count_field + 4;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < PARTITION_TABLE_COUNT; i++) {
+        uint32_t entries = info[i].partition_count;
+        if (entries > PARTITION_TABLE_MAX_ENTRIES) entries = PARTITION_TABLE_MAX_ENTRIES;
+        for (uint32_t j = 0; j < entries && count < WBFS_INDEX_MAX_PARTITIONS; j++, count++) {
+            WiiDiscPartitionTableEntry entry;
+            err = wbfs_disc_parse_partition_table(disc, &entry,
+                                                  info[i].offset + j * sizeof(WiiDiscPartitionTableEntry));
+            if (err != e_wbfs_success) return err;
+            p = wbfs_index_put32(p, entry.offset);
+            p = wbfs_index_put32(p, entry.type);
+        }
+    }
+    wbfs_index_put32(count_field, count);
+    *cursor = p;
+    return e_wbfs_success;
+}
+
+wbfs_enum wbfs_index_record_build(Wbfs* wbfs, const WbfsIndexKey* key, uint32_t flags, void* memory,
+                                  void* record)
+{
+    if (!wbfs || !key || !key->path || !memory || !record) return e_wbfs_segfault;
+    if (!wbfs->file_header || !wbfs->file_header->disc_table) return e_wbfs_segfault;
+    if (wbfs->valid != WBFS_MAGIC) return e_wbfs_invalid_handle;
+
+    uint8_t* p = (uint8_t*)record + 4;
+    p = wbfs_index_put64(p, key->file_size);
+    p = wbfs_index_put64(p, key->mtime);
+    uint32_t path_length = (uint32_t)strlen(key->path);
+    p = wbfs_index_put32(p, path_length);
+    memcpy(p, key->path, path_length + 1);
+    p += path_length + 1;
+    *p++ = wbfs->file_header->hd_sector_shift;
+    *p++ = wbfs->file_header->wbfs_sector_shift;
+    *p++ = (uint8_t)(flags >> 8);
+    *p++ = (uint8_t)flags;
+    p = wbfs_index_put32(p, wbfs->file_header->hd_sector_count);
+    p = wbfs_index_put32(p, wbfs->wii_disc_count);
+
+    // Every disc is opened the usual way, with the same memory reused for each sector table
+    for (uint32_t i = 0; i < wbfs->wii_disc_count; i++) {
+        WiiDisc disc;
+        memset(&disc, 0, sizeof(WiiDisc));
+        disc.wbfs_sector_lookup = (uint16_t*)memory;
+        if (flags & WBFS_INDEX_EXTENTS) {
+            disc.extents = (WbfsExtent*)((uint8_t*)memory + wbfs_helper_sector_table_size(wbfs));
+        }
+        wbfs_enum err = wbfs_disc_get_offset(&disc, wbfs, i);
+        if (err != e_wbfs_success) return err;
+        err = wbfs_disc_parse_sector_table(&disc);
+        if (err != e_wbfs_success) return err;
+
+        uint8_t header[TITLE_OFFSET + TITLE_SIZE];
+        err = wbfs_disc_read_buffer(&disc, header, 0, sizeof(header));
+        if (err != e_wbfs_success) return err;
+
+        uint32_t stored_sectors = 0;
+        for (uint32_t j = 0; j < disc.sector_count; j++) {
+            if (disc.wbfs_sector_lookup[j]) stored_sectors++;
+        }
+
+        p = wbfs_index_put32(p, (uint32_t)((disc.wbfs_offset - wbfs->hd_sector_size) / wbfs->disc_info_size));
+        p = wbfs_index_put64(p, disc.wbfs_offset);
+        memcpy(p, header, GAME_ID_SIZE);
+        p += GAME_ID_SIZE;
+        memcpy(p, header + TITLE_OFFSET, TITLE_SIZE);
+        p += TITLE_SIZE;
+        p = wbfs_index_put32(p, stored_sectors);
+        p = wbfs_index_put64(p, wbfs_disc_iso_size(&disc));
+        err = wbfs_index_put_partitions(&disc, &p);
+        if (err != e_wbfs_success) return err;
+
+        // The extent map is only kept, and only given room by wbfs_helper_index_record_size, when asked for
+        uint32_t extent_count = (flags & WBFS_INDEX_EXTENTS) ? disc.extent_count : 0;
+        p = wbfs_index_put32(p, extent_count);
+        for (uint32_t j = 0; j < extent_count; j++) {
+            p = wbfs_index_put32(p, disc.extents[j].disc_sector);
+            p = wbfs_index_put32(p, disc.extents[j].file_sector);
+            p = wbfs_index_put32(p, disc.extents[j].sector_count);
+        }
+    }
+
+    wbfs_index_put32((uint8_t*)record, (uint32_t)(p - (uint8_t*)record));
+    return e_wbfs_success;
+}
+
+uint32_t wbfs_index_record_size(const void* record)
+{
+    if (!record) return 0;
+    return wbfs_helper_read_be32(record);
+}
+
+wbfs_enum wbfs_index_record_file(const void* record, WbfsIndexFile* file)
+{
+    if (!record || !file) return e_wbfs_segfault;
+    const uint8_t* p = (const uint8_t*)record + 4;
+    file->file_size = wbfs_helper_read_be64(p);
+    file->mtime = wbfs_helper_read_be64(p + 8);
+    uint32_t path_length = wbfs_helper_read_be32(p + 16);
+    file->path = (const char*)p + 20;
+    p += 20 + path_length + 1;
+    file->hd_sector_shift = p[0];
+    file->wbfs_sector_shift = p[1];
+    file->flags = ((uint32_t)p[2] << 8) | p[3];
+    file->hd_sector_count = wbfs_helper_read_be32(p + 4);
+    file->disc_count = wbfs_helper_read_be32(p + 8);
+    return e_wbfs_success;
+}
+
+// Skips to the start of a disc, every disc before it has to be stepped over as they vary in size
+static const uint8_t* wbfs_index_find_disc(const void* record, uint32_t index)
+{
+    const uint8_t* p = (const uint8_t*)record + 20;
+    p += 4 + wbfs_helper_read_be32(p) + 1 + 12;
+    for (uint32_t i = 0; i < index; i++) {
+        p += RECORD_DISC_SIZE - 8;
+        p += 4 + wbfs_helper_read_be32(p) * RECORD_PARTITION_SIZE;
+        p += 4 + wbfs_helper_read_be32(p) * RECORD_EXTENT_SIZE;
+    }
+    return p;
+}
+
+wbfs_enum wbfs_index_record_disc(const void* record, uint32_t index, WbfsIndexDisc* disc, WbfsExtent* extents)
+{
+    if (!record || !disc) return e_wbfs_segfault;
+    WbfsIndexFile file;
+    wbfs_index_record_file(record, &file);
+    if (index >= file.disc_count) return e_wbfs_invalid_disc_table;
+
+    const uint8_t* p = wbfs_index_find_disc(record, index);
+    memset(disc, 0, sizeof(WbfsIndexDisc));
+    disc->catalog.slot = wbfs_helper_read_be32(p);
+    disc->catalog.wbfs_offset = wbfs_helper_read_be64(p + 4);
+    memcpy(disc->catalog.game_id, p + 12, GAME_ID_SIZE);
+    memcpy(disc->catalog.title, p + 12 + GAME_ID_SIZE, TITLE_SIZE);
+    p += 12 + GAME_ID_SIZE + TITLE_SIZE;
+    disc->catalog.stored_sectors = wbfs_helper_read_be32(p);
+    disc->catalog.stored_size = (uint64_t)disc->catalog.stored_sectors << file.wbfs_sector_shift;
+    disc->catalog.iso_size = wbfs_helper_read_be64(p + 4);
+    p += 12;
+
+    uint32_t partition_count = wbfs_helper_read_be32(p);
+    p += 4;
+    for (uint32_t i = 0; i < partition_count; i++, p += RECORD_PARTITION_SIZE) {
+        if (i >= WBFS_INDEX_MAX_PARTITIONS) continue;
+        disc->partitions[i].offset = wbfs_helper_read_be32(p);
+        disc->partitions[i].type = wbfs_helper_read_be32(p + 4);
+        disc->partition_count++;
+    }
+
+    disc->extent_count = wbfs_helper_read_be32(p);
+    p += 4;
+    if (extents) {
+        for (uint32_t i = 0; i < disc->extent_count; i++, p += RECORD_EXTENT_SIZE) {
+            extents[i].disc_sector = wbfs_helper_read_be32(p);
+            extents[i].file_sector = wbfs_helper_read_be32(p + 4);
+            extents[i].sector_count = wbfs_helper_read_be32(p + 8);
+        }
+    }
+    return e_wbfs_success;
+}
+
+// Records are ordered by path so a lookup can binary search them
+static const char* wbfs_index_record_path(const void* record) { return (const char*)record + 24; }
+
+static int wbfs_index_compare_records(const void* a, const void* b)
+{
+    const void* record_a = *(const void* const*)a;
+    const void* record_b = *(const void* const*)b;
+    return strcmp(wbfs_index_record_path(record_a), wbfs_index_record_path(record_b));
+}
+
+wbfs_enum wbfs_index_write(WbfsIo* out, const void** records, uint32_t count)
+{
+    if (!out || (!records && count)) return e_wbfs_segfault;
+    if (!out->write_at || !out->set_size) return e_wbfs_invalid_io;
+
+    qsort((void*)records, count, sizeof(const void*), wbfs_index_compare_records);
+    if (out->set_size(out, 0) != 0) return e_wbfs_failed_file_write;
+
+    uint8_t header[INDEX_HEADER_SIZE];
+    uint8_t* p = wbfs_index_put32(header, WBFS_INDEX_MAGIC);
+    p = wbfs_index_put32(p, WBFS_INDEX_VERSION);
+    wbfs_index_put32(p, count);
+    if (out->write_at(out, header, 0, sizeof(header)) != 0) return e_wbfs_failed_file_write;
+
+    // The offset table goes out a piece at a time so it never has to be held in full
+    uint64_t table_offset = INDEX_HEADER_SIZE;
+    uint64_t record_offset = table_offset + (uint64_t)count * INDEX_OFFSET_SIZE;
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t entry[INDEX_OFFSET_SIZE];
+        wbfs_index_put64(entry, record_offset);
+        if (out->write_at(out, entry, table_offset + (uint64_t)i * INDEX_OFFSET_SIZE, sizeof(entry)) != 0) {
+            return e_wbfs_failed_file_write;
+        }
+        uint32_t size = wbfs_index_record_size(records[i]);
+        if (out->write_at(out, records[i], record_offset, size) != 0) return e_wbfs_failed_file_write;
+        record_offset += size;
+    }
+    return e_wbfs_success;
+}
+
+/*
+ * Walks every field of a record to make sure it all fits inside the record, so nothing read from it later can
+ * run off the end. The path has to be null terminated where its length says, and the discs have to take up
+ * exactly what's left
+ */
+static int wbfs_index_record_valid(const uint8_t* record, uint64_t record_size)
+{
+    uint64_t path_length = wbfs_helper_read_be32(record + 20);
+    if (path_length > record_size - RECORD_FILE_SIZE - 1) return 0;
+    const uint8_t* path = record + 24;
+    if (path[path_length] != 0 || memchr(path, 0, (size_t)path_length)) return 0;
+
+    // Sector sizes are shifted by, so anything a real wbfs file can't have is turned away
+    uint64_t used = RECORD_FILE_SIZE + path_length + 1;
+    if (record[used - 12] > 31 || record[used - 11] > 31) return 0;
+    uint32_t disc_count = wbfs_helper_read_be32(record + used - 4);
+    for (uint32_t i = 0; i < disc_count; i++) {
+        // Everything up to and including the partition count, then the partitions and the extent count
+        if (record_size - used < RECORD_DISC_SIZE - 4) return 0;
+        used += RECORD_DISC_SIZE - 8;
+        uint64_t partitions = (uint64_t)wbfs_helper_read_be32(record + used) * RECORD_PARTITION_SIZE;
+        used += 4;
+        if (record_size - used < partitions + 4) return 0;
+        used += partitions;
+        uint64_t extents = (uint64_t)wbfs_helper_read_be32(record + used) * RECORD_EXTENT_SIZE;
+        used += 4;
+        if (record_size - used < extents) return 0;
+        used += extents;
+    }
+    return used == record_size;
+}
+
+wbfs_enum wbfs_index_open(WbfsIndex* index, const void* data, uint64_t size)
+{
+    if (!index || !data) return e_wbfs_segfault;
+    memset(index, 0, sizeof(WbfsIndex));
+
+    // Anything that doesn't add up is treated as no index at all, the caller just rebuilds it
+    const uint8_t* bytes = (const uint8_t*)data;
+    if (size < INDEX_HEADER_SIZE || wbfs_helper_read_be32(bytes) != WBFS_INDEX_MAGIC ||
+        wbfs_helper_read_be32(bytes + 4) != WBFS_INDEX_VERSION) {
+        return e_wbfs_not_found;
+    }
+    uint32_t count = wbfs_helper_read_be32(bytes + 8);
+    if ((size - INDEX_HEADER_SIZE) / INDEX_OFFSET_SIZE < count) return e_wbfs_not_found;
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t offset = wbfs_helper_read_be64(bytes + INDEX_HEADER_SIZE + (uint64_t)i * INDEX_OFFSET_SIZE);
+        if (offset > size || size - offset < RECORD_FILE_SIZE) return e_wbfs_not_found;
+        uint32_t record_size = wbfs_helper_read_be32(bytes + offset);
+        if (record_size < RECORD_FILE_SIZE + 1 || record_size > size - offset) return e_wbfs_not_found;
+        if (!wbfs_index_record_valid(bytes + offset, record_size)) return e_wbfs_not_found;
+    }
+
+    index->data = bytes;
+    index->size = size;
+    index->record_count = count;
+    return e_wbfs_success;
+}
+
+const void* wbfs_index_record(const WbfsIndex* index, uint32_t i)
+{
+    if (!index || !index->data || i >= index->record_count) return 0;
+    const uint8_t* offset = index->data + INDEX_HEADER_SIZE + (uint64_t)i * INDEX_OFFSET_SIZE;
+    return index->data + wbfs_helper_read_be64(offset);
+}
+
+wbfs_enum wbfs_index_find(const WbfsIndex* index, const WbfsIndexKey* key, const void** record)
+{
+    if (!index || !key || !key->path || !record) return e_wbfs_segfault;
+
+    uint32_t low = 0;
+    uint32_t high = index->record_count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        const void* candidate = wbfs_index_record(index, mid);
+        if (!candidate) return e_wbfs_not_found;
+        int order = strcmp(wbfs_index_record_path(candidate), key->path);
+        if (order < 0) {
+            low = mid + 1;
+        } else if (order > 0) {
+            high = mid;
+        } else {
+            // The file has changed since it was indexed, so the record is as good as missing
+            WbfsIndexFile file;
+            wbfs_index_record_file(candidate, &file);
+            if (file.file_size != key->file_size || file.mtime != key->mtime) return e_wbfs_not_found;
+            *record = candidate;
+            return e_wbfs_success;
+        }
+    }
+    return e_wbfs_not_found;
+}
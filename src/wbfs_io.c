@@ -0,0 +1,412 @@
+/*
+ * The built in I/O backend. Rather than seeking a shared FILE* and reading from wherever it ends up, every
+ * read carries its own offset. This is what lets several threads read the same Wbfs handle at the same time
+ */
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <string.h>
+
+#include "wbfs.h"
+
+#ifdef _WIN32
+static int wbfs_io_handle_read(intptr_t file, void* data, uint64_t offset, uint64_t size)
+{
+    HANDLE handle = (HANDLE)file;
+    uint8_t* out = (uint8_t*)data;
+
+    // ReadFile takes the offset through the overlapped struct, this doesn't depend on the file position
+    while (size > 0) {
+        DWORD chunk = size > 0x40000000ull ? 0x40000000ul : (DWORD)size;
+        DWORD bytes_read = 0;
+        OVERLAPPED overlapped;
+        memset(&overlapped, 0, sizeof(OVERLAPPED));
+        overlapped.Offset = (DWORD)(offset & 0xFFFFFFFFull);
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+        if (!ReadFile(handle, out, chunk, &bytes_read, &overlapped) || bytes_read == 0) return -1;
+        out += bytes_read;
+        offset += bytes_read;
+        size -= bytes_read;
+    }
+    return 0;
+}
+
+static int wbfs_io_file_write_at(WbfsIo* io, const void* data, uint64_t offset, uint64_t size)
+{
+    HANDLE handle = (HANDLE)io->handle;
+    const uint8_t* in = (const uint8_t*)data;
+
+    while (size > 0) {
+        DWORD chunk = size > 0x40000000ull ? 0x40000000ul : (DWORD)size;
+        DWORD bytes_written = 0;
+        OVERLAPPED overlapped;
+        memset(&overlapped, 0, sizeof(OVERLAPPED));
+        overlapped.Offset = (DWORD)(offset & 0xFFFFFFFFull);
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+        if (!WriteFile(handle, in, chunk, &bytes_written, &overlapped) || bytes_written == 0) return -1;
+        in += bytes_written;
+        offset += bytes_written;
+        size -= bytes_written;
+    }
+    return 0;
+}
+
+static int wbfs_io_file_set_size(WbfsIo* io, uint64_t size)
+{
+    HANDLE handle = (HANDLE)io->handle;
+
+    // NTFS only leaves holes in files marked as sparse, if the file system can't do it the file just ends up
+    // filled with zeros
+    DWORD returned = 0;
+    DeviceIoControl(handle, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, NULL);
+
+    FILE_END_OF_FILE_INFO end;
+    end.EndOfFile.QuadPart = (LONGLONG)size;
+    return SetFileInformationByHandle(handle, FileEndOfFileInfo, &end, sizeof(end)) ? 0 : -1;
+}
+
+// Opening and sizing the pieces of a split file, a failed open gives back -1 the same as INVALID_HANDLE_VALUE
+static intptr_t wbfs_io_open_read(const char* path)
+{
+    HANDLE handle =
+        CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    return (intptr_t)handle;
+}
+
+static void wbfs_io_close_handle(intptr_t handle) { CloseHandle((HANDLE)handle); }
+
+static int wbfs_io_path_size(const char* path, uint64_t* size)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data)) return -1;
+    *size = (uint64_t)data.nFileSizeHigh << 32 | data.nFileSizeLow;
+    return 0;
+}
+#else
+static int wbfs_io_handle_read(intptr_t file, void* data, uint64_t offset, uint64_t size)
+{
+    int fd = (int)file;
+    uint8_t* out = (uint8_t*)data;
+
+    // pread can come back short, or be interrupted, so keep going until we have everything or hit the end
+    while (size > 0) {
+        size_t chunk = size > 0x40000000ull ? 0x40000000u : (size_t)size;
+        ssize_t bytes_read = pread(fd, out, chunk, (off_t)offset);
+        if (bytes_read < 0 && errno == EINTR) continue;
+        if (bytes_read <= 0) return -1;
+        out += bytes_read;
+        offset += (uint64_t)bytes_read;
+        size -= (uint64_t)bytes_read;
+    }
+    return 0;
+}
+
+static int wbfs_io_file_write_at(WbfsIo* io, const void* data, uint64_t offset, uint64_t size)
+{
+    int fd = (int)io->handle;
+    const uint8_t* in = (const uint8_t*)data;
+
+    while (size > 0) {
+        size_t chunk = size > 0x40000000ull ? 0x40000000u : (size_t)size;
+        ssize_t bytes_written = pwrite(fd, in, chunk, (off_t)offset);
+        if (bytes_written < 0 && errno == EINTR) continue;
+        if (bytes_written <= 0) return -1;
+        in += bytes_written;
+        offset += (uint64_t)bytes_written;
+        size -= (uint64_t)bytes_written;
+    }
+    return 0;
+}
+
+// Growing a file with ftruncate leaves a hole on any file system that supports them
+static int wbfs_io_file_set_size(WbfsIo* io, uint64_t size)
+{
+    return ftruncate((int)io->handle, (off_t)size) == 0 ? 0 : -1;
+}
+
+static intptr_t wbfs_io_open_read(const char* path) { return open(path, O_RDONLY); }
+
+static void wbfs_io_close_handle(intptr_t handle) { close((int)handle); }
+
+static int wbfs_io_path_size(const char* path, uint64_t* size)
+{
+    struct stat file_stat;
+    if (stat(path, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) return -1;
+    *size = (uint64_t)file_stat.st_size;
+    return 0;
+}
+#endif
+
+static int wbfs_io_file_read_at(WbfsIo* io, void* data, uint64_t offset, uint64_t size)
+{
+    return wbfs_io_handle_read(io->handle, data, offset, size);
+}
+
+// The whole wbfs file is the one file, so everything carries on to the end of it
+static int wbfs_io_file_locate(WbfsIo* io, uint64_t offset, intptr_t* handle, uint64_t* handle_offset,
+                               uint64_t* handle_left)
+{
+    *handle = io->handle;
+    *handle_offset = offset;
+    *handle_left = UINT64_MAX - offset;
+    return 0;
+}
+
+wbfs_enum wbfs_io_init_file(WbfsIo* io, FILE* fp)
+{
+    if (!io || !fp) return e_wbfs_segfault;
+    memset(io, 0, sizeof(WbfsIo));
+
+#ifdef _WIN32
+    intptr_t handle = _get_osfhandle(_fileno(fp));
+    if (handle == (intptr_t)INVALID_HANDLE_VALUE) return e_wbfs_invalid_io;
+#else
+    int handle = fileno(fp);
+    if (handle < 0) return e_wbfs_invalid_io;
+#endif
+
+    io->handle = handle;
+    io->read_at = wbfs_io_file_read_at;
+    io->write_at = wbfs_io_file_write_at;
+    io->set_size = wbfs_io_file_set_size;
+    io->locate = wbfs_io_file_locate;
+    return e_wbfs_success;
+}
+
+/*
+ * The disc backend, one disc seen as a plain disc image. A write is cut wherever the disc's sectors are stored
+ * apart in the wbfs file and each part is written through the wbfs handle's own backend
+ */
+static int wbfs_io_disc_read_at(WbfsIo* io, void* data, uint64_t offset, uint64_t size)
+{
+    return wbfs_disc_read_buffer((WiiDisc*)io->user, data, offset, size) == e_wbfs_success ? 0 : -1;
+}
+
+static int wbfs_io_disc_write_at(WbfsIo* io, const void* data, uint64_t offset, uint64_t size)
+{
+    WiiDisc* disc = (WiiDisc*)io->user;
+    WbfsIo* file = &disc->wbfs->io;
+    if (!file->write_at) return -1;
+
+    const uint8_t* in = (const uint8_t*)data;
+    while (size > 0) {
+        uint64_t file_address;
+        uint64_t run_left;
+        if (wbfs_disc_locate_run(disc, offset, size, &file_address, &run_left) != e_wbfs_success) return -1;
+        uint64_t chunk = size < run_left ? size : run_left;
+        if (file->write_at(file, in, file_address, chunk) != 0) return -1;
+        in += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+wbfs_enum wbfs_io_init_disc(WbfsIo* io, WiiDisc* disc)
+{
+    if (!io || !disc || !disc->wbfs) return e_wbfs_segfault;
+    memset(io, 0, sizeof(WbfsIo));
+    io->user = disc;
+    io->read_at = wbfs_io_disc_read_at;
+    io->write_at = wbfs_io_disc_write_at;
+    return e_wbfs_success;
+}
+
+int wbfs_io_is_file(const WbfsIo* io)
+{
+    return io && io->locate;
+}
+
+/*
+ * The split backend, a read is cut wherever it crosses from one piece into the next and each part is read from
+ * its own piece. The first piece is the path as given, the rest swap the s of .wbfs for the piece number
+ */
+static void wbfs_io_split_path(const WbfsSplitFile* split, uint32_t piece, char* path)
+{
+    size_t length = strlen(split->path);
+    memcpy(path, split->path, length + 1);
+    if (piece > 0) path[length - 1] = (char)('0' + piece);
+}
+
+static intptr_t wbfs_io_split_handle(WbfsSplitFile* split, uint32_t piece)
+{
+    intptr_t handle = split->handles[piece];
+    if (handle != -1) return handle;
+
+    // Only one thread opens a piece, anyone else after the same piece waits and then uses the same handle. A
+    // piece that fails to open is tried again next time
+    wbfs_mutex_lock(&split->open_lock);
+    if (split->handles[piece] == -1) {
+        char path[WBFS_SPLIT_PATH_SIZE];
+        wbfs_io_split_path(split, piece, path);
+        split->handles[piece] = wbfs_io_open_read(path);
+    }
+    handle = split->handles[piece];
+    wbfs_mutex_unlock(&split->open_lock);
+    return handle;
+}
+
+static int wbfs_io_split_locate(WbfsIo* io, uint64_t offset, intptr_t* handle, uint64_t* handle_offset,
+                                uint64_t* handle_left)
+{
+    WbfsSplitFile* split = (WbfsSplitFile*)io->user;
+    if (offset >= split->total_size) return -1;
+
+    uint32_t piece = (uint32_t)(offset / split->piece_size);
+    *handle = wbfs_io_split_handle(split, piece);
+    if (*handle == -1) return -1;
+    uint64_t piece_start = (uint64_t)piece * split->piece_size;
+    uint64_t piece_end = piece + 1 == split->piece_count ? split->total_size : piece_start + split->piece_size;
+    *handle_offset = offset - piece_start;
+    *handle_left = piece_end - offset;
+    return 0;
+}
+
+static int wbfs_io_split_read_at(WbfsIo* io, void* data, uint64_t offset, uint64_t size)
+{
+    uint8_t* out = (uint8_t*)data;
+    while (size > 0) {
+        intptr_t handle;
+        uint64_t piece_offset;
+        uint64_t piece_left;
+        if (wbfs_io_split_locate(io, offset, &handle, &piece_offset, &piece_left) != 0) return -1;
+
+        uint64_t chunk = size < piece_left ? size : piece_left;
+        if (wbfs_io_handle_read(handle, out, piece_offset, chunk) != 0) return -1;
+        out += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+    return 0;
+}
+
+wbfs_enum wbfs_io_init_split(WbfsIo* io, WbfsSplitFile* split, const char* path)
+{
+    if (!io || !split || !path) return e_wbfs_segfault;
+    size_t length = strlen(path);
+    if (length >= WBFS_SPLIT_PATH_SIZE) return e_wbfs_invalid_io;
+
+    memset(io, 0, sizeof(WbfsIo));
+    memset(split, 0, sizeof(WbfsSplitFile));
+    memcpy(split->path, path, length + 1);
+    for (uint32_t i = 0; i < WBFS_SPLIT_MAX_PIECES; i++) split->handles[i] = -1;
+
+    // Only the sizes are looked at here, the pieces are opened as they're read. The pieces stop at the first
+    // one that's missing, and a file that doesn't end in .wbfs can't have been split
+    int splittable = length > 5 && strcmp(path + length - 5, ".wbfs") == 0;
+    uint64_t last_size = 0;
+    for (uint32_t i = 0; i < WBFS_SPLIT_MAX_PIECES && (i == 0 || splittable); i++) {
+        char piece_path[WBFS_SPLIT_PATH_SIZE];
+        wbfs_io_split_path(split, i, piece_path);
+        uint64_t size;
+        if (wbfs_io_path_size(piece_path, &size) != 0) break;
+
+        // Every piece before this one has to have been full for the offsets to line up
+        if (i == 0) split->piece_size = size;
+        if (i > 0 && (last_size != split->piece_size || size > split->piece_size)) return e_wbfs_invalid_io;
+        split->piece_count++;
+        split->total_size += size;
+        last_size = size;
+    }
+    if (split->piece_count == 0 || split->piece_size == 0) return e_wbfs_invalid_io;
+
+    wbfs_mutex_init(&split->open_lock);
+    io->user = split;
+    io->read_at = wbfs_io_split_read_at;
+    io->locate = wbfs_io_split_locate;
+    return e_wbfs_success;
+}
+
+wbfs_enum wbfs_io_close_split(WbfsIo* io)
+{
+    if (!io || !io->user) return e_wbfs_segfault;
+    if (io->read_at != wbfs_io_split_read_at) return e_wbfs_invalid_io;
+
+    WbfsSplitFile* split = (WbfsSplitFile*)io->user;
+    for (uint32_t i = 0; i < split->piece_count; i++) {
+        if (split->handles[i] != -1) wbfs_io_close_handle(split->handles[i]);
+        split->handles[i] = -1;
+    }
+    wbfs_mutex_destroy(&split->open_lock);
+    memset(io, 0, sizeof(WbfsIo));
+    return e_wbfs_success;
+}
+
+/*
+ * The mapped backend, reads are just copies out of the mapping. Anything that wants to avoid the copy can look
+ * at io->map directly
+ */
+static int wbfs_io_mapped_read_at(WbfsIo* io, void* data, uint64_t offset, uint64_t size)
+{
+    if (offset > io->map_size || size > io->map_size - offset) return -1;
+    memcpy(data, io->map + offset, size);
+    return 0;
+}
+
+wbfs_enum wbfs_io_init_mapped(WbfsIo* io, FILE* fp)
+{
+    if (!io || !fp) return e_wbfs_segfault;
+    memset(io, 0, sizeof(WbfsIo));
+
+#ifdef _WIN32
+    HANDLE file = (HANDLE)_get_osfhandle(_fileno(fp));
+    LARGE_INTEGER file_size;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        return e_wbfs_invalid_io;
+    }
+
+    // Windows needs a mapping object as well as the view, keep hold of it so it can be closed on unmap
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) return e_wbfs_invalid_io;
+    void* map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!map) {
+        CloseHandle(mapping);
+        return e_wbfs_invalid_io;
+    }
+
+    io->handle = (intptr_t)mapping;
+    io->map_size = (uint64_t)file_size.QuadPart;
+#else
+    int fd = fileno(fp);
+    struct stat file_stat;
+    if (fd < 0 || fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) return e_wbfs_invalid_io;
+
+    void* map = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return e_wbfs_invalid_io;
+
+    io->handle = fd;
+    io->map_size = (uint64_t)file_stat.st_size;
+#endif
+
+    io->map = (const uint8_t*)map;
+    io->read_at = wbfs_io_mapped_read_at;
+    return e_wbfs_success;
+}
+
+wbfs_enum wbfs_io_unmap(WbfsIo* io)
+{
+    if (!io) return e_wbfs_segfault;
+    if (!io->map) return e_wbfs_invalid_io;
+
+#ifdef _WIN32
+    UnmapViewOfFile((void*)io->map);
+    CloseHandle((HANDLE)io->handle);
+#else
+    munmap((void*)io->map, (size_t)io->map_size);
+#endif
+
+    // Leave the backend unusable rather than pointing at memory that's gone
+    memset(io, 0, sizeof(WbfsIo));
+    return e_wbfs_success;
+}
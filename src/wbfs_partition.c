@@ -0,0 +1,196 @@
+#include <string.h>
+
+#include "wbfs.h"
+#include "wbfs_thread.h"
+
+// Where things live inside the ticket and partition header, relative to the start of the partition
+#define TICKET_TITLE_KEY (0x1BF)
+#define TICKET_TITLE_ID (0x1DC)
+#define TICKET_COMMON_KEY_INDEX (0x1F1)
+#define PARTITION_HEADER (0x2A4)
+#define PARTITION_HEADER_END (0x2C0)
+
+// The IV for a cluster's data is stored inside its encrypted hash block
+#define CLUSTER_DATA_IV (0x3D0)
+
+#define PARTITION_VALID(PARTITION)                                            \
+    {                                                                         \
+        if (!(PARTITION) || !(PARTITION)->disc) return e_wbfs_segfault;       \
+        if ((PARTITION)->data_size == 0) return e_wbfs_invalid_partition;     \
+    }
+
+wbfs_enum wbfs_partition_open(WiiPartition* partition, WiiDisc* disc, uint64_t address)
+{
+    if (!partition || !disc) return e_wbfs_segfault;
+    memset(partition, 0, sizeof(WiiPartition));
+
+    // The ticket and the header are next to each other, so grab both at once
+    uint8_t scratch[PARTITION_HEADER_END];
+    const void* view;
+    wbfs_enum err = wbfs_disc_view(disc, address, sizeof(scratch), scratch, &view);
+    if (err != e_wbfs_success) return err;
+    const uint8_t* header = (const uint8_t*)view;
+
+    // Offsets in the header are all stored shifted down by two
+    const uint8_t* fields = header + PARTITION_HEADER;
+    partition->offset = address;
+    partition->tmd_size = wbfs_helper_read_be32(fields);
+    partition->tmd_offset = address + ((uint64_t)wbfs_helper_read_be32(fields + 4) << 2);
+    partition->cert_size = wbfs_helper_read_be32(fields + 8);
+    partition->cert_offset = address + ((uint64_t)wbfs_helper_read_be32(fields + 12) << 2);
+    partition->h3_offset = address + ((uint64_t)wbfs_helper_read_be32(fields + 16) << 2);
+    partition->data_offset = address + ((uint64_t)wbfs_helper_read_be32(fields + 20) << 2);
+    partition->data_size = (uint64_t)wbfs_helper_read_be32(fields + 24) << 2;
+
+    if (partition->data_size == 0 || partition->data_size % WII_CLUSTER_SIZE != 0) {
+        partition->data_size = 0;
+        return e_wbfs_invalid_partition;
+    }
+
+    // Only the standard common key is known, korean discs use a different one. The layout is still filled in
+    // so the caller knows where the partition lies, but without the disc nothing will try to decrypt it
+    if (header[TICKET_COMMON_KEY_INDEX] != 0) return e_wbfs_unsupported_key;
+    partition->disc = disc;
+
+    // The title key is encrypted with the common key, using the title id padded with zeros as the IV
+    uint8_t iv[16];
+    WbfsAesKey common_key;
+    memset(iv, 0, sizeof(iv));
+    memcpy(partition->title_id, header + TICKET_TITLE_ID, sizeof(partition->title_id));
+    memcpy(iv, partition->title_id, sizeof(partition->title_id));
+    wbfs_aes_set_key(&common_key, k_wii_aes_common_key);
+    wbfs_aes_cbc_decrypt(&common_key, iv, header + TICKET_TITLE_KEY, partition->title_key, 16);
+
+    wbfs_aes_set_key(&partition->key, partition->title_key);
+    return e_wbfs_success;
+}
+
+uint64_t wbfs_partition_cluster_count(const WiiPartition* partition)
+{
+    if (!partition) return 0;
+    return partition->data_size / WII_CLUSTER_SIZE;
+}
+
+wbfs_enum wbfs_partition_decrypt_cluster(const WiiPartition* partition, const void* in, void* out)
+{
+    PARTITION_VALID(partition);
+    if (!in || !out) return e_wbfs_segfault;
+
+    // Take a copy of the data IV first, decrypting the hashes in place would overwrite it
+    uint8_t iv[16];
+    memcpy(iv, (const uint8_t*)in + CLUSTER_DATA_IV, sizeof(iv));
+
+    // The hash block always uses an IV of zero
+    uint8_t zero_iv[16];
+    memset(zero_iv, 0, sizeof(zero_iv));
+    wbfs_aes_cbc_decrypt(&partition->key, zero_iv, in, out, WII_CLUSTER_HASH_SIZE);
+    wbfs_aes_cbc_decrypt(&partition->key, iv, (const uint8_t*)in + WII_CLUSTER_HASH_SIZE,
+                         (uint8_t*)out + WII_CLUSTER_HASH_SIZE, WII_CLUSTER_DATA_SIZE);
+    return e_wbfs_success;
+}
+
+wbfs_enum wbfs_partition_encrypt_cluster(const WiiPartition* partition, const void* in, void* out)
+{
+    PARTITION_VALID(partition);
+    if (!in || !out) return e_wbfs_segfault;
+
+    // The reverse of decrypting, the data's IV is taken from the hash block once that has been encrypted
+    uint8_t zero_iv[16];
+    memset(zero_iv, 0, sizeof(zero_iv));
+    wbfs_aes_cbc_encrypt(&partition->key, zero_iv, in, out, WII_CLUSTER_HASH_SIZE);
+
+    uint8_t iv[16];
+    memcpy(iv, (const uint8_t*)out + CLUSTER_DATA_IV, sizeof(iv));
+    wbfs_aes_cbc_encrypt(&partition->key, iv, (const uint8_t*)in + WII_CLUSTER_HASH_SIZE,
+                         (uint8_t*)out + WII_CLUSTER_HASH_SIZE, WII_CLUSTER_DATA_SIZE);
+    return e_wbfs_success;
+}
+
+/*
+ * Clusters don't depend on each other, so each one is a job in a parallel for
+ */
+typedef struct WbfsDecryptBatch {
+    const WiiPartition* partition;
+    const uint8_t* in;
+    uint8_t* out;
+} WbfsDecryptBatch;
+
+static void wbfs_partition_decrypt_job(void* user, uint64_t index)
+{
+    WbfsDecryptBatch* batch = (WbfsDecryptBatch*)user;
+    wbfs_partition_decrypt_cluster(batch->partition, batch->in + index * WII_CLUSTER_SIZE,
+                                   batch->out + index * WII_CLUSTER_SIZE);
+}
+
+wbfs_enum wbfs_partition_decrypt_clusters(const WiiPartition* partition, const void* in, void* out,
+                                          uint32_t count, uint32_t thread_count)
+{
+    PARTITION_VALID(partition);
+    if (!in || !out) return e_wbfs_segfault;
+
+    WbfsDecryptBatch batch;
+    batch.partition = partition;
+    batch.in = (const uint8_t*)in;
+    batch.out = (uint8_t*)out;
+    wbfs_thread_parallel_for(thread_count, count, wbfs_partition_decrypt_job, &batch);
+    return e_wbfs_success;
+}
+
+wbfs_enum wbfs_partition_read_clusters(const WiiPartition* partition, void* data, uint64_t cluster,
+                                       uint32_t count, uint32_t thread_count)
+{
+    PARTITION_VALID(partition);
+    if (cluster + count > wbfs_partition_cluster_count(partition)) return e_wbfs_invalid_partition;
+
+    uint64_t address = partition->data_offset + cluster * WII_CLUSTER_SIZE;
+    wbfs_enum err = wbfs_disc_read_buffer(partition->disc, data, address, (uint64_t)count * WII_CLUSTER_SIZE);
+    if (err != e_wbfs_success) return err;
+    return wbfs_partition_decrypt_clusters(partition, data, data, count, thread_count);
+}
+
+wbfs_enum wbfs_partition_read(const WiiPartition* partition, void* data, uint64_t address, uint64_t size)
+{
+    PARTITION_VALID(partition);
+    if (!data) return e_wbfs_segfault;
+
+    // Space for a whole cluster's data plus the IV in front of it
+    uint8_t buffer[WII_CLUSTER_DATA_SIZE + 0x30];
+    uint64_t bytes_read = 0;
+    while (bytes_read < size) {
+        uint64_t local_address = address + bytes_read;
+        uint64_t cluster = local_address / WII_CLUSTER_DATA_SIZE;
+        uint64_t offset = local_address % WII_CLUSTER_DATA_SIZE;
+        uint64_t chunk = WII_CLUSTER_DATA_SIZE - offset;
+        if (chunk > size - bytes_read) chunk = size - bytes_read;
+        if (cluster >= wbfs_partition_cluster_count(partition)) return e_wbfs_invalid_partition;
+
+        // CBC only needs the cipher block in front of a block to decrypt it, so only read the AES blocks that
+        // cover the range plus whatever the IV is. For the first block that's the IV stored in the hash block,
+        // which sits 0x30 bytes before the data, so it's cheaper to read the gap than do a second read
+        uint64_t first_block = offset / 16;
+        uint64_t last_block = (offset + chunk + 15) / 16;
+        uint64_t cluster_address = partition->data_offset + cluster * WII_CLUSTER_SIZE;
+        uint64_t read_address;
+        uint64_t cipher_start;
+        if (first_block == 0) {
+            read_address = cluster_address + CLUSTER_DATA_IV;
+            cipher_start = WII_CLUSTER_HASH_SIZE - CLUSTER_DATA_IV;
+        } else {
+            read_address = cluster_address + WII_CLUSTER_HASH_SIZE + (first_block - 1) * 16;
+            cipher_start = 16;
+        }
+
+        uint64_t cipher_size = (last_block - first_block) * 16;
+        uint64_t read_size = cipher_start + cipher_size;
+        wbfs_enum err = wbfs_disc_read_buffer(partition->disc, buffer, read_address, read_size);
+        if (err != e_wbfs_success) return err;
+
+        uint8_t iv[16];
+        memcpy(iv, buffer, sizeof(iv));
+        wbfs_aes_cbc_decrypt(&partition->key, iv, buffer + cipher_start, buffer + cipher_start, cipher_size);
+        memcpy((uint8_t*)data + bytes_read, buffer + cipher_start + (offset - first_block * 16), chunk);
+        bytes_read += chunk;
+    }
+
+    return e_wbfs_success;
+}
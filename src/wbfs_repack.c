@@ -0,0 +1,452 @@
+/*
+ * Writing changed data back into a partition. The data can't just be encrypted and written over the old, every
+ * cluster's hash block has to agree with it all the way up the tree. A change to one cluster changes its H0
+ * table, the H1 table every cluster in its subgroup carries, the H2 table every cluster in its group carries,
+ * the group's entry in the H3 table and the hash of the H3 table in the TMD. So the unit of work is a whole H3
+ * group of 64 clusters, and groups nothing was patched in are never read or written
+ */
+#include <string.h>
+
+#include "wbfs.h"
+
+// Where the hashes live in a decrypted cluster's hash block, the same layout the verification checks
+#define H0_OFFSET (0x000)
+#define H1_OFFSET (0x280)
+#define H2_OFFSET (0x340)
+#define H0_BLOCK_SIZE (0x400)
+#define H0_COUNT (31)
+#define H1_COUNT (8)
+#define H2_COUNT (8)
+#define SHA1_SIZE (20)
+
+#define H3_TABLE_SIZE (0x18000)
+#define H3_GROUP_CLUSTERS (H1_COUNT * H2_COUNT)
+#define TMD_CONTENT_HASH (0x1F4)
+
+// A group's worth of decrypted data, and of whole clusters
+#define GROUP_DATA_SIZE ((uint64_t)H3_GROUP_CLUSTERS * WII_CLUSTER_DATA_SIZE)
+#define GROUP_SIZE (H3_GROUP_CLUSTERS * WII_CLUSTER_SIZE)
+
+// What happened to each cluster of a group
+#define REPACK_HOLE (1u << 0)     // Not stored, so it's left as it is
+#define REPACK_CHANGED (1u << 1)  // Something was patched into it
+#define REPACK_MISSING (1u << 2)  // A patch landed in it but it couldn't be read
+
+// Marks a group that isn't in use, past the last one a partition can have
+#define REPACK_NO_GROUP (UINT64_MAX)
+
+// While one group is worked on the next is being read
+#define REPACK_SLOTS (2)
+
+// A group's clusters are all patched and hashed before any of them can be encrypted, the tables in between
+// need every new H0 hash
+#define REPACK_STAGE_PATCH (0)
+#define REPACK_STAGE_ENCRYPT (1)
+
+typedef struct WbfsRepackGroup {
+    const WiiPartition* partition;
+    const WbfsRepackPatch* patches;
+    uint32_t patch_count;
+    uint8_t* clusters;
+    uint64_t group;
+    uint64_t first_cluster;
+    uint32_t count;
+    uint8_t state[H3_GROUP_CLUSTERS];
+    uint8_t h1_entry[H3_GROUP_CLUSTERS][SHA1_SIZE];  // Hash of the new H0 table of every changed cluster
+
+    // The new tables once they have been worked out, and which subgroups they changed in
+    uint8_t h1_tables[H2_COUNT][H1_COUNT * SHA1_SIZE];
+    uint8_t h2_table[H2_COUNT * SHA1_SIZE];
+    uint8_t subgroup_changed[H2_COUNT];
+} WbfsRepackGroup;
+
+/*
+ * One repack's worth of threads, laid out like a verify. A single reader fills the group slots in turn and the
+ * same workers take every group through both of its stages, group n always lives in slot n % REPACK_SLOTS.
+ * Everything past the setup is guarded by the lock
+ */
+typedef struct WbfsRepackRun {
+    WbfsRepackGroup groups[REPACK_SLOTS];
+    uint64_t group_count;  // Groups any patch lands in, only these are read and written
+    uint64_t cluster_count;
+    uint8_t* h3;
+    WbfsIo* out;
+
+    WbfsMutex lock;
+    WbfsCond changed;
+    uint64_t groups_read;   // Groups the reader has finished
+    uint64_t groups_done;   // Groups written out, the next one is what the workers are on
+    uint32_t stage;         // Which REPACK_STAGE_ the group being worked on is in
+    uint32_t next_cluster;  // Next cluster of the stage to hand out
+    uint32_t clusters_done;
+    wbfs_enum err;  // What went wrong, everything stops once it's set
+} WbfsRepackRun;
+
+size_t wbfs_helper_repack_size(void)
+{
+    return H3_TABLE_SIZE + REPACK_SLOTS * GROUP_SIZE;
+}
+
+/*
+ * The first group after a given one that any patch lands in. Patches can come in any order, this just takes
+ * the lowest of each patch's next group
+ */
+static uint64_t wbfs_repack_next_group(const WbfsRepackPatch* patches, uint32_t patch_count, uint64_t after)
+{
+    uint64_t next = REPACK_NO_GROUP;
+    for (uint32_t i = 0; i < patch_count; i++) {
+        if (patches[i].size == 0) continue;
+        uint64_t first = patches[i].address / GROUP_DATA_SIZE;
+        uint64_t last = (patches[i].address + patches[i].size - 1) / GROUP_DATA_SIZE;
+        if (after != REPACK_NO_GROUP && first <= after) first = after + 1;
+        if (first <= last && first < next) next = first;
+    }
+    return next;
+}
+
+// Checks every cluster a patch lands in is stored, so a patch that can't go in is caught before anything is
+// written
+static int wbfs_repack_patch_stored(const WiiPartition* partition, const WbfsRepackPatch* patch)
+{
+    uint64_t first = patch->address / WII_CLUSTER_DATA_SIZE;
+    uint64_t last = (patch->address + patch->size - 1) / WII_CLUSTER_DATA_SIZE;
+    uint64_t address = partition->data_offset + first * WII_CLUSTER_SIZE;
+    uint64_t end = partition->data_offset + (last + 1) * WII_CLUSTER_SIZE;
+    while (address < end) {
+        uint64_t file_address;
+        uint64_t run_left;
+        if (wbfs_disc_locate_run(partition->disc, address, end - address, &file_address, &run_left) !=
+            e_wbfs_success) {
+            return 0;
+        }
+        address += run_left;
+    }
+    return 1;
+}
+
+/*
+ * Reads a group of encrypted clusters in one go, falling back to a cluster at a time if that fails. Clusters
+ * that can't be read are the ones a wbfs file doesn't store, they're left as holes
+ */
+static void wbfs_repack_read_group(void* argument)
+{
+    WbfsRepackGroup* group = (WbfsRepackGroup*)argument;
+    const WiiPartition* partition = group->partition;
+    uint64_t address = partition->data_offset + group->first_cluster * WII_CLUSTER_SIZE;
+    memset(group->state, 0, sizeof(group->state));
+    if (wbfs_disc_read_buffer(partition->disc, group->clusters, address,
+                              (uint64_t)group->count * WII_CLUSTER_SIZE) == e_wbfs_success) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < group->count; i++) {
+        uint64_t offset = (uint64_t)i * WII_CLUSTER_SIZE;
+        if (wbfs_disc_read_buffer(partition->disc, group->clusters + offset, address + offset,
+                                  WII_CLUSTER_SIZE) != e_wbfs_success) {
+            group->state[i] = REPACK_HOLE;
+        }
+    }
+}
+
+/*
+ * Decrypts one cluster, copies in whatever the patches have for its data and works its H0 table out again. The
+ * hash of the new H0 table is kept to one side, the H1 table it goes in is shared by the whole subgroup
+ */
+static void wbfs_repack_patch_job(WbfsRepackGroup* group, uint32_t index)
+{
+    uint8_t* cluster = group->clusters + (uint64_t)index * WII_CLUSTER_SIZE;
+    uint8_t* data = cluster + WII_CLUSTER_HASH_SIZE;
+    int hole = (group->state[index] & REPACK_HOLE) != 0;
+    if (!hole) wbfs_partition_decrypt_cluster(group->partition, cluster, cluster);
+
+    uint64_t start = (group->first_cluster + index) * WII_CLUSTER_DATA_SIZE;
+    uint64_t end = start + WII_CLUSTER_DATA_SIZE;
+    for (uint32_t i = 0; i < group->patch_count; i++) {
+        const WbfsRepackPatch* patch = group->patches + i;
+        if (patch->size == 0 || patch->address >= end || patch->address + patch->size <= start) continue;
+        if (hole) {
+            group->state[index] |= REPACK_MISSING;
+            return;
+        }
+
+        uint64_t from = patch->address > start ? patch->address : start;
+        uint64_t to = patch->address + patch->size < end ? patch->address + patch->size : end;
+        const uint8_t* source = (const uint8_t*)patch->data + (from - patch->address);
+        memcpy(data + (from - start), source, (size_t)(to - from));
+        group->state[index] |= REPACK_CHANGED;
+    }
+    if (!(group->state[index] & REPACK_CHANGED)) return;
+
+    for (uint32_t i = 0; i < H0_COUNT; i++) {
+        wbfs_sha1(data + i * H0_BLOCK_SIZE, H0_BLOCK_SIZE, cluster + H0_OFFSET + i * SHA1_SIZE);
+    }
+    wbfs_sha1(cluster + H0_OFFSET, H0_COUNT * SHA1_SIZE, group->h1_entry[index]);
+}
+
+/*
+ * Works out the new H1 tables of the subgroups that changed and the new H2 table of the group, and returns the
+ * group's new H3 entry. The hashes of clusters that didn't change are taken from the tables already stored,
+ * which is what lets clusters a wbfs file doesn't store keep their place in the tree
+ */
+static void wbfs_repack_tables(WbfsRepackGroup* group, uint8_t h3_entry[SHA1_SIZE])
+{
+    // Every cluster carries the same H2 table, the first one that changed was read so its copy will do
+    uint32_t first_changed = 0;
+    while (!(group->state[first_changed] & REPACK_CHANGED)) first_changed++;
+    memcpy(group->h2_table, group->clusters + first_changed * WII_CLUSTER_SIZE + H2_OFFSET,
+           sizeof(group->h2_table));
+
+    memset(group->subgroup_changed, 0, sizeof(group->subgroup_changed));
+    for (uint32_t subgroup = 0; subgroup < H2_COUNT; subgroup++) {
+        uint32_t first = subgroup * H1_COUNT;
+        uint32_t reference = H3_GROUP_CLUSTERS;
+        for (uint32_t i = first; i < first + H1_COUNT && i < group->count; i++) {
+            if (group->state[i] & REPACK_CHANGED) {
+                reference = i;
+                break;
+            }
+        }
+        if (reference == H3_GROUP_CLUSTERS) continue;
+
+        // A changed cluster was read, so its copy of the subgroup's H1 table is there to start from
+        uint8_t* h1_table = group->h1_tables[subgroup];
+        memcpy(h1_table, group->clusters + reference * WII_CLUSTER_SIZE + H1_OFFSET, H1_COUNT * SHA1_SIZE);
+        for (uint32_t i = first; i < first + H1_COUNT && i < group->count; i++) {
+            if (!(group->state[i] & REPACK_CHANGED)) continue;
+            memcpy(h1_table + (i - first) * SHA1_SIZE, group->h1_entry[i], SHA1_SIZE);
+        }
+        wbfs_sha1(h1_table, H1_COUNT * SHA1_SIZE, group->h2_table + subgroup * SHA1_SIZE);
+        group->subgroup_changed[subgroup] = 1;
+    }
+    wbfs_sha1(group->h2_table, sizeof(group->h2_table), h3_entry);
+}
+
+// Puts the new tables into a cluster's hash block and encrypts it again
+static void wbfs_repack_encrypt_job(WbfsRepackGroup* group, uint32_t index)
+{
+    if (group->state[index] & REPACK_HOLE) return;
+
+    uint8_t* cluster = group->clusters + (uint64_t)index * WII_CLUSTER_SIZE;
+    uint32_t subgroup = index / H1_COUNT;
+    if (group->subgroup_changed[subgroup]) {
+        memcpy(cluster + H1_OFFSET, group->h1_tables[subgroup], H1_COUNT * SHA1_SIZE);
+    }
+    memcpy(cluster + H2_OFFSET, group->h2_table, sizeof(group->h2_table));
+    wbfs_partition_encrypt_cluster(group->partition, cluster, cluster);
+}
+
+// Writes every run of clusters that was read back out, holes are skipped over
+static wbfs_enum wbfs_repack_write_group(WbfsRepackGroup* group, WbfsIo* out)
+{
+    uint64_t address = group->partition->data_offset + group->first_cluster * WII_CLUSTER_SIZE;
+    uint32_t i = 0;
+    while (i < group->count) {
+        if (group->state[i] & REPACK_HOLE) {
+            i++;
+            continue;
+        }
+        uint32_t first = i;
+        while (i < group->count && !(group->state[i] & REPACK_HOLE)) i++;
+
+        uint64_t offset = (uint64_t)first * WII_CLUSTER_SIZE;
+        uint64_t size = (uint64_t)(i - first) * WII_CLUSTER_SIZE;
+        if (out->write_at(out, group->clusters + offset, address + offset, size) != 0) {
+            return e_wbfs_failed_file_write;
+        }
+    }
+    return e_wbfs_success;
+}
+
+// Sets up the slot group n is read into, index is which H3 group of the partition it is
+static WbfsRepackGroup* wbfs_repack_slot(WbfsRepackRun* run, uint64_t n, uint64_t index)
+{
+    WbfsRepackGroup* group = run->groups + n % REPACK_SLOTS;
+    uint64_t left = run->cluster_count - index * H3_GROUP_CLUSTERS;
+    group->group = index;
+    group->first_cluster = index * H3_GROUP_CLUSTERS;
+    group->count = left < H3_GROUP_CLUSTERS ? (uint32_t)left : H3_GROUP_CLUSTERS;
+    return group;
+}
+
+static void wbfs_repack_job(WbfsRepackGroup* group, uint32_t stage, uint32_t index)
+{
+    if (stage == REPACK_STAGE_PATCH) {
+        wbfs_repack_patch_job(group, index);
+    } else {
+        wbfs_repack_encrypt_job(group, index);
+    }
+}
+
+/*
+ * What happens between the stages, once every cluster of one is done. After patching the tables are worked out
+ * and the group's H3 entry is updated, after encrypting the group is written out
+ */
+static wbfs_enum wbfs_repack_finish_stage(WbfsRepackRun* run, WbfsRepackGroup* group, uint32_t stage)
+{
+    if (stage == REPACK_STAGE_ENCRYPT) return wbfs_repack_write_group(group, run->out);
+
+    // Everything patched was checked to be stored, but a read can still fail
+    for (uint32_t i = 0; i < group->count; i++) {
+        if (group->state[i] & REPACK_MISSING) return e_wbfs_invalid_disc_table;
+    }
+    wbfs_repack_tables(group, run->h3 + group->group * SHA1_SIZE);
+    return e_wbfs_success;
+}
+
+// Reads every group a patch lands in, in order, waiting for the workers to free up a slot before reading it
+static void wbfs_repack_reader(void* argument)
+{
+    WbfsRepackRun* run = (WbfsRepackRun*)argument;
+    const WbfsRepackGroup* first = run->groups;
+    uint64_t index = REPACK_NO_GROUP;
+    for (uint64_t i = 0; i < run->group_count; i++) {
+        wbfs_mutex_lock(&run->lock);
+        while (i >= run->groups_done + REPACK_SLOTS && run->err == e_wbfs_success) {
+            wbfs_cond_wait(&run->changed, &run->lock);
+        }
+        int stopped = run->err != e_wbfs_success;
+        wbfs_mutex_unlock(&run->lock);
+        if (stopped) return;
+
+        index = wbfs_repack_next_group(first->patches, first->patch_count, index);
+        wbfs_repack_read_group(wbfs_repack_slot(run, i, index));
+
+        wbfs_mutex_lock(&run->lock);
+        run->groups_read = i + 1;
+        wbfs_cond_broadcast(&run->changed);
+        wbfs_mutex_unlock(&run->lock);
+    }
+}
+
+/*
+ * Hands out the clusters of the oldest group that's been read, one at a time, first to patch and then to
+ * encrypt. Whoever finishes the last cluster of a stage does what comes after it, the rest wait for the next
+ * stage or group
+ */
+static void wbfs_repack_worker(void* argument)
+{
+    WbfsRepackRun* run = (WbfsRepackRun*)argument;
+    wbfs_mutex_lock(&run->lock);
+    while (run->groups_done < run->group_count && run->err == e_wbfs_success) {
+        WbfsRepackGroup* group = run->groups + run->groups_done % REPACK_SLOTS;
+        if (run->groups_read <= run->groups_done || run->next_cluster == group->count) {
+            wbfs_cond_wait(&run->changed, &run->lock);
+            continue;
+        }
+
+        uint32_t stage = run->stage;
+        uint32_t index = run->next_cluster++;
+        wbfs_mutex_unlock(&run->lock);
+        wbfs_repack_job(group, stage, index);
+        wbfs_mutex_lock(&run->lock);
+        if (++run->clusters_done < group->count) continue;
+
+        // Nothing else is handed out until the stage is finished, so the lock isn't needed for it
+        wbfs_mutex_unlock(&run->lock);
+        wbfs_enum err = wbfs_repack_finish_stage(run, group, stage);
+        wbfs_mutex_lock(&run->lock);
+
+        run->err = err;
+        run->next_cluster = 0;
+        run->clusters_done = 0;
+        if (stage == REPACK_STAGE_PATCH) {
+            run->stage = REPACK_STAGE_ENCRYPT;
+        } else {
+            run->stage = REPACK_STAGE_PATCH;
+            run->groups_done++;
+        }
+        wbfs_cond_broadcast(&run->changed);
+    }
+    wbfs_mutex_unlock(&run->lock);
+}
+
+wbfs_enum wbfs_partition_repack(const WiiPartition* partition, WbfsIo* out, const WbfsRepackPatch* patches,
+                                uint32_t patch_count, void* memory, uint32_t thread_count)
+{
+    if (!partition || !partition->disc || !out || !memory || (!patches && patch_count)) return e_wbfs_segfault;
+    if (!out->write_at) return e_wbfs_invalid_io;
+    if (partition->data_size == 0) return e_wbfs_invalid_partition;
+    if (partition->tmd_size < TMD_CONTENT_HASH + SHA1_SIZE) return e_wbfs_invalid_partition;
+
+    // Every patch has to land inside the partition data before anything gets written
+    uint64_t cluster_count = wbfs_partition_cluster_count(partition);
+    if (cluster_count > (uint64_t)(H3_TABLE_SIZE / SHA1_SIZE) * H3_GROUP_CLUSTERS) {
+        return e_wbfs_invalid_partition;
+    }
+    uint64_t data_size = cluster_count * WII_CLUSTER_DATA_SIZE;
+    for (uint32_t i = 0; i < patch_count; i++) {
+        if (patches[i].size == 0) continue;
+        if (!patches[i].data) return e_wbfs_segfault;
+        if (patches[i].address >= data_size || patches[i].size > data_size - patches[i].address) {
+            return e_wbfs_invalid_partition;
+        }
+        if (!wbfs_repack_patch_stored(partition, patches + i)) return e_wbfs_invalid_disc_table;
+    }
+
+    WbfsRepackRun run;
+    memset(&run, 0, sizeof(WbfsRepackRun));
+    run.cluster_count = cluster_count;
+    run.h3 = (uint8_t*)memory;
+    run.out = out;
+    for (uint32_t i = 0; i < REPACK_SLOTS; i++) {
+        run.groups[i].partition = partition;
+        run.groups[i].patches = patches;
+        run.groups[i].patch_count = patch_count;
+        run.groups[i].clusters = run.h3 + H3_TABLE_SIZE + i * GROUP_SIZE;
+    }
+    uint64_t index = wbfs_repack_next_group(patches, patch_count, REPACK_NO_GROUP);
+    while (index != REPACK_NO_GROUP) {
+        run.group_count++;
+        index = wbfs_repack_next_group(patches, patch_count, index);
+    }
+    if (run.group_count == 0) return e_wbfs_success;
+
+    wbfs_enum err = wbfs_disc_read_buffer(partition->disc, run.h3, partition->h3_offset, H3_TABLE_SIZE);
+    if (err != e_wbfs_success) return err;
+
+    if (thread_count == 0) thread_count = wbfs_thread_hardware_count();
+    if (thread_count > WBFS_MAX_THREADS) thread_count = WBFS_MAX_THREADS;
+    if (thread_count > H3_GROUP_CLUSTERS) thread_count = H3_GROUP_CLUSTERS;
+    wbfs_mutex_init(&run.lock);
+    wbfs_cond_init(&run.changed);
+
+    // One reader and one set of workers for the whole repack, the calling thread is one of the workers. If the
+    // reader won't start every group is read, patched, encrypted and written here in turn
+    WbfsThread reader;
+    if (wbfs_thread_create(&reader, wbfs_repack_reader, &run) == 0) {
+        WbfsThread workers[WBFS_MAX_THREADS];
+        uint32_t started = 0;
+        while (started + 1 < thread_count &&
+               wbfs_thread_create(workers + started, wbfs_repack_worker, &run) == 0) {
+            started++;
+        }
+        wbfs_repack_worker(&run);
+        for (uint32_t i = 0; i < started; i++) wbfs_thread_join(workers + i);
+        wbfs_thread_join(&reader);
+    } else {
+        index = REPACK_NO_GROUP;
+        for (uint64_t i = 0; i < run.group_count && run.err == e_wbfs_success; i++) {
+            index = wbfs_repack_next_group(patches, patch_count, index);
+            WbfsRepackGroup* group = wbfs_repack_slot(&run, i, index);
+            wbfs_repack_read_group(group);
+            for (uint32_t stage = REPACK_STAGE_PATCH; stage <= REPACK_STAGE_ENCRYPT; stage++) {
+                for (uint32_t j = 0; j < group->count; j++) wbfs_repack_job(group, stage, j);
+                run.err = wbfs_repack_finish_stage(&run, group, stage);
+                if (run.err != e_wbfs_success) break;
+            }
+        }
+    }
+
+    wbfs_cond_destroy(&run.changed);
+    wbfs_mutex_destroy(&run.lock);
+    if (run.err != e_wbfs_success) return run.err;
+
+    // The top of the tree, the H3 table and its hash in the TMD
+    uint8_t tmd_hash[SHA1_SIZE];
+    wbfs_sha1(run.h3, H3_TABLE_SIZE, tmd_hash);
+    if (out->write_at(out, run.h3, partition->h3_offset, H3_TABLE_SIZE) != 0) return e_wbfs_failed_file_write;
+    if (out->write_at(out, tmd_hash, partition->tmd_offset + TMD_CONTENT_HASH, SHA1_SIZE) != 0) {
+        return e_wbfs_failed_file_write;
+    }
+    return e_wbfs_success;
+}
@@ -0,0 +1,260 @@
+/*
+ * SHA-1 for checking the partition hash tree. Like the AES there are two paths, a portable one and one that
+ * uses the SHA extensions when the cpu has them, picked at runtime
+ */
+#include <string.h>
+
+#include "wbfs.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define WBFS_SHA_X86 (1)
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define WBFS_TARGET_SHA
+#else
+#include <cpuid.h>
+#define WBFS_TARGET_SHA __attribute__((target("sha,ssse3,sse4.1")))
+#endif
+#endif
+
+#define ROTL32(X, N) (((X) << (N)) | ((X) >> (32 - (N))))
+#define LOAD_BE32(P) \
+    (((uint32_t)(P)[0] << 24) | ((uint32_t)(P)[1] << 16) | ((uint32_t)(P)[2] << 8) | (uint32_t)(P)[3])
+
+/*
+ * One round of the portable path. The schedule only ever needs the last 16 words, so they're kept in a ring
+ * and the next word is worked out in place from round 16 onwards
+ */
+#define SHA1_SCHEDULE(I)                                                                      \
+    ((I) < 16 ? w[(I)&15]                                                                     \
+              : (w[(I)&15] = ROTL32(w[((I) + 13) & 15] ^ w[((I) + 8) & 15] ^ w[((I) + 2) & 15] ^ \
+                                      w[(I)&15], 1)))
+#define SHA1_ROUND(I, F, K)                                             \
+    {                                                                   \
+        uint32_t t = ROTL32(a, 5) + (F) + e + (K) + SHA1_SCHEDULE(I);   \
+        e = d;                                                          \
+        d = c;                                                          \
+        c = ROTL32(b, 30);                                              \
+        b = a;                                                          \
+        a = t;                                                          \
+    }
+
+static void wbfs_sha1_blocks_portable(uint32_t state[5], const uint8_t* data, size_t blocks)
+{
+    for (; blocks > 0; blocks--, data += 64) {
+        uint32_t w[16];
+        for (uint32_t i = 0; i < 16; i++) w[i] = LOAD_BE32(data + i * 4);
+
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+        uint32_t e = state[4];
+        uint32_t i = 0;
+        for (; i < 20; i++) SHA1_ROUND(i, d ^ (b & (c ^ d)), 0x5A827999u);
+        for (; i < 40; i++) SHA1_ROUND(i, b ^ c ^ d, 0x6ED9EBA1u);
+        for (; i < 60; i++) SHA1_ROUND(i, (b & c) | (d & (b | c)), 0x8F1BBCDCu);
+        for (; i < 80; i++) SHA1_ROUND(i, b ^ c ^ d, 0xCA62C1D6u);
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+#ifdef WBFS_SHA_X86
+/*
+ * Four rounds on the SHA extensions. While one group of message words is used the next group is finished off
+ * with msg2, the one after gets its xor and the one after that is started with msg1. The two e registers take
+ * turns, one feeding the rounds while the other holds a copy of abcd for the next group
+ */
+#define SHA1_NI_ROUNDS(E_IN, E_OUT, MSG_CUR, MSG_NEXT, MSG_XOR, MSG_PREP, FUNC) \
+    E_IN = _mm_sha1nexte_epu32(E_IN, MSG_CUR);                                  \
+    E_OUT = abcd;                                                               \
+    MSG_NEXT = _mm_sha1msg2_epu32(MSG_NEXT, MSG_CUR);                           \
+    abcd = _mm_sha1rnds4_epu32(abcd, E_IN, FUNC);                               \
+    MSG_PREP = _mm_sha1msg1_epu32(MSG_PREP, MSG_CUR);                           \
+    MSG_XOR = _mm_xor_si128(MSG_XOR, MSG_CUR);
+
+WBFS_TARGET_SHA static void wbfs_sha1_blocks_ni(uint32_t state[5], const uint8_t* data, size_t blocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ll, 0x08090a0b0c0d0e0fll);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1B);
+    __m128i e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+    __m128i e1;
+    __m128i msg0, msg1, msg2, msg3;
+
+    for (; blocks > 0; blocks--, data += 64) {
+        __m128i abcd_save = abcd;
+        __m128i e0_save = e0;
+
+        // The first four groups load the block as they go
+        msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), mask);
+        e0 = _mm_add_epi32(e0, msg0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+        msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), mask);
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+        msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), mask);
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+        msg0 = _mm_xor_si128(msg0, msg2);
+
+        msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), mask);
+        SHA1_NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 0);
+        SHA1_NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 0);
+        SHA1_NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 1);
+        SHA1_NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 1);
+        SHA1_NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 1);
+        SHA1_NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 1);
+        SHA1_NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 1);
+        SHA1_NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 2);
+        SHA1_NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 2);
+        SHA1_NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 2);
+        SHA1_NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 2);
+        SHA1_NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 2);
+        SHA1_NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 3);
+        SHA1_NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 3);
+
+        // The last three groups have no more message words left to prepare
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+        msg3 = _mm_xor_si128(msg3, msg1);
+
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+        e1 = _mm_sha1nexte_epu32(e1, msg3);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+static int wbfs_sha1_ni_detect(void)
+{
+    // The SHA extensions are bit 29 of ebx for leaf 7, the shuffles also need SSSE3 and SSE4.1 from leaf 1
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    if (!((info[2] >> 9) & 1) || !((info[2] >> 19) & 1)) return 0;
+    __cpuidex(info, 7, 0);
+    return (info[1] >> 29) & 1;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    if (!((ecx >> 9) & 1) || !((ecx >> 19) & 1)) return 0;
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return 0;
+    return (ebx >> 29) & 1;
+#endif
+}
+#endif
+
+// Worked out the first time it's needed, racing threads all come up with the same answer
+static volatile int s_sha1_path = -1;
+
+int wbfs_sha1_hardware_accelerated(void)
+{
+    if (s_sha1_path < 0) {
+#ifdef WBFS_SHA_X86
+        s_sha1_path = wbfs_sha1_ni_detect();
+#else
+        s_sha1_path = 0;
+#endif
+    }
+    return s_sha1_path;
+}
+
+static void wbfs_sha1_blocks(uint32_t state[5], const uint8_t* data, size_t blocks)
+{
+#ifdef WBFS_SHA_X86
+    if (wbfs_sha1_hardware_accelerated()) {
+        wbfs_sha1_blocks_ni(state, data, blocks);
+        return;
+    }
+#endif
+    wbfs_sha1_blocks_portable(state, data, blocks);
+}
+
+void wbfs_sha1_init(WbfsSha1* sha1)
+{
+    sha1->state[0] = 0x67452301u;
+    sha1->state[1] = 0xEFCDAB89u;
+    sha1->state[2] = 0x98BADCFEu;
+    sha1->state[3] = 0x10325476u;
+    sha1->state[4] = 0xC3D2E1F0u;
+    sha1->length = 0;
+    sha1->buffered = 0;
+}
+
+void wbfs_sha1_update(WbfsSha1* sha1, const void* data, size_t size)
+{
+    const uint8_t* in = (const uint8_t*)data;
+    sha1->length += size;
+
+    // Top up a partial block first, then run whole blocks straight from the input
+    if (sha1->buffered > 0) {
+        size_t take = 64 - sha1->buffered < size ? 64 - sha1->buffered : size;
+        memcpy(sha1->buffer + sha1->buffered, in, take);
+        sha1->buffered += (uint32_t)take;
+        in += take;
+        size -= take;
+        if (sha1->buffered < 64) return;
+        wbfs_sha1_blocks(sha1->state, sha1->buffer, 1);
+        sha1->buffered = 0;
+    }
+
+    if (size >= 64) {
+        wbfs_sha1_blocks(sha1->state, in, size / 64);
+        in += size & ~(size_t)63;
+        size &= 63;
+    }
+    memcpy(sha1->buffer, in, size);
+    sha1->buffered = (uint32_t)size;
+}
+
+void wbfs_sha1_final(WbfsSha1* sha1, uint8_t digest[20])
+{
+    // Pad with a one bit, zeros, then the length in bits in the last 8 bytes of a block
+    uint64_t bit_length = sha1->length * 8;
+    uint8_t padding[72];
+    size_t pad_size = (sha1->buffered < 56 ? 56 : 120) - sha1->buffered;
+    memset(padding, 0, sizeof(padding));
+    padding[0] = 0x80;
+    for (uint32_t i = 0; i < 8; i++) padding[pad_size + i] = (uint8_t)(bit_length >> (56 - i * 8));
+    wbfs_sha1_update(sha1, padding, pad_size + 8);
+
+    for (uint32_t i = 0; i < 5; i++) {
+        digest[i * 4] = (uint8_t)(sha1->state[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(sha1->state[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(sha1->state[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)sha1->state[i];
+    }
+}
+
+void wbfs_sha1(const void* data, size_t size, uint8_t digest[20])
+{
+    WbfsSha1 sha1;
+    wbfs_sha1_init(&sha1);
+    wbfs_sha1_update(&sha1, data, size);
+    wbfs_sha1_final(&sha1, digest);
+}
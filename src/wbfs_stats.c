@@ -0,0 +1,100 @@
+#include <string.h>
+
+#include "wbfs.h"
+
+wbfs_enum wbfs_stats_attach(Wbfs* wbfs, WbfsStats* stats)
+{
+    if (!wbfs) return e_wbfs_segfault;
+    if (wbfs->valid != WBFS_MAGIC) return e_wbfs_invalid_handle;
+
+    wbfs->stats = stats;
+    return e_wbfs_success;
+}
+
+void wbfs_stats_reset(WbfsStats* stats)
+{
+    if (!stats) return;
+
+    void (*trace)(void* user, const WbfsIoEvent* event) = stats->trace;
+    void* trace_user = stats->trace_user;
+    memset(stats, 0, sizeof(WbfsStats));
+    stats->trace = trace;
+    stats->trace_user = trace_user;
+}
+
+// The bucket is the position of the highest set bit, so bucket n holds everything from 2 ^ (n - 1) up to 2 ^ n
+static uint32_t wbfs_stats_bucket(uint64_t nanoseconds)
+{
+    uint32_t bucket = 0;
+    while (nanoseconds && bucket < WBFS_STATS_LATENCY_BUCKETS - 1) {
+        nanoseconds >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void wbfs_stats_record_read(WbfsStats* stats, uint64_t offset, uint64_t size, uint64_t nanoseconds,
+                            int result)
+{
+    if (!stats) return;
+
+    WBFS_ATOMIC_ADD(&stats->reads, 1);
+    WBFS_ATOMIC_ADD(&stats->bytes_read, size);
+    WBFS_ATOMIC_ADD(&stats->read_nanoseconds, nanoseconds);
+    WBFS_ATOMIC_ADD(&stats->latency[wbfs_stats_bucket(nanoseconds)], 1);
+    if (result != 0) WBFS_ATOMIC_ADD(&stats->failed_reads, 1);
+
+    // Swapping in the end of this read keeps the check right when several threads share the counters, each
+    // read is compared against whichever one finished before it
+    if ((uint64_t)WBFS_ATOMIC_EXCHANGE(&stats->next_offset, offset + size) != offset) {
+        WBFS_ATOMIC_ADD(&stats->seeks, 1);
+    }
+
+    if (stats->trace) {
+        WbfsIoEvent event = { offset, size, nanoseconds, result };
+        stats->trace(stats->trace_user, &event);
+    }
+}
+
+wbfs_enum wbfs_stats_read_at(Wbfs* wbfs, void* data, uint64_t offset, uint64_t size)
+{
+    if (!wbfs) return e_wbfs_segfault;
+    if (!wbfs->io.read_at) return e_wbfs_invalid_io;
+
+#ifdef WBFS_STATS
+    uint64_t start = wbfs->stats ? wbfs_thread_time_ns() : 0;
+    int result = wbfs->io.read_at(&wbfs->io, data, offset, size);
+    if (wbfs->stats) wbfs_stats_record_read(wbfs->stats, offset, size, wbfs_thread_time_ns() - start, result);
+#else
+    int result = wbfs->io.read_at(&wbfs->io, data, offset, size);
+#endif
+    return result != 0 ? e_wbfs_failed_file_read : e_wbfs_success;
+}
+
+void wbfs_stats_dump(const WbfsStats* stats, FILE* out)
+{
+    if (!stats || !out) return;
+
+    unsigned long long reads = stats->reads;
+    fprintf(out, "reads %llu, seeks %llu, failed %llu, bytes %llu\n", reads, (unsigned long long)stats->seeks,
+            (unsigned long long)stats->failed_reads, (unsigned long long)stats->bytes_read);
+    if (reads) {
+        fprintf(out, "average %llu bytes, %.2f us per read\n", (unsigned long long)(stats->bytes_read / reads),
+                (double)stats->read_nanoseconds / (double)reads / 1000.0);
+    }
+    fprintf(out, "disc reads %llu, sector crossings %llu, split reads %llu\n",
+            (unsigned long long)stats->disc_reads, (unsigned long long)stats->sector_crossings,
+            (unsigned long long)stats->split_reads);
+    if (stats->cache_hits || stats->cache_misses) {
+        fprintf(out, "cache hits %llu, misses %llu\n", (unsigned long long)stats->cache_hits,
+                (unsigned long long)stats->cache_misses);
+    }
+
+    // Only the buckets something landed in, labelled with their upper bound
+    for (uint32_t i = 0; i < WBFS_STATS_LATENCY_BUCKETS; i++) {
+        if (!stats->latency[i]) continue;
+        const char* label = i == WBFS_STATS_LATENCY_BUCKETS - 1 ? ">=" : "< ";
+        uint32_t shift = i == WBFS_STATS_LATENCY_BUCKETS - 1 ? i - 1 : i;
+        fprintf(out, "  %s %10llu ns  %llu\n", label, 1ull << shift, (unsigned long long)stats->latency[i]);
+    }
+}
@@ -0,0 +1,166 @@
+#include <string.h>
+
+#ifndef _WIN32
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "wbfs_thread.h"
+
+#ifdef _WIN32
+static DWORD WINAPI wbfs_thread_entry(LPVOID argument)
+{
+    WbfsThread* thread = (WbfsThread*)argument;
+    thread->function(thread->argument);
+    return 0;
+}
+
+int wbfs_thread_create(WbfsThread* thread, void (*function)(void*), void* argument)
+{
+    thread->function = function;
+    thread->argument = argument;
+    thread->handle = CreateThread(NULL, 0, wbfs_thread_entry, thread, 0, NULL);
+    return thread->handle ? 0 : -1;
+}
+
+void wbfs_thread_join(WbfsThread* thread)
+{
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+}
+
+uint32_t wbfs_thread_hardware_count(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (uint32_t)info.dwNumberOfProcessors : 1;
+}
+
+uint64_t wbfs_thread_time_ns(void)
+{
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    // Split into whole seconds and the remainder so the multiply can't overflow
+    uint64_t ticks = (uint64_t)counter.QuadPart;
+    uint64_t rate = (uint64_t)frequency.QuadPart;
+    return ticks / rate * 1000000000ull + ticks % rate * 1000000000ull / rate;
+}
+
+void wbfs_thread_yield(void) { SwitchToThread(); }
+
+void wbfs_mutex_init(WbfsMutex* mutex) { InitializeSRWLock(&mutex->lock); }
+void wbfs_mutex_destroy(WbfsMutex* mutex) { (void)mutex; }
+void wbfs_mutex_lock(WbfsMutex* mutex) { AcquireSRWLockExclusive(&mutex->lock); }
+void wbfs_mutex_unlock(WbfsMutex* mutex) { ReleaseSRWLockExclusive(&mutex->lock); }
+
+void wbfs_cond_init(WbfsCond* cond) { InitializeConditionVariable(&cond->cond); }
+void wbfs_cond_destroy(WbfsCond* cond) { (void)cond; }
+void wbfs_cond_wait(WbfsCond* cond, WbfsMutex* mutex)
+{
+    SleepConditionVariableSRW(&cond->cond, &mutex->lock, INFINITE, 0);
+}
+void wbfs_cond_signal(WbfsCond* cond) { WakeConditionVariable(&cond->cond); }
+void wbfs_cond_broadcast(WbfsCond* cond) { WakeAllConditionVariable(&cond->cond); }
+#else
+static void* wbfs_thread_entry(void* argument)
+{
+    WbfsThread* thread = (WbfsThread*)argument;
+    thread->function(thread->argument);
+    return NULL;
+}
+
+int wbfs_thread_create(WbfsThread* thread, void (*function)(void*), void* argument)
+{
+    thread->function = function;
+    thread->argument = argument;
+    return pthread_create(&thread->handle, NULL, wbfs_thread_entry, thread) == 0 ? 0 : -1;
+}
+
+void wbfs_thread_join(WbfsThread* thread) { pthread_join(thread->handle, NULL); }
+
+uint32_t wbfs_thread_hardware_count(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (uint32_t)count : 1;
+}
+
+uint64_t wbfs_thread_time_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+void wbfs_thread_yield(void) { sched_yield(); }
+
+void wbfs_mutex_init(WbfsMutex* mutex) { pthread_mutex_init(&mutex->lock, NULL); }
+void wbfs_mutex_destroy(WbfsMutex* mutex) { pthread_mutex_destroy(&mutex->lock); }
+void wbfs_mutex_lock(WbfsMutex* mutex) { pthread_mutex_lock(&mutex->lock); }
+void wbfs_mutex_unlock(WbfsMutex* mutex) { pthread_mutex_unlock(&mutex->lock); }
+
+void wbfs_cond_init(WbfsCond* cond) { pthread_cond_init(&cond->cond, NULL); }
+void wbfs_cond_destroy(WbfsCond* cond) { pthread_cond_destroy(&cond->cond); }
+void wbfs_cond_wait(WbfsCond* cond, WbfsMutex* mutex) { pthread_cond_wait(&cond->cond, &mutex->lock); }
+void wbfs_cond_signal(WbfsCond* cond) { pthread_cond_signal(&cond->cond); }
+void wbfs_cond_broadcast(WbfsCond* cond) { pthread_cond_broadcast(&cond->cond); }
+#endif
+
+/*
+ * Shared state for a parallel for, every worker takes the next job index under the lock until they run out
+ */
+typedef struct WbfsParallelFor {
+    WbfsMutex lock;
+    uint64_t next_job;
+    uint64_t job_count;
+    void (*job)(void* user, uint64_t index);
+    void* user;
+} WbfsParallelFor;
+
+static void wbfs_parallel_for_worker(void* argument)
+{
+    WbfsParallelFor* work = (WbfsParallelFor*)argument;
+    for (;;) {
+        wbfs_mutex_lock(&work->lock);
+        uint64_t index = work->next_job++;
+        wbfs_mutex_unlock(&work->lock);
+
+        if (index >= work->job_count) return;
+        work->job(work->user, index);
+    }
+}
+
+void wbfs_thread_parallel_for(uint32_t thread_count, uint64_t job_count,
+                              void (*job)(void* user, uint64_t index), void* user)
+{
+    if (thread_count == 0) thread_count = wbfs_thread_hardware_count();
+    if (thread_count > WBFS_MAX_THREADS) thread_count = WBFS_MAX_THREADS;
+    if (thread_count > job_count) thread_count = (uint32_t)job_count;
+
+    // Nothing to gain from a thread if there's only one job
+    if (thread_count <= 1) {
+        for (uint64_t i = 0; i < job_count; i++) job(user, i);
+        return;
+    }
+
+    WbfsParallelFor work;
+    memset(&work, 0, sizeof(WbfsParallelFor));
+    wbfs_mutex_init(&work.lock);
+    work.job_count = job_count;
+    work.job = job;
+    work.user = user;
+
+    // The calling thread is one of the workers, so only start thread_count - 1 extra. If a thread fails to
+    // start the others just pick up its share
+    WbfsThread threads[WBFS_MAX_THREADS];
+    uint32_t started = 0;
+    for (uint32_t i = 0; i + 1 < thread_count; i++) {
+        if (wbfs_thread_create(threads + started, wbfs_parallel_for_worker, &work) == 0) started++;
+    }
+    wbfs_parallel_for_worker(&work);
+
+    for (uint32_t i = 0; i < started; i++) wbfs_thread_join(threads + i);
+    wbfs_mutex_destroy(&work.lock);
+}
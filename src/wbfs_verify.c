@@ -0,0 +1,288 @@
+#include <string.h>
+
+#include "wbfs.h"
+
+// Where the hashes live in a decrypted cluster's hash block
+#define H0_OFFSET (0x000)
+#define H1_OFFSET (0x280)
+#define H2_OFFSET (0x340)
+#define H0_BLOCK_SIZE (0x400)
+#define H0_COUNT (31)
+#define H1_COUNT (8)
+#define H2_COUNT (8)
+#define SHA1_SIZE (20)
+
+// Each H3 hash covers a group of 64 clusters, the table has room for far more groups than a partition needs
+#define H3_TABLE_SIZE (0x18000)
+#define H3_GROUP_CLUSTERS (H1_COUNT * H2_COUNT)
+
+// The hash of the H3 table in the first content record of the TMD
+#define TMD_CONTENT_HASH (0x1F4)
+
+// Clusters are read in batches of one H3 group, while one batch is checked the next is being read
+#define VERIFY_BATCH_CLUSTERS (H3_GROUP_CLUSTERS)
+#define VERIFY_BATCH_SIZE (VERIFY_BATCH_CLUSTERS * WII_CLUSTER_SIZE)
+#define VERIFY_BATCH_SLOTS (2)
+
+typedef struct WbfsVerifyBatch {
+    const WiiPartition* partition;
+    const uint8_t* h3;
+    uint8_t* clusters;
+    uint64_t first_cluster;
+    uint32_t count;
+    uint8_t status[VERIFY_BATCH_CLUSTERS];
+} WbfsVerifyBatch;
+
+/*
+ * One verify's worth of threads. A single reader fills the batch slots in turn and the same workers check
+ * every batch, batch n always lives in slot n % VERIFY_BATCH_SLOTS. Everything past the setup is guarded by
+ * the lock
+ */
+typedef struct WbfsVerifyRun {
+    WbfsVerifyBatch batches[VERIFY_BATCH_SLOTS];
+    uint64_t batch_count;
+    uint8_t* cluster_status;
+    WbfsVerifyReport* report;
+
+    WbfsMutex lock;
+    WbfsCond changed;
+    uint64_t batches_read;     // Batches the reader has finished
+    uint64_t batches_checked;  // Batches the workers have finished, the next one is what they're working on
+    uint32_t next_cluster;     // Next cluster of the batch being checked to hand out
+    uint32_t clusters_done;
+} WbfsVerifyRun;
+
+size_t wbfs_helper_verify_size(void)
+{
+    return H3_TABLE_SIZE + VERIFY_BATCH_SLOTS * VERIFY_BATCH_SIZE;
+}
+
+/*
+ * Reads a batch of encrypted clusters in one go, decrypting is left to the workers. If that fails each cluster
+ * is tried on its own, so a single missing cluster doesn't take the rest of the batch down with it
+ */
+static void wbfs_verify_read_batch(void* argument)
+{
+    WbfsVerifyBatch* batch = (WbfsVerifyBatch*)argument;
+    const WiiPartition* partition = batch->partition;
+    uint64_t address = partition->data_offset + batch->first_cluster * WII_CLUSTER_SIZE;
+    memset(batch->status, 0, sizeof(batch->status));
+    if (wbfs_disc_read_buffer(partition->disc, batch->clusters, address,
+                              (uint64_t)batch->count * WII_CLUSTER_SIZE) == e_wbfs_success) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < batch->count; i++) {
+        uint64_t offset = (uint64_t)i * WII_CLUSTER_SIZE;
+        if (wbfs_disc_read_buffer(partition->disc, batch->clusters + offset, address + offset,
+                                  WII_CLUSTER_SIZE) != e_wbfs_success) {
+            batch->status[i] = WBFS_VERIFY_UNREADABLE;
+        }
+    }
+}
+
+static int wbfs_verify_hash(const void* data, size_t size, const uint8_t* expected)
+{
+    uint8_t digest[SHA1_SIZE];
+    wbfs_sha1(data, size, digest);
+    return memcmp(digest, expected, SHA1_SIZE) == 0;
+}
+
+/*
+ * Checks one decrypted cluster against the whole tree. Every cluster carries its own copy of the H1 table for
+ * its subgroup and the H2 table for its group, so following its chain up to the H3 table needs nothing from
+ * any other cluster
+ */
+static uint8_t wbfs_verify_cluster(const uint8_t* cluster, uint64_t cluster_index, const uint8_t* h3_table)
+{
+    const uint8_t* data = cluster + WII_CLUSTER_HASH_SIZE;
+    uint8_t status = 0;
+    for (uint32_t i = 0; i < H0_COUNT; i++) {
+        if (!wbfs_verify_hash(data + i * H0_BLOCK_SIZE, H0_BLOCK_SIZE, cluster + H0_OFFSET + i * SHA1_SIZE)) {
+            status |= WBFS_VERIFY_H0;
+            break;
+        }
+    }
+
+    const uint8_t* h1 = cluster + H1_OFFSET + (cluster_index % H1_COUNT) * SHA1_SIZE;
+    if (!wbfs_verify_hash(cluster + H0_OFFSET, H0_COUNT * SHA1_SIZE, h1)) status |= WBFS_VERIFY_H1;
+
+    const uint8_t* h2 = cluster + H2_OFFSET + ((cluster_index / H1_COUNT) % H2_COUNT) * SHA1_SIZE;
+    if (!wbfs_verify_hash(cluster + H1_OFFSET, H1_COUNT * SHA1_SIZE, h2)) status |= WBFS_VERIFY_H2;
+
+    const uint8_t* h3 = h3_table + (cluster_index / H3_GROUP_CLUSTERS) * SHA1_SIZE;
+    if (!wbfs_verify_hash(cluster + H2_OFFSET, H2_COUNT * SHA1_SIZE, h3)) status |= WBFS_VERIFY_H3;
+    return status;
+}
+
+static void wbfs_verify_cluster_job(WbfsVerifyBatch* batch, uint32_t index)
+{
+    if (batch->status[index] & WBFS_VERIFY_UNREADABLE) return;
+
+    uint8_t* cluster = batch->clusters + (uint64_t)index * WII_CLUSTER_SIZE;
+    wbfs_partition_decrypt_cluster(batch->partition, cluster, cluster);
+    batch->status[index] = wbfs_verify_cluster(cluster, batch->first_cluster + index, batch->h3);
+}
+
+static void wbfs_verify_tally(WbfsVerifyRun* run, const WbfsVerifyBatch* batch)
+{
+    for (uint32_t i = 0; i < batch->count; i++) {
+        if (batch->status[i] == 0) {
+            run->report->good_clusters++;
+        } else if (batch->status[i] & WBFS_VERIFY_UNREADABLE) {
+            run->report->unreadable_clusters++;
+        } else {
+            run->report->bad_clusters++;
+        }
+    }
+    if (run->cluster_status) memcpy(run->cluster_status + batch->first_cluster, batch->status, batch->count);
+}
+
+static WbfsVerifyBatch* wbfs_verify_slot(WbfsVerifyRun* run, uint64_t index)
+{
+    WbfsVerifyBatch* batch = run->batches + index % VERIFY_BATCH_SLOTS;
+    uint64_t left = run->report->cluster_count - index * VERIFY_BATCH_CLUSTERS;
+    batch->first_cluster = index * VERIFY_BATCH_CLUSTERS;
+    batch->count = left < VERIFY_BATCH_CLUSTERS ? (uint32_t)left : VERIFY_BATCH_CLUSTERS;
+    return batch;
+}
+
+// Reads every batch in order, waiting for the workers to free up a slot before reading into it
+static void wbfs_verify_reader(void* argument)
+{
+    WbfsVerifyRun* run = (WbfsVerifyRun*)argument;
+    for (uint64_t i = 0; i < run->batch_count; i++) {
+        wbfs_mutex_lock(&run->lock);
+        while (i >= run->batches_checked + VERIFY_BATCH_SLOTS) wbfs_cond_wait(&run->changed, &run->lock);
+        wbfs_mutex_unlock(&run->lock);
+
+        wbfs_verify_read_batch(wbfs_verify_slot(run, i));
+
+        wbfs_mutex_lock(&run->lock);
+        run->batches_read = i + 1;
+        wbfs_cond_broadcast(&run->changed);
+        wbfs_mutex_unlock(&run->lock);
+    }
+}
+
+/*
+ * Hands out the clusters of the oldest batch that's been read, one at a time. Whoever finishes a batch's last
+ * cluster adds it to the report and frees its slot for the reader
+ */
+static void wbfs_verify_worker(void* argument)
+{
+    WbfsVerifyRun* run = (WbfsVerifyRun*)argument;
+    wbfs_mutex_lock(&run->lock);
+    while (run->batches_checked < run->batch_count) {
+        WbfsVerifyBatch* batch = run->batches + run->batches_checked % VERIFY_BATCH_SLOTS;
+        if (run->batches_read <= run->batches_checked || run->next_cluster == batch->count) {
+            wbfs_cond_wait(&run->changed, &run->lock);
+            continue;
+        }
+
+        uint32_t index = run->next_cluster++;
+        wbfs_mutex_unlock(&run->lock);
+        wbfs_verify_cluster_job(batch, index);
+        wbfs_mutex_lock(&run->lock);
+
+        if (++run->clusters_done == batch->count) {
+            wbfs_verify_tally(run, batch);
+            run->next_cluster = 0;
+            run->clusters_done = 0;
+            run->batches_checked++;
+            wbfs_cond_broadcast(&run->changed);
+        }
+    }
+    wbfs_mutex_unlock(&run->lock);
+}
+
+wbfs_enum wbfs_partition_read_h3(const WiiPartition* partition, void* h3, uint32_t* h3_valid)
+{
+    if (!partition || !partition->disc || !h3 || !h3_valid) return e_wbfs_segfault;
+    if (partition->data_size == 0) return e_wbfs_invalid_partition;
+    if (partition->tmd_size < TMD_CONTENT_HASH + SHA1_SIZE) return e_wbfs_invalid_partition;
+    if (wbfs_partition_cluster_count(partition) > (uint64_t)(H3_TABLE_SIZE / SHA1_SIZE) * H3_GROUP_CLUSTERS) {
+        return e_wbfs_invalid_partition;
+    }
+
+    // The top of the tree, the H3 table against the hash the TMD holds for it
+    uint8_t tmd_hash[SHA1_SIZE];
+    wbfs_enum err = wbfs_disc_read_buffer(partition->disc, tmd_hash, partition->tmd_offset + TMD_CONTENT_HASH,
+                                          SHA1_SIZE);
+    if (err != e_wbfs_success) return err;
+    err = wbfs_disc_read_buffer(partition->disc, h3, partition->h3_offset, H3_TABLE_SIZE);
+    if (err != e_wbfs_success) return err;
+    *h3_valid = wbfs_verify_hash(h3, H3_TABLE_SIZE, tmd_hash);
+    return e_wbfs_success;
+}
+
+wbfs_enum wbfs_partition_check_clusters(const WiiPartition* partition, const void* h3, uint64_t first_cluster,
+                                        uint32_t count, void* clusters, uint8_t* cluster_status)
+{
+    if (!partition || !partition->disc || !h3 || !clusters || !cluster_status) return e_wbfs_segfault;
+    if (first_cluster + count > wbfs_partition_cluster_count(partition)) return e_wbfs_invalid_partition;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (cluster_status[i] & WBFS_VERIFY_UNREADABLE) continue;
+        uint8_t* cluster = (uint8_t*)clusters + (uint64_t)i * WII_CLUSTER_SIZE;
+        wbfs_partition_decrypt_cluster(partition, cluster, cluster);
+        cluster_status[i] = wbfs_verify_cluster(cluster, first_cluster + i, (const uint8_t*)h3);
+    }
+    return e_wbfs_success;
+}
+
+wbfs_enum wbfs_partition_verify(const WiiPartition* partition, uint8_t* cluster_status,
+                                WbfsVerifyReport* report, void* memory, uint32_t thread_count)
+{
+    if (!partition || !partition->disc || !report || !memory) return e_wbfs_segfault;
+
+    memset(report, 0, sizeof(WbfsVerifyReport));
+    report->cluster_count = wbfs_partition_cluster_count(partition);
+    uint8_t* h3 = (uint8_t*)memory;
+    wbfs_enum err = wbfs_partition_read_h3(partition, h3, &report->h3_valid);
+    if (err != e_wbfs_success) return err;
+
+    WbfsVerifyRun run;
+    memset(&run, 0, sizeof(WbfsVerifyRun));
+    run.batch_count = (report->cluster_count + VERIFY_BATCH_CLUSTERS - 1) / VERIFY_BATCH_CLUSTERS;
+    run.cluster_status = cluster_status;
+    run.report = report;
+    for (uint32_t i = 0; i < VERIFY_BATCH_SLOTS; i++) {
+        run.batches[i].partition = partition;
+        run.batches[i].h3 = h3;
+        run.batches[i].clusters = h3 + H3_TABLE_SIZE + i * VERIFY_BATCH_SIZE;
+    }
+    if (run.batch_count == 0) return e_wbfs_success;
+
+    if (thread_count == 0) thread_count = wbfs_thread_hardware_count();
+    if (thread_count > WBFS_MAX_THREADS) thread_count = WBFS_MAX_THREADS;
+    if (thread_count > VERIFY_BATCH_CLUSTERS) thread_count = VERIFY_BATCH_CLUSTERS;
+    wbfs_mutex_init(&run.lock);
+    wbfs_cond_init(&run.changed);
+
+    // One reader and one set of workers for the whole partition, the calling thread is one of the workers. If
+    // the reader won't start every batch is read and checked here in turn
+    WbfsThread reader;
+    if (wbfs_thread_create(&reader, wbfs_verify_reader, &run) == 0) {
+        WbfsThread workers[WBFS_MAX_THREADS];
+        uint32_t started = 0;
+        while (started + 1 < thread_count &&
+               wbfs_thread_create(workers + started, wbfs_verify_worker, &run) == 0) {
+            started++;
+        }
+        wbfs_verify_worker(&run);
+        for (uint32_t i = 0; i < started; i++) wbfs_thread_join(workers + i);
+        wbfs_thread_join(&reader);
+    } else {
+        for (uint64_t i = 0; i < run.batch_count; i++) {
+            WbfsVerifyBatch* batch = wbfs_verify_slot(&run, i);
+            wbfs_verify_read_batch(batch);
+            for (uint32_t j = 0; j < batch->count; j++) wbfs_verify_cluster_job(batch, j);
+            wbfs_verify_tally(&run, batch);
+        }
+    }
+
+    wbfs_cond_destroy(&run.changed);
+    wbfs_mutex_destroy(&run.lock);
+    return e_wbfs_success;
+}